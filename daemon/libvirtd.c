@@ -797,7 +797,19 @@ static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
             VIR_WARN("Error while reloading drivers");
 }
 
-static int daemonSetupSignals(virNetServerPtr srv)
+static void daemonStatsHandler(virNetServerPtr srv,
+                               siginfo_t *sig ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    const char *path = opaque;
+
+    if (virNetServerDumpStats(srv, path) < 0)
+        VIR_WARN("Error while dumping RPC statistics");
+    else
+        VIR_INFO("Dumped RPC statistics to %s on SIGUSR1", path);
+}
+
+static int daemonSetupSignals(virNetServerPtr srv, const char *statsFile)
 {
     if (virNetServerAddSignalHandler(srv, SIGINT, daemonShutdownHandler, NULL) < 0)
         return -1;
@@ -807,6 +819,11 @@ static int daemonSetupSignals(virNetServerPtr srv)
         return -1;
     if (virNetServerAddSignalHandler(srv, SIGHUP, daemonReloadHandler, NULL) < 0)
         return -1;
+#ifdef SIGUSR1
+    if (virNetServerAddSignalHandler(srv, SIGUSR1, daemonStatsHandler,
+                                     (void *)statsFile) < 0)
+        return -1;
+#endif
     return 0;
 }
 
@@ -1117,6 +1134,7 @@ int main(int argc, char **argv) {
     bool privileged = geteuid() == 0 ? true : false;
     bool implicit_conf = false;
     char *run_dir = NULL;
+    char *stats_file = NULL;
     mode_t old_umask;
 
     struct option opts[] = {
@@ -1433,7 +1451,12 @@ int main(int argc, char **argv) {
                                  timeout);
     }
 
-    if ((daemonSetupSignals(srv)) < 0) {
+    if (virAsprintf(&stats_file, "%s/libvirtd-rpc-stats", run_dir) < 0) {
+        ret = VIR_DAEMON_ERR_SIGNAL;
+        goto cleanup;
+    }
+
+    if ((daemonSetupSignals(srv, stats_file)) < 0) {
         ret = VIR_DAEMON_ERR_SIGNAL;
         goto cleanup;
     }
@@ -1543,6 +1566,7 @@ cleanup:
     VIR_FREE(pid_file);
     VIR_FREE(remote_config_file);
     VIR_FREE(run_dir);
+    VIR_FREE(stats_file);
 
     daemonConfigFree(config);
 
@@ -44,6 +44,7 @@ struct daemonClientStream {
 
     unsigned int recvEOF : 1;
     unsigned int closed : 1;
+    unsigned int allowSkip : 1; /* client accepts holes in the stream */
 
     int filterID;
 
@@ -281,7 +282,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -308,6 +310,7 @@ cleanup:
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @allowSkip: whether holes may be sent to the client as such
  *
  * Creates a new stream for this conn
  *
@@ -317,13 +320,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool allowSkip)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%d, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%d, st=%p, allowSkip=%d",
+              client, header->proc, header->serial, st, allowSkip);
 
     if (VIR_ALLOC(stream) < 0)
         return NULL;
@@ -335,6 +339,7 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->allowSkip = allowSkip;
 
     return stream;
 }
@@ -548,6 +553,56 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Returns:
+ *   -1  if fatal error occurred
+ *    0  if message was fully processed
+ *    1  if message is still being processed
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    size_t offset = msg->bufferOffset;
+    int ret;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0) {
+        ret = -1;
+    } else {
+        ret = virStreamSendHole(stream->st, data.length, data.flags);
+    }
+
+    if (ret == -2) {
+        /* Blocking, so decode the hole again later */
+        msg->bufferOffset = offset;
+        return 1;
+    } else if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        VIR_INFO("Stream send hole failed");
+        stream->closed = 1;
+        return virNetServerProgramSendReplyError(stream->prog,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 &msg->header);
+    }
+
+    return 0;
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -652,7 +707,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -729,11 +787,52 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (VIR_ALLOC_N(buffer, bufferLen) < 0)
         return -1;
 
-    ret = virStreamRecv(stream->st, buffer, bufferLen);
+    if (stream->allowSkip)
+        ret = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                 VIR_STREAM_RECV_STOP_AT_HOLE);
+    else
+        ret = virStreamRecv(stream->st, buffer, bufferLen);
+
     if (ret == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
         ret = 0;
+    } else if (ret == -3) {
+        virNetMessagePtr msg;
+        long long length;
+
+        /* Holes are sent as a single message, the client
+         * skips over them without receiving any data */
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            virNetMessageError rerr;
+
+            memset(&rerr, 0, sizeof(rerr));
+
+            if (!(msg = virNetMessageNew(false)))
+                ret = -1;
+            else
+                ret = virNetServerProgramSendStreamError(remoteProgram,
+                                                         client,
+                                                         msg,
+                                                         &rerr,
+                                                         stream->procedure,
+                                                         stream->serial);
+        } else {
+            stream->tx = 0;
+            if (!(msg = virNetMessageNew(false))) {
+                ret = -1;
+            } else {
+                msg->cb = daemonStreamMessageFinished;
+                msg->opaque = stream;
+                stream->refs++;
+                ret = virNetServerProgramSendStreamHole(remoteProgram,
+                                                        client,
+                                                        msg,
+                                                        stream->procedure,
+                                                        stream->serial,
+                                                        length, 0);
+            }
+        }
     } else if (ret < 0) {
         virNetMessagePtr msg;
         virNetMessageError rerr;
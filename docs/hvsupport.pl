@@ -345,6 +345,19 @@ foreach my $drv (keys %{$groups{"virDriver"}->{drivers}}) {
 }
 
 
+# Another special case for the virDomainListGetStats API which shares
+# the connectGetAllDomainStats driver callback with
+# virConnectGetAllDomainStats
+$groups{virDriver}->{apis}->{"domainListGetStats"} = "virDomainListGetStats";
+
+foreach my $drv (keys %{$groups{"virDriver"}->{drivers}}) {
+    my $statsVersStr = $groups{"virDriver"}->{drivers}->{$drv}->{"connectGetAllDomainStats"};
+    next unless defined $statsVersStr;
+
+    $groups{"virDriver"}->{drivers}->{$drv}->{"domainListGetStats"} = $statsVersStr;
+}
+
+
 # Finally we generate the HTML file with the tables
 
 print <<EOF;
@@ -151,6 +151,7 @@ typedef int (*virDomainDefNamespaceParse)(xmlDocPtr, xmlNodePtr,
 typedef void (*virDomainDefNamespaceFree)(void *);
 typedef int (*virDomainDefNamespaceXMLFormat)(virBufferPtr, void *);
 typedef const char *(*virDomainDefNamespaceHref)(void);
+typedef void *(*virDomainDefNamespaceCopy)(void *);
 
 typedef struct _virDomainXMLNamespace virDomainXMLNamespace;
 typedef virDomainXMLNamespace *virDomainXMLNamespacePtr;
@@ -159,6 +160,7 @@ struct _virDomainXMLNamespace {
     virDomainDefNamespaceFree free;
     virDomainDefNamespaceXMLFormat format;
     virDomainDefNamespaceHref href;
+    virDomainDefNamespaceCopy copy;
 };
 
 typedef struct _virCaps virCaps;
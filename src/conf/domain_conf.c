@@ -53,6 +53,8 @@
 #include "device_conf.h"
 #include "virtpm.h"
 #include "virstring.h"
+#include "virhashcode.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -67,6 +69,17 @@ struct _virDomainObjList {
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* name -> virDomainObj mapping for O(1) lookup-by-name.
+     * Entries do not hold a reference, @objs owns the objects */
+    virHashTable *objsName;
+
+    /* id -> virDomainObj mapping for O(1) lookup-by-id. Drivers
+     * change IDs through virDomainObjListSetID with only the domain
+     * locked, so the table has its own lock, taken after the list and
+     * domain locks and never held while acquiring another one */
+    virMutex idLock;
+    virHashTable *objsID;
 };
 
 
@@ -948,6 +961,88 @@ virDomainObjListDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
     virObjectUnref(obj);
 }
 
+
+static uint32_t
+virDomainObjListIDCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(name, sizeof(int), seed);
+}
+
+
+static bool
+virDomainObjListIDEqual(const void *namea, const void *nameb)
+{
+    return *(const int *)namea == *(const int *)nameb;
+}
+
+
+static void *
+virDomainObjListIDCopy(const void *name)
+{
+    int *id;
+
+    if (VIR_ALLOC_QUIET(id) < 0)
+        return NULL;
+    *id = *(const int *)name;
+    return id;
+}
+
+
+static void
+virDomainObjListIDFree(void *name)
+{
+    VIR_FREE(name);
+}
+
+
+/*
+ * Drop the ID index entry of @dom. The caller must hold the lock
+ * on @dom and @doms->idLock.
+ */
+static void
+virDomainObjListUnindexID(virDomainObjListPtr doms,
+                          virDomainObjPtr dom)
+{
+    if (dom->def->id != -1 &&
+        virHashLookup(doms->objsID, &dom->def->id) == dom)
+        virHashRemoveEntry(doms->objsID, &dom->def->id);
+}
+
+
+/*
+ * Add @dom to the ID index under its current ID. The caller must
+ * hold the lock on @dom.
+ */
+static int
+virDomainObjListIndexID(virDomainObjListPtr doms,
+                        virDomainObjPtr dom)
+{
+    int ret;
+
+    virMutexLock(&doms->idLock);
+    ret = virHashAddEntry(doms->objsID, &dom->def->id, dom);
+    virMutexUnlock(&doms->idLock);
+
+    return ret;
+}
+
+
+/*
+ * Drop any secondary index entries pointing to @dom. The
+ * caller must hold the lock on @doms and @dom.
+ */
+static void
+virDomainObjListUnindex(virDomainObjListPtr doms,
+                        virDomainObjPtr dom)
+{
+    if (virHashLookup(doms->objsName, dom->def->name) == dom)
+        virHashRemoveEntry(doms->objsName, dom->def->name);
+
+    virMutexLock(&doms->idLock);
+    virDomainObjListUnindexID(doms, dom);
+    virMutexUnlock(&doms->idLock);
+}
+
 virDomainObjListPtr virDomainObjListNew(void)
 {
     virDomainObjListPtr doms;
@@ -958,7 +1053,20 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (!(doms = virObjectLockableNew(virDomainObjListClass)))
         return NULL;
 
-    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree))) {
+    if (virMutexInit(&doms->idLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        virObjectUnref(doms);
+        return NULL;
+    }
+
+    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree)) ||
+        !(doms->objsName = virHashCreate(50, NULL)) ||
+        !(doms->objsID = virHashCreateFull(50, NULL,
+                                           virDomainObjListIDCode,
+                                           virDomainObjListIDEqual,
+                                           virDomainObjListIDCopy,
+                                           virDomainObjListIDFree))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -971,34 +1079,33 @@ static void virDomainObjListDispose(void *obj)
 {
     virDomainObjListPtr doms = obj;
 
+    virHashFree(doms->objsID);
+    virHashFree(doms->objsName);
     virHashFree(doms->objs);
+    virMutexDestroy(&doms->idLock);
 }
 
 
-static int virDomainObjListSearchID(const void *payload,
-                                    const void *name ATTRIBUTE_UNUSED,
-                                    const void *data)
-{
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    const int *id = data;
-    int want = 0;
-
-    virObjectLock(obj);
-    if (virDomainObjIsActive(obj) &&
-        obj->def->id == *id)
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
-}
-
 virDomainObjPtr virDomainObjListFindByID(virDomainObjListPtr doms,
                                          int id)
 {
     virDomainObjPtr obj;
     virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
-    if (obj)
+
+    virMutexLock(&doms->idLock);
+    obj = virHashLookup(doms->objsID, &id);
+    virMutexUnlock(&doms->idLock);
+
+    /* @obj stays in @doms while we hold its lock, but it might have
+     * been stopped before we got hold of it */
+    if (obj) {
         virObjectLock(obj);
+        if (obj->def->id != id) {
+            virObjectUnlock(obj);
+            obj = NULL;
+        }
+    }
+
     virObjectUnlock(doms);
     return obj;
 }
@@ -1020,26 +1127,12 @@ virDomainObjPtr virDomainObjListFindByUUID(virDomainObjListPtr doms,
     return obj;
 }
 
-static int virDomainObjListSearchName(const void *payload,
-                                      const void *name ATTRIBUTE_UNUSED,
-                                      const void *data)
-{
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    int want = 0;
-
-    virObjectLock(obj);
-    if (STREQ(obj->def->name, (const char *)data))
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
-}
-
 virDomainObjPtr virDomainObjListFindByName(virDomainObjListPtr doms,
                                            const char *name)
 {
     virDomainObjPtr obj;
     virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchName, name);
+    obj = virHashLookup(doms->objsName, name);
     if (obj)
         virObjectLock(obj);
     virObjectUnlock(doms);
@@ -1412,11 +1505,20 @@ virDomainChrSourceDefCopy(virDomainChrSourceDefPtr dest,
 
         if (VIR_STRDUP(dest->data.tcp.service, src->data.tcp.service) < 0)
             return -1;
+
+        dest->data.tcp.listen = src->data.tcp.listen;
+        dest->data.tcp.protocol = src->data.tcp.protocol;
         break;
 
     case VIR_DOMAIN_CHR_TYPE_UNIX:
         if (VIR_STRDUP(dest->data.nix.path, src->data.nix.path) < 0)
             return -1;
+
+        dest->data.nix.listen = src->data.nix.listen;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_SPICEVMC:
+        dest->data.spicevmc = src->data.spicevmc;
         break;
     }
 
@@ -2180,13 +2282,24 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             }
         }
 
+        /* An inactive domain picks up the ID of the new definition */
+        if (!virDomainObjIsActive(vm) && def->id != -1) {
+            int rc;
+
+            virMutexLock(&doms->idLock);
+            rc = virHashAddEntry(doms->objsID, &def->id, vm);
+            virMutexUnlock(&doms->idLock);
+            if (rc < 0)
+                goto error;
+        }
+
         virDomainObjAssignDef(vm,
                               def,
                               !!(flags & VIR_DOMAIN_OBJ_LIST_ADD_LIVE),
                               oldDef);
     } else {
         /* UUID does not match, but if a name matches, refuse it */
-        if ((vm = virHashSearch(doms->objs, virDomainObjListSearchName, def->name))) {
+        if ((vm = virHashLookup(doms->objsName, def->name))) {
             virObjectLock(vm);
             virUUIDFormat(vm->def->uuid, uuidstr);
             virReportError(VIR_ERR_OPERATION_FAILED,
@@ -2204,6 +2317,18 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             virObjectUnref(vm);
             return NULL;
         }
+
+        if (virHashAddEntry(doms->objsName, def->name, vm) < 0) {
+            virHashRemoveEntry(doms->objs, uuidstr);
+            return NULL;
+        }
+
+        if (def->id != -1 &&
+            virDomainObjListIndexID(doms, vm) < 0) {
+            virHashRemoveEntry(doms->objsName, def->name);
+            virHashRemoveEntry(doms->objs, uuidstr);
+            return NULL;
+        }
     }
 cleanup:
     return vm;
@@ -2357,12 +2482,47 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
 
     virObjectLock(doms);
     virObjectLock(dom);
+    virDomainObjListUnindex(doms, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virObjectUnlock(dom);
     virObjectUnref(dom);
     virObjectUnlock(doms);
 }
 
+
+/**
+ * virDomainObjListSetID:
+ * @doms: the list holding @dom
+ * @dom: a locked domain object
+ * @id: the new ID, or -1 when the domain stops
+ *
+ * Set the ID of @dom and update the ID index of @doms accordingly.
+ * Drivers must not assign to dom->def->id directly once @dom is in
+ * @doms. The caller must not hold the lock on @doms.
+ *
+ * Returns 0 on success, -1 on error in which case @dom is left
+ * without an ID.
+ */
+int
+virDomainObjListSetID(virDomainObjListPtr doms,
+                      virDomainObjPtr dom,
+                      int id)
+{
+    int ret = 0;
+
+    virMutexLock(&doms->idLock);
+    virDomainObjListUnindexID(doms, dom);
+    dom->def->id = id;
+    if (id != -1 &&
+        virHashAddEntry(doms->objsID, &id, dom) < 0) {
+        dom->def->id = -1;
+        ret = -1;
+    }
+    virMutexUnlock(&doms->idLock);
+
+    return ret;
+}
+
 /* The caller must hold lock on 'doms' in addition to 'virDomainObjListRemove'
  * requirements
  *
@@ -2375,6 +2535,7 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     virUUIDFormat(dom->def->uuid, uuidstr);
+    virDomainObjListUnindex(doms, dom);
     virObjectUnlock(dom);
 
     virHashRemoveEntry(doms->objs, uuidstr);
@@ -2441,13 +2602,18 @@ virDomainDeviceInfoCopy(virDomainDeviceInfoPtr dst,
     /* first a shallow copy of *everything* */
     *dst = *src;
 
-    /* then redo the two fields that are pointers */
+    /* then redo the fields that are pointers */
     dst->alias = NULL;
     dst->romfile = NULL;
+    if (dst->type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_USB)
+        dst->addr.usb.port = NULL;
 
     if (VIR_STRDUP(dst->alias, src->alias) < 0 ||
         VIR_STRDUP(dst->romfile, src->romfile) < 0)
         return -1;
+    if (src->type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_USB &&
+        VIR_STRDUP(dst->addr.usb.port, src->addr.usb.port) < 0)
+        return -1;
     return 0;
 }
 
@@ -17347,80 +17513,125 @@ cleanup:
 }
 
 
+/*
+ * Loading configs is split in two steps: parsing the file, which
+ * doesn't touch @doms and may run in parallel for several files,
+ * and adding the result to @doms, which requires the list lock.
+ */
+typedef struct _virDomainObjListLoadEntry virDomainObjListLoadEntry;
+typedef virDomainObjListLoadEntry *virDomainObjListLoadEntryPtr;
+struct _virDomainObjListLoadEntry {
+    char *name;
+
+    /* Result of parsing the status or config file */
+    virDomainObjPtr obj;
+    virDomainDefPtr def;
+    int autostart;
+};
+
+typedef struct _virDomainObjListLoadData virDomainObjListLoadData;
+typedef virDomainObjListLoadData *virDomainObjListLoadDataPtr;
+struct _virDomainObjListLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+    unsigned int expectedVirtTypes;
+
+    size_t nentries;
+    virDomainObjListLoadEntryPtr entries;
+
+    /* Index of the next entry to parse, atomic access only */
+    int next;
+};
+
+static int
+virDomainObjListParseConfig(virDomainObjListLoadDataPtr data,
+                            virDomainObjListLoadEntryPtr entry)
+{
+    char *configFile = NULL, *autostartLink = NULL;
+    int ret = -1;
+
+    if ((configFile = virDomainConfigFile(data->configDir, entry->name)) == NULL)
+        goto cleanup;
+    if (!(entry->def = virDomainDefParseFile(configFile, data->caps,
+                                             data->xmlopt,
+                                             data->expectedVirtTypes,
+                                             VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(data->autostartDir,
+                                             entry->name)) == NULL)
+        goto cleanup;
+
+    if ((entry->autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        virDomainDefFree(entry->def);
+        entry->def = NULL;
+    }
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+    return ret;
+}
+
 static virDomainObjPtr
 virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
                            virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           unsigned int expectedVirtTypes,
+                           virDomainObjListLoadEntryPtr entry,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
-    int autostart;
     virDomainDefPtr oldDef = NULL;
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt,
-                                      expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INACTIVE)))
-        goto error;
-
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
-
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
+    if (!(dom = virDomainObjListAddLocked(doms, entry->def, xmlopt, 0, &oldDef)))
+        return NULL;
+    entry->def = NULL;
 
-    dom->autostart = autostart;
+    dom->autostart = entry->autostart;
 
     if (notify)
         (*notify)(dom, oldDef == NULL, opaque);
 
     virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
+}
 
-error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    virDomainDefFree(def);
-    return NULL;
+static int
+virDomainObjListParseStatus(virDomainObjListLoadDataPtr data,
+                            virDomainObjListLoadEntryPtr entry)
+{
+    char *statusFile = NULL;
+
+    if ((statusFile = virDomainConfigFile(data->configDir, entry->name)) == NULL)
+        return -1;
+
+    entry->obj = virDomainObjParseFile(statusFile, data->caps, data->xmlopt,
+                                       data->expectedVirtTypes,
+                                       VIR_DOMAIN_XML_INTERNAL_STATUS |
+                                       VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
+                                       VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES |
+                                       VIR_DOMAIN_XML_INTERNAL_BASEDATE);
+    VIR_FREE(statusFile);
+    return entry->obj ? 0 : -1;
 }
 
 static virDomainObjPtr
 virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           unsigned int expectedVirtTypes,
+                           virDomainObjListLoadEntryPtr entry,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = entry->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INTERNAL_STATUS |
-                                      VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
-                                      VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_XML_INTERNAL_BASEDATE)))
-        goto error;
-
+    entry->obj = NULL;
     virUUIDFormat(obj->def->uuid, uuidstr);
 
     if (virHashLookup(doms->objs, uuidstr) != NULL) {
@@ -17430,21 +17641,109 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
         goto error;
     }
 
+    if (virHashLookup(doms->objsName, obj->def->name) != NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected domain %s already exists"),
+                       obj->def->name);
+        goto error;
+    }
+
     if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
         goto error;
 
+    if (virHashAddEntry(doms->objsName, obj->def->name, obj) < 0) {
+        /* The hash table owns the reference now */
+        virHashRemoveEntry(doms->objs, uuidstr);
+        obj = NULL;
+        goto error;
+    }
+
+    if (obj->def->id != -1) {
+        if (virDomainObjListIndexID(doms, obj) < 0) {
+            virHashRemoveEntry(doms->objsName, obj->def->name);
+            virHashRemoveEntry(doms->objs, uuidstr);
+            obj = NULL;
+            goto error;
+        }
+    }
+
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
 error:
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
+static void
+virDomainObjListParseEntry(virDomainObjListLoadDataPtr data,
+                           virDomainObjListLoadEntryPtr entry)
+{
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", entry->name);
+    if (data->liveStatus)
+        ignore_value(virDomainObjListParseStatus(data, entry));
+    else
+        ignore_value(virDomainObjListParseConfig(data, entry));
+}
+
+static void
+virDomainObjListParseWorker(void *opaque)
+{
+    virDomainObjListLoadDataPtr data = opaque;
+    int i;
+
+    while ((i = virAtomicIntAdd(&data->next, 1)) < (int) data->nentries)
+        virDomainObjListParseEntry(data, &data->entries[i]);
+}
+
+/*
+ * Parse the files of all the entries, using up to @nworkers
+ * threads. Entries which fail to parse are left empty.
+ */
+static void
+virDomainObjListParseAll(virDomainObjListLoadDataPtr data,
+                         unsigned int nworkers)
+{
+    virThreadPtr workers = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (nworkers > data->nentries)
+        nworkers = data->nentries;
+
+    if (nworkers > 1 &&
+        VIR_ALLOC_N_QUIET(workers, nworkers - 1) == 0) {
+        for (i = 0; i < nworkers - 1; i++) {
+            if (virThreadCreate(&workers[i], true,
+                                virDomainObjListParseWorker, data) < 0) {
+                VIR_WARN("Failed to create worker thread, "
+                         "loading configs with %zu", nthreads + 1);
+                break;
+            }
+            nthreads++;
+        }
+    }
+
+    /* The calling thread is a worker too */
+    virDomainObjListParseWorker(data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&workers[i]);
+    VIR_FREE(workers);
+}
+
+static void
+virDomainObjListLoadEntryClear(virDomainObjListLoadEntryPtr entry)
+{
+    VIR_FREE(entry->name);
+    virObjectUnref(entry->obj);
+    virDomainDefFree(entry->def);
+}
+
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -17456,8 +17755,44 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    return virDomainObjListLoadAllConfigsFull(doms, configDir, autostartDir,
+                                              liveStatus, caps, xmlopt,
+                                              expectedVirtTypes, 1,
+                                              notify, opaque);
+}
+
+/**
+ * virDomainObjListLoadAllConfigsFull:
+ *
+ * Same as virDomainObjListLoadAllConfigs, but parses the files
+ * with up to @nworkers threads. The domains are still added to
+ * @doms and passed to @notify one at a time, in directory order.
+ */
+int
+virDomainObjListLoadAllConfigsFull(virDomainObjListPtr doms,
+                                   const char *configDir,
+                                   const char *autostartDir,
+                                   int liveStatus,
+                                   virCapsPtr caps,
+                                   virDomainXMLOptionPtr xmlopt,
+                                   unsigned int expectedVirtTypes,
+                                   unsigned int nworkers,
+                                   virDomainLoadConfigNotify notify,
+                                   void *opaque)
+{
+    virDomainObjListLoadData data = {
+        .configDir = configDir,
+        .autostartDir = autostartDir,
+        .liveStatus = liveStatus,
+        .caps = caps,
+        .xmlopt = xmlopt,
+        .expectedVirtTypes = expectedVirtTypes,
+    };
+    size_t nalloc = 0;
     DIR *dir;
     struct dirent *entry;
+    size_t i;
+    int ret = -1;
 
     VIR_INFO("Scanning for configs in %s", configDir);
 
@@ -17470,49 +17805,52 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         return -1;
     }
 
-    virObjectLock(doms);
-
     while ((entry = readdir(dir))) {
-        virDomainObjPtr dom;
-
         if (entry->d_name[0] == '.')
             continue;
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             expectedVirtTypes,
-                                             notify,
-                                             opaque);
+        if (VIR_RESIZE_N(data.entries, nalloc, data.nentries, 1) < 0 ||
+            VIR_STRDUP(data.entries[data.nentries].name, entry->d_name) < 0)
+            goto cleanup;
+        data.nentries++;
+    }
+
+    virDomainObjListParseAll(&data, nworkers);
+
+    virObjectLock(doms);
+    for (i = 0; i < data.nentries; i++) {
+        virDomainObjPtr dom;
+
+        if (liveStatus) {
+            if (!data.entries[i].obj)
+                continue;
+            dom = virDomainObjListLoadStatus(doms, &data.entries[i],
+                                             notify, opaque);
+        } else {
+            if (!data.entries[i].def)
+                continue;
+            dom = virDomainObjListLoadConfig(doms, xmlopt, &data.entries[i],
+                                             notify, opaque);
+        }
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
         }
     }
+    virObjectUnlock(doms);
 
+    ret = 0;
+
+cleanup:
     closedir(dir);
-    virObjectUnlock(doms);
-    return 0;
+    for (i = 0; i < data.nentries; i++)
+        virDomainObjListLoadEntryClear(&data.entries[i]);
+    VIR_FREE(data.entries);
+    return ret;
 }
 
 int
@@ -17906,12 +18244,1191 @@ cleanup:
 }
 
 
-/* Copy src into a new definition; with the quality of the copy
- * depending on the migratable flag (false for transitions between
- * persistent and active, true for transitions across save files or
- * snapshots).  */
-virDomainDefPtr
-virDomainDefCopy(virDomainDefPtr src,
+/*
+ * Native copy of a domain definition.
+ *
+ * The result matches what formatting @src and parsing it back with
+ * VIR_DOMAIN_XML_INACTIVE produces, without the libxml2 overhead: all
+ * pointers are duplicated and the state which the inactive parser
+ * ignores (device aliases, generated labels, block job mirrors,
+ * automatically allocated ports, ...) is not carried over.
+ */
+static int
+virDomainDeviceInfoCopyInactive(virDomainDeviceInfoPtr dst,
+                                virDomainDeviceInfoPtr src)
+{
+    if (virDomainDeviceInfoCopy(dst, src) < 0)
+        return -1;
+
+    /* aliases are only parsed from live XML */
+    VIR_FREE(dst->alias);
+    return 0;
+}
+
+static int
+virDomainChrSourceDefCopyInactive(virDomainChrSourceDefPtr dest,
+                                  virDomainChrSourceDefPtr src)
+{
+    if (virDomainChrSourceDefCopy(dest, src) < 0)
+        return -1;
+
+    /* the path of a pty is only parsed from live XML */
+    if (dest->type == VIR_DOMAIN_CHR_TYPE_PTY)
+        VIR_FREE(dest->data.file.path);
+    return 0;
+}
+
+static virSecurityLabelDefPtr
+virSecurityLabelDefCopyInactive(virSecurityLabelDefPtr src)
+{
+    virSecurityLabelDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    def->norelabel = src->norelabel;
+
+    /* generated labels are only parsed from live XML */
+    if (VIR_STRDUP(def->model, src->model) < 0 ||
+        (def->type == VIR_DOMAIN_SECLABEL_STATIC &&
+         VIR_STRDUP(def->label, src->label) < 0) ||
+        (def->type == VIR_DOMAIN_SECLABEL_DYNAMIC &&
+         VIR_STRDUP(def->baselabel, src->baselabel) < 0)) {
+        virSecurityLabelDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static int
+virSecurityDeviceLabelDefsCopyInactive(virSecurityDeviceLabelDefPtr **dst,
+                                       size_t *ndst,
+                                       virSecurityDeviceLabelDefPtr *src,
+                                       size_t nsrc)
+{
+    size_t i;
+
+    if (nsrc && VIR_ALLOC_N(*dst, nsrc) < 0)
+        return -1;
+
+    for (i = 0; i < nsrc; i++) {
+        virSecurityDeviceLabelDefPtr seclabel;
+
+        if (VIR_ALLOC(seclabel) < 0)
+            return -1;
+        (*dst)[(*ndst)++] = seclabel;
+
+        /* labelskip is only parsed from live XML and replaces the
+         * relabel attribute when formatted */
+        seclabel->norelabel = src[i]->labelskip ? false : src[i]->norelabel;
+
+        if (VIR_STRDUP(seclabel->model, src[i]->model) < 0 ||
+            VIR_STRDUP(seclabel->label, src[i]->label) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Inactive XML leaves out the device labels which neither name a
+ * label nor disable relabelling, so they disappear on the round trip */
+static void
+virSecurityDeviceLabelDefsPruneInactive(virSecurityDeviceLabelDefPtr **seclabels,
+                                        size_t *nseclabels)
+{
+    size_t i = 0;
+
+    while (i < *nseclabels) {
+        virSecurityDeviceLabelDefPtr seclabel = (*seclabels)[i];
+
+        if (seclabel->label || seclabel->norelabel) {
+            i++;
+            continue;
+        }
+
+        virSecurityDeviceLabelDefFree(seclabel);
+        VIR_DELETE_ELEMENT_INPLACE(*seclabels, i, *nseclabels);
+    }
+
+    if (!*nseclabels)
+        VIR_FREE(*seclabels);
+}
+
+static virDomainDiskDefPtr
+virDomainDiskDefCopyInactive(virDomainDiskDefPtr src)
+{
+    virDomainDiskDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    /* first a shallow copy of *everything* */
+    *def = *src;
+
+    /* then clear the pointers, they are duplicated below */
+    def->src = NULL;
+    def->dst = NULL;
+    def->nhosts = 0;
+    def->hosts = NULL;
+    def->srcpool = NULL;
+    def->auth.username = NULL;
+    if (def->auth.secretType == VIR_DOMAIN_DISK_SECRET_TYPE_USAGE)
+        def->auth.secret.usage = NULL;
+    def->driverName = NULL;
+    def->backingChain = NULL;
+    def->mirror = NULL;
+    def->serial = NULL;
+    def->wwn = NULL;
+    def->vendor = NULL;
+    def->product = NULL;
+    memset(&def->info, 0, sizeof(def->info));
+    def->encryption = NULL;
+    def->nseclabels = 0;
+    def->seclabels = NULL;
+
+    /* block jobs are only parsed from live XML */
+    def->mirrorFormat = VIR_STORAGE_FILE_NONE;
+    def->mirroring = false;
+
+    if (VIR_STRDUP(def->src, src->src) < 0 ||
+        VIR_STRDUP(def->dst, src->dst) < 0 ||
+        VIR_STRDUP(def->auth.username, src->auth.username) < 0 ||
+        VIR_STRDUP(def->driverName, src->driverName) < 0 ||
+        VIR_STRDUP(def->serial, src->serial) < 0 ||
+        VIR_STRDUP(def->wwn, src->wwn) < 0 ||
+        VIR_STRDUP(def->vendor, src->vendor) < 0 ||
+        VIR_STRDUP(def->product, src->product) < 0)
+        goto error;
+
+    if (def->auth.secretType == VIR_DOMAIN_DISK_SECRET_TYPE_USAGE &&
+        VIR_STRDUP(def->auth.secret.usage, src->auth.secret.usage) < 0)
+        goto error;
+
+    if (src->nhosts && VIR_ALLOC_N(def->hosts, src->nhosts) < 0)
+        goto error;
+
+    for (i = 0; i < src->nhosts; i++) {
+        def->nhosts++;
+        def->hosts[i].transport = src->hosts[i].transport;
+        if (VIR_STRDUP(def->hosts[i].name, src->hosts[i].name) < 0 ||
+            VIR_STRDUP(def->hosts[i].port, src->hosts[i].port) < 0 ||
+            VIR_STRDUP(def->hosts[i].socket, src->hosts[i].socket) < 0)
+            goto error;
+    }
+
+    if (src->srcpool) {
+        if (VIR_ALLOC(def->srcpool) < 0)
+            goto error;
+
+        def->srcpool->voltype = src->srcpool->voltype;
+        def->srcpool->pooltype = src->srcpool->pooltype;
+        def->srcpool->mode = src->srcpool->mode;
+        if (VIR_STRDUP(def->srcpool->pool, src->srcpool->pool) < 0 ||
+            VIR_STRDUP(def->srcpool->volume, src->srcpool->volume) < 0)
+            goto error;
+    }
+
+    if (src->encryption &&
+        !(def->encryption = virStorageEncryptionCopy(src->encryption)))
+        goto error;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0 ||
+        virSecurityDeviceLabelDefsCopyInactive(&def->seclabels,
+                                               &def->nseclabels,
+                                               src->seclabels,
+                                               src->nseclabels) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainDiskDefFree(def);
+    return NULL;
+}
+
+static virDomainControllerDefPtr
+virDomainControllerDefCopyInactive(virDomainControllerDefPtr src)
+{
+    virDomainControllerDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    *def = *src;
+    memset(&def->info, 0, sizeof(def->info));
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainControllerDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainLeaseDefPtr
+virDomainLeaseDefCopyInactive(virDomainLeaseDefPtr src)
+{
+    virDomainLeaseDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->offset = src->offset;
+
+    if (VIR_STRDUP(def->lockspace, src->lockspace) < 0 ||
+        VIR_STRDUP(def->key, src->key) < 0 ||
+        VIR_STRDUP(def->path, src->path) < 0) {
+        virDomainLeaseDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainFSDefPtr
+virDomainFSDefCopyInactive(virDomainFSDefPtr src)
+{
+    virDomainFSDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    *def = *src;
+    def->src = NULL;
+    def->dst = NULL;
+    memset(&def->info, 0, sizeof(def->info));
+
+    if (VIR_STRDUP(def->src, src->src) < 0 ||
+        VIR_STRDUP(def->dst, src->dst) < 0 ||
+        virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainFSDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+/* Duplicates everything but the parent and guest address of a hostdev,
+ * which are owned by whoever embeds @dst.  */
+static int
+virDomainHostdevDefCopySource(virDomainHostdevDefPtr dst,
+                              virDomainHostdevDefPtr src)
+{
+    dst->mode = src->mode;
+    dst->startupPolicy = src->startupPolicy;
+    dst->managed = src->managed;
+    dst->readonly = src->readonly;
+    dst->shareable = src->shareable;
+    dst->source = src->source;
+
+    /* origstates are only kept in the status XML */
+
+    switch (src->mode) {
+    case VIR_DOMAIN_HOSTDEV_MODE_CAPABILITIES:
+        switch (src->source.caps.type) {
+        case VIR_DOMAIN_HOSTDEV_CAPS_TYPE_STORAGE:
+            dst->source.caps.u.storage.block = NULL;
+            if (VIR_STRDUP(dst->source.caps.u.storage.block,
+                           src->source.caps.u.storage.block) < 0)
+                return -1;
+            break;
+        case VIR_DOMAIN_HOSTDEV_CAPS_TYPE_MISC:
+            dst->source.caps.u.misc.chardev = NULL;
+            if (VIR_STRDUP(dst->source.caps.u.misc.chardev,
+                           src->source.caps.u.misc.chardev) < 0)
+                return -1;
+            break;
+        case VIR_DOMAIN_HOSTDEV_CAPS_TYPE_NET:
+            dst->source.caps.u.net.iface = NULL;
+            if (VIR_STRDUP(dst->source.caps.u.net.iface,
+                           src->source.caps.u.net.iface) < 0)
+                return -1;
+            break;
+        }
+        break;
+    case VIR_DOMAIN_HOSTDEV_MODE_SUBSYS:
+        if (src->source.subsys.type == VIR_DOMAIN_HOSTDEV_SUBSYS_TYPE_SCSI) {
+            dst->source.subsys.u.scsi.adapter = NULL;
+            if (VIR_STRDUP(dst->source.subsys.u.scsi.adapter,
+                           src->source.subsys.u.scsi.adapter) < 0)
+                return -1;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+static virDomainHostdevDefPtr
+virDomainHostdevDefCopyInactive(virDomainHostdevDefPtr src)
+{
+    virDomainHostdevDefPtr def;
+
+    if (!(def = virDomainHostdevDefAlloc()))
+        return NULL;
+
+    if (virDomainHostdevDefCopySource(def, src) < 0 ||
+        virDomainDeviceInfoCopyInactive(def->info, src->info) < 0) {
+        virDomainHostdevDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainNetDefPtr
+virDomainNetDefCopyInactive(virDomainNetDefPtr src)
+{
+    virDomainNetDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    def->mac = src->mac;
+    def->driver = src->driver;
+    def->tune = src->tune;
+    def->linkstate = src->linkstate;
+
+    switch (src->type) {
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+        if (VIR_STRDUP(def->data.ethernet.dev, src->data.ethernet.dev) < 0 ||
+            VIR_STRDUP(def->data.ethernet.ipaddr,
+                       src->data.ethernet.ipaddr) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+        def->data.socket.port = src->data.socket.port;
+        if (VIR_STRDUP(def->data.socket.address,
+                       src->data.socket.address) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+        /* the actual device is only kept in the status XML */
+        if (VIR_STRDUP(def->data.network.name, src->data.network.name) < 0 ||
+            VIR_STRDUP(def->data.network.portgroup,
+                       src->data.network.portgroup) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        if (VIR_STRDUP(def->data.bridge.brname, src->data.bridge.brname) < 0 ||
+            VIR_STRDUP(def->data.bridge.ipaddr, src->data.bridge.ipaddr) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+        if (VIR_STRDUP(def->data.internal.name, src->data.internal.name) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+        def->data.direct.mode = src->data.direct.mode;
+        if (VIR_STRDUP(def->data.direct.linkdev,
+                       src->data.direct.linkdev) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+        def->data.hostdev.def.parent.type = VIR_DOMAIN_DEVICE_NET;
+        def->data.hostdev.def.parent.data.net = def;
+        def->data.hostdev.def.info = &def->info;
+        if (virDomainHostdevDefCopySource(&def->data.hostdev.def,
+                                          &src->data.hostdev.def) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    if (src->virtPortProfile) {
+        if (VIR_ALLOC(def->virtPortProfile) < 0)
+            goto error;
+        *def->virtPortProfile = *src->virtPortProfile;
+    }
+
+    if (VIR_STRDUP(def->model, src->model) < 0 ||
+        VIR_STRDUP(def->script, src->script) < 0 ||
+        VIR_STRDUP(def->filter, src->filter) < 0)
+        goto error;
+
+    /* generated target names are only parsed from live XML, and
+     * macvtap devices never keep theirs */
+    if (src->ifname &&
+        src->type != VIR_DOMAIN_NET_TYPE_DIRECT &&
+        !STRPREFIX(src->ifname, VIR_NET_GENERATED_PREFIX) &&
+        VIR_STRDUP(def->ifname, src->ifname) < 0)
+        goto error;
+
+    if (src->filterparams &&
+        (!(def->filterparams = virNWFilterHashTableCreate(0)) ||
+         virNWFilterHashTablePutAll(src->filterparams,
+                                    def->filterparams) < 0))
+        goto error;
+
+    if (virNetDevBandwidthCopy(&def->bandwidth, src->bandwidth) < 0 ||
+        virNetDevVlanCopy(&def->vlan, &src->vlan) < 0 ||
+        virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainNetDefFree(def);
+    return NULL;
+}
+
+static virDomainChrDefPtr
+virDomainChrDefCopyInactive(virDomainChrDefPtr src)
+{
+    virDomainChrDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->deviceType = src->deviceType;
+    def->targetTypeAttr = src->targetTypeAttr;
+    def->targetType = src->targetType;
+
+    if (def->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL &&
+        def->targetType == VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_GUESTFWD) {
+        if (src->target.addr) {
+            if (VIR_ALLOC(def->target.addr) < 0)
+                goto error;
+            *def->target.addr = *src->target.addr;
+        }
+    } else if (def->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL &&
+               def->targetType == VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_VIRTIO) {
+        if (VIR_STRDUP(def->target.name, src->target.name) < 0)
+            goto error;
+    } else {
+        def->target.port = src->target.port;
+    }
+
+    if (virDomainChrSourceDefCopyInactive(&def->source, &src->source) < 0 ||
+        virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0 ||
+        virSecurityDeviceLabelDefsCopyInactive(&def->seclabels,
+                                               &def->nseclabels,
+                                               src->seclabels,
+                                               src->nseclabels) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainChrDefFree(def);
+    return NULL;
+}
+
+static virDomainSmartcardDefPtr
+virDomainSmartcardDefCopyInactive(virDomainSmartcardDefPtr src)
+{
+    virDomainSmartcardDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+
+    switch (src->type) {
+    case VIR_DOMAIN_SMARTCARD_TYPE_HOST_CERTIFICATES:
+        for (i = 0; i < VIR_DOMAIN_SMARTCARD_NUM_CERTIFICATES; i++) {
+            if (VIR_STRDUP(def->data.cert.file[i],
+                           src->data.cert.file[i]) < 0)
+                goto error;
+        }
+        if (VIR_STRDUP(def->data.cert.database,
+                       src->data.cert.database) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_SMARTCARD_TYPE_PASSTHROUGH:
+        if (virDomainChrSourceDefCopyInactive(&def->data.passthru,
+                                              &src->data.passthru) < 0)
+            goto error;
+        break;
+    }
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainSmartcardDefFree(def);
+    return NULL;
+}
+
+static virDomainInputDefPtr
+virDomainInputDefCopyInactive(virDomainInputDefPtr src)
+{
+    virDomainInputDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    def->bus = src->bus;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainInputDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainSoundDefPtr
+virDomainSoundDefCopyInactive(virDomainSoundDefPtr src)
+{
+    virDomainSoundDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->model = src->model;
+
+    if (src->ncodecs && VIR_ALLOC_N(def->codecs, src->ncodecs) < 0)
+        goto error;
+
+    for (i = 0; i < src->ncodecs; i++) {
+        if (VIR_ALLOC(def->codecs[i]) < 0)
+            goto error;
+        def->ncodecs++;
+        *def->codecs[i] = *src->codecs[i];
+    }
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainSoundDefFree(def);
+    return NULL;
+}
+
+static virDomainVideoDefPtr
+virDomainVideoDefCopyInactive(virDomainVideoDefPtr src)
+{
+    virDomainVideoDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    def->ram = src->ram;
+    def->vram = src->vram;
+    def->heads = src->heads;
+    def->primary = src->primary;
+
+    if (src->accel) {
+        if (VIR_ALLOC(def->accel) < 0)
+            goto error;
+        *def->accel = *src->accel;
+    }
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainVideoDefFree(def);
+    return NULL;
+}
+
+static virDomainGraphicsDefPtr
+virDomainGraphicsDefCopyInactive(virDomainGraphicsDefPtr src)
+{
+    virDomainGraphicsDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    /* first a shallow copy of *everything* */
+    *def = *src;
+
+    /* then redo the pointers of the type in use, as well as the
+     * listens, and forget the ports allocated on startup which are
+     * only parsed from live XML */
+    def->nListens = 0;
+    def->listens = NULL;
+
+    switch (def->type) {
+    case VIR_DOMAIN_GRAPHICS_TYPE_VNC:
+        def->data.vnc.keymap = NULL;
+        def->data.vnc.socket = NULL;
+        def->data.vnc.auth.passwd = NULL;
+        if (def->data.vnc.autoport)
+            def->data.vnc.port = 0;
+        if (VIR_STRDUP(def->data.vnc.keymap, src->data.vnc.keymap) < 0 ||
+            VIR_STRDUP(def->data.vnc.socket, src->data.vnc.socket) < 0 ||
+            VIR_STRDUP(def->data.vnc.auth.passwd,
+                       src->data.vnc.auth.passwd) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SDL:
+        def->data.sdl.display = NULL;
+        def->data.sdl.xauth = NULL;
+        if (VIR_STRDUP(def->data.sdl.display, src->data.sdl.display) < 0 ||
+            VIR_STRDUP(def->data.sdl.xauth, src->data.sdl.xauth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_RDP:
+        if (def->data.rdp.autoport)
+            def->data.rdp.port = 0;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_DESKTOP:
+        def->data.desktop.display = NULL;
+        if (VIR_STRDUP(def->data.desktop.display,
+                       src->data.desktop.display) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SPICE:
+        def->data.spice.keymap = NULL;
+        def->data.spice.auth.passwd = NULL;
+        if (def->data.spice.autoport) {
+            def->data.spice.port = 0;
+            def->data.spice.tlsPort = 0;
+        }
+        if (VIR_STRDUP(def->data.spice.keymap, src->data.spice.keymap) < 0 ||
+            VIR_STRDUP(def->data.spice.auth.passwd,
+                       src->data.spice.auth.passwd) < 0)
+            goto error;
+        break;
+    }
+
+    if (src->nListens && VIR_ALLOC_N(def->listens, src->nListens) < 0)
+        goto error;
+
+    for (i = 0; i < src->nListens; i++) {
+        virDomainGraphicsListenDefPtr dst = &def->listens[def->nListens++];
+
+        /* the address of a network listen is only parsed from live XML,
+         * and fromConfig only from the status XML */
+        dst->type = src->listens[i].type;
+        if ((dst->type == VIR_DOMAIN_GRAPHICS_LISTEN_TYPE_ADDRESS &&
+             VIR_STRDUP(dst->address, src->listens[i].address) < 0) ||
+            VIR_STRDUP(dst->network, src->listens[i].network) < 0)
+            goto error;
+    }
+
+    return def;
+
+error:
+    virDomainGraphicsDefFree(def);
+    return NULL;
+}
+
+static virDomainRedirdevDefPtr
+virDomainRedirdevDefCopyInactive(virDomainRedirdevDefPtr src)
+{
+    virDomainRedirdevDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->bus = src->bus;
+
+    if (virDomainChrSourceDefCopyInactive(&def->source.chr,
+                                          &src->source.chr) < 0 ||
+        virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainRedirdevDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainHubDefPtr
+virDomainHubDefCopyInactive(virDomainHubDefPtr src)
+{
+    virDomainHubDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainHubDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainWatchdogDefPtr
+virDomainWatchdogDefCopyInactive(virDomainWatchdogDefPtr src)
+{
+    virDomainWatchdogDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->model = src->model;
+    def->action = src->action;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainWatchdogDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainMemballoonDefPtr
+virDomainMemballoonDefCopyInactive(virDomainMemballoonDefPtr src)
+{
+    virDomainMemballoonDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->model = src->model;
+    def->period = src->period;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainMemballoonDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainNVRAMDefPtr
+virDomainNVRAMDefCopyInactive(virDomainNVRAMDefPtr src)
+{
+    virDomainNVRAMDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainNVRAMDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainTPMDefPtr
+virDomainTPMDefCopyInactive(virDomainTPMDefPtr src)
+{
+    virDomainTPMDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    def->model = src->model;
+
+    if ((def->type == VIR_DOMAIN_TPM_TYPE_PASSTHROUGH &&
+         virDomainChrSourceDefCopy(&def->data.passthrough.source,
+                                   &src->data.passthrough.source) < 0) ||
+        virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0) {
+        virDomainTPMDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainRNGDefPtr
+virDomainRNGDefCopyInactive(virDomainRNGDefPtr src)
+{
+    virDomainRNGDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->model = src->model;
+    def->backend = src->backend;
+    def->rate = src->rate;
+    def->period = src->period;
+
+    switch ((enum virDomainRNGBackend) def->backend) {
+    case VIR_DOMAIN_RNG_BACKEND_RANDOM:
+        if (VIR_STRDUP(def->source.file, src->source.file) < 0)
+            goto error;
+        break;
+    case VIR_DOMAIN_RNG_BACKEND_EGD:
+        if (VIR_ALLOC(def->source.chardev) < 0 ||
+            virDomainChrSourceDefCopyInactive(def->source.chardev,
+                                              src->source.chardev) < 0)
+            goto error;
+        break;
+    case VIR_DOMAIN_RNG_BACKEND_LAST:
+        break;
+    }
+
+    if (virDomainDeviceInfoCopyInactive(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainRNGDefFree(def);
+    return NULL;
+}
+
+static virDomainRedirFilterDefPtr
+virDomainRedirFilterDefCopyInactive(virDomainRedirFilterDefPtr src)
+{
+    virDomainRedirFilterDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (src->nusbdevs && VIR_ALLOC_N(def->usbdevs, src->nusbdevs) < 0)
+        goto error;
+
+    for (i = 0; i < src->nusbdevs; i++) {
+        if (VIR_ALLOC(def->usbdevs[i]) < 0)
+            goto error;
+        def->nusbdevs++;
+        *def->usbdevs[i] = *src->usbdevs[i];
+    }
+
+    return def;
+
+error:
+    virDomainRedirFilterDefFree(def);
+    return NULL;
+}
+
+#define VIR_DOMAIN_DEF_COPY_DEVICES(devs, ndevs, copyfunc)      \
+    do {                                                        \
+        if (src->ndevs && VIR_ALLOC_N(def->devs, src->ndevs) < 0) \
+            goto error;                                         \
+        for (i = 0; i < src->ndevs; i++) {                      \
+            if (!(def->devs[i] = copyfunc(src->devs[i])))       \
+                goto error;                                     \
+            def->ndevs++;                                       \
+        }                                                       \
+    } while (0)
+
+#define VIR_DOMAIN_DEF_COPY_DEVICE(dev, copyfunc)               \
+    do {                                                        \
+        if (src->dev && !(def->dev = copyfunc(src->dev)))       \
+            goto error;                                         \
+    } while (0)
+
+static virDomainDefPtr
+virDomainDefCopyInactive(virDomainDefPtr src)
+{
+    virDomainDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    /* the ID of a running domain is only parsed from live XML */
+    def->id = -1;
+    def->virtType = src->virtType;
+    memcpy(def->uuid, src->uuid, VIR_UUID_BUFLEN);
+
+    def->blkio.weight = src->blkio.weight;
+    def->mem = src->mem;
+    def->vcpus = src->vcpus;
+    def->maxvcpus = src->maxvcpus;
+    def->placement_mode = src->placement_mode;
+    def->cputune.shares = src->cputune.shares;
+    def->cputune.period = src->cputune.period;
+    def->cputune.quota = src->cputune.quota;
+    def->cputune.emulator_period = src->cputune.emulator_period;
+    def->cputune.emulator_quota = src->cputune.emulator_quota;
+    def->numatune.memory.mode = src->numatune.memory.mode;
+    def->numatune.memory.placement_mode = src->numatune.memory.placement_mode;
+    def->onReboot = src->onReboot;
+    def->onPoweroff = src->onPoweroff;
+    def->onCrash = src->onCrash;
+    def->onLockFailure = src->onLockFailure;
+    def->pm = src->pm;
+
+    def->os.arch = src->os.arch;
+    def->os.nBootDevs = src->os.nBootDevs;
+    memcpy(def->os.bootDevs, src->os.bootDevs, sizeof(def->os.bootDevs));
+    def->os.bootmenu = src->os.bootmenu;
+    def->os.smbios_mode = src->os.smbios_mode;
+    def->os.bios = src->os.bios;
+
+    memcpy(def->features, src->features, sizeof(def->features));
+    def->apic_eoi = src->apic_eoi;
+    memcpy(def->hyperv_features, src->hyperv_features,
+           sizeof(def->hyperv_features));
+    def->hyperv_spinlocks = src->hyperv_spinlocks;
+
+    def->clock.offset = src->clock.offset;
+    if (def->clock.offset != VIR_DOMAIN_CLOCK_OFFSET_TIMEZONE)
+        def->clock.data = src->clock.data;
+    else if (VIR_STRDUP(def->clock.data.timezone,
+                        src->clock.data.timezone) < 0)
+        goto error;
+
+    def->ns = src->ns;
+
+    if (VIR_STRDUP(def->name, src->name) < 0 ||
+        VIR_STRDUP(def->title, src->title) < 0 ||
+        VIR_STRDUP(def->description, src->description) < 0 ||
+        VIR_STRDUP(def->emulator, src->emulator) < 0 ||
+        VIR_STRDUP(def->os.type, src->os.type) < 0 ||
+        VIR_STRDUP(def->os.machine, src->os.machine) < 0 ||
+        VIR_STRDUP(def->os.init, src->os.init) < 0 ||
+        VIR_STRDUP(def->os.kernel, src->os.kernel) < 0 ||
+        VIR_STRDUP(def->os.initrd, src->os.initrd) < 0 ||
+        VIR_STRDUP(def->os.cmdline, src->os.cmdline) < 0 ||
+        VIR_STRDUP(def->os.dtb, src->os.dtb) < 0 ||
+        VIR_STRDUP(def->os.root, src->os.root) < 0 ||
+        VIR_STRDUP(def->os.loader, src->os.loader) < 0 ||
+        VIR_STRDUP(def->os.bootloader, src->os.bootloader) < 0 ||
+        VIR_STRDUP(def->os.bootloaderArgs, src->os.bootloaderArgs) < 0)
+        goto error;
+
+    if (src->os.initargv) {
+        for (i = 0; src->os.initargv[i]; i++)
+            ;
+        if (VIR_ALLOC_N(def->os.initargv, i + 1) < 0)
+            goto error;
+        for (i = 0; src->os.initargv[i]; i++) {
+            if (VIR_STRDUP(def->os.initargv[i], src->os.initargv[i]) < 0)
+                goto error;
+        }
+    }
+
+    if (src->blkio.ndevices &&
+        VIR_ALLOC_N(def->blkio.devices, src->blkio.ndevices) < 0)
+        goto error;
+
+    for (i = 0; i < src->blkio.ndevices; i++) {
+        def->blkio.ndevices++;
+        def->blkio.devices[i].weight = src->blkio.devices[i].weight;
+        if (VIR_STRDUP(def->blkio.devices[i].path,
+                       src->blkio.devices[i].path) < 0)
+            goto error;
+    }
+
+    if (src->cpumask &&
+        !(def->cpumask = virBitmapNewCopy(src->cpumask)))
+        goto error;
+
+    if (src->cputune.nvcpupin) {
+        if (!(def->cputune.vcpupin =
+              virDomainVcpuPinDefCopy(src->cputune.vcpupin,
+                                      src->cputune.nvcpupin)))
+            goto error;
+        def->cputune.nvcpupin = src->cputune.nvcpupin;
+    }
+
+    if (src->cputune.emulatorpin) {
+        if (VIR_ALLOC(def->cputune.emulatorpin) < 0)
+            goto error;
+        def->cputune.emulatorpin->vcpuid = src->cputune.emulatorpin->vcpuid;
+        if (!(def->cputune.emulatorpin->cpumask =
+              virBitmapNewCopy(src->cputune.emulatorpin->cpumask)))
+            goto error;
+    }
+
+    if (src->numatune.memory.nodemask &&
+        !(def->numatune.memory.nodemask =
+          virBitmapNewCopy(src->numatune.memory.nodemask)))
+        goto error;
+
+    if (src->resource) {
+        if (VIR_ALLOC(def->resource) < 0 ||
+            VIR_STRDUP(def->resource->partition,
+                       src->resource->partition) < 0)
+            goto error;
+    }
+
+    if (src->idmap.nuidmap) {
+        if (VIR_ALLOC_N(def->idmap.uidmap, src->idmap.nuidmap) < 0)
+            goto error;
+        memcpy(def->idmap.uidmap, src->idmap.uidmap,
+               src->idmap.nuidmap * sizeof(*src->idmap.uidmap));
+        def->idmap.nuidmap = src->idmap.nuidmap;
+    }
+
+    if (src->idmap.ngidmap) {
+        if (VIR_ALLOC_N(def->idmap.gidmap, src->idmap.ngidmap) < 0)
+            goto error;
+        memcpy(def->idmap.gidmap, src->idmap.gidmap,
+               src->idmap.ngidmap * sizeof(*src->idmap.gidmap));
+        def->idmap.ngidmap = src->idmap.ngidmap;
+    }
+
+    if (src->clock.ntimers &&
+        VIR_ALLOC_N(def->clock.timers, src->clock.ntimers) < 0)
+        goto error;
+
+    for (i = 0; i < src->clock.ntimers; i++) {
+        if (VIR_ALLOC(def->clock.timers[i]) < 0)
+            goto error;
+        def->clock.ntimers++;
+        *def->clock.timers[i] = *src->clock.timers[i];
+    }
+
+    if (src->nseclabels &&
+        VIR_ALLOC_N(def->seclabels, src->nseclabels) < 0)
+        goto error;
+
+    for (i = 0; i < src->nseclabels; i++) {
+        virSecurityLabelDefPtr seclabel = src->seclabels[i];
+
+        /* labels which are never formatted do not survive the trip */
+        if (seclabel->type == VIR_DOMAIN_SECLABEL_DEFAULT ||
+            (STREQ_NULLABLE(seclabel->model, "dac") && seclabel->implicit))
+            continue;
+
+        if (!(def->seclabels[def->nseclabels] =
+              virSecurityLabelDefCopyInactive(seclabel)))
+            goto error;
+        def->nseclabels++;
+    }
+
+    VIR_DOMAIN_DEF_COPY_DEVICES(graphics, ngraphics,
+                                virDomainGraphicsDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(disks, ndisks,
+                                virDomainDiskDefCopyInactive);
+
+    /* controllers are kept sorted, which may differ from the order
+     * implicit ones were appended in */
+    if (src->ncontrollers &&
+        VIR_ALLOC_N(def->controllers, src->ncontrollers) < 0)
+        goto error;
+    for (i = 0; i < src->ncontrollers; i++) {
+        virDomainControllerDefPtr controller;
+
+        if (!(controller =
+              virDomainControllerDefCopyInactive(src->controllers[i])))
+            goto error;
+        virDomainControllerInsertPreAlloced(def, controller);
+    }
+
+    VIR_DOMAIN_DEF_COPY_DEVICES(fss, nfss,
+                                virDomainFSDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(nets, nnets,
+                                virDomainNetDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(inputs, ninputs,
+                                virDomainInputDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(sounds, nsounds,
+                                virDomainSoundDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(videos, nvideos,
+                                virDomainVideoDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(redirdevs, nredirdevs,
+                                virDomainRedirdevDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(smartcards, nsmartcards,
+                                virDomainSmartcardDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(serials, nserials,
+                                virDomainChrDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(parallels, nparallels,
+                                virDomainChrDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(channels, nchannels,
+                                virDomainChrDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(consoles, nconsoles,
+                                virDomainChrDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(leases, nleases,
+                                virDomainLeaseDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICES(hubs, nhubs,
+                                virDomainHubDefCopyInactive);
+
+    if (src->id == -1) {
+        for (i = 0; i < def->ndisks; i++)
+            virSecurityDeviceLabelDefsPruneInactive(&def->disks[i]->seclabels,
+                                                    &def->disks[i]->nseclabels);
+        for (i = 0; i < def->nserials; i++)
+            virSecurityDeviceLabelDefsPruneInactive(&def->serials[i]->seclabels,
+                                                    &def->serials[i]->nseclabels);
+        for (i = 0; i < def->nparallels; i++)
+            virSecurityDeviceLabelDefsPruneInactive(&def->parallels[i]->seclabels,
+                                                    &def->parallels[i]->nseclabels);
+        for (i = 0; i < def->nchannels; i++)
+            virSecurityDeviceLabelDefsPruneInactive(&def->channels[i]->seclabels,
+                                                    &def->channels[i]->nseclabels);
+        for (i = 0; i < def->nconsoles; i++)
+            virSecurityDeviceLabelDefsPruneInactive(&def->consoles[i]->seclabels,
+                                                    &def->consoles[i]->nseclabels);
+    }
+
+    /* As when parsing, <interface type='hostdev'> come first in the
+     * hostdevs array, followed by the plain <hostdev> devices.  Those
+     * backing an actual network device are dropped with it.  */
+    for (i = 0; i < def->nnets; i++) {
+        if (def->nets[i]->type == VIR_DOMAIN_NET_TYPE_HOSTDEV &&
+            virDomainHostdevInsert(def, &def->nets[i]->data.hostdev.def) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < src->nhostdevs; i++) {
+        virDomainHostdevDefPtr hostdev;
+
+        if (src->hostdevs[i]->parent.type != VIR_DOMAIN_DEVICE_NONE)
+            continue;
+
+        if (!(hostdev = virDomainHostdevDefCopyInactive(src->hostdevs[i])))
+            goto error;
+
+        if (virDomainHostdevInsert(def, hostdev) < 0) {
+            virDomainHostdevDefFree(hostdev);
+            goto error;
+        }
+    }
+
+    VIR_DOMAIN_DEF_COPY_DEVICE(watchdog, virDomainWatchdogDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(memballoon, virDomainMemballoonDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(nvram, virDomainNVRAMDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(tpm, virDomainTPMDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(rng, virDomainRNGDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(redirfilter,
+                               virDomainRedirFilterDefCopyInactive);
+    VIR_DOMAIN_DEF_COPY_DEVICE(cpu, virCPUDefCopy);
+    VIR_DOMAIN_DEF_COPY_DEVICE(sysinfo, virSysinfoDefCopy);
+
+    if (src->namespaceData &&
+        !(def->namespaceData = (src->ns.copy)(src->namespaceData)))
+        goto error;
+
+    if (src->metadata &&
+        !(def->metadata = xmlCopyNode(src->metadata, 1))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    return def;
+
+error:
+    virDomainDefFree(def);
+    return NULL;
+}
+
+#undef VIR_DOMAIN_DEF_COPY_DEVICE
+#undef VIR_DOMAIN_DEF_COPY_DEVICES
+
+
+/* Copy src into a new definition; with the quality of the copy
+ * depending on the migratable flag (false for transitions between
+ * persistent and active, true for transitions across save files or
+ * snapshots).  */
+virDomainDefPtr
+virDomainDefCopy(virDomainDefPtr src,
                  virCapsPtr caps,
                  virDomainXMLOptionPtr xmlopt,
                  bool migratable)
@@ -17921,10 +19438,16 @@ virDomainDefCopy(virDomainDefPtr src,
     unsigned int write_flags = VIR_DOMAIN_XML_WRITE_FLAGS;
     unsigned int read_flags = VIR_DOMAIN_XML_READ_FLAGS;
 
+    /* Migratable XML deliberately leaves parts of the definition out,
+     * and namespace data can only be duplicated by its owner, so both
+     * of those still clone via a round-trip through XML.  */
+    if (!migratable &&
+        (!src->namespaceData || src->ns.copy))
+        return virDomainDefCopyInactive(src);
+
     if (migratable)
         write_flags |= VIR_DOMAIN_XML_INACTIVE | VIR_DOMAIN_XML_MIGRATABLE;
 
-    /* Easiest to clone via a round-trip through XML.  */
     if (!(xml = virDomainDefFormat(src, write_flags)))
         return NULL;
 
@@ -2308,6 +2308,9 @@ virDomainDefPtr virDomainObjCopyPersistentDef(virDomainObjPtr dom,
 
 void virDomainObjListRemove(virDomainObjListPtr doms,
                             virDomainObjPtr dom);
+int virDomainObjListSetID(virDomainObjListPtr doms,
+                          virDomainObjPtr dom,
+                          int id);
 void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
                                   virDomainObjPtr dom);
 
@@ -2485,6 +2488,16 @@ int virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                    unsigned int expectedVirtTypes,
                                    virDomainLoadConfigNotify notify,
                                    void *opaque);
+int virDomainObjListLoadAllConfigsFull(virDomainObjListPtr doms,
+                                       const char *configDir,
+                                       const char *autostartDir,
+                                       int liveStatus,
+                                       virCapsPtr caps,
+                                       virDomainXMLOptionPtr xmlopt,
+                                       unsigned int expectedVirtTypes,
+                                       unsigned int nworkers,
+                                       virDomainLoadConfigNotify notify,
+                                       void *opaque);
 
 int virDomainDeleteConfig(const char *configDir,
                           const char *autostartDir,
@@ -1704,6 +1704,145 @@ virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr pool,
     return NULL;
 }
 
+/* Initial size of the volume lookup tables of a pool */
+#define VIR_STORAGE_VOL_TABLE_SIZE 64
+
+typedef const char *(*virStorageVolDefIDFunc)(virStorageVolDefPtr vol);
+
+static const char *
+virStorageVolDefName(virStorageVolDefPtr vol)
+{
+    return vol->name;
+}
+
+static const char *
+virStorageVolDefKey(virStorageVolDefPtr vol)
+{
+    return vol->key;
+}
+
+static const char *
+virStorageVolDefPath(virStorageVolDefPtr vol)
+{
+    return vol->target.path;
+}
+
+/*
+ * Like the linear scans these tables replace, a lookup returns the
+ * first volume added with a given ID, so a later duplicate is only
+ * indexed once the earlier one goes away.
+ */
+static int
+virStorageVolDefTableAdd(virHashTablePtr *table,
+                         virStorageVolDefIDFunc getID,
+                         virStorageVolDefPtr vol)
+{
+    const char *id = getID(vol);
+
+    if (!id)
+        return 0;
+
+    if (!*table &&
+        !(*table = virHashCreate(VIR_STORAGE_VOL_TABLE_SIZE, NULL)))
+        return -1;
+
+    if (virHashLookup(*table, id))
+        return 0;
+
+    return virHashAddEntry(*table, id, vol);
+}
+
+static void
+virStorageVolDefTableRemove(virStoragePoolObjPtr pool,
+                            virHashTablePtr table,
+                            virStorageVolDefIDFunc getID,
+                            virStorageVolDefPtr vol)
+{
+    const char *id = getID(vol);
+    size_t i;
+
+    if (!id || !table || virHashLookup(table, id) != vol)
+        return;
+
+    /* Hand the ID over to the next volume carrying it, if any. This
+     * cannot allocate as the entry is updated in place. */
+    for (i = 0; i < pool->volumes.count; i++) {
+        virStorageVolDefPtr other = pool->volumes.objs[i];
+
+        if (other != vol && STREQ_NULLABLE(getID(other), id)) {
+            ignore_value(virHashUpdateEntry(table, id, other));
+            return;
+        }
+    }
+
+    ignore_value(virHashRemoveEntry(table, id));
+}
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: locked pool object
+ * @vol: volume definition, with its name, key and path filled in
+ *
+ * Appends @vol to the volumes of @pool and indexes it for the
+ * virStorageVolDefFindBy* functions. On success @pool owns @vol.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr volumes = &pool->volumes;
+
+    if (VIR_APPEND_ELEMENT_COPY(volumes->objs, volumes->count, vol) < 0)
+        return -1;
+
+    if (virStorageVolDefTableAdd(&volumes->names,
+                                 virStorageVolDefName, vol) < 0 ||
+        virStorageVolDefTableAdd(&volumes->keys,
+                                 virStorageVolDefKey, vol) < 0 ||
+        virStorageVolDefTableAdd(&volumes->paths,
+                                 virStorageVolDefPath, vol) < 0) {
+        virStoragePoolObjRemoveVol(pool, vol);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: locked pool object
+ * @vol: volume definition owned by @pool
+ *
+ * Removes @vol from the volumes of @pool, handing its ownership back
+ * to the caller.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr volumes = &pool->volumes;
+    size_t i;
+
+    for (i = 0; i < volumes->count; i++) {
+        if (volumes->objs[i] == vol)
+            break;
+    }
+
+    if (i == volumes->count)
+        return;
+
+    VIR_DELETE_ELEMENT(volumes->objs, i, volumes->count);
+
+    virStorageVolDefTableRemove(pool, volumes->names,
+                                virStorageVolDefName, vol);
+    virStorageVolDefTableRemove(pool, volumes->keys,
+                                virStorageVolDefKey, vol);
+    virStorageVolDefTableRemove(pool, volumes->paths,
+                                virStorageVolDefPath, vol);
+}
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 {
@@ -1713,45 +1852,48 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+
+    virHashFree(pool->volumes.names);
+    virHashFree(pool->volumes.keys);
+    virHashFree(pool->volumes.paths);
+    pool->volumes.names = NULL;
+    pool->volumes.keys = NULL;
+    pool->volumes.paths = NULL;
+
+    if (pool->volumes.privateDataFreeFunc)
+        (pool->volumes.privateDataFreeFunc)(pool->volumes.privateData);
+    pool->volumes.privateData = NULL;
+    pool->volumes.privateDataFreeFunc = NULL;
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
                           const char *key)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.keys)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.keys, key);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.paths)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.paths, path);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
+    if (!pool->volumes.names)
+        return NULL;
 
-    return NULL;
+    return virHashLookup(pool->volumes.names, name);
 }
 
 virStoragePoolObjPtr
@@ -27,6 +27,7 @@
 # include "internal.h"
 # include "storage_encryption_conf.h"
 # include "virbitmap.h"
+# include "virhash.h"
 # include "virthread.h"
 
 # include <libxml/tree.h>
@@ -114,6 +115,16 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     size_t count;
     virStorageVolDefPtr *objs;
+
+    /* Lookup tables, maintained by virStoragePoolObjAddVol and
+     * virStoragePoolObjRemoveVol, mapping to entries of @objs */
+    virHashTablePtr names;
+    virHashTablePtr keys;
+    virHashTablePtr paths;
+
+    /* Backend data describing the volumes, released along with them */
+    void *privateData;
+    virFreeCallback privateDataFreeFunc;
 };
 
 VIR_ENUM_DECL(virStorageVol)
@@ -357,6 +368,12 @@ struct _virStorageDriverState {
     char *configDir;
     char *autostartDir;
     bool privileged;
+
+    /* Volume keys and paths mapped to the name of the pool holding
+     * them, guarded by volIndexLock which nests inside pool locks */
+    virMutex volIndexLock;
+    virHashTablePtr volKeys;
+    virHashTablePtr volPaths;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
@@ -400,6 +417,10 @@ virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name);
 
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol);
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol);
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
 
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
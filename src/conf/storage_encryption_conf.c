@@ -67,6 +67,35 @@ virStorageEncryptionFree(virStorageEncryptionPtr enc)
     VIR_FREE(enc);
 }
 
+virStorageEncryptionPtr
+virStorageEncryptionCopy(const virStorageEncryption *src)
+{
+    virStorageEncryptionPtr enc;
+    size_t i;
+
+    if (VIR_ALLOC(enc) < 0)
+        return NULL;
+
+    enc->format = src->format;
+
+    if (src->nsecrets &&
+        VIR_ALLOC_N(enc->secrets, src->nsecrets) < 0)
+        goto error;
+
+    for (i = 0; i < src->nsecrets; i++) {
+        if (VIR_ALLOC(enc->secrets[i]) < 0)
+            goto error;
+        enc->nsecrets++;
+        *enc->secrets[i] = *src->secrets[i];
+    }
+
+    return enc;
+
+error:
+    virStorageEncryptionFree(enc);
+    return NULL;
+}
+
 static virStorageEncryptionSecretPtr
 virStorageEncryptionSecretParse(xmlXPathContextPtr ctxt,
                                 xmlNodePtr node)
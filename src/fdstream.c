@@ -52,6 +52,15 @@ struct virFDStreamData {
     unsigned long long offset;
     unsigned long long length;
 
+    /* In sparse mode the I/O helper exchanges records with us,
+     * see virFileSparseRecord */
+    bool sparse;
+    virFileSparseRecord rec;
+    size_t recOffset;   /* bytes of @rec transferred so far */
+    bool recPending;    /* @rec still has to be written out */
+    unsigned long long dataLen; /* data left in the current record */
+    unsigned long long holeLen; /* hole left in the current record */
+
     int watch;
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
@@ -361,6 +370,86 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+/*
+ * Finish writing the pending record header
+ *
+ * Returns 0 once written, -2 if the pipe is full, -1 on error
+ */
+static int
+virFDStreamWriteRecord(struct virFDStreamData *fdst)
+{
+    while (fdst->recOffset < sizeof(fdst->rec)) {
+        ssize_t done = write(fdst->fd,
+                             (char *)&fdst->rec + fdst->recOffset,
+                             sizeof(fdst->rec) - fdst->recOffset);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            virReportSystemError(errno, "%s",
+                                 _("cannot write to stream"));
+            return -1;
+        }
+        fdst->recOffset += done;
+    }
+
+    fdst->recPending = false;
+    return 0;
+}
+
+
+/*
+ * Read the next record header
+ *
+ * Returns 1 once a header was read, 0 at the end of the stream,
+ * -2 if no data is available yet, -1 on error
+ */
+static int
+virFDStreamReadRecord(struct virFDStreamData *fdst)
+{
+    while (fdst->recOffset < sizeof(fdst->rec)) {
+        ssize_t got = read(fdst->fd,
+                           (char *)&fdst->rec + fdst->recOffset,
+                           sizeof(fdst->rec) - fdst->recOffset);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+        if (got == 0) {
+            if (fdst->recOffset == 0)
+                return 0;
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated record in sparse stream"));
+            return -1;
+        }
+        fdst->recOffset += got;
+    }
+    fdst->recOffset = 0;
+
+    switch ((virFileSparseRecordType) fdst->rec.type) {
+    case VIR_FILE_SPARSE_RECORD_DATA:
+        fdst->dataLen = fdst->rec.length;
+        break;
+    case VIR_FILE_SPARSE_RECORD_HOLE:
+        fdst->holeLen = fdst->rec.length;
+        break;
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected record type %u in sparse stream"),
+                       fdst->rec.type);
+        return -1;
+    }
+
+    return 1;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     struct virFDStreamData *fdst = st->privateData;
@@ -392,6 +481,29 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        /* Flush a hole whose write previously blocked */
+        if (fdst->recPending &&
+            fdst->rec.type == VIR_FILE_SPARSE_RECORD_HOLE &&
+            (ret = virFDStreamWriteRecord(fdst)) < 0)
+            goto cleanup;
+
+        if (!fdst->dataLen && !fdst->recPending) {
+            fdst->rec.type = VIR_FILE_SPARSE_RECORD_DATA;
+            fdst->rec.length = nbytes;
+            fdst->recOffset = 0;
+            fdst->recPending = true;
+            fdst->dataLen = nbytes;
+        }
+
+        if (fdst->recPending &&
+            (ret = virFDStreamWriteRecord(fdst)) < 0)
+            goto cleanup;
+
+        if (fdst->dataLen < nbytes)
+            nbytes = fdst->dataLen;
+    }
+
 retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -404,20 +516,85 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->sparse)
+            fdst->dataLen -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int
+virFDStreamSendHole(virStreamPtr st,
+                    long long length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream was not opened in sparse mode"));
+        goto cleanup;
+    }
+
+    if (fdst->dataLen ||
+        (fdst->recPending && fdst->rec.type != VIR_FILE_SPARSE_RECORD_HOLE)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("previous data was not completely written"));
+        goto cleanup;
+    }
+
+    if (!fdst->recPending) {
+        if (fdst->length &&
+            (fdst->length - fdst->offset) < length) {
+            virReportSystemError(ENOSPC, "%s",
+                                 _("cannot write to stream"));
+            goto cleanup;
+        }
+
+        fdst->rec.type = VIR_FILE_SPARSE_RECORD_HOLE;
+        fdst->rec.length = length;
+        fdst->recOffset = 0;
+        fdst->recPending = true;
+        if (fdst->length)
+            fdst->offset += length;
+    }
+
+    ret = virFDStreamWriteRecord(fdst);
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int
+virFDStreamRecvFlags(virStreamPtr st,
+                     char *bytes,
+                     size_t nbytes,
+                     unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -442,6 +619,31 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        while (!fdst->dataLen && !fdst->holeLen) {
+            if ((ret = virFDStreamReadRecord(fdst)) <= 0)
+                goto cleanup;
+        }
+
+        if (fdst->holeLen) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+
+            /* The caller does not know about holes, hand it zeros */
+            if (fdst->holeLen < nbytes)
+                nbytes = fdst->holeLen;
+            memset(bytes, 0, nbytes);
+            fdst->holeLen -= nbytes;
+            ret = nbytes;
+            goto done;
+        }
+
+        if (fdst->dataLen < nbytes)
+            nbytes = fdst->dataLen;
+    }
+
 retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -454,18 +656,73 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+        goto cleanup;
     }
 
+    if (fdst->sparse) {
+        if (ret == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("truncated record in sparse stream"));
+            ret = -1;
+            goto cleanup;
+        }
+        fdst->dataLen -= ret;
+    }
+
+done:
+    if (fdst->length)
+        fdst->offset += ret;
+
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
 
 
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamRecvFlags(st, bytes, nbytes, 0);
+}
+
+
+static int
+virFDStreamRecvHole(virStreamPtr st,
+                    long long *length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (fdst->holeLen > LLONG_MAX) {
+        *length = LLONG_MAX;
+        fdst->holeLen -= LLONG_MAX;
+    } else {
+        *length = fdst->holeLen;
+        fdst->holeLen = 0;
+    }
+    if (fdst->length)
+        fdst->offset += *length;
+
+    virMutexUnlock(&fdst->lock);
+    return 0;
+}
+
+
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamRecvFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamEventAddCallback = virFDStreamAddCallback,
@@ -477,12 +734,13 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virCommandPtr cmd,
                                    int errfd,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse)
 {
     struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
-              st, fd, cmd, errfd, length);
+    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu sparse=%d",
+              st, fd, cmd, errfd, length, sparse);
 
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         virSetNonBlock(fd) < 0)
@@ -495,6 +753,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    fdst->sparse = sparse;
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -512,7 +771,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, -1, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, -1, 0, false);
 }
 
 
@@ -557,7 +816,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
 
-    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0, false) < 0)
         goto error;
     return 0;
 
@@ -582,7 +841,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long offset,
                             unsigned long long length,
                             int oflags,
-                            int mode)
+                            int mode,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
@@ -590,8 +850,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     virCommandPtr cmd = NULL;
     int errfd = -1;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o "
+              "sparse=%d", st, path, oflags, offset, length, mode, sparse);
 
     oflags |= O_NOCTTY | O_BINARY;
 
@@ -625,8 +885,13 @@ virFDStreamOpenFileInternal(virStreamPtr st,
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
      * the I/O so we just have a fifo. Or use AIO :-(
+     * Holes are only tracked by the helper, so it's also
+     * needed in sparse mode.
      */
-    if ((st->flags & VIR_STREAM_NONBLOCK) &&
+    if (S_ISCHR(sb.st_mode) || S_ISFIFO(sb.st_mode))
+        sparse = false;
+
+    if (((st->flags & VIR_STREAM_NONBLOCK) || sparse) &&
         (!S_ISCHR(sb.st_mode) &&
          !S_ISFIFO(sb.st_mode))) {
         int fds[2] = { -1, -1 };
@@ -651,6 +916,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         virCommandPassFD(cmd, fd,
                          VIR_COMMAND_PASS_FD_CLOSE_PARENT);
         virCommandAddArgFormat(cmd, "%d", fd);
+        if (sparse)
+            virCommandAddArg(cmd, "1");
 
         if ((oflags & O_ACCMODE) == O_RDONLY) {
             childfd = fds[1];
@@ -669,7 +936,7 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         VIR_FORCE_CLOSE(childfd);
     }
 
-    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
+    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length, sparse) < 0)
         goto error;
 
     return 0;
@@ -698,7 +965,24 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0);
+                                       oflags, 0, false);
+}
+
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags)
+{
+    if (oflags & O_CREAT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Attempt to create %s without specifying mode"),
+                       path);
+        return -1;
+    }
+    return virFDStreamOpenFileInternal(st, path,
+                                       offset, length,
+                                       oflags, 0, true);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -710,7 +994,7 @@ int virFDStreamCreateFile(virStreamPtr st,
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags | O_CREAT, mode);
+                                       oflags | O_CREAT, mode, false);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -48,6 +48,11 @@ int virFDStreamOpenFile(virStreamPtr st,
                         unsigned long long offset,
                         unsigned long long length,
                         int oflags);
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags);
 int virFDStreamCreateFile(virStreamPtr st,
                           const char *path,
                           unsigned long long offset,
@@ -272,7 +272,7 @@ libxlVmCleanup(libxlDriverPrivatePtr driver,
     }
 
     if (vm->persistent) {
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     }
 
@@ -644,7 +644,8 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
         goto error;
     }
 
-    vm->def->id = domid;
+    if (virDomainObjListSetID(driver->domains, vm, domid) < 0)
+        goto error;
     if ((dom_xml = virDomainDefFormat(vm->def, 0)) == NULL)
         goto error;
 
@@ -691,7 +692,7 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
 error:
     if (domid > 0) {
         libxl_domain_destroy(priv->ctx, domid, NULL);
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_FAILED);
     }
     libxl_domain_config_dispose(&d_config);
@@ -740,7 +741,8 @@ libxlReconnectDomain(virDomainObjPtr vm,
     }
 
     /* Update domid in case it changed (e.g. reboot) while we were gone? */
-    vm->def->id = d_info.domid;
+    if (virDomainObjListSetID(driver->domains, vm, d_info.domid) < 0)
+        goto out;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_UNKNOWN);
 
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
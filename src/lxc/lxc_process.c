@@ -182,7 +182,7 @@ static void virLXCProcessCleanup(virLXCDriverPtr driver,
 
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     vm->pid = -1;
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
@@ -1257,7 +1257,8 @@ int virLXCProcessStart(virConnectPtr conn,
 
     priv->stopReason = VIR_DOMAIN_EVENT_STOPPED_FAILED;
     priv->wantReboot = false;
-    vm->def->id = vm->pid;
+    if (virDomainObjListSetID(driver->domains, vm, vm->pid) < 0)
+        goto error;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, reason);
     priv->doneStopEvent = false;
 
@@ -1442,7 +1443,8 @@ virLXCProcessReconnectDomain(virDomainObjPtr vm,
     priv = vm->privateData;
 
     if (vm->pid != 0) {
-        vm->def->id = vm->pid;
+        if (virDomainObjListSetID(driver->domains, vm, vm->pid) < 0)
+            goto error;
         virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_UNKNOWN);
 
@@ -1488,7 +1490,7 @@ virLXCProcessReconnectDomain(virDomainObjPtr vm,
         }
 
     } else {
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
     }
 
     ret = 0;
@@ -722,9 +722,16 @@ int networkAddFirewallRules(virNetworkObjPtr network)
     virNetworkIpDefPtr ipdef;
     virErrorPtr orig_error;
 
+    /* Queue all the rules and apply them with a single iptables-restore
+     * per address family rather than one iptables process per rule */
+    if (iptablesTransactionBegin() < 0)
+        return -1;
+
     /* Add "once per network" rules */
-    if (networkAddGeneralFirewallRules(network) < 0)
+    if (networkAddGeneralFirewallRules(network) < 0) {
+        iptablesTransactionAbort();
         return -1;
+    }
 
     for (i = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, i));
@@ -734,9 +741,23 @@ int networkAddFirewallRules(virNetworkObjPtr network)
             goto err;
         }
     }
+
+    if (iptablesTransactionCommit(false) < 0) {
+        /* some tables may have been committed before the failure */
+        orig_error = virSaveLastError();
+        networkRemoveFirewallRules(network);
+        virSetError(orig_error);
+        virFreeError(orig_error);
+        return -1;
+    }
     return 0;
 
 err:
+    /* Rules queued so far were never applied, but without
+     * iptables-restore they are applied immediately and must be
+     * removed below */
+    iptablesTransactionAbort();
+
     /* store the previous error message before attempting removal of rules */
     orig_error = virSaveLastError();
 
@@ -761,6 +782,9 @@ void networkRemoveFirewallRules(virNetworkObjPtr network)
 {
     size_t i;
     virNetworkIpDefPtr ipdef;
+    bool transaction;
+
+    transaction = iptablesTransactionBegin() == 0;
 
     for (i = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, i));
@@ -768,4 +792,7 @@ void networkRemoveFirewallRules(virNetworkObjPtr network)
         networkRemoveIpSpecificFirewallRules(network, ipdef);
     }
     networkRemoveGeneralFirewallRules(network);
+
+    if (transaction)
+        ignore_value(iptablesTransactionCommit(true));
 }
@@ -53,6 +53,9 @@
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <net/if.h>
+#include <net/ethernet.h>
+#include <netpacket/packet.h>
+#include <linux/filter.h>
 
 #include "viralloc.h"
 #include "virlog.h"
@@ -64,6 +67,7 @@
 #include "nwfilter_ipaddrmap.h"
 #include "virnetdev.h"
 #include "virfile.h"
+#include "intprops.h"
 #include "viratomic.h"
 #include "virthreadpool.h"
 #include "configmake.h"
@@ -78,6 +82,9 @@
 # define LEASEFILE LEASEFILE_DIR "nwfilter.leases"
 # define TMPLEASEFILE LEASEFILE_DIR "nwfilter.ltmp"
 
+typedef struct _virNWFilterSnoopEngine virNWFilterSnoopEngine;
+typedef virNWFilterSnoopEngine *virNWFilterSnoopEnginePtr;
+
 struct virNWFilterSnoopState {
     /* lease file */
     int                  leaseFD;
@@ -90,6 +97,8 @@ struct virNWFilterSnoopState {
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     virHashTablePtr      active;
     virMutex             activeLock; /* protects Active */
+    virNWFilterSnoopEnginePtr engine; /* snoops all interfaces */
+    virMutex             engineLock; /* protects Engine and its ifaces */
 };
 
 # define virNWFilterSnoopLock() \
@@ -117,12 +126,6 @@ typedef virNWFilterSnoopReq *virNWFilterSnoopReqPtr;
 typedef struct _virNWFilterSnoopIPLease virNWFilterSnoopIPLease;
 typedef virNWFilterSnoopIPLease *virNWFilterSnoopIPLeasePtr;
 
-typedef enum {
-    THREAD_STATUS_NONE,
-    THREAD_STATUS_OK,
-    THREAD_STATUS_FAIL,
-} virNWFilterSnoopThreadStatus;
-
 struct _virNWFilterSnoopReq {
     /*
      * reference counter: while the req is on the
@@ -146,11 +149,12 @@ struct _virNWFilterSnoopReq {
     virNWFilterSnoopIPLeasePtr           end;
     char                                *threadkey;
 
-    virNWFilterSnoopThreadStatus         threadStatus;
-    virCond                              threadStatusCond;
-
     int                                  jobCompletionStatus;
-    /* the number of submitted jobs in the worker's queue */
+    /* the number of submitted jobs in the worker's queue,
+     * from and to the VM */
+    int                                  qCtr[2];
+    /* whether a job running the lease timers is queued */
+    int                                  timerJob;
     /*
      * protect those members that can change while the
      * req is on the public SnoopReq hash and
@@ -160,7 +164,6 @@ struct _virNWFilterSnoopReq {
      * - start
      * - end
      * - a lease while it is on the list
-     * - threadStatus
      * (for refctr, see above)
      */
     virMutex                             lock;
@@ -170,6 +173,8 @@ struct _virNWFilterSnoopReq {
  * Note about lock-order:
  * 1st: virNWFilterSnoopLock()
  * 2nd: virNWFilterSnoopReqLock(req)
+ * 3rd: engineLock
+ * 4th: virNWFilterSnoopActiveLock()
  *
  * Rationale: Former protects the SnoopReqs hash, latter its contents
  */
@@ -233,9 +238,20 @@ struct _virNWFilterSnoopDHCPHdr {
      offsetof(virNWFilterSnoopDHCPHdr, d_opts))
 
 # define PCAP_PBUFSIZE              576 /* >= IP/TCP/DHCP headers */
-# define PCAP_READ_MAXERRS          25 /* retries on failing device */
 # define PCAP_FLOOD_TIMEOUT_MS      10 /* ms */
 
+/* DHCP requests from the VMs and replies to them */
+# define DHCP_SNOOP_FILTER \
+    "udp and ((dst port 67 and src port 68) or " \
+             "(src port 67 and dst port 68))"
+# define DHCP_SNOOP_WORKERS         4 /* threads decoding packets */
+# define DHCP_SNOOP_POLL_MS         1000 /* run lease timers this often */
+
+/* Socket receive buffer for a burst in both directions of each
+ * interface, counting the kernel's overhead per packet */
+# define DHCP_SNOOP_RCVBUF_IFACE    (2 * DHCP_PKT_BURST * 2048)
+# define DHCP_SNOOP_RCVBUF_MAX      (16 * 1024 * 1024)
+
 typedef struct _virNWFilterDHCPDecodeJob virNWFilterDHCPDecodeJob;
 typedef virNWFilterDHCPDecodeJob *virNWFilterDHCPDecodeJobPtr;
 
@@ -243,15 +259,16 @@ struct _virNWFilterDHCPDecodeJob {
     unsigned char packet[PCAP_PBUFSIZE];
     int caplen;
     bool fromVM;
+    bool timers;                /* run the lease timers of req instead */
+    virNWFilterSnoopReqPtr req; /* holds a reference */
     int *qCtr;
+    int *nJobs;
 };
 
 # define DHCP_PKT_RATE          10 /* pkts/sec */
 # define DHCP_PKT_BURST         50 /* pkts/sec */
 # define DHCP_BURST_INTERVAL_S  10 /* sec */
 
-# define PCAP_BUFFERSIZE        (DHCP_PKT_BURST * PCAP_PBUFSIZE / 2)
-
 # define MAX_QUEUED_JOBS        (DHCP_PKT_BURST + 2 * DHCP_PKT_RATE)
 
 typedef struct _virNWFilterSnoopRateLimitConf virNWFilterSnoopRateLimitConf;
@@ -261,22 +278,41 @@ struct _virNWFilterSnoopRateLimitConf {
     time_t prev;
     unsigned int pkt_ctr;
     time_t burst;
-    const unsigned int rate;
-    const unsigned int burstRate;
-    const unsigned int burstInterval;
+    unsigned int rate;
+    unsigned int burstRate;
+    unsigned int burstInterval;
+};
+
+/*
+ * An interface snooped by the engine; only the engine's thread uses
+ * it, with the exception of adding it to the engine's ifaces
+ */
+typedef struct _virNWFilterSnoopIface virNWFilterSnoopIface;
+typedef virNWFilterSnoopIface *virNWFilterSnoopIfacePtr;
+
+struct _virNWFilterSnoopIface {
+    virNWFilterSnoopReqPtr req; /* holds a reference */
+    char *threadkey;            /* the req's key when it was added */
+    virThreadPoolPtr worker;
+    /* indep. rate limiters from and to the VM */
+    virNWFilterSnoopRateLimitConf rateLimit[2];
+    unsigned long long penaltyTimeoutAbs[2];
+    time_t last_displayed;
+    time_t last_displayed_queue;
 };
 
-typedef struct _virNWFilterSnoopPcapConf virNWFilterSnoopPcapConf;
-typedef virNWFilterSnoopPcapConf *virNWFilterSnoopPcapConfPtr;
-
-struct _virNWFilterSnoopPcapConf {
-    pcap_t *handle;
-    const pcap_direction_t dir;
-    const char *filter;
-    virNWFilterSnoopRateLimitConf rateLimit; /* indep. rate limiters */
-    int qCtr; /* number of jobs in the worker's queue */
-    const unsigned int maxQSize;
-    unsigned long long penaltyTimeoutAbs;
+/*
+ * One packet socket receives the DHCP traffic of all interfaces and
+ * hands it to the interface it was seen on; the packets of one
+ * interface are always decoded by the same worker, in order, which
+ * also runs the lease timers of the interface.
+ */
+struct _virNWFilterSnoopEngine {
+    int fd;
+    struct bpf_program filter;  /* DHCP_SNOOP_FILTER, compiled */
+    virHashTablePtr ifaces;     /* ifindex -> virNWFilterSnoopIface */
+    virThreadPoolPtr workers[DHCP_SNOOP_WORKERS];
+    int nJobs;                  /* jobs queued to the workers */
 };
 
 /* local function prototypes */
@@ -585,22 +621,14 @@ virNWFilterSnoopReqNew(const char *ifkey)
     if (VIR_ALLOC(req) < 0)
         return NULL;
 
-    req->threadStatus = THREAD_STATUS_NONE;
-
     if (virStrcpyStatic(req->ifkey, ifkey) == NULL ||
         virMutexInitRecursive(&req->lock) < 0)
         goto err_free_req;
 
-    if (virCondInit(&req->threadStatusCond) < 0)
-        goto err_destroy_mutex;
-
     virNWFilterSnoopReqGet(req);
 
     return req;
 
-err_destroy_mutex:
-    virMutexDestroy(&req->lock);
-
 err_free_req:
     VIR_FREE(req);
 
@@ -634,7 +662,6 @@ virNWFilterSnoopReqFree(virNWFilterSnoopReqPtr req)
     virNWFilterHashTableFree(req->vars);
 
     virMutexDestroy(&req->lock);
-    virCondDestroy(&req->threadStatusCond);
 
     VIR_FREE(req);
 }
@@ -1005,6 +1032,10 @@ virNWFilterSnoopDHCPDecode(virNWFilterSnoopReqPtr req,
     if (len < 0)
         return -2;                 /* invalid packet length */
 
+    /* requests and replies are captured together */
+    if (ntohs(pup->dest) != (fromVM ? 67 : 68))
+        return -2;
+
     /*
      * some DHCP servers send their responses as MAC broadcast replies
      * filter messages from the server also by the destination MAC
@@ -1066,110 +1097,109 @@ virNWFilterSnoopDHCPDecode(virNWFilterSnoopReqPtr req,
     return 0;
 }
 
-static pcap_t *
-virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
-                         const char *filter, pcap_direction_t dir)
+/*
+ * Open the packet socket receiving the DHCP traffic of all interfaces.
+ * libpcap only compiles the filter into @fp, which is attached to the
+ * socket before it is bound, so it never sees other traffic.  The
+ * caller must free @fp with pcap_freecode if this succeeds.
+ */
+static int
+virNWFilterSnoopDHCPOpen(struct bpf_program *fp)
 {
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    char pcap_errbuf[PCAP_ERRBUF_SIZE];
-    char *ext_filter = NULL;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
-
-    virMacAddrFormat(mac, macaddr);
-
-    if (dir == PCAP_D_IN /* from VM */) {
-        /*
-         * don't want to hear about another VM's DHCP requests
-         *
-         * extend the filter with the macaddr of the VM; filter the
-         * more unlikely parameters first, then go for the MAC
-         */
-        if (virAsprintf(&ext_filter,
-                        "%s and ether src %s", filter, macaddr) < 0)
-            return NULL;
-    } else {
-        /*
-         * Some DHCP servers respond via MAC broadcast; we rely on later
-         * filtering of responses by comparing the MAC address inside the
-         * DHCP response against the one of the VM. Assuming that the
-         * bridge learns the VM's MAC address quickly this should not
-         * generate much more traffic than if we filtered by VM and
-         * braodcast MAC as well
-         */
-        if (VIR_STRDUP(ext_filter, filter) < 0)
-            return NULL;
-    }
-
-    handle = pcap_create(ifname, pcap_errbuf);
+    pcap_t *dead;
+    struct sock_fprog prog;
+    struct sockaddr_ll sll;
+    int fd = -1;
 
-    if (handle == NULL) {
+    dead = pcap_open_dead(DLT_EN10MB, PCAP_PBUFSIZE);
+    if (dead == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("pcap_create failed"));
-        goto cleanup_nohandle;
+                       _("pcap_open_dead failed"));
+        return -1;
     }
 
-    if (pcap_set_snaplen(handle, PCAP_PBUFSIZE) < 0 ||
-        pcap_set_buffer_size(handle, PCAP_BUFFERSIZE) < 0 ||
-        pcap_activate(handle) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("setup of pcap handle failed"));
-        goto cleanup;
+    if (pcap_compile(dead, fp, DHCP_SNOOP_FILTER, 1,
+                     PCAP_NETMASK_UNKNOWN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("pcap_compile: %s"), pcap_geterr(dead));
+        pcap_close(dead);
+        return -1;
     }
 
-    if (pcap_compile(handle, &fp, ext_filter, 1, PCAP_NETMASK_UNKNOWN) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_compile: %s"), pcap_geterr(handle));
+    pcap_close(dead);
+
+    /* no protocol yet, so nothing is received until bound */
+    if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot open packet socket"));
         goto cleanup;
     }
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setfilter: %s"), pcap_geterr(handle));
-        goto cleanup_freecode;
+    if (virSetCloseExec(fd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot set close-on-exec flag"));
+        goto error;
     }
 
-    if (pcap_setdirection(handle, dir) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("pcap_setdirection: %s"),
-                       pcap_geterr(handle));
-        goto cleanup_freecode;
+    prog.len = fp->bf_len;
+    prog.filter = (struct sock_filter *)fp->bf_insns;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot attach DHCP filter to packet socket"));
+        goto error;
     }
 
-    pcap_freecode(&fp);
-    VIR_FREE(ext_filter);
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = 0; /* all interfaces */
 
-    return handle;
+    if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot bind packet socket"));
+        goto error;
+    }
 
-cleanup_freecode:
-    pcap_freecode(&fp);
 cleanup:
-    pcap_close(handle);
-cleanup_nohandle:
-    VIR_FREE(ext_filter);
+    if (fd < 0)
+        pcap_freecode(fp);
 
-    return NULL;
+    return fd;
+
+error:
+    VIR_FORCE_CLOSE(fd);
+    goto cleanup;
 }
 
 /*
- * Worker function to decode the DHCP message and with that
- * also do the time-consuming work of instantiating the filters
+ * Worker function to decode the DHCP message or run the lease timers,
+ * and with that also do the time-consuming work of instantiating the
+ * filters
  */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = opaque;
     virNWFilterDHCPDecodeJobPtr job = jobdata;
+    virNWFilterSnoopReqPtr req = job->req;
     virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
 
-    if (virNWFilterSnoopDHCPDecode(req, packet,
-                                   job->caplen, job->fromVM) == -1) {
+    if (job->timers) {
+        virAtomicIntSet(&req->timerJob, 0);
+        virNWFilterSnoopReqLeaseTimerRun(req);
+    } else if (virNWFilterSnoopDHCPDecode(req, packet,
+                                          job->caplen, job->fromVM) == -1) {
         req->jobCompletionStatus = -1;
 
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Instantiation of rules failed on "
                          "interface '%s'"), req->ifname);
     }
-    virAtomicIntDecAndTest(job->qCtr);
+    if (job->qCtr)
+        virAtomicIntDecAndTest(job->qCtr);
+    virNWFilterSnoopReqPut(req);
+    virAtomicIntDecAndTest(job->nJobs);
     VIR_FREE(job);
 }
 
@@ -1178,9 +1208,10 @@ static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
  */
 static int
 virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
+                                    virNWFilterSnoopReqPtr req,
                                     virNWFilterSnoopEthHdrPtr pep,
-                                    int len, pcap_direction_t dir,
-                                    int *qCtr)
+                                    int len, bool fromVM,
+                                    int *nJobs)
 {
     virNWFilterDHCPDecodeJobPtr job;
     int ret;
@@ -1193,15 +1224,65 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
 
     memcpy(job->packet, pep, len);
     job->caplen = len;
-    job->fromVM = (dir == PCAP_D_IN);
-    job->qCtr = qCtr;
+    job->fromVM = fromVM;
+    job->req = req;
+    job->qCtr = &req->qCtr[fromVM ? 0 : 1];
+    job->nJobs = nJobs;
+
+    virNWFilterSnoopReqGet(req);
+    virAtomicIntInc(job->qCtr);
+    virAtomicIntInc(nJobs);
 
     ret = virThreadPoolSendJob(pool, 0, job);
 
-    if (ret == 0)
-        virAtomicIntInc(qCtr);
-    else
+    if (ret < 0) {
+        virAtomicIntDecAndTest(job->qCtr);
+        virAtomicIntDecAndTest(nJobs);
+        virNWFilterSnoopReqPut(req);
+        VIR_FREE(job);
+    }
+
+    return ret;
+}
+
+/*
+ * Have the worker thread of @req run its lease timers, unless that is
+ * already queued; expiring a lease re-instantiates the filters, which
+ * must not hold up the reading of packets.
+ */
+static int
+virNWFilterSnoopLeaseTimerJobSubmit(virThreadPoolPtr pool,
+                                    virNWFilterSnoopReqPtr req,
+                                    int *nJobs)
+{
+    virNWFilterDHCPDecodeJobPtr job;
+    int ret;
+
+    if (!virAtomicIntCompareExchange(&req->timerJob, 0, 1))
+        return 0;
+
+    if (VIR_ALLOC(job) < 0) {
+        virAtomicIntSet(&req->timerJob, 0);
+        return -1;
+    }
+
+    job->timers = true;
+    job->req = req;
+    job->nJobs = nJobs;
+
+    virNWFilterSnoopReqGet(req);
+    virAtomicIntInc(nJobs);
+
+    ret = virThreadPoolSendJob(pool, 0, job);
+
+    if (ret < 0) {
+        virAtomicIntDecAndTest(nJobs);
+        /* the caller holds engineLock and a reference to @req, so don't
+         * take the SnoopLock in virNWFilterSnoopReqPut */
+        ignore_value(virAtomicIntDecAndTest(&req->refctr));
+        virAtomicIntSet(&req->timerJob, 0);
         VIR_FREE(job);
+    }
 
     return ret;
 }
@@ -1255,16 +1336,16 @@ virNWFilterSnoopRateLimit(virNWFilterSnoopRateLimitConfPtr rl)
 /*
  * virNWFilterSnoopRatePenalty
  *
- * @pc: pointer to the virNWFilterSnoopPcapConf
+ * @penaltyTimeoutAbs: pointer to the end of the penalty
  * @diff: the amount of pkts beyond the rate, i.e., if the rate is 10
  *        and 13 pkts have been received now in one seconds, then
  *        this should be 3.
  *
- * Adjusts the timeout the virNWFilterSnooPcapConf will be penalized for
- * sending too many packets.
+ * Adjusts the time until which the packets in one direction of an
+ * interface are dropped for sending too many packets.
  */
 static void
-virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConfPtr pc,
+virNWFilterSnoopRatePenalty(unsigned long long *penaltyTimeoutAbs,
                             unsigned int diff, unsigned int limit)
 {
     if (diff > limit) {
@@ -1272,299 +1353,517 @@ virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConfPtr pc,
 
         if (virTimeMillisNowRaw(&now) < 0) {
             usleep(PCAP_FLOOD_TIMEOUT_MS); /* 1 ms */
-            pc->penaltyTimeoutAbs = 0;
+            *penaltyTimeoutAbs = 0;
         } else {
-            /* don't listen to the fd for 1 ms */
-            pc->penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
+            /* drop the packets for 1 ms */
+            *penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
         }
     }
 }
 
-static int
-virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
-                           size_t nPc, struct pollfd *pfd,
-                           int *pollTo)
+static void
+virNWFilterSnoopIfaceFree(virNWFilterSnoopIfacePtr iface)
+{
+    if (!iface)
+        return;
+
+    virNWFilterSnoopReqPut(iface->req);
+    VIR_FREE(iface->threadkey);
+    VIR_FREE(iface);
+}
+
+/*
+ * Stop snooping on an interface after an error; this is what the
+ * owner of the interface would otherwise do with virNWFilterDHCPSnoopEnd.
+ */
+static void
+virNWFilterSnoopIfaceAbort(virNWFilterSnoopIfacePtr iface)
+{
+    virNWFilterSnoopReqPtr req = iface->req;
+
+    /* protect IfNameToKey */
+    virNWFilterSnoopLock();
+
+    /* protect req->ifname & req->threadkey */
+    virNWFilterSnoopReqLock(req);
+
+    if (req->threadkey && STREQ(req->threadkey, iface->threadkey)) {
+        virNWFilterSnoopCancel(&req->threadkey);
+
+        if (req->ifname)
+            ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                            req->ifname));
+
+        VIR_FREE(req->ifname);
+    }
+
+    virNWFilterSnoopReqUnlock(req);
+    virNWFilterSnoopUnlock();
+}
+
+static void
+virNWFilterSnoopEngineFree(virNWFilterSnoopEnginePtr engine)
 {
-    int ret = 0;
     size_t i;
-    int tmp;
-    unsigned long long now = 0;
 
-    *pollTo = -1;
+    if (!engine)
+        return;
 
-    for (i = 0; i < nPc; i++) {
-        if (pc[i].penaltyTimeoutAbs != 0) {
-            if (now == 0) {
-                if (virTimeMillisNow(&now) < 0) {
-                    ret = -1;
-                    break;
-                }
-            }
+    /* queued jobs hold references to their req */
+    while (virAtomicIntGet(&engine->nJobs) > 0)
+        usleep(10 * 1000);
 
-            if (now < pc[i].penaltyTimeoutAbs) {
-                /* don't listen to incoming data on the fd for some time */
-                pfd[i].events &= ~POLLIN;
-                /*
-                 * calc the max. time to spend in poll() until adjustments
-                 * to the pollfd array are needed again.
-                 */
-                tmp = pc[i].penaltyTimeoutAbs - now;
-                if (*pollTo == -1 || tmp < *pollTo)
-                    *pollTo = tmp;
-            } else {
-                /* listen again to the fd */
-                pfd[i].events |= POLLIN;
-
-                pc[i].penaltyTimeoutAbs = 0;
-            }
+    for (i = 0; i < DHCP_SNOOP_WORKERS; i++)
+        virThreadPoolFree(engine->workers[i]);
+
+    virHashFree(engine->ifaces);
+    if (engine->fd >= 0)
+        pcap_freecode(&engine->filter);
+    VIR_FORCE_CLOSE(engine->fd);
+    VIR_FREE(engine);
+}
+
+static virNWFilterSnoopEnginePtr
+virNWFilterSnoopEngineNew(void)
+{
+    virNWFilterSnoopEnginePtr engine;
+    size_t i;
+
+    if (VIR_ALLOC(engine) < 0)
+        return NULL;
+
+    engine->fd = -1;
+
+    if (!(engine->ifaces = virHashCreate(0, NULL)))
+        goto error;
+
+    for (i = 0; i < DHCP_SNOOP_WORKERS; i++) {
+        engine->workers[i] = virThreadPoolNew(1, 1, 0,
+                                              virNWFilterDHCPDecodeWorker,
+                                              NULL);
+        if (!engine->workers[i])
+            goto error;
+    }
+
+    if ((engine->fd = virNWFilterSnoopDHCPOpen(&engine->filter)) < 0)
+        goto error;
+
+    return engine;
+
+error:
+    virNWFilterSnoopEngineFree(engine);
+    return NULL;
+}
+
+/*
+ * Adapt the socket of @engine, which must be locked, to the interfaces
+ * it snoops: the DHCP filter is preceded by a check of the interface
+ * index so that the kernel drops the DHCP traffic of all others rather
+ * than queue it, and the receive buffer grows with the interfaces.
+ */
+static int
+virNWFilterSnoopEngineUpdate(virNWFilterSnoopEnginePtr engine)
+{
+    size_t nifaces = virHashSize(engine->ifaces);
+    struct sock_filter *insns = NULL;
+    struct sock_fprog prog;
+    int rcvbuf;
+    int rc;
+    int ret = -1;
+
+    prog.len = engine->filter.bf_len;
+    prog.filter = (struct sock_filter *)engine->filter.bf_insns;
+
+# ifdef SKF_AD_IFINDEX
+    if (nifaces > 0 &&
+        2 * nifaces + 2 + engine->filter.bf_len <= BPF_MAXINSNS) {
+        virHashKeyValuePairPtr items;
+        size_t ninsns = 0;
+        size_t i;
+
+        if (!(items = virHashGetItems(engine->ifaces, NULL)))
+            goto cleanup;
+        if (VIR_ALLOC_N(insns, 2 * nifaces + 2 + engine->filter.bf_len) < 0) {
+            VIR_FREE(items);
+            goto cleanup;
+        }
+
+        insns[ninsns++] = (struct sock_filter)
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+        for (i = 0; i < nifaces; i++) {
+            virNWFilterSnoopIfacePtr iface = (virNWFilterSnoopIfacePtr)items[i].value;
+
+            /* on a match, jump over the remaining checks and the drop */
+            insns[ninsns++] = (struct sock_filter)
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, iface->req->ifindex, 0, 1);
+            insns[ninsns++] = (struct sock_filter)
+                BPF_JUMP(BPF_JMP | BPF_JA, 2 * (nifaces - i - 1) + 1, 0, 0);
         }
+        insns[ninsns++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+        memcpy(insns + ninsns, engine->filter.bf_insns,
+               engine->filter.bf_len * sizeof(*insns));
+
+        prog.len = ninsns + engine->filter.bf_len;
+        prog.filter = insns;
+        VIR_FREE(items);
+    }
+# endif
+
+    rc = setsockopt(engine->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                    &prog, sizeof(prog));
+    if (rc < 0 && insns) {
+        /* kernels without SKF_AD_IFINDEX reject the check */
+        prog.len = engine->filter.bf_len;
+        prog.filter = (struct sock_filter *)engine->filter.bf_insns;
+        rc = setsockopt(engine->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                        &prog, sizeof(prog));
+    }
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot attach DHCP filter to packet socket"));
+        goto cleanup;
     }
 
+    rcvbuf = MIN(MAX(nifaces, 1) * DHCP_SNOOP_RCVBUF_IFACE,
+                 DHCP_SNOOP_RCVBUF_MAX);
+# ifdef SO_RCVBUFFORCE
+    /* beyond net.core.rmem_max */
+    if (setsockopt(engine->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+                   &rcvbuf, sizeof(rcvbuf)) == 0)
+        rcvbuf = 0;
+# endif
+    if (rcvbuf &&
+        setsockopt(engine->fd, SOL_SOCKET, SO_RCVBUF,
+                   &rcvbuf, sizeof(rcvbuf)) < 0)
+        VIR_WARN("cannot set the receive buffer of the DHCP snooping "
+                 "socket to %d bytes", rcvbuf);
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(insns);
     return ret;
 }
 
 /*
- * The DHCP snooping thread. It spends most of its time in the pcap
- * library and if it gets suitable packets, it submits them to the worker
- * thread for processing.
+ * Hand a packet seen on the interface with index @ifindex to the
+ * worker of the interface, if it is snooped.
  */
 static void
-virNWFilterDHCPSnoopThread(void *req0)
+virNWFilterSnoopEngineDispatch(virNWFilterSnoopEnginePtr engine,
+                               unsigned char *packet, int len,
+                               int ifindex, bool fromVM)
 {
-    virNWFilterSnoopReqPtr req = req0;
-    struct pcap_pkthdr *hdr;
-    virNWFilterSnoopEthHdrPtr packet;
-    int ifindex = 0;
-    int errcount = 0;
-    int tmp = -1, rv, n, pollTo;
-    size_t i;
-    char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
-    time_t last_displayed = 0, last_displayed_queue = 0;
-    virNWFilterSnoopPcapConf pcapConf[] = {
-        {
-            .dir = PCAP_D_IN, /* from VM */
-            .filter = "dst port 67 and src port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        }, {
-            .dir = PCAP_D_OUT, /* to VM */
-            .filter = "src port 67 and dst port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        },
-    };
-    struct pollfd fds[] = {
-        {
-            /* get a POLLERR if interface goes down or disappears */
-            .events = POLLIN | POLLERR,
-        }, {
-            .events = POLLIN | POLLERR,
-        },
-    };
-    bool error = false;
+    virNWFilterSnoopEthHdrPtr pep = (virNWFilterSnoopEthHdrPtr)packet;
+    virNWFilterSnoopIfacePtr iface;
+    char key[INT_BUFSIZE_BOUND(ifindex)];
+    size_t dir = fromVM ? 0 : 1;
+    unsigned long long now;
+    unsigned int diff;
+
+    if (len <= MIN_VALID_DHCP_PKT_SIZE)
+        return;
 
-    /* whoever started us increased the reference counter for the req for us */
+    snprintf(key, sizeof(key), "%d", ifindex);
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    virMutexLock(&virNWFilterSnoopState.engineLock);
 
-    if (req->ifname && req->threadkey) {
-        for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-            pcapConf[i].handle =
-                virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                         pcapConf[i].filter,
-                                         pcapConf[i].dir);
-            if (!pcapConf[i].handle) {
-                error = true;
-                break;
-            }
-            fds[i].fd = pcap_fileno(pcapConf[i].handle);
+    if (!(iface = virHashLookup(engine->ifaces, key)))
+        goto cleanup;
+
+    /* don't want to hear about another VM's DHCP requests */
+    if (fromVM &&
+        virMacAddrCmpRaw(&iface->req->macaddr, pep->eh_src.addr) != 0)
+        goto cleanup;
+
+    if (iface->penaltyTimeoutAbs[dir] != 0) {
+        if (virTimeMillisNow(&now) < 0 ||
+            now < iface->penaltyTimeoutAbs[dir])
+            goto cleanup;
+        iface->penaltyTimeoutAbs[dir] = 0;
+    }
+
+    if (!virNWFilterSnoopIsActive(iface->threadkey) ||
+        iface->req->jobCompletionStatus != 0)
+        goto cleanup;
+
+    /* submit packet to worker thread */
+    if (virAtomicIntGet(&iface->req->qCtr[dir]) > MAX_QUEUED_JOBS) {
+        if (time(0) - iface->last_displayed_queue > 10) {
+            iface->last_displayed_queue = time(0);
+            VIR_WARN("Worker thread for interface '%s' has a "
+                     "job queue that is too long\n",
+                     iface->req->ifname);
         }
-        tmp = virNetDevGetIndex(req->ifname, &ifindex);
-        ignore_value(VIR_STRDUP(threadkey, req->threadkey));
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
+        goto cleanup;
     }
 
-    /* let creator know how well we initialized */
-    if (error == true || !threadkey || tmp < 0 || !worker ||
-        ifindex != req->ifindex)
-        req->threadStatus = THREAD_STATUS_FAIL;
-    else
-        req->threadStatus = THREAD_STATUS_OK;
+    diff = virNWFilterSnoopRateLimit(&iface->rateLimit[dir]);
+    if (diff > 0) {
+        virNWFilterSnoopRatePenalty(&iface->penaltyTimeoutAbs[dir], diff,
+                                    DHCP_PKT_RATE);
+        /* rate-limited warnings */
+        if (time(0) - iface->last_displayed > 10) {
+             iface->last_displayed = time(0);
+             VIR_WARN("Too many DHCP packets on interface '%s'",
+                      iface->req->ifname);
+        }
+        goto cleanup;
+    }
 
-    virCondSignal(&req->threadStatusCond);
+    if (virNWFilterSnoopDHCPDecodeJobSubmit(iface->worker, iface->req,
+                                            pep, len, fromVM,
+                                            &engine->nJobs) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Job submission failed on "
+                         "interface '%s'"), iface->req->ifname);
+        /* stops snooping on the interface */
+        iface->req->jobCompletionStatus = -1;
+    }
 
-    virNWFilterSnoopReqUnlock(req);
+cleanup:
+    virMutexUnlock(&virNWFilterSnoopState.engineLock);
+}
 
-    if (req->threadStatus != THREAD_STATUS_OK)
-        goto exit;
+/*
+ * Have the workers run the lease timers of the snooped interfaces and
+ * drop those that are no longer snooped, or whose jobs failed.
+ *
+ * Returns false once no interface is left; the engine is then detached
+ * and a new one gets started for the next interface.
+ */
+static bool
+virNWFilterSnoopEngineRun(virNWFilterSnoopEnginePtr engine)
+{
+    virHashKeyValuePairPtr items = NULL;
+    virNWFilterSnoopIfacePtr *done = NULL;
+    size_t ndone = 0;
+    bool ret = true;
+    size_t i;
 
-    while (!error) {
-        if (virNWFilterSnoopAdjustPoll(pcapConf,
-                                       ARRAY_CARDINALITY(pcapConf),
-                                       fds, &pollTo) < 0) {
-            break;
-        }
+    virMutexLock(&virNWFilterSnoopState.engineLock);
 
-        n = poll(fds, ARRAY_CARDINALITY(fds), pollTo);
+    if (VIR_ALLOC_N(done, virHashSize(engine->ifaces)) < 0 ||
+        !(items = virHashGetItems(engine->ifaces, NULL))) {
+        virMutexUnlock(&virNWFilterSnoopState.engineLock);
+        goto cleanup;
+    }
 
-        if (n < 0) {
-            if (errno != EAGAIN && errno != EINTR)
-                error = true;
+    for (i = 0; items[i].key; i++) {
+        virNWFilterSnoopIfacePtr iface = (virNWFilterSnoopIfacePtr)items[i].value;
+
+        if (!virNWFilterSnoopIsActive(iface->threadkey) ||
+            iface->req->jobCompletionStatus != 0) {
+            ignore_value(virHashSteal(engine->ifaces, items[i].key));
+            done[ndone++] = iface;
+        } else if (virNWFilterSnoopLeaseTimerJobSubmit(iface->worker,
+                                                       iface->req,
+                                                       &engine->nJobs) < 0) {
+            VIR_WARN("Cannot run the lease timers of interface '%s'",
+                     iface->req->ifname);
         }
+    }
 
-        virNWFilterSnoopReqLeaseTimerRun(req);
+    if (virHashSize(engine->ifaces) == 0) {
+        if (virNWFilterSnoopState.engine == engine)
+            virNWFilterSnoopState.engine = NULL;
+        ret = false;
+    } else if (ndone > 0) {
+        /* on failure the filter still lets the traffic of the removed
+         * interfaces through, which is only dropped later */
+        ignore_value(virNWFilterSnoopEngineUpdate(engine));
+    }
 
-        /*
-         * Check whether we were cancelled or whether
-         * a previously submitted job failed.
-         */
-        if (!virNWFilterSnoopIsActive(threadkey) ||
-            req->jobCompletionStatus != 0)
-            goto exit;
+    virMutexUnlock(&virNWFilterSnoopState.engineLock);
 
-        for (i = 0; n > 0 && i < ARRAY_CARDINALITY(fds); i++) {
-            if (!fds[i].revents)
-                continue;
+    for (i = 0; i < ndone; i++) {
+        if (done[i]->req->jobCompletionStatus != 0)
+            virNWFilterSnoopIfaceAbort(done[i]);
+        virNWFilterSnoopIfaceFree(done[i]);
+    }
 
-            fds[i].revents = 0;
-            n--;
+cleanup:
+    VIR_FREE(items);
+    VIR_FREE(done);
 
-            rv = pcap_next_ex(pcapConf[i].handle, &hdr,
-                              (const u_char **)&packet);
+    return ret;
+}
 
-            if (rv < 0) {
-                /* error reading from socket */
-                tmp = -1;
+/*
+ * Detach the engine after an error and stop snooping on all of its
+ * interfaces
+ */
+static void
+virNWFilterSnoopEngineAbort(virNWFilterSnoopEnginePtr engine)
+{
+    virHashKeyValuePairPtr items;
+    size_t i;
 
-                /* protect req->ifname */
-                virNWFilterSnoopReqLock(req);
+    virMutexLock(&virNWFilterSnoopState.engineLock);
 
-                if (req->ifname)
-                    tmp = virNetDevValidateConfig(req->ifname, NULL, ifindex);
+    if (virNWFilterSnoopState.engine == engine)
+        virNWFilterSnoopState.engine = NULL;
 
-                virNWFilterSnoopReqUnlock(req);
+    items = virHashGetItems(engine->ifaces, NULL);
+    for (i = 0; items && items[i].key; i++)
+        ignore_value(virHashSteal(engine->ifaces, items[i].key));
 
-                if (tmp <= 0) {
-                    error = true;
-                    break;
-                }
+    virMutexUnlock(&virNWFilterSnoopState.engineLock);
 
-                if (++errcount > PCAP_READ_MAXERRS) {
-                    pcap_close(pcapConf[i].handle);
-                    pcapConf[i].handle = NULL;
-
-                    /* protect req->ifname */
-                    virNWFilterSnoopReqLock(req);
-
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("interface '%s' failing; "
-                                     "reopening"),
-                                   req->ifname);
-                    if (req->ifname)
-                        pcapConf[i].handle =
-                            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                                     pcapConf[i].filter,
-                                                     pcapConf[i].dir);
-
-                    virNWFilterSnoopReqUnlock(req);
-
-                    if (!pcapConf[i].handle) {
-                        error = true;
-                        break;
-                    }
-                }
-                continue;
-            }
+    for (i = 0; items && items[i].key; i++) {
+        virNWFilterSnoopIfacePtr iface = (virNWFilterSnoopIfacePtr)items[i].value;
 
-            errcount = 0;
-
-            if (rv) {
-                unsigned int diff;
-
-                /* submit packet to worker thread */
-                if (virAtomicIntGet(&pcapConf[i].qCtr) >
-                    pcapConf[i].maxQSize) {
-                    if (last_displayed_queue - time(0) > 10) {
-                        last_displayed_queue = time(0);
-                        VIR_WARN("Worker thread for interface '%s' has a "
-                                 "job queue that is too long\n",
-                                 req->ifname);
-                    }
-                    continue;
-                }
+        virNWFilterSnoopIfaceAbort(iface);
+        virNWFilterSnoopIfaceFree(iface);
+    }
 
-                diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
-                if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
-                    /* rate-limited warnings */
-                    if (time(0) - last_displayed > 10) {
-                         last_displayed = time(0);
-                         VIR_WARN("Too many DHCP packets on interface '%s'",
-                                  req->ifname);
-                    }
-                    continue;
-                }
+    VIR_FREE(items);
+}
 
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Job submission failed on "
-                                     "interface '%s'"), req->ifname);
+/*
+ * The DHCP snooping thread. It waits for packets on the socket of the
+ * engine and if it gets suitable packets, it submits them to the worker
+ * thread of their interface for processing.  It ends once there are no
+ * more interfaces to snoop on.
+ */
+static void
+virNWFilterDHCPSnoopThread(void *opaque)
+{
+    virNWFilterSnoopEnginePtr engine = opaque;
+    unsigned char packet[PCAP_PBUFSIZE];
+    struct sockaddr_ll sll;
+    socklen_t slen;
+    struct pollfd fds[] = {
+        {
+            .fd = engine->fd,
+            .events = POLLIN,
+        },
+    };
+    time_t lastRun = 0;
+    ssize_t len;
+    size_t i;
+    int n;
+    bool error = false;
+
+    while (!error) {
+        n = poll(fds, ARRAY_CARDINALITY(fds), DHCP_SNOOP_POLL_MS);
+
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot poll packet socket"));
+                error = true;
+            }
+            continue;
+        }
+
+        if (time(0) != lastRun) {
+            lastRun = time(0);
+            if (!virNWFilterSnoopEngineRun(engine))
+                break;
+        }
+
+        for (i = 0; n > 0 && i < DHCP_PKT_BURST; i++) {
+            slen = sizeof(sll);
+            len = recvfrom(engine->fd, packet, sizeof(packet),
+                           MSG_DONTWAIT | MSG_TRUNC,
+                           (struct sockaddr *)&sll, &slen);
+            if (len < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    virReportSystemError(errno, "%s",
+                                         _("cannot read from packet socket"));
                     error = true;
-                    break;
                 }
+                break;
             }
-        } /* for all fds */
-    } /* while (!error) */
 
-    /* protect IfNameToKey */
-    virNWFilterSnoopLock();
+            virNWFilterSnoopEngineDispatch(engine, packet,
+                                           MIN(len, sizeof(packet)),
+                                           sll.sll_ifindex,
+                                           sll.sll_pkttype != PACKET_OUTGOING);
+        }
+    }
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    if (error)
+        virNWFilterSnoopEngineAbort(engine);
 
-    virNWFilterSnoopCancel(&req->threadkey);
+    virNWFilterSnoopEngineFree(engine);
 
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
-                                    req->ifname));
+    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+}
 
-    VIR_FREE(req->ifname);
+/*
+ * Start snooping on the interface of @req, starting the engine first if
+ * it isn't running.  The engine takes over the caller's reference to
+ * @req on success.
+ */
+static int
+virNWFilterSnoopEngineAddReq(virNWFilterSnoopReqPtr req)
+{
+    virNWFilterSnoopEnginePtr engine;
+    virNWFilterSnoopIfacePtr iface, old = NULL;
+    char key[INT_BUFSIZE_BOUND(req->ifindex)];
+    virThread thread;
+    size_t i;
+    int ret = -1;
 
-    virNWFilterSnoopReqUnlock(req);
-    virNWFilterSnoopUnlock();
+    if (VIR_ALLOC(iface) < 0 ||
+        VIR_STRDUP(iface->threadkey, req->threadkey) < 0)
+        goto cleanup;
 
-exit:
-    virThreadPoolFree(worker);
+    for (i = 0; i < ARRAY_CARDINALITY(iface->rateLimit); i++) {
+        iface->rateLimit[i].prev = time(0);
+        iface->rateLimit[i].rate = DHCP_PKT_RATE;
+        iface->rateLimit[i].burstRate = DHCP_PKT_BURST;
+        iface->rateLimit[i].burstInterval = DHCP_BURST_INTERVAL_S;
+    }
 
-    virNWFilterSnoopReqPut(req);
+    snprintf(key, sizeof(key), "%d", req->ifindex);
+
+    virMutexLock(&virNWFilterSnoopState.engineLock);
 
-    VIR_FREE(threadkey);
+    if (!(engine = virNWFilterSnoopState.engine)) {
+        if (!(engine = virNWFilterSnoopEngineNew()))
+            goto unlock;
 
-    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-        if (pcapConf[i].handle)
-            pcap_close(pcapConf[i].handle);
+        if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
+                            engine) != 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot create DHCP snooping thread"));
+            virNWFilterSnoopEngineFree(engine);
+            goto unlock;
+        }
+
+        virAtomicIntInc(&virNWFilterSnoopState.nThreads);
+        virNWFilterSnoopState.engine = engine;
     }
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+    /* an interface that is gone may have had the same index */
+    old = virHashSteal(engine->ifaces, key);
 
-    return;
+    if (virHashAddEntry(engine->ifaces, key, iface) < 0)
+        goto unlock;
+
+    iface->req = req;
+    if (virNWFilterSnoopEngineUpdate(engine) < 0) {
+        /* the caller keeps its reference */
+        iface->req = NULL;
+        ignore_value(virHashSteal(engine->ifaces, key));
+        goto unlock;
+    }
+
+    iface->worker = engine->workers[req->ifindex % DHCP_SNOOP_WORKERS];
+    iface = NULL;
+    ret = 0;
+
+unlock:
+    virMutexUnlock(&virNWFilterSnoopState.engineLock);
+
+cleanup:
+    virNWFilterSnoopIfaceFree(old);
+    virNWFilterSnoopIfaceFree(iface);
+
+    return ret;
 }
 
 static void
@@ -1591,7 +1890,6 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     bool isnewreq;
     char ifkey[VIR_IFKEY_LEN];
     int tmp;
-    virThread thread;
     virNWFilterVarValuePtr dhcpsrvrs;
 
     virNWFilterSnoopIFKeyFMT(ifkey, vmuuid, macaddr);
@@ -1675,19 +1973,9 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_rem_ifnametokey;
     }
 
-    /* prevent thread from holding req */
+    /* prevent the engine from holding req */
     virNWFilterSnoopReqLock(req);
 
-    if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
-                        req) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate "
-                         "failed on interface '%s'"), ifname);
-        goto exit_snoopreq_unlock;
-    }
-
-    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
-
     req->threadkey = virNWFilterSnoopActivate(req);
     if (!req->threadkey) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1703,16 +1991,21 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_snoop_cancel;
     }
 
-    /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0 ||
-        req->threadStatus != THREAD_STATUS_OK)
+    /* a recycled req may have failed on its previous interface */
+    req->jobCompletionStatus = 0;
+
+    if (virNWFilterSnoopEngineAddReq(req) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("DHCP snooping failed to start on "
+                         "interface '%s'"), req->ifname);
         goto exit_snoop_cancel;
+    }
 
     virNWFilterSnoopReqUnlock(req);
 
     virNWFilterSnoopUnlock();
 
-    /* do not 'put' the req -- the thread will do this */
+    /* do not 'put' the req -- the snooping engine will do this */
 
     return 0;
 
@@ -2073,7 +2366,8 @@ virNWFilterDHCPSnoopInit(void)
     VIR_DEBUG("Initializing DHCP snooping");
 
     if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0 ||
-        virMutexInit(&virNWFilterSnoopState.activeLock) < 0)
+        virMutexInit(&virNWFilterSnoopState.activeLock) < 0 ||
+        virMutexInit(&virNWFilterSnoopState.engineLock) < 0)
         return -1;
 
     virNWFilterSnoopState.ifnameToKey = virHashCreate(0, NULL);
@@ -40,6 +40,7 @@
 #include "nwfilter_driver.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_ebiptables_driverpriv.h"
 #include "virfile.h"
 #include "vircommand.h"
 #include "configmake.h"
@@ -84,7 +85,15 @@
 static char *ebtables_cmd_path;
 static char *iptables_cmd_path;
 static char *ip6tables_cmd_path;
+static char *iptables_restore_cmd_path;
+static char *ip6tables_restore_cmd_path;
 static char *grep_cmd_path;
+static bool ebtables_use_atomic_file;
+
+/* Since all scripts are serialized by execCLIMutex, one file is
+ * enough for ebtables to build the new nat table in */
+#define EBTABLES_ATOMIC_DIR LOCALSTATEDIR "/run/libvirt/nwfilter"
+#define EBTABLES_ATOMIC_FILE EBTABLES_ATOMIC_DIR "/ebtables-nat.atomic"
 
 /*
  * --ctdir original vs. --ctdir reply's meaning was inverted in netfilter
@@ -153,6 +162,29 @@ static const char ebiptables_script_func_rename_chains[] =
     "  done\n"
     "}\n";
 
+/* The queue_rule() script replaces $IPT while rules are batched: it
+ * writes its arguments as one line of iptables-restore input to file
+ * descriptor 3, quoting those that need it.  It runs in the subshell
+ * of the 'eval res=$(...)' that executes each rule, so the line cannot
+ * be kept in a variable.
+ */
+static const char iptables_script_func_queue_rule[] =
+    "queue_rule()\n"
+    "{\n"
+    "  sep=\n"
+    "  for tmp in \"$@\"; do\n"
+    "    case $tmp in\n"
+    "      ''|*[!A-Za-z0-9_.:/,!=+-]*)\n"
+    "        tmp=$(printf '%s' \"$tmp\" | sed 's/[\\\\\"]/\\\\&/g')\n"
+    "        printf '%s\"%s\"' \"$sep\" \"$tmp\" ;;\n"
+    "      *)\n"
+    "        printf '%s%s' \"$sep\" \"$tmp\" ;;\n"
+    "    esac\n"
+    "    sep=' '\n"
+    "  done >&3\n"
+    "  echo >&3\n"
+    "}\n";
+
 static const char ebiptables_script_set_ifs[] =
     "tmp='\n'\n"
     "IFS=' ''\t'$tmp\n";
@@ -161,6 +193,7 @@ static const char ebiptables_script_set_ifs[] =
 #define NWFILTER_FUNC_RM_CHAINS ebiptables_script_func_rm_chains
 #define NWFILTER_FUNC_RENAME_CHAINS ebiptables_script_func_rename_chains
 #define NWFILTER_FUNC_SET_IFS ebiptables_script_set_ifs
+#define NWFILTER_FUNC_QUEUE_RULE iptables_script_func_queue_rule
 
 #define NWFILTER_SET_EBTABLES_SHELLVAR(BUFPTR) \
     virBufferAsprintf(BUFPTR, "EBT=\"%s\"\n", ebtables_cmd_path);
@@ -968,6 +1001,72 @@ iptablesInstCommand(virBufferPtr buf,
 }
 
 
+/*
+ * Make the iptables commands following in @buf queue their rules for
+ * a single iptables-restore --noflush issued by iptablesCommitBatch,
+ * rather than run as one iptables process each that re-reads and
+ * re-commits the whole kernel table.  The queued commands must not
+ * stop on error since they do not execute anything.
+ */
+static void
+iptablesBeginBatch(virBufferPtr buf, const char *restore_cmd_path)
+{
+    virBufferAdd(buf, NWFILTER_FUNC_QUEUE_RULE, -1);
+    virBufferAsprintf(buf,
+                      "IPT=queue_rule\n"
+                      CMD_DEF("%s --noflush") CMD_SEPARATOR
+                      "res=$( {\n"
+                      "echo '*filter'\n",
+                      restore_cmd_path);
+}
+
+
+static void
+iptablesCommitBatch(virBufferPtr buf)
+{
+    virBufferAsprintf(buf,
+                      "echo COMMIT\n"
+                      "} 3>&1 | ${cmd} 2>&1)\n"
+                      "%s",
+                      CMD_STOPONERR(1));
+}
+
+
+static const char *
+iptablesRestoreCmdPath(enum RuleType ruleType)
+{
+    return (ruleType == RT_IP6TABLES) ? ip6tables_restore_cmd_path
+                                      : iptables_restore_cmd_path;
+}
+
+
+/*
+ * Add the commands instantiating all rules of type @ruleType to @buf,
+ * batched if iptables-restore is available.
+ */
+static void
+iptablesInstRules(virBufferPtr buf,
+                  ebiptablesRuleInstPtr *inst, int nruleInstances,
+                  enum RuleType ruleType)
+{
+    const char *restore_cmd_path = iptablesRestoreCmdPath(ruleType);
+    size_t i;
+
+    if (restore_cmd_path)
+        iptablesBeginBatch(buf, restore_cmd_path);
+
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ruleType == ruleType)
+            iptablesInstCommand(buf,
+                                inst[i]->commandTemplate,
+                                'A', -1, !restore_cmd_path);
+    }
+
+    if (restore_cmd_path)
+        iptablesCommitBatch(buf);
+}
+
+
 static int
 iptablesHandleSrcMacAddr(virBufferPtr buf,
                          virNWFilterVarCombIterPtr vars,
@@ -3208,6 +3307,565 @@ ebiptablesInstCommand(virBufferPtr buf,
 }
 
 
+/*
+ * Make the ebtables commands following in @buf work on a copy of the
+ * nat table saved to a file, so they no longer re-read and re-commit
+ * the kernel table each; ebtablesCommitAtomicFile then replaces the
+ * kernel table with the file in one go.
+ *
+ * Changes that anybody but libvirt makes to the nat table between the
+ * save and the commit are lost, so the file is only used if the nat
+ * table held nothing but libvirt's rules when the driver was started
+ * (see ebtablesNatHasForeignRules).
+ */
+static void
+ebtablesBeginAtomicFile(virBufferPtr buf)
+{
+    if (!ebtables_use_atomic_file)
+        return;
+
+    virBufferAsprintf(buf,
+                      "EBTABLES_ATOMIC_FILE=%s\n"
+                      "export EBTABLES_ATOMIC_FILE\n"
+                      CMD_DEF("$EBT -t nat --atomic-save") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s",
+                      EBTABLES_ATOMIC_FILE,
+                      CMD_STOPONERR(1));
+}
+
+
+static void
+ebtablesCommitAtomicFile(virBufferPtr buf)
+{
+    if (!ebtables_use_atomic_file)
+        return;
+
+    virBufferAsprintf(buf,
+                      CMD_DEF("$EBT -t nat --atomic-commit") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s"
+                      "unset EBTABLES_ATOMIC_FILE\n",
+                      CMD_STOPONERR(1));
+}
+
+
+/*
+ * The rules last applied to each interface are remembered, so that an
+ * update of a filter can be applied by deleting the rules that are gone
+ * from the live chains and inserting the new ones, rather than by
+ * building all chains of the interface anew and swapping them in.  This
+ * is only done while the new rules need the same chains as the old ones
+ * and every rule can be told apart from the others; otherwise the chains
+ * are rebuilt as before.
+ */
+typedef struct _ebiptablesLiveRule ebiptablesLiveRule;
+typedef ebiptablesLiveRule *ebiptablesLiveRulePtr;
+struct _ebiptablesLiveRule {
+    enum RuleType ruleType;
+    char *chain;            /* the live chain holding the rule */
+    char *commandTemplate;  /* the rule's template for the live chain */
+    bool jump;              /* jump into an ebtables protocol chain */
+};
+
+struct _ebiptablesRuleSet {
+    char *layout;                   /* the chains the rules are spread over */
+    size_t nrules;
+    ebiptablesLiveRulePtr rules;    /* in their order within each chain */
+};
+
+typedef struct _ebiptablesIfaceRules ebiptablesIfaceRules;
+typedef ebiptablesIfaceRules *ebiptablesIfaceRulesPtr;
+struct _ebiptablesIfaceRules {
+    ebiptablesRuleSetPtr live;      /* rules in the live chains */
+    ebiptablesRuleSetPtr pending;   /* rules of the last applyNewRules */
+    bool pendingInLiveChains;       /* pending was applied as a diff */
+};
+
+/* ifname -> ebiptablesIfaceRules; the entry of an interface is taken out
+ * of the table while it is worked on */
+static virHashTablePtr ifaceRules;
+static virMutex ifaceRulesLock;
+
+
+void
+ebiptablesRuleSetFree(ebiptablesRuleSetPtr set)
+{
+    size_t i;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < set->nrules; i++) {
+        VIR_FREE(set->rules[i].chain);
+        VIR_FREE(set->rules[i].commandTemplate);
+    }
+    VIR_FREE(set->rules);
+    VIR_FREE(set->layout);
+    VIR_FREE(set);
+}
+
+
+static void
+ebiptablesIfaceRulesFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    ebiptablesIfaceRulesPtr rules = payload;
+
+    if (!rules)
+        return;
+
+    ebiptablesRuleSetFree(rules->live);
+    ebiptablesRuleSetFree(rules->pending);
+    VIR_FREE(rules);
+}
+
+
+static ebiptablesIfaceRulesPtr
+ebiptablesIfaceRulesSteal(const char *ifname)
+{
+    ebiptablesIfaceRulesPtr rules = NULL;
+
+    if (!ifaceRules)
+        return NULL;
+
+    virMutexLock(&ifaceRulesLock);
+    rules = virHashSteal(ifaceRules, ifname);
+    virMutexUnlock(&ifaceRulesLock);
+
+    return rules;
+}
+
+
+/* Put back the entry taken by ebiptablesIfaceRulesSteal, or free it if
+ * nothing is known about the rules of the interface anymore */
+static void
+ebiptablesIfaceRulesPut(const char *ifname,
+                        ebiptablesIfaceRulesPtr rules)
+{
+    if (!rules)
+        return;
+
+    if (!ifaceRules || (!rules->live && !rules->pending)) {
+        ebiptablesIfaceRulesFree(rules, ifname);
+        return;
+    }
+
+    virMutexLock(&ifaceRulesLock);
+    if (virHashUpdateEntry(ifaceRules, ifname, rules) < 0) {
+        virResetLastError();
+        ebiptablesIfaceRulesFree(rules, ifname);
+    }
+    virMutexUnlock(&ifaceRulesLock);
+}
+
+
+static void
+ebiptablesIfaceRulesForget(const char *ifname)
+{
+    ebiptablesIfaceRulesFree(ebiptablesIfaceRulesSteal(ifname), ifname);
+}
+
+
+/*
+ * Add a rule with the template @templ, which is written for a temporary
+ * chain, to @set with the template rewritten for the live chain the
+ * temporary one is renamed to.
+ */
+static int
+ebiptablesRuleSetAdd(ebiptablesRuleSetPtr set,
+                     enum RuleType ruleType,
+                     const char *templ,
+                     bool jump)
+{
+    ebiptablesLiveRulePtr rule;
+    const char *cmd = NULL;
+    const char *tmp = templ;
+    const char *chain;
+    size_t offset, len;
+    char *prefix;
+
+    /* a comment of the rule is set before the command, and the jump
+     * into a protocol chain is preceded by the commands creating it */
+    while ((tmp = strstr(tmp, CMD_DEF_PRE)) != NULL) {
+        cmd = tmp;
+        tmp += strlen(CMD_DEF_PRE);
+    }
+    if (!cmd || !(chain = strstr(cmd, "-%c ")))
+        return -1;
+
+    chain += strlen("-%c ");
+    len = strcspn(chain, " ");
+
+    if (ruleType == RT_EBTABLES)
+        offset = STRPREFIX(chain, "libvirt-") ? strlen("libvirt-") : 0;
+    else
+        offset = 1;
+    if (offset >= len)
+        return -1;
+
+    if (VIR_EXPAND_N(set->rules, set->nrules, 1) < 0)
+        return -1;
+    rule = &set->rules[set->nrules - 1];
+
+    if (VIR_STRDUP(rule->commandTemplate, templ) < 0)
+        return -1;
+
+    prefix = rule->commandTemplate + (chain - templ) + offset;
+    switch (*prefix) {
+    case CHAINPREFIX_HOST_IN_TEMP:
+        *prefix = CHAINPREFIX_HOST_IN;
+        break;
+    case CHAINPREFIX_HOST_OUT_TEMP:
+        *prefix = CHAINPREFIX_HOST_OUT;
+        break;
+    default:
+        return -1;
+    }
+
+    if (VIR_STRNDUP(rule->chain,
+                    rule->commandTemplate + (chain - templ), len) < 0)
+        return -1;
+
+    rule->ruleType = ruleType;
+    rule->jump = jump;
+
+    return 0;
+}
+
+
+/*
+ * Record the rules ebiptablesApplyNewRules creates from @inst, sorted,
+ * and @ebtChains in the order they end up in their chains.
+ */
+ebiptablesRuleSetPtr
+ebiptablesRuleSetNew(ebiptablesRuleInstPtr *inst,
+                     int nruleInstances,
+                     ebiptablesRuleInstPtr ebtChains,
+                     int nEbtChains,
+                     bool haveChainsIn,
+                     bool haveChainsOut)
+{
+    ebiptablesRuleSetPtr set;
+    virBuffer layout = VIR_BUFFER_INITIALIZER;
+    bool haveIptables = false;
+    bool haveIp6tables = false;
+    size_t i, j;
+
+    if (VIR_ALLOC(set) < 0)
+        return NULL;
+
+    j = 0;
+    for (i = 0; i < nruleInstances; i++) {
+        switch (inst[i]->ruleType) {
+        case RT_EBTABLES:
+            while (j < nEbtChains &&
+                   ebtChains[j].priority <= inst[i]->priority) {
+                if (ebiptablesRuleSetAdd(set, RT_EBTABLES,
+                                         ebtChains[j++].commandTemplate,
+                                         true) < 0)
+                    goto error;
+            }
+            if (ebiptablesRuleSetAdd(set, RT_EBTABLES,
+                                     inst[i]->commandTemplate, false) < 0)
+                goto error;
+        break;
+        case RT_IPTABLES:
+            haveIptables = true;
+        break;
+        case RT_IP6TABLES:
+            haveIp6tables = true;
+        break;
+        }
+    }
+
+    while (j < nEbtChains) {
+        if (ebiptablesRuleSetAdd(set, RT_EBTABLES,
+                                 ebtChains[j++].commandTemplate, true) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ruleType == RT_IPTABLES &&
+            ebiptablesRuleSetAdd(set, RT_IPTABLES,
+                                 inst[i]->commandTemplate, false) < 0)
+            goto error;
+    }
+
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ruleType == RT_IP6TABLES &&
+            ebiptablesRuleSetAdd(set, RT_IP6TABLES,
+                                 inst[i]->commandTemplate, false) < 0)
+            goto error;
+    }
+
+    virBufferAsprintf(&layout, "in=%d out=%d iptables=%d ip6tables=%d\n",
+                      haveChainsIn, haveChainsOut,
+                      haveIptables, haveIp6tables);
+    for (j = 0; j < nEbtChains; j++)
+        virBufferAsprintf(&layout, "%s\n", ebtChains[j].commandTemplate);
+
+    if (virBufferError(&layout)) {
+        virReportOOMError();
+        goto error;
+    }
+
+    set->layout = virBufferContentAndReset(&layout);
+
+    return set;
+
+error:
+    virBufferFreeAndReset(&layout);
+    ebiptablesRuleSetFree(set);
+    return NULL;
+}
+
+
+/* Map the templates of the rules of type @ruleType in @set to the
+ * rules, failing if two of them are the same */
+static virHashTablePtr
+ebiptablesRuleSetIndex(ebiptablesRuleSetPtr set,
+                       enum RuleType ruleType)
+{
+    virHashTablePtr index;
+    size_t i;
+
+    if (!(index = virHashCreate(10, NULL)))
+        return NULL;
+
+    for (i = 0; i < set->nrules; i++) {
+        ebiptablesLiveRulePtr rule = &set->rules[i];
+
+        if (rule->ruleType != ruleType)
+            continue;
+
+        if (virHashLookup(index, rule->commandTemplate) ||
+            virHashAddEntry(index, rule->commandTemplate, rule) < 0) {
+            virHashFree(index);
+            return NULL;
+        }
+    }
+
+    return index;
+}
+
+
+static bool
+ebiptablesLiveRuleInChain(ebiptablesLiveRulePtr rule,
+                          enum RuleType ruleType,
+                          const char *chain)
+{
+    return rule->ruleType == ruleType && STREQ(rule->chain, chain);
+}
+
+
+/*
+ * Add a script to @buf that turns the rules of type @ruleType in the
+ * live chains from those of @from into those of @to: the rules that are
+ * gone are deleted and the new ones inserted at their position, all in
+ * one commit to the kernel.  The rules kept must be in the same order
+ * in both sets.
+ *
+ * Returns the number of rules to delete or insert, or -1 if the rules
+ * cannot be changed this way.
+ */
+int
+ebiptablesRuleSetDiff(virBufferPtr buf,
+                      ebiptablesRuleSetPtr from,
+                      ebiptablesRuleSetPtr to,
+                      enum RuleType ruleType)
+{
+    virBuffer cmds = VIR_BUFFER_INITIALIZER;
+    virHashTablePtr inFrom = NULL;
+    virHashTablePtr inTo = NULL;
+    const char *restore_cmd_path = NULL;
+    char *content = NULL;
+    bool stopOnError = ruleType == RT_EBTABLES;
+    int nchanges = 0;
+    int ret = -1;
+    size_t i, j, k;
+    int pos;
+
+    if (!(inFrom = ebiptablesRuleSetIndex(from, ruleType)) ||
+        !(inTo = ebiptablesRuleSetIndex(to, ruleType)))
+        goto cleanup;
+
+    for (i = 0; i < from->nrules; i++) {
+        ebiptablesLiveRulePtr rule = &from->rules[i];
+
+        if (rule->ruleType != ruleType ||
+            virHashLookup(inTo, rule->commandTemplate))
+            continue;
+
+        if (rule->jump)
+            goto cleanup;
+
+        ebiptablesInstCommand(&cmds, rule->commandTemplate,
+                              'D', -1, stopOnError);
+        nchanges++;
+    }
+
+    for (i = 0; i < to->nrules; i++) {
+        const char *chain = to->rules[i].chain;
+
+        if (to->rules[i].ruleType != ruleType)
+            continue;
+
+        /* handle each chain at its first rule */
+        for (j = 0; j < i; j++) {
+            if (ebiptablesLiveRuleInChain(&to->rules[j], ruleType, chain))
+                break;
+        }
+        if (j < i)
+            continue;
+
+        k = 0;
+        for (j = i; j < to->nrules; j++) {
+            ebiptablesLiveRulePtr rule = &to->rules[j];
+
+            if (!ebiptablesLiveRuleInChain(rule, ruleType, chain) ||
+                !virHashLookup(inFrom, rule->commandTemplate))
+                continue;
+
+            while (k < from->nrules &&
+                   (!ebiptablesLiveRuleInChain(&from->rules[k],
+                                               ruleType, chain) ||
+                    !virHashLookup(inTo, from->rules[k].commandTemplate)))
+                k++;
+
+            if (k == from->nrules ||
+                STRNEQ(from->rules[k].commandTemplate,
+                       rule->commandTemplate))
+                goto cleanup;
+            k++;
+        }
+
+        pos = 1;
+        for (j = i; j < to->nrules; j++) {
+            ebiptablesLiveRulePtr rule = &to->rules[j];
+
+            if (!ebiptablesLiveRuleInChain(rule, ruleType, chain))
+                continue;
+
+            if (!virHashLookup(inFrom, rule->commandTemplate)) {
+                if (rule->jump)
+                    goto cleanup;
+
+                ebiptablesInstCommand(&cmds, rule->commandTemplate,
+                                      'I', pos, stopOnError);
+                nchanges++;
+            }
+            pos++;
+        }
+    }
+
+    if (virBufferError(&cmds))
+        goto cleanup;
+
+    if (nchanges > 0) {
+        switch (ruleType) {
+        case RT_EBTABLES:
+            if (!ebtables_use_atomic_file)
+                goto cleanup;
+            NWFILTER_SET_EBTABLES_SHELLVAR(buf);
+            ebtablesBeginAtomicFile(buf);
+        break;
+        case RT_IPTABLES:
+        case RT_IP6TABLES:
+            if (!(restore_cmd_path = iptablesRestoreCmdPath(ruleType)))
+                goto cleanup;
+            if (ruleType == RT_IPTABLES) {
+                NWFILTER_SET_IPTABLES_SHELLVAR(buf);
+            } else {
+                NWFILTER_SET_IP6TABLES_SHELLVAR(buf);
+            }
+            iptablesBeginBatch(buf, restore_cmd_path);
+        break;
+        }
+
+        content = virBufferContentAndReset(&cmds);
+        virBufferAdd(buf, content, -1);
+
+        if (ruleType == RT_EBTABLES)
+            ebtablesCommitAtomicFile(buf);
+        else
+            iptablesCommitBatch(buf);
+    }
+
+    ret = nchanges;
+
+cleanup:
+    virBufferFreeAndReset(&cmds);
+    VIR_FREE(content);
+    virHashFree(inFrom);
+    virHashFree(inTo);
+    return ret;
+}
+
+
+/*
+ * Try to turn the rules in the live chains of @ifname from @from into
+ * @to, one tool after the other.  If a tool fails, the changes made
+ * with the tools before are taken back.
+ *
+ * Returns 1 if the live chains now hold @to, 0 otherwise.
+ */
+int
+ebiptablesApplyRuleSetDiff(const char *ifname,
+                           ebiptablesRuleSetPtr from,
+                           ebiptablesRuleSetPtr to)
+{
+    static const enum RuleType ruleTypes[] = {
+        RT_EBTABLES, RT_IPTABLES, RT_IP6TABLES,
+    };
+    virBuffer bufs[ARRAY_CARDINALITY(ruleTypes)] = {
+        VIR_BUFFER_INITIALIZER, VIR_BUFFER_INITIALIZER, VIR_BUFFER_INITIALIZER,
+    };
+    int nchanges[ARRAY_CARDINALITY(ruleTypes)];
+    char *errmsg = NULL;
+    int ret = 0;
+    size_t i, j;
+
+    if (STRNEQ(from->layout, to->layout))
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(ruleTypes); i++) {
+        if ((nchanges[i] = ebiptablesRuleSetDiff(&bufs[i], from, to,
+                                                 ruleTypes[i])) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(ruleTypes); i++) {
+        if (nchanges[i] == 0)
+            continue;
+
+        if (ebiptablesExecCLI(&bufs[i], NULL, &errmsg) < 0) {
+            VIR_WARN("Could not update the rules of interface %s in place, "
+                     "rebuilding them: %s", ifname, NULLSTR(errmsg));
+
+            for (j = 0; j < i; j++) {
+                if (nchanges[j] == 0)
+                    continue;
+                if (ebiptablesRuleSetDiff(&bufs[j], to, from,
+                                          ruleTypes[j]) < 0 ||
+                    ebiptablesExecCLI(&bufs[j], NULL, NULL) < 0)
+                    VIR_WARN("Could not restore the rules of "
+                             "interface %s", ifname);
+            }
+            virResetLastError();
+            goto cleanup;
+        }
+    }
+
+    ret = 1;
+
+cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(ruleTypes); i++)
+        virBufferFreeAndReset(&bufs[i]);
+    VIR_FREE(errmsg);
+    return ret;
+}
+
+
 /**
  * ebiptablesCanApplyBasicRules
  *
@@ -3542,6 +4200,8 @@ static int ebtablesCleanAll(const char *ifname)
     if (!ebtables_cmd_path)
         return 0;
 
+    ebiptablesIfaceRulesForget(ifname);
+
     NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
 
     ebtablesUnlinkRootChain(&buf, 1, ifname);
@@ -3704,6 +4364,7 @@ ebiptablesApplyNewRules(const char *ifname,
                         void **_inst)
 {
     size_t i, j;
+    int rc = -1;
     int cli_status;
     ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
@@ -3714,6 +4375,10 @@ ebiptablesApplyNewRules(const char *ifname,
     ebiptablesRuleInstPtr ebtChains = NULL;
     int nEbtChains = 0;
     char *errmsg = NULL;
+    virBuffer chainbuf = VIR_BUFFER_INITIALIZER;
+    ebiptablesIfaceRulesPtr ifRules = NULL;
+    ebiptablesRuleSetPtr newRules = NULL;
+    char *content = NULL;
 
     if (inst == NULL)
         nruleInstances = 0;
@@ -3743,26 +4408,16 @@ ebiptablesApplyNewRules(const char *ifname,
     }
 
 
-    /* cleanup whatever may exist */
-    if (ebtables_cmd_path) {
-        NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
-
-        ebtablesUnlinkTmpRootChain(&buf, 1, ifname);
-        ebtablesUnlinkTmpRootChain(&buf, 0, ifname);
-        ebtablesRemoveTmpSubChains(&buf, ifname);
-        ebtablesRemoveTmpRootChain(&buf, 1, ifname);
-        ebtablesRemoveTmpRootChain(&buf, 0, ifname);
-        ebiptablesExecCLI(&buf, &cli_status, NULL);
-    }
-
-    NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+    NWFILTER_SET_EBTABLES_SHELLVAR(&chainbuf);
 
     /* create needed chains */
     if ((virHashSize(chains_in_set) > 0 &&
-         ebtablesCreateTmpRootAndSubChains(&buf, ifname, chains_in_set, 1,
+         ebtablesCreateTmpRootAndSubChains(&chainbuf, ifname,
+                                           chains_in_set, 1,
                                            &ebtChains, &nEbtChains) < 0) ||
         (virHashSize(chains_out_set) > 0 &&
-         ebtablesCreateTmpRootAndSubChains(&buf, ifname, chains_out_set, 0,
+         ebtablesCreateTmpRootAndSubChains(&chainbuf, ifname,
+                                           chains_out_set, 0,
                                            &ebtChains, &nEbtChains) < 0)) {
         goto tear_down_tmpebchains;
     }
@@ -3771,10 +4426,59 @@ ebiptablesApplyNewRules(const char *ifname,
         qsort(&ebtChains[0], nEbtChains, sizeof(ebtChains[0]),
               ebiptablesRuleOrderSort);
 
+    /* if the new rules fit the live chains, just apply the difference */
+    ifRules = ebiptablesIfaceRulesSteal(ifname);
+    if (ifRules && ifRules->pending) {
+        if (ifRules->pendingInLiveChains) {
+            ebiptablesRuleSetFree(ifRules->live);
+            ifRules->live = ifRules->pending;
+        } else {
+            ebiptablesRuleSetFree(ifRules->pending);
+        }
+        ifRules->pending = NULL;
+        ifRules->pendingInLiveChains = false;
+    }
+
+    if (ifaceRules &&
+        !(newRules = ebiptablesRuleSetNew(inst, nruleInstances,
+                                          ebtChains, nEbtChains,
+                                          virHashSize(chains_in_set) > 0,
+                                          virHashSize(chains_out_set) > 0)))
+        virResetLastError();
+
+    if (ifRules && ifRules->live && newRules &&
+        ebiptablesApplyRuleSetDiff(ifname, ifRules->live, newRules) > 0) {
+        ifRules->pending = newRules;
+        ifRules->pendingInLiveChains = true;
+        newRules = NULL;
+        virBufferFreeAndReset(&chainbuf);
+        ebiptablesIfaceRulesPut(ifname, ifRules);
+        ifRules = NULL;
+        rc = 0;
+        goto exit_free_sets;
+    }
+
+    /* cleanup whatever may exist */
+    if (ebtables_cmd_path) {
+        NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+
+        ebtablesUnlinkTmpRootChain(&buf, 1, ifname);
+        ebtablesUnlinkTmpRootChain(&buf, 0, ifname);
+        ebtablesRemoveTmpSubChains(&buf, ifname);
+        ebtablesRemoveTmpRootChain(&buf, 1, ifname);
+        ebtablesRemoveTmpRootChain(&buf, 0, ifname);
+        ebiptablesExecCLI(&buf, &cli_status, NULL);
+    }
+
+    content = virBufferContentAndReset(&chainbuf);
+    virBufferAdd(&buf, content, -1);
+    VIR_FREE(content);
+
     if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
         goto tear_down_tmpebchains;
 
     NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+    ebtablesBeginAtomicFile(&buf);
 
     /* process ebtables commands; interleave commands from filters with
        commands for creating and connecting ebtables chains */
@@ -3807,6 +4511,8 @@ ebiptablesApplyNewRules(const char *ifname,
                               ebtChains[j++].commandTemplate,
                               'A', -1, 1);
 
+    ebtablesCommitAtomicFile(&buf);
+
     if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
         goto tear_down_tmpebchains;
 
@@ -3837,13 +4543,8 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
-        for (i = 0; i < nruleInstances; i++) {
-            sa_assert(inst);
-            if (inst[i]->ruleType == RT_IPTABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
-        }
+        sa_assert(inst);
+        iptablesInstRules(&buf, inst, nruleInstances, RT_IPTABLES);
 
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpiptchains;
@@ -3878,12 +4579,7 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
-        for (i = 0; i < nruleInstances; i++) {
-            if (inst[i]->ruleType == RT_IP6TABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
-        }
+        iptablesInstRules(&buf, inst, nruleInstances, RT_IP6TABLES);
 
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpip6tchains;
@@ -3901,16 +4597,19 @@ ebiptablesApplyNewRules(const char *ifname,
     if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
         goto tear_down_ebsubchains_and_unlink;
 
-    virHashFree(chains_in_set);
-    virHashFree(chains_out_set);
-
-    for (i = 0; i < nEbtChains; i++)
-        VIR_FREE(ebtChains[i].commandTemplate);
-    VIR_FREE(ebtChains);
-
-    VIR_FREE(errmsg);
+    /* the rules become live once tearOldRules swaps in the new chains */
+    if (newRules) {
+        if (!ifRules && VIR_ALLOC(ifRules) < 0) {
+            virResetLastError();
+        } else {
+            ifRules->pending = newRules;
+            ifRules->pendingInLiveChains = false;
+            newRules = NULL;
+        }
+    }
 
-    return 0;
+    rc = 0;
+    goto exit_free_sets;
 
 tear_down_ebsubchains_and_unlink:
     if (ebtables_cmd_path) {
@@ -3962,9 +4661,13 @@ exit_free_sets:
         VIR_FREE(ebtChains[i].commandTemplate);
     VIR_FREE(ebtChains);
 
+    virBufferFreeAndReset(&chainbuf);
+    ebiptablesRuleSetFree(newRules);
+    ebiptablesIfaceRulesPut(ifname, ifRules);
+
     VIR_FREE(errmsg);
 
-    return -1;
+    return rc;
 }
 
 
@@ -3973,6 +4676,29 @@ ebiptablesTearNewRules(const char *ifname)
 {
     int cli_status;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    ebiptablesIfaceRulesPtr ifRules = ebiptablesIfaceRulesSteal(ifname);
+
+    if (ifRules && ifRules->pending && ifRules->pendingInLiveChains) {
+        /* take back the difference applied to the live chains */
+        if (ebiptablesApplyRuleSetDiff(ifname, ifRules->pending,
+                                       ifRules->live) == 0) {
+            VIR_WARN("Could not restore the previous rules of "
+                     "interface %s", ifname);
+            ebiptablesRuleSetFree(ifRules->live);
+            ifRules->live = ifRules->pending;
+        } else {
+            ebiptablesRuleSetFree(ifRules->pending);
+        }
+        ifRules->pending = NULL;
+        ebiptablesIfaceRulesPut(ifname, ifRules);
+        return 0;
+    }
+
+    if (ifRules) {
+        ebiptablesRuleSetFree(ifRules->pending);
+        ifRules->pending = NULL;
+        ebiptablesIfaceRulesPut(ifname, ifRules);
+    }
 
     if (iptables_cmd_path) {
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
@@ -4010,6 +4736,23 @@ ebiptablesTearOldRules(const char *ifname)
 {
     int cli_status;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    ebiptablesIfaceRulesPtr ifRules = ebiptablesIfaceRulesSteal(ifname);
+    bool inLiveChains = false;
+
+    /* the live chains are replaced, so whatever was known of them is
+     * outdated unless the new rules were remembered */
+    if (ifRules) {
+        ebiptablesRuleSetFree(ifRules->live);
+        ifRules->live = ifRules->pending;
+        ifRules->pending = NULL;
+        inLiveChains = ifRules->pendingInLiveChains;
+        ifRules->pendingInLiveChains = false;
+        ebiptablesIfaceRulesPut(ifname, ifRules);
+    }
+
+    /* a difference was applied to the live chains directly */
+    if (inLiveChains)
+        return 0;
 
     /* switch to new iptables user defined chains */
     if (iptables_cmd_path) {
@@ -4064,7 +4807,7 @@ ebiptablesTearOldRules(const char *ifname)
  * commands failed.
  */
 static int
-ebiptablesRemoveRules(const char *ifname ATTRIBUTE_UNUSED,
+ebiptablesRemoveRules(const char *ifname,
                       int nruleInstances,
                       void **_inst)
 {
@@ -4074,6 +4817,8 @@ ebiptablesRemoveRules(const char *ifname ATTRIBUTE_UNUSED,
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
 
+    ebiptablesIfaceRulesForget(ifname);
+
     NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
 
     for (i = 0; i < nruleInstances; i++)
@@ -4112,6 +4857,8 @@ ebiptablesAllTeardown(const char *ifname)
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     int cli_status;
 
+    ebiptablesIfaceRulesForget(ifname);
+
     if (iptables_cmd_path) {
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
@@ -4243,9 +4990,91 @@ ebiptablesDriverInitCLITools(void)
     if (!ip6tables_cmd_path)
         VIR_WARN("Could not find 'ip6tables' executable");
 
+    /* firewalld's passthrough has no batch interface, so these are only
+     * used with the command line tools */
+    if (iptables_cmd_path)
+        iptables_restore_cmd_path = virFindFileInPath("iptables-restore");
+    if (ip6tables_cmd_path)
+        ip6tables_restore_cmd_path = virFindFileInPath("ip6tables-restore");
+
+    if (ebtables_cmd_path) {
+        if (virFileMakePathWithMode(EBTABLES_ATOMIC_DIR, 0700) < 0)
+            VIR_WARN("Could not create directory %s, ebtables rules will "
+                     "be committed one by one", EBTABLES_ATOMIC_DIR);
+        else
+            ebtables_use_atomic_file = true;
+    }
+
     return 0;
 }
 
+/*
+ * Use the given tools rather than those found in $PATH, along with
+ * the ebtables atomic file and iptables-restore as far as given.
+ */
+int
+ebiptablesDriverSetTools(const char *ebtables,
+                         const char *iptables,
+                         const char *iptablesRestore,
+                         const char *ip6tables,
+                         const char *ip6tablesRestore)
+{
+    VIR_FREE(ebtables_cmd_path);
+    VIR_FREE(iptables_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
+
+    if (VIR_STRDUP(ebtables_cmd_path, ebtables) < 0 ||
+        VIR_STRDUP(iptables_cmd_path, iptables) < 0 ||
+        VIR_STRDUP(iptables_restore_cmd_path, iptablesRestore) < 0 ||
+        VIR_STRDUP(ip6tables_cmd_path, ip6tables) < 0 ||
+        VIR_STRDUP(ip6tables_restore_cmd_path, ip6tablesRestore) < 0)
+        return -1;
+
+    ebtables_use_atomic_file = ebtables != NULL;
+
+    return 0;
+}
+
+/*
+ * Whether the listing of the ebtables nat table in @listing has chains
+ * or rules that were not created by libvirt.  libvirt only adds rules
+ * jumping to its root chains to the built-in chains, and names its own
+ * chains after one of the chain prefixes.
+ */
+static bool
+ebtablesNatHasForeignRules(const char *listing)
+{
+    char **lines;
+    bool builtin = false;
+    bool ret = false;
+    size_t i;
+
+    if (!(lines = virStringSplit(listing, "\n", 0)))
+        return true;
+
+    for (i = 0; lines[i] && !ret; i++) {
+        const char *line = lines[i];
+        const char *chain;
+
+        if ((chain = STRSKIP(line, "Bridge chain: "))) {
+            builtin = STRPREFIX(chain, "PREROUTING,") ||
+                      STRPREFIX(chain, "OUTPUT,") ||
+                      STRPREFIX(chain, "POSTROUTING,");
+            if (STRPREFIX(chain, "libvirt-"))
+                chain += strlen("libvirt-");
+            ret = !builtin &&
+                  !(chain[0] && strchr("IOJP", chain[0]) && chain[1] == '-');
+        } else if (builtin && line[0] == '-') {
+            ret = !strstr(line, "-j libvirt-");
+        }
+    }
+
+    virStringFreeList(lines);
+    return ret;
+}
+
 /*
  * ebiptablesDriverTestCLITools
  *
@@ -4261,11 +5090,12 @@ ebiptablesDriverTestCLITools(void)
 
     if (ebtables_cmd_path) {
         NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
-        /* basic probing */
+        /* basic probing, which also tells who uses the nat table */
         virBufferAsprintf(&buf,
                           CMD_DEF("$EBT -t nat -L") CMD_SEPARATOR
                           CMD_EXEC
-                          "%s",
+                          "%s"
+                          "echo \"${res}\"\n",
                           CMD_STOPONERR(1));
 
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0) {
@@ -4273,6 +5103,11 @@ ebiptablesDriverTestCLITools(void)
             VIR_ERROR(_("Testing of ebtables command failed: %s"),
                       errmsg);
             ret = -1;
+        } else if (ebtables_use_atomic_file &&
+                   errmsg && ebtablesNatHasForeignRules(errmsg)) {
+            VIR_INFO("ebtables nat table is shared with other users, "
+                     "rules will be committed one by one");
+            ebtables_use_atomic_file = false;
         }
     }
 
@@ -4393,6 +5228,12 @@ ebiptablesDriverInit(bool privileged)
     if (virMutexInit(&execCLIMutex) < 0)
         return -EINVAL;
 
+    if (virMutexInit(&ifaceRulesLock) < 0)
+        return -EINVAL;
+
+    if (!(ifaceRules = virHashCreate(10, ebiptablesIfaceRulesFree)))
+        return -ENOMEM;
+
     grep_cmd_path = virFindFileInPath("grep");
 
     /*
@@ -4439,5 +5280,10 @@ ebiptablesDriverShutdown(void)
     VIR_FREE(ebtables_cmd_path);
     VIR_FREE(iptables_cmd_path);
     VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
+    ebtables_use_atomic_file = false;
+    virHashFree(ifaceRules);
+    ifaceRules = NULL;
     ebiptables_driver.flags = 0;
 }
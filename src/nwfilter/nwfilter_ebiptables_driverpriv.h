@@ -0,0 +1,59 @@
+/*
+ * nwfilter_ebiptables_driverpriv.h: private declarations for the
+ *                                   ebtables/iptables driver
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __NWFILTER_EBIPTABLES_DRIVERPRIV_H__
+# define __NWFILTER_EBIPTABLES_DRIVERPRIV_H__
+
+# include "virbuffer.h"
+# include "nwfilter_conf.h"
+# include "nwfilter_ebiptables_driver.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+typedef struct _ebiptablesRuleSet ebiptablesRuleSet;
+typedef ebiptablesRuleSet *ebiptablesRuleSetPtr;
+
+int ebiptablesDriverSetTools(const char *ebtables,
+                             const char *iptables,
+                             const char *iptablesRestore,
+                             const char *ip6tables,
+                             const char *ip6tablesRestore);
+
+ebiptablesRuleSetPtr ebiptablesRuleSetNew(ebiptablesRuleInstPtr *inst,
+                                          int nruleInstances,
+                                          ebiptablesRuleInstPtr ebtChains,
+                                          int nEbtChains,
+                                          bool haveChainsIn,
+                                          bool haveChainsOut);
+void ebiptablesRuleSetFree(ebiptablesRuleSetPtr set);
+
+int ebiptablesRuleSetDiff(virBufferPtr buf,
+                          ebiptablesRuleSetPtr from,
+                          ebiptablesRuleSetPtr to,
+                          enum RuleType ruleType);
+int ebiptablesApplyRuleSetDiff(const char *ifname,
+                               ebiptablesRuleSetPtr from,
+                               ebiptablesRuleSetPtr to);
+
+#endif /* __NWFILTER_EBIPTABLES_DRIVERPRIV_H__ */
@@ -796,6 +796,10 @@ parallelsLoadDomain(parallelsConnPtr privconn, virJSONValuePtr jobj)
     if (parallelsAddVNCInfo(def, jobj) < 0)
         goto cleanup;
 
+    /* the list indexes running domains by the ID they are added with */
+    if (STREQ(state, "running"))
+        def->id = pdom->id;
+
     if (!(dom = virDomainObjListAdd(privconn->domains, def,
                                     privconn->xmlopt,
                                     0, NULL)))
@@ -807,11 +811,9 @@ parallelsLoadDomain(parallelsConnPtr privconn, virJSONValuePtr jobj)
     dom->persistent = 1;
 
     /* TODO: handle all possible states */
-    if (STREQ(state, "running")) {
+    if (STREQ(state, "running"))
         virDomainObjSetState(dom, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_BOOTED);
-        def->id = pdom->id;
-    }
 
     if (STREQ(autostart, "on"))
         dom->autostart = 1;
@@ -665,7 +665,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -680,7 +680,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering EOF callback");
@@ -691,7 +691,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering error callback");
@@ -804,7 +804,7 @@ void qemuAgentClose(qemuAgentPtr mon)
      * wake him up. No message will arrive anyway. */
     if (mon->msg && !mon->msg->finished) {
         mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
     }
     virObjectUnlock(mon);
 
@@ -839,14 +839,6 @@ static int qemuAgentSend(qemuAgentPtr mon,
     int ret = -1;
     unsigned long long then = 0;
 
-    /* Check whether qemu quit unexpectedly */
-    if (mon->lastError.code != VIR_ERR_OK) {
-        VIR_DEBUG("Attempt to send command while error is set %s",
-                  NULLSTR(mon->lastError.message));
-        virSetError(&mon->lastError);
-        return -1;
-    }
-
     if (seconds > VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) {
         unsigned long long now;
         if (virTimeMillisNow(&now) < 0)
@@ -856,6 +848,31 @@ static int qemuAgentSend(qemuAgentPtr mon,
         then = now + seconds * 1000ull;
     }
 
+    /* Query jobs may share the domain, so another thread can have a
+     * command in flight; the agent handles only one at a time */
+    while (mon->msg) {
+        if ((then && virCondWaitUntil(&mon->notify, &mon->parent.lock, then) < 0) ||
+            (!then && virCondWait(&mon->notify, &mon->parent.lock) < 0)) {
+            if (errno == ETIMEDOUT) {
+                virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                               _("Guest agent not available for now"));
+                return -2;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("Unable to wait on agent monitor "
+                                   "condition"));
+            return -1;
+        }
+    }
+
+    /* Check whether qemu quit unexpectedly */
+    if (mon->lastError.code != VIR_ERR_OK) {
+        VIR_DEBUG("Attempt to send command while error is set %s",
+                  NULLSTR(mon->lastError.message));
+        virSetError(&mon->lastError);
+        return -1;
+    }
+
     mon->msg = msg;
     qemuAgentUpdateWatch(mon);
 
@@ -887,6 +904,7 @@ static int qemuAgentSend(qemuAgentPtr mon,
 cleanup:
     mon->msg = NULL;
     qemuAgentUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1239,7 +1257,7 @@ void qemuAgentNotifyEvent(qemuAgentPtr mon,
         /* somebody waiting for this event, wake him up. */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     } else {
         /* shouldn't happen but one never knows */
@@ -38,6 +38,8 @@
 #include "virnodesuspend.h"
 #include "qemu_monitor.h"
 #include "virstring.h"
+#include "virxml.h"
+#include "sha256.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -252,6 +254,13 @@ struct _virQEMUCaps {
 
     char *binary;
     time_t mtime;
+    time_t ctime;
+
+    /* what else the probed capabilities depend on */
+    uid_t runUid;
+    gid_t runGid;
+    time_t kvmCtime;            /* 0 if there is no /dev/kvm */
+    bool kvmUsable;             /* runUid:runGid may use /dev/kvm */
 
     virBitmapPtr flags;
 
@@ -273,6 +282,7 @@ struct _virQEMUCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
     char *libDir;
+    char *cacheDir;
     char *runDir;
     uid_t runUid;
     gid_t runGid;
@@ -2709,15 +2719,385 @@ cleanup:
 }
 
 
+/*
+ * Probed capabilities are stored in @cacheDir, in a file named after
+ * the SHA-256 checksum of the binary path, so that the daemon does not
+ * need to run QEMU again on startup if neither the binary nor libvirt
+ * changed.
+ */
+static char *
+virQEMUCapsCacheFile(const char *cacheDir,
+                     const char *binary)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char buf[SHA256_DIGEST_SIZE];
+    char sum[(SHA256_DIGEST_SIZE * 2) + 1];
+    char *ret;
+    size_t i;
+
+    if (!(sha256_buffer(binary, strlen(binary), buf))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to compute sha256 checksum"));
+        return NULL;
+    }
+
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        sum[i * 2] = hex[(buf[i] >> 4) & 0xf];
+        sum[(i * 2) + 1] = hex[buf[i] & 0xf];
+    }
+    sum[SHA256_DIGEST_SIZE * 2] = '\0';
+
+    ignore_value(virAsprintf(&ret, "%s/capabilities/%s.xml", cacheDir, sum));
+    return ret;
+}
+
+
+/*
+ * Parsing a cache file such as
+ *
+ * <qemuCaps>
+ *   <emulator path='/usr/bin/qemu-system-x86_64'/>
+ *   <qemuctime>1234567890</qemuctime>
+ *   <qemumtime>1234567890</qemumtime>
+ *   <selfvers>1001004</selfvers>
+ *   <runUid>107</runUid>
+ *   <runGid>107</runGid>
+ *   <kvmctime>1234567890</kvmctime>
+ *   <kvmUsable/>
+ *   <usedQMP/>
+ *   <flag name='foo'/>
+ *   <flag name='bar'/>
+ *   ...
+ *   <version>1005003</version>
+ *   <kvmVersion>0</kvmVersion>
+ *   <arch>x86_64</arch>
+ *   <cpu name='pentium3'/>
+ *   ...
+ *   <machine name='pc-1.0' alias='pc' maxCpus='4'/>
+ *   ...
+ * </qemuCaps>
+ *
+ * Returns 1 if the capabilities were loaded, 0 if the file is missing
+ * or stale and -1 on error.
+ */
+static int
+virQEMUCapsLoadCache(virQEMUCapsPtr qemuCaps,
+                     const char *filename)
+{
+    xmlDocPtr doc = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr *nodes = NULL;
+    char *str = NULL;
+    unsigned long long qemuctime;
+    unsigned long long qemumtime;
+    unsigned long selfvers;
+    long long runUid;
+    long long runGid;
+    unsigned long long kvmctime;
+    bool kvmUsable;
+    int n;
+    size_t i;
+    int ret = -1;
+
+    if (!virFileExists(filename))
+        return 0;
+
+    if (!(doc = virXMLParseFileCtxt(filename, &ctxt)))
+        goto cleanup;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "qemuCaps")) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unexpected root element <%s>, expecting <qemuCaps>"),
+                       ctxt->node->name);
+        goto cleanup;
+    }
+
+    if (virXPathULongLong("string(./qemuctime)", ctxt, &qemuctime) < 0 ||
+        virXPathULongLong("string(./qemumtime)", ctxt, &qemumtime) < 0 ||
+        virXPathULong("string(./selfvers)", ctxt, &selfvers) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing timestamps in QEMU capabilities cache"));
+        goto cleanup;
+    }
+
+    /* caches written before these were recorded are just stale */
+    if (virXPathLongLong("string(./runUid)", ctxt, &runUid) < 0 ||
+        virXPathLongLong("string(./runGid)", ctxt, &runGid) < 0 ||
+        virXPathULongLong("string(./kvmctime)", ctxt, &kvmctime) < 0) {
+        VIR_DEBUG("Outdated capabilities cache '%s' for %s",
+                  filename, qemuCaps->binary);
+        ret = 0;
+        goto cleanup;
+    }
+    kvmUsable = virXPathBoolean("count(./kvmUsable) > 0", ctxt) > 0;
+
+    str = virXPathString("string(./emulator/@path)", ctxt);
+    if (!str || STRNEQ(str, qemuCaps->binary) ||
+        qemuctime != qemuCaps->ctime ||
+        qemumtime != qemuCaps->mtime ||
+        selfvers != LIBVIR_VERSION_NUMBER ||
+        runUid != (long long)qemuCaps->runUid ||
+        runGid != (long long)qemuCaps->runGid ||
+        kvmctime != qemuCaps->kvmCtime ||
+        kvmUsable != qemuCaps->kvmUsable) {
+        VIR_DEBUG("Outdated capabilities cache '%s' for %s",
+                  filename, qemuCaps->binary);
+        ret = 0;
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    qemuCaps->usedQMP = virXPathBoolean("count(./usedQMP) > 0", ctxt) > 0;
+
+    if ((n = virXPathNodeSet("./flag", ctxt, &nodes)) < 0)
+        goto cleanup;
+    for (i = 0; i < n; i++) {
+        int flag;
+
+        if (!(str = virXMLPropString(nodes[i], "name"))) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("missing flag name in QEMU capabilities cache"));
+            goto cleanup;
+        }
+        if ((flag = virQEMUCapsTypeFromString(str)) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown qemu capabilities flag %s"), str);
+            goto cleanup;
+        }
+        VIR_FREE(str);
+        virQEMUCapsSet(qemuCaps, flag);
+    }
+    VIR_FREE(nodes);
+
+    if (virXPathUInt("string(./version)", ctxt, &qemuCaps->version) < 0 ||
+        virXPathUInt("string(./kvmVersion)", ctxt, &qemuCaps->kvmVersion) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing version in QEMU capabilities cache"));
+        goto cleanup;
+    }
+
+    if (!(str = virXPathString("string(./arch)", ctxt)) ||
+        (qemuCaps->arch = virArchFromString(str)) == VIR_ARCH_NONE) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid arch '%s' in QEMU capabilities cache"),
+                       NULLSTR(str));
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if ((n = virXPathNodeSet("./cpu", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->cpuDefinitions, n) < 0)
+            goto cleanup;
+        for (i = 0; i < n; i++) {
+            if (!(qemuCaps->cpuDefinitions[i] =
+                  virXMLPropString(nodes[i], "name"))) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing CPU name in QEMU capabilities cache"));
+                goto cleanup;
+            }
+            qemuCaps->ncpuDefinitions++;
+        }
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./machine", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->machineTypes, n) < 0 ||
+            VIR_ALLOC_N(qemuCaps->machineAliases, n) < 0 ||
+            VIR_ALLOC_N(qemuCaps->machineMaxCpus, n) < 0)
+            goto cleanup;
+        for (i = 0; i < n; i++) {
+            qemuCaps->nmachineTypes++;
+            if (!(qemuCaps->machineTypes[i] =
+                  virXMLPropString(nodes[i], "name"))) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing machine name in QEMU capabilities cache"));
+                goto cleanup;
+            }
+            qemuCaps->machineAliases[i] = virXMLPropString(nodes[i], "alias");
+
+            str = virXMLPropString(nodes[i], "maxCpus");
+            if (str &&
+                virStrToLong_ui(str, NULL, 10,
+                                &qemuCaps->machineMaxCpus[i]) < 0) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("malformed machine cpu count in QEMU capabilities cache"));
+                goto cleanup;
+            }
+            VIR_FREE(str);
+        }
+    }
+
+    VIR_DEBUG("Loaded capabilities of %s from '%s'",
+              qemuCaps->binary, filename);
+    ret = 1;
+
+cleanup:
+    VIR_FREE(str);
+    VIR_FREE(nodes);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+    return ret;
+}
+
+
+static int
+virQEMUCapsSaveCache(virQEMUCapsPtr qemuCaps,
+                     const char *filename)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *xml = NULL;
+    char *dir = NULL;
+    char *tmp;
+    size_t i;
+    int ret = -1;
+
+    virBufferAddLit(&buf, "<qemuCaps>\n");
+    virBufferEscapeString(&buf, "  <emulator path='%s'/>\n",
+                          qemuCaps->binary);
+    virBufferAsprintf(&buf, "  <qemuctime>%llu</qemuctime>\n",
+                      (unsigned long long)qemuCaps->ctime);
+    virBufferAsprintf(&buf, "  <qemumtime>%llu</qemumtime>\n",
+                      (unsigned long long)qemuCaps->mtime);
+    virBufferAsprintf(&buf, "  <selfvers>%lu</selfvers>\n",
+                      (unsigned long)LIBVIR_VERSION_NUMBER);
+    virBufferAsprintf(&buf, "  <runUid>%lld</runUid>\n",
+                      (long long)qemuCaps->runUid);
+    virBufferAsprintf(&buf, "  <runGid>%lld</runGid>\n",
+                      (long long)qemuCaps->runGid);
+    virBufferAsprintf(&buf, "  <kvmctime>%llu</kvmctime>\n",
+                      (unsigned long long)qemuCaps->kvmCtime);
+    if (qemuCaps->kvmUsable)
+        virBufferAddLit(&buf, "  <kvmUsable/>\n");
+
+    if (qemuCaps->usedQMP)
+        virBufferAddLit(&buf, "  <usedQMP/>\n");
+
+    for (i = 0; i < QEMU_CAPS_LAST; i++) {
+        if (virQEMUCapsGet(qemuCaps, i)) {
+            virBufferAsprintf(&buf, "  <flag name='%s'/>\n",
+                              virQEMUCapsTypeToString(i));
+        }
+    }
+
+    virBufferAsprintf(&buf, "  <version>%u</version>\n",
+                      qemuCaps->version);
+    virBufferAsprintf(&buf, "  <kvmVersion>%u</kvmVersion>\n",
+                      qemuCaps->kvmVersion);
+    virBufferAsprintf(&buf, "  <arch>%s</arch>\n",
+                      virArchToString(qemuCaps->arch));
+
+    for (i = 0; i < qemuCaps->ncpuDefinitions; i++) {
+        virBufferEscapeString(&buf, "  <cpu name='%s'/>\n",
+                              qemuCaps->cpuDefinitions[i]);
+    }
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        virBufferEscapeString(&buf, "  <machine name='%s'",
+                              qemuCaps->machineTypes[i]);
+        virBufferEscapeString(&buf, " alias='%s'",
+                              qemuCaps->machineAliases[i]);
+        virBufferAsprintf(&buf, " maxCpus='%u'/>\n",
+                          qemuCaps->machineMaxCpus[i]);
+    }
+
+    virBufferAddLit(&buf, "</qemuCaps>\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        goto cleanup;
+    }
+    xml = virBufferContentAndReset(&buf);
+
+    if (VIR_STRDUP(dir, filename) < 0)
+        goto cleanup;
+    if ((tmp = strrchr(dir, '/')))
+        *tmp = '\0';
+    if (virFileMakePath(dir) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot create directory '%s'"), dir);
+        goto cleanup;
+    }
+
+    if (virXMLSaveFile(filename, NULL, NULL, xml) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Saved capabilities of %s to '%s'",
+              qemuCaps->binary, filename);
+    ret = 0;
+
+cleanup:
+    VIR_FREE(dir);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/* Whether /dev/kvm exists, as told by its ctime being non-zero, and
+ * whether runUid:runGid may use it.  Changing the owner or mode of
+ * /dev/kvm changes its ctime, but adding runUid to the group owning
+ * it does not. */
+static void
+virQEMUCapsProbeKVMDevice(uid_t runUid,
+                          gid_t runGid,
+                          time_t *kvmCtime,
+                          bool *kvmUsable)
+{
+    struct stat sb;
+
+    *kvmCtime = 0;
+    *kvmUsable = false;
+
+    if (stat("/dev/kvm", &sb) < 0)
+        return;
+
+    *kvmCtime = sb.st_ctime;
+    *kvmUsable =
+        virFileAccessibleAs("/dev/kvm", R_OK | W_OK,
+                            runUid == (uid_t)-1 ? geteuid() : runUid,
+                            runGid == (gid_t)-1 ? getegid() : runGid) == 0;
+}
+
+
+/* Record what the capabilities of a binary whose status is @sb depend
+ * on; a cache file is only used if all of it still matches */
+static void
+virQEMUCapsInitCacheKey(virQEMUCapsPtr qemuCaps,
+                        struct stat *sb,
+                        uid_t runUid,
+                        gid_t runGid,
+                        time_t kvmCtime,
+                        bool kvmUsable)
+{
+    qemuCaps->mtime = sb->st_mtime;
+    qemuCaps->ctime = sb->st_ctime;
+    qemuCaps->runUid = runUid;
+    qemuCaps->runGid = runGid;
+    qemuCaps->kvmCtime = kvmCtime;
+    qemuCaps->kvmUsable = kvmUsable;
+}
+
+
 virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
                                        const char *libDir,
+                                       const char *cacheDir,
                                        uid_t runUid,
                                        gid_t runGid)
 {
     virQEMUCapsPtr qemuCaps = virQEMUCapsNew();
+    char *cacheFile = NULL;
     struct stat sb;
+    time_t kvmCtime;
+    bool kvmUsable;
     int rv;
 
+    if (!qemuCaps)
+        return NULL;
+
     if (VIR_STRDUP(qemuCaps->binary, binary) < 0)
         goto error;
 
@@ -2728,7 +3108,9 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
                              binary);
         goto error;
     }
-    qemuCaps->mtime = sb.st_mtime;
+    virQEMUCapsProbeKVMDevice(runUid, runGid, &kvmCtime, &kvmUsable);
+    virQEMUCapsInitCacheKey(qemuCaps, &sb, runUid, runGid,
+                            kvmCtime, kvmUsable);
 
     /* Make sure the binary we are about to try exec'ing exists.
      * Technically we could catch the exec() failure, but that's
@@ -2740,6 +3122,30 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
         goto error;
     }
 
+    if (cacheDir) {
+        if (!(cacheFile = virQEMUCapsCacheFile(cacheDir, binary)))
+            goto error;
+
+        if ((rv = virQEMUCapsLoadCache(qemuCaps, cacheFile)) > 0)
+            goto cleanup;
+
+        if (rv < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Failed to load capabilities cache '%s' for %s: %s",
+                     cacheFile, binary,
+                     err ? err->message : _("unknown error"));
+            virResetLastError();
+        }
+
+        /* Start from scratch if the cache was partially loaded */
+        virObjectUnref(qemuCaps);
+        if (!(qemuCaps = virQEMUCapsNew()) ||
+            VIR_STRDUP(qemuCaps->binary, binary) < 0)
+            goto error;
+        virQEMUCapsInitCacheKey(qemuCaps, &sb, runUid, runGid,
+                                kvmCtime, kvmUsable);
+    }
+
     if ((rv = virQEMUCapsInitQMP(qemuCaps, libDir, runUid, runGid)) < 0)
         goto error;
 
@@ -2747,9 +3153,22 @@ virQEMUCapsPtr virQEMUCapsNewForBinary(const char *binary,
         virQEMUCapsInitHelp(qemuCaps, runUid, runGid) < 0)
         goto error;
 
+    /* Failing to save the cache only costs probing again next time */
+    if (cacheFile &&
+        virQEMUCapsSaveCache(qemuCaps, cacheFile) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Failed to save capabilities cache '%s' for %s: %s",
+                 cacheFile, binary,
+                 err ? err->message : _("unknown error"));
+        virResetLastError();
+    }
+
+cleanup:
+    VIR_FREE(cacheFile);
     return qemuCaps;
 
 error:
+    VIR_FREE(cacheFile);
     virObjectUnref(qemuCaps);
     qemuCaps = NULL;
     return NULL;
@@ -2766,7 +3185,15 @@ bool virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps)
     if (stat(qemuCaps->binary, &sb) < 0)
         return false;
 
-    return sb.st_mtime == qemuCaps->mtime;
+    if (sb.st_mtime != qemuCaps->mtime ||
+        sb.st_ctime != qemuCaps->ctime)
+        return false;
+
+    /* e.g. the kvm module was loaded after probing */
+    if (stat("/dev/kvm", &sb) < 0)
+        sb.st_ctime = 0;
+
+    return sb.st_ctime == qemuCaps->kvmCtime;
 }
 
 
@@ -2779,6 +3206,7 @@ virQEMUCapsHashDataFree(void *payload, const void *key ATTRIBUTE_UNUSED)
 
 virQEMUCapsCachePtr
 virQEMUCapsCacheNew(const char *libDir,
+                    const char *cacheDir,
                     uid_t runUid,
                     gid_t runGid)
 {
@@ -2796,7 +3224,8 @@ virQEMUCapsCacheNew(const char *libDir,
 
     if (!(cache->binaries = virHashCreate(10, virQEMUCapsHashDataFree)))
         goto error;
-    if (VIR_STRDUP(cache->libDir, libDir) < 0)
+    if (VIR_STRDUP(cache->libDir, libDir) < 0 ||
+        VIR_STRDUP(cache->cacheDir, cacheDir) < 0)
         goto error;
 
     cache->runUid = runUid;
@@ -2827,6 +3256,7 @@ virQEMUCapsCacheLookup(virQEMUCapsCachePtr cache, const char *binary)
         VIR_DEBUG("Creating capabilities for %s",
                   binary);
         ret = virQEMUCapsNewForBinary(binary, cache->libDir,
+                                      cache->cacheDir,
                                       cache->runUid, cache->runGid);
         if (ret) {
             VIR_DEBUG("Caching capabilities %p for %s",
@@ -2866,6 +3296,7 @@ virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
         return;
 
     VIR_FREE(cache->libDir);
+    VIR_FREE(cache->cacheDir);
     virHashFree(cache->binaries);
     virMutexDestroy(&cache->lock);
     VIR_FREE(cache);
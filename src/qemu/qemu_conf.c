@@ -250,6 +250,9 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->startupWorkers = 8;
+    cfg->autoStartWorkers = 4;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
@@ -268,6 +271,7 @@ static void virQEMUDriverConfigDispose(void *obj)
 
 
     virStringFreeList(cfg->cgroupDeviceACL);
+    virStringFreeList(cfg->autoStartOrder);
 
     VIR_FREE(cfg->configBaseDir);
     VIR_FREE(cfg->configDir);
@@ -547,10 +551,47 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_STR("save_image_format", cfg->saveImageFormat);
     GET_VALUE_STR("dump_image_format", cfg->dumpImageFormat);
     GET_VALUE_STR("snapshot_image_format", cfg->snapshotImageFormat);
+    GET_VALUE_LONG("image_compression_threads", cfg->imageCompressionThreads);
+    if (cfg->imageCompressionThreads < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: image_compression_threads: must not be negative"),
+                       filename);
+        goto cleanup;
+    }
 
     GET_VALUE_STR("auto_dump_path", cfg->autoDumpPath);
     GET_VALUE_BOOL("auto_dump_bypass_cache", cfg->autoDumpBypassCache);
     GET_VALUE_BOOL("auto_start_bypass_cache", cfg->autoStartBypassCache);
+    GET_VALUE_LONG("auto_start_workers", cfg->autoStartWorkers);
+    if (cfg->autoStartWorkers < 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: auto_start_workers: must be at least 1"),
+                       filename);
+        goto cleanup;
+    }
+
+    p = virConfGetValue(conf, "auto_start_order");
+    CHECK_TYPE("auto_start_order", VIR_CONF_LIST);
+    if (p) {
+        int len = 0;
+        virConfValuePtr pp;
+        for (pp = p->list; pp; pp = pp->next)
+            len++;
+        if (VIR_ALLOC_N(cfg->autoStartOrder, 1+len) < 0)
+            goto cleanup;
+
+        for (i = 0, pp = p->list; pp; ++i, pp = pp->next) {
+            if (pp->type != VIR_CONF_STRING) {
+                virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                               _("auto_start_order must be a "
+                                 "list of strings"));
+                goto cleanup;
+            }
+            if (VIR_STRDUP(cfg->autoStartOrder[i], pp->str) < 0)
+                goto cleanup;
+        }
+        cfg->autoStartOrder[i] = NULL;
+    }
 
     GET_VALUE_STR("hugetlbfs_mount", cfg->hugetlbfsMount);
     GET_VALUE_STR("bridge_helper", cfg->bridgeHelperName);
@@ -568,6 +609,24 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
 
     GET_VALUE_LONG("max_queued", cfg->maxQueuedJobs);
 
+    GET_VALUE_LONG("startup_workers", cfg->startupWorkers);
+    if (cfg->startupWorkers < 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: startup_workers: must be at least 1"),
+                       filename);
+        goto cleanup;
+    }
+
+    GET_VALUE_LONG("stats_max_age", cfg->statsMaxAge);
+    if (cfg->statsMaxAge < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: stats_max_age: must not be negative"),
+                       filename);
+        goto cleanup;
+    }
+
+    GET_VALUE_BOOL("monitor_stream_parser", cfg->monitorStreamParser);
+
     GET_VALUE_LONG("keepalive_interval", cfg->keepAliveInterval);
     GET_VALUE_LONG("keepalive_count", cfg->keepAliveCount);
 
@@ -140,6 +140,12 @@ struct _virQEMUDriverConfig {
 
     int maxQueuedJobs;
 
+    int startupWorkers;
+
+    int statsMaxAge;
+
+    bool monitorStreamParser;
+
     char **securityDriverNames;
     bool securityDefaultConfined;
     bool securityRequireConfined;
@@ -147,10 +153,13 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    int imageCompressionThreads;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    int autoStartWorkers;
+    char **autoStartOrder;
 
     char *lockManagerName;
 
@@ -176,6 +185,9 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr reconnectPool;
+
     /* Atomic increment only */
     int nextvmid;
 
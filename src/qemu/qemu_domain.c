@@ -147,6 +147,7 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
 
     job->active = QEMU_JOB_NONE;
     job->owner = 0;
+    job->queries = 0;
 }
 
 static void
@@ -161,6 +162,7 @@ qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
     job->start = 0;
     job->dump_memory_only = false;
     job->asyncAbort = false;
+    job->compressor = NULL;
     memset(&job->status, 0, sizeof(job->status));
     memset(&job->info, 0, sizeof(job->info));
 }
@@ -672,12 +674,52 @@ qemuDomainDefNamespaceHref(void)
     return "xmlns:qemu='" QEMU_NAMESPACE_HREF "'";
 }
 
+static void *
+qemuDomainDefNamespaceCopy(void *nsdata)
+{
+    qemuDomainCmdlineDefPtr src = nsdata;
+    qemuDomainCmdlineDefPtr cmd = NULL;
+    size_t i;
+
+    if (VIR_ALLOC(cmd) < 0)
+        return NULL;
+
+    if (src->num_args &&
+        VIR_ALLOC_N(cmd->args, src->num_args) < 0)
+        goto error;
+
+    for (i = 0; i < src->num_args; i++) {
+        if (VIR_STRDUP(cmd->args[i], src->args[i]) < 0)
+            goto error;
+        cmd->num_args++;
+    }
+
+    if (src->num_env &&
+        (VIR_ALLOC_N(cmd->env_name, src->num_env) < 0 ||
+         VIR_ALLOC_N(cmd->env_value, src->num_env) < 0))
+        goto error;
+
+    for (i = 0; i < src->num_env; i++) {
+        cmd->num_env++;
+        if (VIR_STRDUP(cmd->env_name[i], src->env_name[i]) < 0 ||
+            VIR_STRDUP(cmd->env_value[i], src->env_value[i]) < 0)
+            goto error;
+    }
+
+    return cmd;
+
+error:
+    qemuDomainCmdlineDefFree(cmd);
+    return NULL;
+}
+
 
 virDomainXMLNamespace virQEMUDriverDomainXMLNamespace = {
     .parse = qemuDomainDefNamespaceParse,
     .free = qemuDomainDefNamespaceFree,
     .format = qemuDomainDefNamespaceFormatXML,
     .href = qemuDomainDefNamespaceHref,
+    .copy = qemuDomainDefNamespaceCopy,
 };
 
 
@@ -993,10 +1035,27 @@ qemuDomainNestedJobAllowed(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
     return !priv->job.asyncJob || (priv->job.mask & JOB_MASK(job)) != 0;
 }
 
+/*
+ * Query jobs only read the domain state, so any number of them may run
+ * together.  Every other job is exclusive.  Once an exclusive job is
+ * waiting, new queries queue up behind it so that a steady stream of
+ * readers cannot starve it.
+ */
+static bool
+qemuDomainJobBusy(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
+{
+    if (job == QEMU_JOB_QUERY)
+        return priv->job.waiters ||
+               (priv->job.active && priv->job.active != QEMU_JOB_QUERY);
+
+    return priv->job.active != QEMU_JOB_NONE;
+}
+
 bool
 qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
 {
-    return !priv->job.active && qemuDomainNestedJobAllowed(priv, job);
+    return !qemuDomainJobBusy(priv, job) &&
+           qemuDomainNestedJobAllowed(priv, job);
 }
 
 /* Give up waiting for mutex after 30 seconds */
@@ -1015,6 +1074,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     unsigned long long now;
     unsigned long long then;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
+    bool shared = job == QEMU_JOB_QUERY;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Starting %s: %s (async=%s vm=%p name=%s)",
@@ -1046,17 +1106,34 @@ retry:
             goto error;
     }
 
-    while (priv->job.active) {
+    if (!shared)
+        priv->job.waiters++;
+    while (qemuDomainJobBusy(priv, job)) {
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
+        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0) {
+            if (!shared)
+                priv->job.waiters--;
             goto error;
+        }
     }
+    if (!shared)
+        priv->job.waiters--;
 
     /* No job is active but a new async job could have been started while obj
      * was unlocked, so we need to recheck it. */
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
+    if (shared && priv->job.active == QEMU_JOB_QUERY) {
+        priv->job.queries++;
+        VIR_DEBUG("Joined job: %s (queries=%u async=%s vm=%p name=%s)",
+                  qemuDomainJobTypeToString(job), priv->job.queries,
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  obj, obj->def->name);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
     qemuDomainObjResetJob(priv);
 
     if (job != QEMU_JOB_ASYNC) {
@@ -1066,6 +1143,8 @@ retry:
                   obj, obj->def->name);
         priv->job.active = job;
         priv->job.owner = virThreadSelfID();
+        if (shared)
+            priv->job.queries = 1;
     } else {
         VIR_DEBUG("Started async job: %s (vm=%p name=%s)",
                   qemuDomainAsyncJobTypeToString(asyncJob),
@@ -1179,10 +1258,15 @@ bool qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    /* The last of the queries sharing the job releases it */
+    if (job == QEMU_JOB_QUERY && --priv->job.queries > 0)
+        return virObjectUnref(obj);
+
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* Several queries may be waiting and all of them can start now */
+    virCondBroadcast(&priv->job.cond);
 
     return virObjectUnref(obj);
 }
@@ -1252,7 +1336,8 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
               priv->mon, obj, obj->def->name);
     virObjectLock(priv->mon);
     virObjectRef(priv->mon);
-    ignore_value(virTimeMillisNow(&priv->monStart));
+    if (priv->monUsers++ == 0)
+        ignore_value(virTimeMillisNow(&priv->monStart));
     virObjectUnlock(obj);
 
     return 0;
@@ -1274,14 +1359,15 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
     VIR_DEBUG("Exited monitor (mon=%p vm=%p name=%s)",
               priv->mon, obj, obj->def->name);
 
-    priv->monStart = 0;
+    if (--priv->monUsers == 0)
+        priv->monStart = 0;
     if (!hasRefs)
         priv->mon = NULL;
 
     if (priv->job.active == QEMU_JOB_ASYNC_NESTED) {
         qemuDomainObjResetJob(priv);
         qemuDomainObjSaveJob(driver, obj);
-        virCondSignal(&priv->job.cond);
+        virCondBroadcast(&priv->job.cond);
 
         virObjectUnref(obj);
     }
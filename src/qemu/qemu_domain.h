@@ -33,6 +33,7 @@
 # include "qemu_conf.h"
 # include "qemu_capabilities.h"
 # include "virchrdev.h"
+# include "vircompress.h"
 
 # define QEMU_EXPECTED_VIRT_TYPES      \
     ((1 << VIR_DOMAIN_VIRT_QEMU) |     \
@@ -103,6 +104,10 @@ struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     enum qemuDomainJob active;          /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
+    unsigned int queries;               /* Number of QEMU_JOB_QUERY jobs
+                                           sharing the active job */
+    unsigned int waiters;               /* Exclusive jobs waiting for the
+                                           current job to finish */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     enum qemuDomainAsyncJob asyncJob;   /* Currently active async job */
@@ -114,6 +119,7 @@ struct qemuDomainJobObj {
     qemuMonitorMigrationStatus status;  /* Raw async job progress data */
     virDomainJobInfo info;              /* Processed async job progress data */
     bool asyncAbort;                    /* abort of async job requested */
+    virCompressorPtr compressor;        /* built-in image compression */
 };
 
 typedef struct _qemuDomainPCIAddressSet qemuDomainPCIAddressSet;
@@ -133,7 +139,10 @@ struct _qemuDomainObjPrivate {
     virDomainChrSourceDefPtr monConfig;
     bool monJSON;
     bool monError;
+    /* Query jobs share the monitor; monStart is when it was last
+     * entered while no other thread was using it */
     unsigned long long monStart;
+    unsigned int monUsers;
 
     qemuAgentPtr agent;
     bool agentError;
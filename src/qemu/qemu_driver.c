@@ -62,6 +62,7 @@
 #include "datatypes.h"
 #include "virbuffer.h"
 #include "nodeinfo.h"
+#include "virstatcache.h"
 #include "virstatslinux.h"
 #include "capabilities.h"
 #include "viralloc.h"
@@ -92,6 +93,7 @@
 #include "virtypedparam.h"
 #include "virbitmap.h"
 #include "virstring.h"
+#include "viratomic.h"
 #include "viraccessapicheck.h"
 #include "viraccessapicheckqemu.h"
 
@@ -190,9 +192,27 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 };
 
 
+/* One domain to be started by qemuAutostartDomains */
+typedef struct _qemuAutostartJob qemuAutostartJob;
+typedef qemuAutostartJob *qemuAutostartJobPtr;
+struct _qemuAutostartJob {
+    virDomainObjPtr vm;
+    char *name;
+    bool ordered;           /* listed in auto_start_order */
+    int result;             /* -1 failed, 0 skipped, 1 started */
+    unsigned long long elapsed;
+};
+
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    qemuAutostartJobPtr jobs;
+    size_t njobs;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;         /* jobs queued to the pool, protected by lock */
 };
 
 
@@ -259,15 +279,19 @@ qemuSnapObjFromSnapshot(virDomainObjPtr vm,
     return qemuSnapObjFromName(vm, snapshot->name);
 }
 
+/*
+ * Start @vm if it is still marked for autostart and not running.
+ * Returns 1 if the domain was started, 0 if there was nothing to
+ * do and -1 on failure.
+ */
 static int
 qemuAutostartDomain(virDomainObjPtr vm,
-                    void *opaque)
+                    struct qemuAutostartData *data)
 {
-    struct qemuAutostartData *data = opaque;
     virErrorPtr err;
     int flags = 0;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(data->driver);
-    int ret = -1;
+    int ret = 0;
 
     if (cfg->autoStartBypassCache)
         flags |= VIR_DOMAIN_START_BYPASS_CACHE;
@@ -276,6 +300,7 @@ qemuAutostartDomain(virDomainObjPtr vm,
     virResetLastError();
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
+        ret = -1;
         if (qemuDomainObjBeginJob(data->driver, vm,
                                   QEMU_JOB_MODIFY) < 0) {
             err = virGetLastError();
@@ -290,13 +315,14 @@ qemuAutostartDomain(virDomainObjPtr vm,
             VIR_ERROR(_("Failed to autostart VM '%s': %s"),
                       vm->def->name,
                       err ? err->message : _("unknown error"));
+        } else {
+            ret = 1;
         }
 
         if (!qemuDomainObjEndJob(data->driver, vm))
             vm = NULL;
     }
 
-    ret = 0;
 cleanup:
     if (vm)
         virObjectUnlock(vm);
@@ -305,6 +331,66 @@ cleanup:
 }
 
 
+static void
+qemuAutostartRunJob(struct qemuAutostartData *data,
+                    qemuAutostartJobPtr job)
+{
+    unsigned long long start = 0;
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMillisNow(&start));
+    job->result = qemuAutostartDomain(job->vm, data);
+    ignore_value(virTimeMillisNow(&now));
+    if (start && now > start)
+        job->elapsed = now - start;
+}
+
+
+static void
+qemuAutostartWorker(void *jobdata,
+                    void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+
+    qemuAutostartRunJob(data, jobdata);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static int
+qemuAutostartCollect(virDomainObjPtr vm,
+                     void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+    int ret = 0;
+
+    virObjectLock(vm);
+    if (vm->autostart && !virDomainObjIsActive(vm)) {
+        if (VIR_EXPAND_N(data->jobs, data->njobs, 1) < 0) {
+            ret = -1;
+        } else if (VIR_STRDUP(data->jobs[data->njobs - 1].name,
+                              vm->def->name) < 0) {
+            data->njobs--;
+            ret = -1;
+        } else {
+            data->jobs[data->njobs - 1].vm = virObjectRef(vm);
+        }
+    }
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+/*
+ * Start the autostart domains.  Those listed in auto_start_order are
+ * started first, one after the other and in that order, then all the
+ * others are started by up to auto_start_workers threads.  Returns
+ * once every domain has been dealt with.
+ */
 static void
 qemuAutostartDomains(virQEMUDriverPtr driver)
 {
@@ -317,9 +403,106 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
     virConnectPtr conn = virConnectOpen(cfg->uri);
     /* Ignoring NULL conn which is mostly harmless here */
     struct qemuAutostartData data = { driver, conn };
+    virThreadPoolPtr pool = NULL;
+    unsigned long long start = 0;
+    unsigned long long now = 0;
+    size_t nstarted = 0;
+    size_t nfailed = 0;
+    size_t workers;
+    char **name;
+    size_t i;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&data.lock);
+        goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&start));
+
+    if (virDomainObjListForEach(driver->domains,
+                                qemuAutostartCollect, &data) < 0)
+        VIR_WARN("Some domains may not be autostarted");
+
+    for (name = cfg->autoStartOrder; name && *name; name++) {
+        for (i = 0; i < data.njobs; i++) {
+            qemuAutostartJobPtr job = &data.jobs[i];
+
+            if (job->ordered || STRNEQ(job->name, *name))
+                continue;
+
+            job->ordered = true;
+            qemuAutostartRunJob(&data, job);
+            break;
+        }
+    }
+
+    workers = MIN(cfg->autoStartWorkers, data.njobs);
+    if (workers > 1 &&
+        !(pool = virThreadPoolNew(workers, workers, 0,
+                                  qemuAutostartWorker, &data)))
+        VIR_WARN("Starting the remaining domains one at a time");
+
+    for (i = 0; i < data.njobs; i++) {
+        qemuAutostartJobPtr job = &data.jobs[i];
+
+        if (job->ordered)
+            continue;
+
+        if (pool) {
+            virMutexLock(&data.lock);
+            data.pending++;
+            virMutexUnlock(&data.lock);
+            if (virThreadPoolSendJob(pool, 0, job) == 0)
+                continue;
+
+            virMutexLock(&data.lock);
+            data.pending--;
+            virMutexUnlock(&data.lock);
+        }
+        qemuAutostartRunJob(&data, job);
+    }
+
+    virMutexLock(&data.lock);
+    while (data.pending)
+        ignore_value(virCondWait(&data.cond, &data.lock));
+    virMutexUnlock(&data.lock);
+    virThreadPoolFree(pool);
+
+    ignore_value(virTimeMillisNow(&now));
+
+    for (i = 0; i < data.njobs; i++) {
+        qemuAutostartJobPtr job = &data.jobs[i];
+
+        if (job->result == 0)
+            continue;
+        if (job->result > 0)
+            nstarted++;
+        else
+            nfailed++;
+        VIR_INFO("Autostart of domain '%s' %s in %llu ms",
+                 job->name,
+                 job->result > 0 ? "succeeded" : "failed",
+                 job->elapsed);
+    }
+    VIR_INFO("Autostarted %zu domains in %llu ms, %zu failed",
+             nstarted, now > start ? now - start : 0, nfailed);
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
 
+cleanup:
+    for (i = 0; i < data.njobs; i++) {
+        virObjectUnref(data.jobs[i].vm);
+        VIR_FREE(data.jobs[i].name);
+    }
+    VIR_FREE(data.jobs);
     if (conn)
         virConnectClose(conn);
     virObjectUnref(cfg);
@@ -577,6 +760,8 @@ qemuStateInitialize(bool privileged,
     virQEMUDriverConfigPtr cfg;
     uid_t run_uid = -1;
     gid_t run_gid = -1;
+    unsigned long long then = 0;
+    unsigned long long now = 0;
 
     if (VIR_ALLOC(qemu_driver) < 0)
         return -1;
@@ -615,6 +800,9 @@ qemuStateInitialize(bool privileged,
         goto error;
     VIR_FREE(driverConf);
 
+    virStatCacheSetMaxAge(cfg->statsMaxAge);
+    qemuMonitorSetStreamParser(cfg->monitorStreamParser);
+
     if (virFileMakePath(cfg->stateDir) < 0) {
         VIR_ERROR(_("Failed to create state dir '%s': %s"),
                   cfg->stateDir, virStrerror(errno, ebuf, sizeof(ebuf)));
@@ -747,6 +935,7 @@ qemuStateInitialize(bool privileged,
     }
 
     qemu_driver->qemuCapsCache = virQEMUCapsCacheNew(cfg->libDir,
+                                                     cfg->cacheDir,
                                                      run_uid,
                                                      run_gid);
     if (!qemu_driver->qemuCapsCache)
@@ -797,14 +986,20 @@ qemuStateInitialize(bool privileged,
         goto error;
 
     /* Get all the running persistent or transient configs first */
-    if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
-                                       cfg->stateDir,
-                                       NULL, 1,
-                                       qemu_driver->caps,
-                                       qemu_driver->xmlopt,
-                                       QEMU_EXPECTED_VIRT_TYPES,
-                                       NULL, NULL) < 0)
+    if (virTimeMillisNow(&then) < 0)
+        goto error;
+    if (virDomainObjListLoadAllConfigsFull(qemu_driver->domains,
+                                           cfg->stateDir,
+                                           NULL, 1,
+                                           qemu_driver->caps,
+                                           qemu_driver->xmlopt,
+                                           QEMU_EXPECTED_VIRT_TYPES,
+                                           cfg->startupWorkers,
+                                           NULL, NULL) < 0)
+        goto error;
+    if (virTimeMillisNow(&now) < 0)
         goto error;
+    VIR_INFO("Loaded status of running domains in %llu ms", now - then);
 
     /* find the maximum ID from active and transient configs to initialize
      * the driver with. This is to avoid race between autostart and reconnect
@@ -820,16 +1015,23 @@ qemuStateInitialize(bool privileged,
     conn = virConnectOpen(cfg->uri);
 
     /* Then inactive persistent configs */
-    if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
-                                       cfg->configDir,
-                                       cfg->autostartDir, 0,
-                                       qemu_driver->caps,
-                                       qemu_driver->xmlopt,
-                                       QEMU_EXPECTED_VIRT_TYPES,
-                                       NULL, NULL) < 0)
+    if (virTimeMillisNow(&then) < 0)
         goto error;
+    if (virDomainObjListLoadAllConfigsFull(qemu_driver->domains,
+                                           cfg->configDir,
+                                           cfg->autostartDir, 0,
+                                           qemu_driver->caps,
+                                           qemu_driver->xmlopt,
+                                           QEMU_EXPECTED_VIRT_TYPES,
+                                           cfg->startupWorkers,
+                                           NULL, NULL) < 0)
+        goto error;
+    if (virTimeMillisNow(&now) < 0)
+        goto error;
+    VIR_INFO("Loaded persistent domain configs in %llu ms", now - then);
 
-    qemuProcessReconnectAll(conn, qemu_driver);
+    if (qemuProcessReconnectAll(conn, qemu_driver) < 0)
+        goto error;
 
     virDomainObjListForEach(qemu_driver->domains,
                             qemuDomainSnapshotLoad,
@@ -987,6 +1189,8 @@ qemuStateCleanup(void) {
     if (!qemu_driver)
         return -1;
 
+    /* Wait for the reconnect workers first, they use everything below */
+    virThreadPoolFree(qemu_driver->reconnectPool);
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->activePciHostdevs);
@@ -1265,13 +1469,14 @@ cleanup:
 
 static int
 qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
-                   pid_t pid, int tid)
+                   int *vcpuState, pid_t pid, int tid)
 {
     char *proc;
-    FILE *pidinfo;
+    char *pidinfo = NULL;
     unsigned long long usertime, systime;
     long rss;
     int cpu;
+    char state;
     int ret;
 
     /* In general, we cannot assume pid_t fits in int; but /proc parsing
@@ -1283,7 +1488,7 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
     if (ret < 0)
         return -1;
 
-    if (!(pidinfo = fopen(proc, "r"))) {
+    if (virStatCacheRead(proc, 4096, &pidinfo) < 0) {
         /* VM probably shut down, so fake 0 */
         if (cpuTime)
             *cpuTime = 0;
@@ -1291,6 +1496,8 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
             *lastCpu = 0;
         if (vm_rss)
             *vm_rss = 0;
+        if (vcpuState)
+            *vcpuState = VIR_VCPU_OFFLINE;
         VIR_FREE(proc);
         return 0;
     }
@@ -1298,19 +1505,20 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
 
     /* See 'man proc' for information about what all these fields are. We're
      * only interested in a very few of them */
-    if (fscanf(pidinfo,
+    if (sscanf(pidinfo,
                /* pid -> stime */
-               "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+               "%*d %*s %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
                /* cutime -> endcode */
                "%*d %*d %*d %*d %*d %*d %*u %*u %ld %*u %*u %*u"
                /* startstack -> processor */
                "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
-               &usertime, &systime, &rss, &cpu) != 4) {
-        VIR_FORCE_FCLOSE(pidinfo);
+               &state, &usertime, &systime, &rss, &cpu) != 5) {
+        VIR_FREE(pidinfo);
         VIR_WARN("cannot parse process status data");
         errno = -EINVAL;
         return -1;
     }
+    VIR_FREE(pidinfo);
 
     /* We got jiffies
      * We want nanoseconds
@@ -1329,11 +1537,25 @@ qemuGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
     if (vm_rss)
         *vm_rss = rss * (sysconf(_SC_PAGESIZE) >> 10);
 
+    /* A vCPU thread is only runnable while it executes guest code or
+     * emulates an exit; a halted vCPU sleeps in the kernel */
+    if (vcpuState) {
+        switch (state) {
+        case 'R':
+            *vcpuState = VIR_VCPU_RUNNING;
+            break;
+        case 'Z':
+        case 'X':
+            *vcpuState = VIR_VCPU_OFFLINE;
+            break;
+        default:
+            *vcpuState = VIR_VCPU_BLOCKED;
+            break;
+        }
+    }
 
-    VIR_DEBUG("Got status for %d/%d user=%llu sys=%llu cpu=%d rss=%ld",
-              (int) pid, tid, usertime, systime, cpu, rss);
-
-    VIR_FORCE_FCLOSE(pidinfo);
+    VIR_DEBUG("Got status for %d/%d state=%c user=%llu sys=%llu cpu=%d rss=%ld",
+              (int) pid, tid, state, usertime, systime, cpu, rss);
 
     return 0;
 }
@@ -2497,7 +2719,8 @@ static int qemuDomainGetInfo(virDomainPtr dom,
     if (!virDomainObjIsActive(vm)) {
         info->cpuTime = 0;
     } else {
-        if (qemuGetProcessInfo(&(info->cpuTime), NULL, NULL, vm->pid, 0) < 0) {
+        if (qemuGetProcessInfo(&(info->cpuTime), NULL, NULL, NULL,
+                               vm->pid, 0) < 0) {
             virReportError(VIR_ERR_OPERATION_FAILED, "%s",
                            _("cannot read cputime for domain"));
             goto cleanup;
@@ -2656,6 +2879,8 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    /* Built-in, multi-threaded and chunked; see vircompress.h */
+    QEMU_SAVE_FORMAT_ZLIB = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2669,7 +2894,8 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "zlib")
 
 typedef struct _virQEMUSaveHeader virQEMUSaveHeader;
 typedef virQEMUSaveHeader *virQEMUSaveHeaderPtr;
@@ -2679,7 +2905,8 @@ struct _virQEMUSaveHeader {
     uint32_t xml_len;
     uint32_t was_running;
     uint32_t compressed;
-    uint32_t unused[15];
+    uint32_t chunk_size;    /* QEMU_SAVE_FORMAT_ZLIB only */
+    uint32_t unused[14];
 };
 
 static inline void
@@ -2688,6 +2915,7 @@ bswap_header(virQEMUSaveHeaderPtr hdr) {
     hdr->xml_len = bswap_32(hdr->xml_len);
     hdr->was_running = bswap_32(hdr->was_running);
     hdr->compressed = bswap_32(hdr->compressed);
+    hdr->chunk_size = bswap_32(hdr->chunk_size);
 }
 
 
@@ -2721,10 +2949,20 @@ endjob:
 static const char *
 qemuCompressProgramName(int compress)
 {
-    return (compress == QEMU_SAVE_FORMAT_RAW ? NULL :
+    return (compress == QEMU_SAVE_FORMAT_RAW ||
+            compress == QEMU_SAVE_FORMAT_ZLIB ? NULL :
             qemuSaveCompressionTypeToString(compress));
 }
 
+/* Given a virQEMUSaveFormat compression level, return the chunk
+ * size for the built-in compressor, or 0 if it is not used.  */
+static size_t
+qemuCompressChunkSize(int compress)
+{
+    return (compress == QEMU_SAVE_FORMAT_ZLIB ?
+            VIR_COMPRESS_CHUNK_SIZE_DEFAULT : 0);
+}
+
 static virCommandPtr
 qemuCompressGetCommand(virQEMUSaveFormat compression)
 {
@@ -2929,6 +3167,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     header.was_running = was_running ? 1 : 0;
 
     header.compressed = compressed;
+    header.chunk_size = qemuCompressChunkSize(compressed);
 
     len = strlen(domXML) + 1;
     offset = sizeof(header) + len;
@@ -2977,6 +3216,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     /* Perform the migration */
     if (qemuMigrationToFile(driver, vm, fd, offset, path,
                             qemuCompressProgramName(compressed),
+                            header.chunk_size,
                             bypassSecurityDriver,
                             asyncJob) < 0)
         goto cleanup;
@@ -3154,6 +3394,9 @@ qemuCompressProgramAvailable(virQEMUSaveFormat compress)
     if (compress == QEMU_SAVE_FORMAT_RAW)
         return true;
 
+    if (compress == QEMU_SAVE_FORMAT_ZLIB)
+        return virCompressorAvailable();
+
     if (!(path = virFindFileInPath(qemuSaveCompressionTypeToString(compress))))
         return false;
 
@@ -3448,7 +3691,8 @@ doCoreDump(virQEMUDriverPtr driver,
         ret = qemuDumpToFd(driver, vm, fd, QEMU_ASYNC_JOB_DUMP);
     } else {
         ret = qemuMigrationToFile(driver, vm, fd, 0, path,
-                                  qemuCompressProgramName(compress), false,
+                                  qemuCompressProgramName(compress),
+                                  qemuCompressChunkSize(compress), false,
                                   QEMU_ASYNC_JOB_DUMP);
     }
 
@@ -4826,6 +5070,7 @@ qemuDomainGetVcpus(virDomainPtr dom,
                     qemuGetProcessInfo(&(info[i].cpuTime),
                                        &(info[i].cpu),
                                        NULL,
+                                       NULL,
                                        vm->pid,
                                        priv->vcpupids[i]) < 0) {
                     virReportSystemError(errno, "%s",
@@ -5338,12 +5583,29 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     int ret = -1;
     virObjectEventPtr event;
     int intermediatefd = -1;
+    int pipeFD[2] = { -1, -1 };
     virCommandPtr cmd = NULL;
+    virCompressorPtr comp = NULL;
     char *errbuf = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if ((header->version == 2) &&
-        (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
+        (header->compressed == QEMU_SAVE_FORMAT_ZLIB)) {
+        if (pipe2(pipeFD, O_CLOEXEC) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create pipe"));
+            goto cleanup;
+        }
+        if (!(comp = virCompressorNew(VIR_COMPRESS_INFLATE, *fd, pipeFD[1],
+                                      path, header->chunk_size,
+                                      cfg->imageCompressionThreads)))
+            goto cleanup;
+
+        intermediatefd = *fd;
+        *fd = pipeFD[0];
+        pipeFD[0] = -1;
+    } else if ((header->version == 2) &&
+               (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
         if (!(cmd = qemuCompressGetCommand(header->compressed)))
             goto cleanup;
 
@@ -5366,7 +5628,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
                            VIR_NETDEV_VPORT_PROFILE_OP_RESTORE,
                            VIR_QEMU_PROCESS_START_PAUSED);
 
-    if (intermediatefd != -1) {
+    if (cmd) {
         if (ret < 0) {
             /* if there was an error setting up qemu, the intermediate
              * process will wait forever to write to stdout, so we
@@ -5382,6 +5644,19 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
         }
         VIR_DEBUG("Decompression binary stderr: %s", NULLSTR(errbuf));
     }
+
+    if (comp) {
+        /* If qemu failed to start, closing our copy of the read end
+         * makes the workers fail instead of blocking on a full pipe */
+        if (ret < 0)
+            VIR_FORCE_CLOSE(*fd);
+
+        if (virCompressorFinish(comp) < 0 && ret == 0) {
+            qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, 0);
+            ret = -1;
+        }
+        VIR_FORCE_CLOSE(pipeFD[1]);
+    }
     VIR_FORCE_CLOSE(intermediatefd);
 
     if (VIR_CLOSE(*fd) < 0) {
@@ -5430,6 +5705,9 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
 
 cleanup:
     virCommandFree(cmd);
+    virCompressorFree(comp);
+    VIR_FORCE_CLOSE(pipeFD[0]);
+    VIR_FORCE_CLOSE(pipeFD[1]);
     VIR_FREE(errbuf);
     if (virSecurityManagerRestoreSavedStateLabel(driver->securityManager,
                                                  vm->def, path) < 0)
@@ -9550,7 +9828,7 @@ qemuDomainMemoryStats(virDomainPtr dom,
 
         if (ret >= 0 && ret < nr_stats) {
             long rss;
-            if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+            if (qemuGetProcessInfo(NULL, NULL, &rss, NULL, vm->pid, 0) < 0) {
                 virReportError(VIR_ERR_OPERATION_FAILED, "%s",
                                _("cannot get RSS for domain"));
             } else {
@@ -11108,6 +11386,26 @@ qemuDomainGetJobStats(virDomainPtr dom,
             goto cleanup;
     }
 
+    if (priv->job.compressor) {
+        unsigned long long bytesIn;
+        unsigned long long bytesOut;
+        unsigned long long elapsed;
+
+        virCompressorGetStats(priv->job.compressor,
+                              &bytesIn, &bytesOut, &elapsed);
+
+        if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                    VIR_DOMAIN_JOB_IMAGE_COMPRESSION_INPUT,
+                                    bytesIn) < 0 ||
+            virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                    VIR_DOMAIN_JOB_IMAGE_COMPRESSION_OUTPUT,
+                                    bytesOut) < 0 ||
+            virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                    VIR_DOMAIN_JOB_IMAGE_COMPRESSION_RATE,
+                                    elapsed ? bytesIn * 1000 / elapsed : 0) < 0)
+            goto cleanup;
+    }
+
     *type = priv->job.info.type;
     *params = par;
     *nparams = npar;
@@ -15710,6 +16008,664 @@ qemuConnectGetCPUModelNames(virConnectPtr conn,
 }
 
 
+/* Upper bound on the number of threads used to collect statistics of
+ * several domains in parallel */
+#define QEMU_DOMAIN_STATS_WORKERS_MAX 8
+
+/* Flags passed to the stats group collectors */
+enum {
+    QEMU_DOMAIN_STATS_HAVE_JOB = (1 << 0), /* a query job is held */
+};
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int privflags);
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+    bool monitor;
+};
+
+
+static int
+qemuDomainGetStatsAddParam(virDomainStatsRecordPtr record,
+                           int *maxparams,
+                           virTypedParameterType type,
+                           const char *prefix,
+                           size_t idx,
+                           const char *suffix,
+                           ...)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    va_list ap;
+    int ret = -1;
+
+    snprintf(field, sizeof(field), "%s.%zu.%s", prefix, idx, suffix);
+
+    va_start(ap, suffix);
+    switch (type) {
+    case VIR_TYPED_PARAM_INT:
+        ret = virTypedParamsAddInt(&record->params, &record->nparams,
+                                   maxparams, field, va_arg(ap, int));
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        ret = virTypedParamsAddULLong(&record->params, &record->nparams,
+                                      maxparams, field,
+                                      va_arg(ap, unsigned long long));
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        ret = virTypedParamsAddString(&record->params, &record->nparams,
+                                      maxparams, field,
+                                      va_arg(ap, const char *));
+        break;
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected typed parameter type %d"), type);
+        break;
+    }
+    va_end(ap);
+
+    return ret;
+}
+
+
+static int
+qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    int state;
+    int reason;
+
+    state = virDomainObjGetState(dom, &reason);
+
+    if (virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "state.state", state) < 0 ||
+        virTypedParamsAddInt(&record->params, &record->nparams, maxparams,
+                             "state.reason", reason) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                      virDomainObjPtr dom,
+                      virDomainStatsRecordPtr record,
+                      int *maxparams,
+                      unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cpu_time = 0;
+    unsigned long long user_time = 0;
+    unsigned long long sys_time = 0;
+
+    if (!virDomainObjIsActive(dom) ||
+        !virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUACCT))
+        return 0;
+
+    /* Missing accounting data is not fatal, just leave the group out */
+    if (virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time) < 0 ||
+        virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "cpu.time", cpu_time) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "cpu.user", user_time) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "cpu.system", sys_time) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virDomainStatsRecordPtr record,
+                          int *maxparams,
+                          unsigned int privflags)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cur_balloon = dom->def->mem.cur_balloon;
+    unsigned long long balloon;
+    int err;
+
+    if (virDomainObjIsActive(dom)) {
+        if (dom->def->memballoon &&
+            dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE) {
+            cur_balloon = dom->def->mem.max_balloon;
+        } else if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BALLOON_EVENT) &&
+                   (privflags & QEMU_DOMAIN_STATS_HAVE_JOB)) {
+            qemuDomainObjEnterMonitor(driver, dom);
+            err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
+            qemuDomainObjExitMonitor(driver, dom);
+
+            if (err < 0)
+                virResetLastError();
+            else if (err == 0)
+                cur_balloon = dom->def->mem.max_balloon;
+            else
+                cur_balloon = balloon;
+        }
+    }
+
+    if (virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "balloon.current", cur_balloon) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, maxparams,
+                                "balloon.maximum",
+                                dom->def->mem.max_balloon) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                       virDomainObjPtr dom,
+                       virDomainStatsRecordPtr record,
+                       int *maxparams,
+                       unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cpu_time;
+    int state;
+    size_t i;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "vcpu.current", dom->def->vcpus) < 0 ||
+        virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "vcpu.maximum", dom->def->maxvcpus) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(dom) || !priv->vcpupids)
+        return 0;
+
+    for (i = 0; i < priv->nvcpupids; i++) {
+        if (qemuGetProcessInfo(&cpu_time, NULL, NULL, &state,
+                               dom->pid, priv->vcpupids[i]) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        if (qemuDomainGetStatsAddParam(record, maxparams, VIR_TYPED_PARAM_INT,
+                                       "vcpu", i, "state", state) < 0 ||
+            qemuDomainGetStatsAddParam(record, maxparams, VIR_TYPED_PARAM_ULLONG,
+                                       "vcpu", i, "time", cpu_time) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+#define QEMU_ADD_NET_PARAM(record, maxparams, num, name, value)         \
+    do {                                                                \
+        if ((value) >= 0 &&                                             \
+            qemuDomainGetStatsAddParam(record, maxparams,               \
+                                       VIR_TYPED_PARAM_ULLONG,          \
+                                       "net", num, name,                \
+                                       (unsigned long long) (value)) < 0) \
+            return -1;                                                  \
+    } while (0)
+
+static int
+qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom,
+                            virDomainStatsRecordPtr record,
+                            int *maxparams,
+                            unsigned int privflags ATTRIBUTE_UNUSED)
+{
+    size_t i;
+    struct _virDomainInterfaceStats tmp;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "net.count", dom->def->nnets) < 0)
+        return -1;
+
+    for (i = 0; i < dom->def->nnets; i++) {
+        virDomainNetDefPtr net = dom->def->nets[i];
+
+        if (!net->ifname)
+            continue;
+
+        if (qemuDomainGetStatsAddParam(record, maxparams,
+                                       VIR_TYPED_PARAM_STRING,
+                                       "net", i, "name", net->ifname) < 0)
+            return -1;
+
+#ifdef __linux__
+        if (linuxDomainInterfaceStats(net->ifname, &tmp) < 0) {
+            virResetLastError();
+            continue;
+        }
+#else
+        continue;
+#endif
+
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "rx.bytes", tmp.rx_bytes);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "rx.pkts", tmp.rx_packets);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "rx.errs", tmp.rx_errs);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "rx.drop", tmp.rx_drop);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "tx.bytes", tmp.tx_bytes);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "tx.pkts", tmp.tx_packets);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "tx.errs", tmp.tx_errs);
+        QEMU_ADD_NET_PARAM(record, maxparams, i, "tx.drop", tmp.tx_drop);
+    }
+
+    return 0;
+}
+
+#undef QEMU_ADD_NET_PARAM
+
+
+#define QEMU_ADD_BLOCK_PARAM(record, maxparams, num, name, value)       \
+    do {                                                                \
+        if ((value) >= 0 &&                                             \
+            qemuDomainGetStatsAddParam(record, maxparams,               \
+                                       VIR_TYPED_PARAM_ULLONG,          \
+                                       "block", num, name,              \
+                                       (unsigned long long) (value)) < 0) \
+            goto cleanup;                                               \
+    } while (0)
+
+static int
+qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
+                        virDomainObjPtr dom,
+                        virDomainStatsRecordPtr record,
+                        int *maxparams,
+                        unsigned int privflags)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    virHashTablePtr stats;
+    size_t i;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom) ||
+        !(privflags & QEMU_DOMAIN_STATS_HAVE_JOB))
+        return 0;
+
+    /* One query-blockstats covers all disks of the domain */
+    qemuDomainObjEnterMonitor(driver, dom);
+    stats = qemuMonitorGetAllBlockStatsInfo(priv->mon);
+    qemuDomainObjExitMonitor(driver, dom);
+
+    if (!stats)
+        virResetLastError();
+
+    if (virTypedParamsAddUInt(&record->params, &record->nparams, maxparams,
+                              "block.count", dom->def->ndisks) < 0)
+        goto cleanup;
+
+    for (i = 0; i < dom->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = dom->def->disks[i];
+        qemuMonitorBlockStatsPtr bstats = NULL;
+
+        if (qemuDomainGetStatsAddParam(record, maxparams,
+                                       VIR_TYPED_PARAM_STRING,
+                                       "block", i, "name", disk->dst) < 0)
+            goto cleanup;
+
+        if (!stats || !disk->info.alias ||
+            !(bstats = virHashLookup(stats, disk->info.alias)))
+            continue;
+
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "rd.reqs", bstats->rd_req);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "rd.bytes", bstats->rd_bytes);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "rd.times",
+                             bstats->rd_total_times);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "wr.reqs", bstats->wr_req);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "wr.bytes", bstats->wr_bytes);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "wr.times",
+                             bstats->wr_total_times);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "fl.reqs",
+                             bstats->flush_req);
+        QEMU_ADD_BLOCK_PARAM(record, maxparams, i, "fl.times",
+                             bstats->flush_total_times);
+    }
+
+    ret = 0;
+
+cleanup:
+    virHashFree(stats);
+    return ret;
+}
+
+#undef QEMU_ADD_BLOCK_PARAM
+
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { NULL, 0, false }
+};
+
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supportedstats = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        *stats = supportedstats;
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supportedstats);
+        return -1;
+    }
+
+    *stats &= supportedstats;
+    return 0;
+}
+
+
+static bool
+qemuDomainGetStatsNeedMonitor(unsigned int stats)
+{
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].monitor)
+            return true;
+
+    return false;
+}
+
+
+/*
+ * Collect the requested @stats of a single locked domain @dom into a
+ * newly allocated @record. Failures to talk to the monitor or read
+ * host accounting data only leave the affected group out; a negative
+ * return means a fatal error such as OOM.
+ */
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainStatsRecordPtr tmp = NULL;
+    unsigned int privflags = 0;
+    int maxparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (qemuDomainGetStatsNeedMonitor(stats) &&
+        virDomainObjIsActive(dom)) {
+        if (qemuDomainObjBeginJob(driver, dom, QEMU_JOB_QUERY) < 0)
+            virResetLastError();
+        else
+            privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    }
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto cleanup;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, tmp,
+                                                  &maxparams, privflags) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+    tmp->dom->id = dom->def->id;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+cleanup:
+    if (privflags & QEMU_DOMAIN_STATS_HAVE_JOB)
+        ignore_value(qemuDomainObjEndJob(driver, dom));
+
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+
+    return ret;
+}
+
+
+typedef struct _qemuDomainGetStatsData qemuDomainGetStatsData;
+typedef qemuDomainGetStatsData *qemuDomainGetStatsDataPtr;
+struct _qemuDomainGetStatsData {
+    virConnectPtr conn;
+    unsigned int stats;
+
+    virDomainObjPtr *vms;   /* referenced, unlocked domain objects */
+    size_t nvms;
+    virDomainStatsRecordPtr *records; /* one slot per entry in @vms */
+
+    int next;               /* next entry of @vms to process */
+
+    virMutex lock;          /* protects @error */
+    virErrorPtr error;      /* first fatal error hit by a worker */
+};
+
+
+static void
+qemuDomainGetStatsWorkerRun(void *opaque)
+{
+    qemuDomainGetStatsDataPtr data = opaque;
+    int idx;
+    int rc;
+
+    while ((idx = virAtomicIntInc(&data->next) - 1) < (int) data->nvms) {
+        virDomainObjPtr vm = data->vms[idx];
+
+        virObjectLock(vm);
+        rc = qemuDomainGetStats(data->conn, vm, data->stats,
+                                &data->records[idx]);
+        virObjectUnlock(vm);
+
+        if (rc < 0) {
+            virMutexLock(&data->lock);
+            if (!data->error)
+                data->error = virSaveLastError();
+            virMutexUnlock(&data->lock);
+            break;
+        }
+    }
+}
+
+
+/*
+ * Gather stats of all domains in @data. Domains with a running guest
+ * may need a monitor round trip per stats group, so several of them
+ * are queried in parallel from a bounded set of worker threads.
+ */
+static int
+qemuDomainGetStatsRun(qemuDomainGetStatsDataPtr data)
+{
+    virThread workers[QEMU_DOMAIN_STATS_WORKERS_MAX];
+    size_t nworkers = 0;
+    size_t maxworkers = 1;
+    size_t i;
+
+    if (qemuDomainGetStatsNeedMonitor(data->stats))
+        maxworkers = MIN(data->nvms, QEMU_DOMAIN_STATS_WORKERS_MAX);
+
+    /* The calling thread always takes part in the work, so that we
+     * still make progress if no extra thread can be spawned */
+    for (i = 1; i < maxworkers; i++) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            qemuDomainGetStatsWorkerRun, data) < 0) {
+            VIR_WARN("Failed to spawn domain stats worker thread");
+            break;
+        }
+        nworkers++;
+    }
+
+    qemuDomainGetStatsWorkerRun(data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data->error) {
+        virSetError(data->error);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainPtr *domlist = NULL;
+    virDomainObjPtr vm;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainGetStatsData data;
+    bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    int ndomlist = 0;
+    int nstats = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+
+    if (ndoms)
+        virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+    else
+        virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                      VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+
+    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+        return -1;
+
+    if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
+        return -1;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!ndoms) {
+        unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                                       VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
+
+        if ((ndomlist = virDomainObjListExport(driver->domains, conn, &domlist,
+                                               virConnectGetAllDomainStatsCheckACL,
+                                               lflags)) < 0)
+            goto cleanup;
+
+        doms = domlist;
+        ndoms = ndomlist;
+    }
+
+    if (VIR_ALLOC_N(data.vms, ndoms) < 0 ||
+        VIR_ALLOC_N(data.records, ndoms) < 0)
+        goto cleanup;
+
+    /* Domains which vanished in the meantime or which the caller
+     * is not allowed to see are silently skipped */
+    for (i = 0; i < ndoms; i++) {
+        if (!(vm = virDomainObjListFindByUUID(driver->domains, doms[i]->uuid)))
+            continue;
+
+        if (!virConnectGetAllDomainStatsCheckACL(conn, vm->def)) {
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        data.vms[data.nvms++] = virObjectRef(vm);
+        virObjectUnlock(vm);
+    }
+
+    data.conn = conn;
+    data.stats = stats;
+
+    if (qemuDomainGetStatsRun(&data) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(tmpstats, data.nvms + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data.nvms; i++) {
+        if (data.records[i]) {
+            tmpstats[nstats++] = data.records[i];
+            data.records[i] = NULL;
+        }
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+cleanup:
+    if (data.records) {
+        for (i = 0; i < data.nvms; i++) {
+            if (!data.records[i])
+                continue;
+            virTypedParamsFree(data.records[i]->params,
+                               data.records[i]->nparams);
+            virDomainFree(data.records[i]->dom);
+            VIR_FREE(data.records[i]);
+        }
+        VIR_FREE(data.records);
+    }
+    for (i = 0; i < data.nvms; i++)
+        virObjectUnref(data.vms[i]);
+    VIR_FREE(data.vms);
+    virFreeError(data.error);
+    virMutexDestroy(&data.lock);
+    virDomainStatsRecordListFree(tmpstats);
+    if (domlist) {
+        for (i = 0; i < ndomlist; i++)
+            virDomainFree(domlist[i]);
+        VIR_FREE(domlist);
+    }
+    return ret;
+}
+
+
 static virDriver qemuDriver = {
     .no = VIR_DRV_QEMU,
     .name = QEMU_DRIVER_NAME,
@@ -15897,6 +16853,7 @@ static virDriver qemuDriver = {
     .domainMigrateFinish3Params = qemuDomainMigrateFinish3Params, /* 1.1.0 */
     .domainMigrateConfirm3Params = qemuDomainMigrateConfirm3Params, /* 1.1.0 */
     .connectGetCPUModelNames = qemuConnectGetCPUModelNames, /* 1.1.3 */
+    .connectGetAllDomainStats = qemuConnectGetAllDomainStats, /* 1.2.1 */
 };
 
 
@@ -52,6 +52,7 @@
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "virstoragefile.h"
 #include "viruri.h"
 #include "virhook.h"
@@ -2346,7 +2347,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PREPARE);
 
     /* Domain starts inactive, even if the domain XML had an id field. */
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (flags & VIR_MIGRATE_OFFLINE)
         goto done;
@@ -2865,7 +2866,19 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
+/* Each buffer is sent as a single stream packet, so size them to the
+ * largest payload every daemon accepts to keep the number of RPC
+ * messages per migrated byte down.
+ */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+/* Number of buffers in flight between the qemu reader and the sender */
+#define TUNNEL_SEND_BUF_COUNT 4
+
+typedef struct _qemuMigrationIOBuffer qemuMigrationIOBuffer;
+struct _qemuMigrationIOBuffer {
+    char *data;
+    size_t len;
+};
 
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
@@ -2876,21 +2889,104 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* Data read from qemu is handed over to a separate sender thread
+     * through a ring of buffers, so that reading the next chunk from
+     * qemu overlaps with pushing the previous one to the destination.
+     * All fields below are protected by @lock.
+     */
+    virThread sendThread;
+    virMutex lock;
+    virCond cond;
+    qemuMigrationIOBuffer bufs[TUNNEL_SEND_BUF_COUNT];
+    size_t head;    /* next buffer to fill */
+    size_t tail;    /* next buffer to send */
+    size_t nfull;   /* buffers waiting to be sent */
+    bool eof;       /* no more buffers will be filled */
+    bool quit;      /* stop sending immediately */
+    bool sendFailed;
+    virError sendErr;
+    unsigned long long sent;
 };
 
+static void qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        qemuMigrationIOBuffer *buf;
+        int rc;
+
+        while (data->nfull == 0 && !data->eof && !data->quit)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+
+        if (data->quit || data->nfull == 0)
+            break;
+
+        /* The reader never touches a full buffer, so it can be sent
+         * without holding the lock */
+        buf = &data->bufs[data->tail];
+        virMutexUnlock(&data->lock);
+        rc = virStreamSend(data->st, buf->data, buf->len);
+        virMutexLock(&data->lock);
+
+        if (rc < 0) {
+            data->sendFailed = true;
+            virCopyLastError(&data->sendErr);
+            virResetLastError();
+            virCondBroadcast(&data->cond);
+            break;
+        }
+
+        data->sent += buf->len;
+        data->tail = (data->tail + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->nfull--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+/* Tell the sender there is nothing more to send, or that it should
+ * give up right away if @abort is true, and wait for it to exit.
+ * Returns -1 if sending failed, 0 otherwise.
+ */
+static int
+qemuMigrationIOStopSender(qemuMigrationIOThreadPtr data, bool abort)
+{
+    bool failed;
+
+    virMutexLock(&data->lock);
+    if (abort)
+        data->quit = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+
+    virMutexLock(&data->lock);
+    failed = data->sendFailed;
+    virMutexUnlock(&data->lock);
+
+    return failed ? -1 : 0;
+}
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    bool senderStopped = false;
 
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
-        goto abrt;
+    ignore_value(virTimeMillisNow(&start));
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -2939,12 +3035,29 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            qemuMigrationIOBuffer *buf;
             int nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            virMutexLock(&data->lock);
+            while (data->nfull == TUNNEL_SEND_BUF_COUNT && !data->sendFailed)
+                ignore_value(virCondWait(&data->cond, &data->lock));
+            if (data->sendFailed) {
+                virMutexUnlock(&data->lock);
+                goto error;
+            }
+            buf = &data->bufs[data->head];
+            virMutexUnlock(&data->lock);
+
+            /* The socket is blocking, so this fills the whole buffer
+             * unless qemu closes its end first */
+            nbytes = saferead(data->sock, buf->data, TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                virMutexLock(&data->lock);
+                buf->len = nbytes;
+                data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+                data->nfull++;
+                virCondBroadcast(&data->cond);
+                virMutexUnlock(&data->lock);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -2956,10 +3069,17 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    senderStopped = true;
+    if (qemuMigrationIOStopSender(data, false) < 0)
+        goto error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
-    VIR_FREE(buffer);
+    ignore_value(virTimeMillisNow(&end));
+    VIR_INFO("Migration tunnel sent %llu bytes in %llu ms (%llu KiB/s)",
+             data->sent, end - start,
+             end > start ? data->sent * 1000 / 1024 / (end - start) : 0);
 
     return;
 
@@ -2969,6 +3089,8 @@ abrt:
         virFreeError(err);
         err = NULL;
     }
+    senderStopped = true;
+    ignore_value(qemuMigrationIOStopSender(data, true));
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -2976,11 +3098,32 @@ abrt:
     }
 
 error:
+    if (!senderStopped)
+        ignore_value(qemuMigrationIOStopSender(data, true));
+    /* Sending failed; the stream was already torn down by then */
+    if (data->sendFailed)
+        virSetError(&data->sendErr);
     virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
 }
 
+static void
+qemuMigrationIOThreadFree(qemuMigrationIOThreadPtr io)
+{
+    size_t i;
+
+    if (!io)
+        return;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(io->bufs[i].data);
+    virResetError(&io->sendErr);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
+    VIR_FORCE_CLOSE(io->wakeupSendFD);
+    VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    VIR_FREE(io);
+}
 
 static qemuMigrationIOThreadPtr
 qemuMigrationStartTunnel(virStreamPtr st,
@@ -2988,6 +3131,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
+    size_t i;
 
     if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
         virReportSystemError(errno, "%s",
@@ -2998,16 +3142,46 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(io);
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
     io->wakeupSendFD = wakeupFD[1];
+    wakeupFD[0] = wakeupFD[1] = -1;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(io->bufs[i].data, TUNNEL_SEND_BUF_SIZE) < 0)
+            goto error;
+    }
+
+    if (virThreadCreate(&io->sendThread, true,
+                        qemuMigrationIOSendFunc,
+                        io) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
+        goto error;
+    }
 
     if (virThreadCreate(&io->thread, true,
                         qemuMigrationIOFunc,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        ignore_value(qemuMigrationIOStopSender(io, true));
         goto error;
     }
 
@@ -3016,7 +3190,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
 error:
     VIR_FORCE_CLOSE(wakeupFD[0]);
     VIR_FORCE_CLOSE(wakeupFD[1]);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return NULL;
 }
 
@@ -3048,9 +3222,7 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
     rv = 0;
 
 cleanup:
-    VIR_FORCE_CLOSE(io->wakeupSendFD);
-    VIR_FORCE_CLOSE(io->wakeupRecvFD);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return rv;
 }
 
@@ -4579,11 +4751,15 @@ cleanup:
 }
 
 
-/* Helper function called while vm is active.  */
+/* Helper function called while vm is active.  The migration stream is
+ * passed through the external @compressor program if given, or through
+ * the built-in compressor in chunks of @compressChunkSize bytes if that
+ * is not zero.  */
 int
 qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                     int fd, off_t offset, const char *path,
                     const char *compressor,
+                    size_t compressChunkSize,
                     bool bypassSecurityDriver,
                     enum qemuDomainAsyncJob asyncJob)
 {
@@ -4592,9 +4768,11 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     int ret = -1;
     bool restoreLabel = false;
     virCommandPtr cmd = NULL;
+    virCompressorPtr comp = NULL;
     int pipeFD[2] = { -1, -1 };
     unsigned long saveMigBandwidth = priv->migMaxBandwidth;
     char *errbuf = NULL;
+    bool usePipe = compressor || compressChunkSize;
 
     /* Increase migration bandwidth to unlimited since target is a file.
      * Failure to change migration speed is not fatal. */
@@ -4606,15 +4784,22 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     }
 
     if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATE_QEMU_FD) &&
-        (!compressor || pipe(pipeFD) == 0)) {
+        (!usePipe || pipe(pipeFD) == 0)) {
         /* All right! We can use fd migration, which means that qemu
          * doesn't have to open() the file, so while we still have to
          * grant SELinux access, we can do it on fd and avoid cleanup
          * later, as well as skip futzing with cgroup.  */
         if (virSecurityManagerSetImageFDLabel(driver->securityManager, vm->def,
-                                              compressor ? pipeFD[1] : fd) < 0)
+                                              usePipe ? pipeFD[1] : fd) < 0)
             goto cleanup;
         bypassSecurityDriver = true;
+    } else if (compressChunkSize) {
+        /* The built-in compressor needs to sit between qemu and the
+         * file, which exec migration can't arrange for.  */
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("built-in image compression requires migration "
+                         "to a file descriptor"));
+        goto cleanup;
     } else {
         /* Phooey - we have to fall back on exec migration, where qemu
          * has to popen() the file by name, and block devices have to be
@@ -4639,10 +4824,35 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         restoreLabel = true;
     }
 
+    if (compressChunkSize) {
+        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+        size_t nthreads = cfg->imageCompressionThreads;
+
+        virObjectUnref(cfg);
+
+        if (virSetCloseExec(pipeFD[1]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to set cloexec flag"));
+            goto cleanup;
+        }
+        if (!(comp = virCompressorNew(VIR_COMPRESS_DEFLATE, pipeFD[0], fd,
+                                      path, compressChunkSize, nthreads)))
+            goto cleanup;
+        priv->job.compressor = comp;
+    }
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         goto cleanup;
 
-    if (!compressor) {
+    if (comp) {
+        rc = qemuMonitorMigrateToFd(priv->mon,
+                                    QEMU_MONITOR_MIGRATE_BACKGROUND,
+                                    pipeFD[1]);
+        /* Only qemu may hold the write end from now on, so the
+         * compressor sees the end of the stream when qemu is done */
+        if (VIR_CLOSE(pipeFD[1]) < 0)
+            VIR_WARN("failed to close intermediate pipe");
+    } else if (!compressor) {
         const char *args[] = { "cat", NULL };
 
         if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATE_QEMU_FD) &&
@@ -4703,6 +4913,9 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (cmd && virCommandWait(cmd, NULL) < 0)
         goto cleanup;
 
+    if (comp && virCompressorFinish(comp) < 0)
+        goto cleanup;
+
     ret = 0;
 
 cleanup:
@@ -4713,8 +4926,14 @@ cleanup:
         qemuDomainObjExitMonitor(driver, vm);
     }
 
-    VIR_FORCE_CLOSE(pipeFD[0]);
+    /* The compressor workers read from pipeFD[0] until qemu closes
+     * its end of the pipe, so they must be gone before we close it */
     VIR_FORCE_CLOSE(pipeFD[1]);
+    if (comp) {
+        priv->job.compressor = NULL;
+        virCompressorFree(comp);
+    }
+    VIR_FORCE_CLOSE(pipeFD[0]);
     if (cmd) {
         VIR_DEBUG("Compression binary stderr: %s", NULLSTR(errbuf));
         VIR_FREE(errbuf);
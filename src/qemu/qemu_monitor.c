@@ -65,9 +65,11 @@ struct _qemuMonitor {
     qemuMonitorCallbacksPtr cb;
     void *callbackOpaque;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
-    qemuMonitorMessagePtr msg;
+    /* Queue of commands being processed, oldest first. The JSON
+     * monitor writes them back-to-back and matches replies by
+     * command ID, the text monitor only handles the head */
+    qemuMonitorMessagePtr msgs;
+    qemuMonitorMessagePtr msgsTail;
 
     /* Buffer incoming data ready for Text/QMP monitor
      * code to process & find message boundaries */
@@ -75,6 +77,9 @@ struct _qemuMonitor {
     size_t bufferLength;
     char *buffer;
 
+    /* Incremental parser for the QMP replies and events in @buffer */
+    virJSONStreamParserPtr jsonParser;
+
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
     virError lastError;
@@ -90,6 +95,8 @@ struct _qemuMonitor {
     /* If found, path to the virtio memballoon driver */
     char *balloonpath;
     bool ballooninit;
+    /* A thread is looking for balloonpath */
+    bool balloonsearch;
 
     /* Log file fd of the qemu process to dig for usable info */
     int logfd;
@@ -98,6 +105,9 @@ struct _qemuMonitor {
 static virClassPtr qemuMonitorClass;
 static void qemuMonitorDispose(void *obj);
 
+/* Set once while the driver starts up, before any monitor is opened */
+static bool qemuMonitorUseStreamParser;
+
 static int qemuMonitorOnceInit(void)
 {
     if (!(qemuMonitorClass = virClassNew(virClassForObjectLockable(),
@@ -112,6 +122,22 @@ static int qemuMonitorOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(qemuMonitor)
 
 
+/**
+ * qemuMonitorSetStreamParser:
+ * @enable: whether to use the incremental parser
+ *
+ * Choose how QMP monitors opened from now on split the data they
+ * receive. By default each line is parsed on its own once it has
+ * been received whole; when enabled a virJSONStreamParser picks the
+ * values out of the data as it arrives.
+ */
+void
+qemuMonitorSetStreamParser(bool enable)
+{
+    qemuMonitorUseStreamParser = enable;
+}
+
+
 VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
               QEMU_MONITOR_MIGRATION_STATUS_LAST,
               "inactive", "active", "completed", "failed", "cancelled", "setup")
@@ -260,6 +286,7 @@ static void qemuMonitorDispose(void *obj)
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
     VIR_FREE(mon->buffer);
+    virJSONStreamParserFree(mon->jsonParser);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
     VIR_FORCE_CLOSE(mon->logfd);
@@ -365,6 +392,78 @@ error:
 }
 
 
+static void
+qemuMonitorMessageQueuePush(qemuMonitorPtr mon,
+                            qemuMonitorMessagePtr msg)
+{
+    msg->next = NULL;
+    if (mon->msgsTail)
+        mon->msgsTail->next = msg;
+    else
+        mon->msgs = msg;
+    mon->msgsTail = msg;
+}
+
+
+static void
+qemuMonitorMessageQueueRemove(qemuMonitorPtr mon,
+                              qemuMonitorMessagePtr msg)
+{
+    qemuMonitorMessagePtr *link = &mon->msgs;
+    qemuMonitorMessagePtr prev = NULL;
+
+    while (*link && *link != msg) {
+        prev = *link;
+        link = &prev->next;
+    }
+
+    if (!*link)
+        return;
+
+    *link = msg->next;
+    if (mon->msgsTail == msg)
+        mon->msgsTail = prev;
+    msg->next = NULL;
+}
+
+
+/* Returns the message whose data should be written next, if any.
+ * The text monitor has no way to tell replies apart, so it
+ * only ever has the head of the queue in flight. */
+static qemuMonitorMessagePtr
+qemuMonitorMessageQueueNextTx(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    if (!mon->json)
+        return mon->msgs && mon->msgs->txOffset < mon->msgs->txLength ?
+            mon->msgs : NULL;
+
+    for (msg = mon->msgs; msg; msg = msg->next) {
+        if (msg->txOffset < msg->txLength)
+            return msg;
+    }
+
+    return NULL;
+}
+
+
+/* Wake up everyone waiting for a reply, e.g. on a fatal
+ * error on the monitor channel. */
+static void
+qemuMonitorMessageQueueFinish(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    if (!mon->msgs)
+        return;
+
+    for (msg = mon->msgs; msg; msg = msg->next)
+        msg->finished = 1;
+    virCondBroadcast(&mon->notify);
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -374,17 +473,19 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
     qemuMonitorMessagePtr msg = NULL;
+    qemuMonitorMessagePtr tmp;
+    bool finished = false;
 
     /* See if there's a message & whether its ready for its reply
      * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    if (mon->msgs && mon->msgs->txOffset == mon->msgs->txLength)
+        msg = mon->msgs;
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
     char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msgs, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
@@ -396,9 +497,9 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
           "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
 
     if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
+        len = qemuMonitorJSONIOProcess(mon, mon->jsonParser,
                                        mon->buffer, mon->bufferOffset,
-                                       msg);
+                                       mon->msgs);
     else
         len = qemuMonitorTextIOProcess(mon,
                                        mon->buffer, mon->bufferOffset,
@@ -420,7 +521,9 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 #if DEBUG_IO
     VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
 #endif
-    if (msg && msg->finished)
+    for (tmp = mon->msgs; tmp && !finished; tmp = tmp->next)
+        finished = tmp->finished;
+    if (finished)
         virCondBroadcast(&mon->notify);
     return len;
 }
@@ -474,39 +577,40 @@ qemuMonitorIOWriteWithFD(qemuMonitorPtr mon,
 static int
 qemuMonitorIOWrite(qemuMonitorPtr mon)
 {
+    qemuMonitorMessagePtr msg;
     int done;
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
+    /* If no message waiting to be transmitted, then no-op */
+    if (!(msg = qemuMonitorMessageQueueNextTx(mon)))
         return 0;
 
-    if (mon->msg->txFD != -1 && !mon->hasSendFD) {
+    if (msg->txFD != -1 && !mon->hasSendFD) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Monitor does not support sending of file descriptors"));
         return -1;
     }
 
-    if (mon->msg->txFD == -1)
+    if (msg->txFD == -1)
         done = write(mon->fd,
-                     mon->msg->txBuffer + mon->msg->txOffset,
-                     mon->msg->txLength - mon->msg->txOffset);
+                     msg->txBuffer + msg->txOffset,
+                     msg->txLength - msg->txOffset);
     else
         done = qemuMonitorIOWriteWithFD(mon,
-                                        mon->msg->txBuffer + mon->msg->txOffset,
-                                        mon->msg->txLength - mon->msg->txOffset,
-                                        mon->msg->txFD);
+                                        msg->txBuffer + msg->txOffset,
+                                        msg->txLength - msg->txOffset,
+                                        msg->txFD);
 
     PROBE(QEMU_MONITOR_IO_WRITE,
           "mon=%p buf=%s len=%d ret=%d errno=%d",
           mon,
-          mon->msg->txBuffer + mon->msg->txOffset,
-          mon->msg->txLength - mon->msg->txOffset,
+          msg->txBuffer + msg->txOffset,
+          msg->txLength - msg->txOffset,
           done, errno);
 
-    if (mon->msg->txFD != -1)
+    if (msg->txFD != -1)
         PROBE(QEMU_MONITOR_IO_SEND_FD,
               "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, errno);
+              mon, msg->txFD, done, errno);
 
     if (done < 0) {
         if (errno == EAGAIN)
@@ -516,7 +620,7 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
                              _("Unable to write to monitor"));
         return -1;
     }
-    mon->msg->txOffset += done;
+    msg->txOffset += done;
     return done;
 }
 
@@ -584,7 +688,7 @@ static void qemuMonitorUpdateWatch(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if ((mon->msg && mon->msg->txOffset < mon->msg->txLength) &&
+        if (qemuMonitorMessageQueueNextTx(mon) &&
             !mon->waitGreeting)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
@@ -708,12 +812,9 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
-         * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
-        }
+        /* If IO process resulted in an error & we have messages,
+         * then wakeup their waiters */
+        qemuMonitorMessageQueueFinish(mon);
     }
 
     qemuMonitorUpdateWatch(mon);
@@ -726,7 +827,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -736,7 +837,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -786,8 +887,12 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
     mon->hasSendFD = hasSendFD;
     mon->vm = virObjectRef(vm);
     mon->json = json;
-    if (json)
+    if (json) {
         mon->waitGreeting = true;
+        if (qemuMonitorUseStreamParser &&
+            !(mon->jsonParser = virJSONStreamParserNew(VIR_JSON_PARSE_ARENA)))
+            goto cleanup;
+    }
     mon->cb = cb;
     mon->callbackOpaque = opaque;
 
@@ -903,10 +1008,10 @@ void qemuMonitorClose(qemuMonitorPtr mon)
         VIR_FORCE_CLOSE(mon->fd);
     }
 
-    /* In case another thread is waiting for its monitor command to be
-     * processed, we need to wake it up with appropriate error set.
+    /* In case other threads are waiting for their monitor commands to be
+     * processed, we need to wake them up with appropriate error set.
      */
-    if (mon->msg) {
+    if (mon->msgs) {
         if (mon->lastError.code == VIR_ERR_OK) {
             virErrorPtr err = virSaveLastError();
 
@@ -920,8 +1025,7 @@ void qemuMonitorClose(qemuMonitorPtr mon)
                 virResetLastError();
             }
         }
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        qemuMonitorMessageQueueFinish(mon);
     }
 
     virObjectUnlock(mon);
@@ -951,14 +1055,16 @@ int qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
-    mon->msg = msg;
+    /* Other commands may still be in flight, ours is written
+     * as soon as those before it are */
+    qemuMonitorMessageQueuePush(mon, msg);
     qemuMonitorUpdateWatch(mon);
 
     PROBE(QEMU_MONITOR_SEND_MSG,
           "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+          mon, msg->txBuffer, msg->txFD);
 
-    while (!mon->msg->finished) {
+    while (!msg->finished) {
         if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Unable to wait on monitor condition"));
@@ -976,7 +1082,7 @@ int qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
 cleanup:
-    mon->msg = NULL;
+    qemuMonitorMessageQueueRemove(mon, msg);
     qemuMonitorUpdateWatch(mon);
 
     return ret;
@@ -1025,14 +1131,6 @@ qemuMonitorFindBalloonObjectPath(qemuMonitorPtr mon,
     qemuMonitorJSONListPathPtr *paths = NULL;
     qemuMonitorJSONListPathPtr *bprops = NULL;
 
-    if (mon->balloonpath) {
-        return 1;
-    } else if (mon->ballooninit) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Cannot determine balloon device path"));
-        return -1;
-    }
-
     /* Not supported */
     if (!vm->def->memballoon ||
         vm->def->memballoon->model != VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO) {
@@ -1083,6 +1181,7 @@ qemuMonitorFindBalloonObjectPath(qemuMonitorPtr mon,
          * traversed looking for more entries
          */
         if (paths[i]->type && STRPREFIX(paths[i]->type, "child<")) {
+            VIR_FREE(nextpath);
             if (virAsprintf(&nextpath, "%s/%s", curpath, paths[i]->name) < 0) {
                 ret = -1;
                 goto cleanup;
@@ -1102,6 +1201,45 @@ cleanup:
     return ret;
 }
 
+
+/*
+ * Look up the balloon object path the first time it's needed.
+ * Queries may use the monitor at the same time and drop its lock
+ * while waiting for replies, so a thread finding a lookup in
+ * progress waits for its result rather than starting another one.
+ *
+ * Returns 1 if the path is known, -1 otherwise.
+ */
+static int
+qemuMonitorInitBalloonObjectPath(qemuMonitorPtr mon)
+{
+    int ret;
+
+    while (mon->balloonsearch) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
+    if (mon->balloonpath) {
+        return 1;
+    } else if (mon->ballooninit) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot determine balloon device path"));
+        return -1;
+    }
+
+    mon->balloonsearch = true;
+    ret = qemuMonitorFindBalloonObjectPath(mon, mon->vm, "/");
+    mon->balloonsearch = false;
+    mon->ballooninit = true;
+    virCondBroadcast(&mon->notify);
+
+    return ret == 1 ? 1 : -1;
+}
+
 int qemuMonitorHMPCommandWithFd(qemuMonitorPtr mon,
                                 const char *cmd,
                                 int scm_fd,
@@ -1571,8 +1709,7 @@ int qemuMonitorGetMemoryStats(qemuMonitorPtr mon,
     }
 
     if (mon->json) {
-        ignore_value(qemuMonitorFindBalloonObjectPath(mon, mon->vm, "/"));
-        mon->ballooninit = true;
+        ignore_value(qemuMonitorInitBalloonObjectPath(mon));
         ret = qemuMonitorJSONGetMemoryStats(mon, mon->balloonpath,
                                             stats, nr_stats);
     } else {
@@ -1599,11 +1736,10 @@ int qemuMonitorSetMemoryStatsPeriod(qemuMonitorPtr mon,
         return -1;
     }
 
-    if (qemuMonitorFindBalloonObjectPath(mon, mon->vm, "/") == 1) {
+    if (qemuMonitorInitBalloonObjectPath(mon) == 1) {
         ret = qemuMonitorJSONSetMemoryStatsPeriod(mon, mon->balloonpath,
                                                   period);
     }
-    mon->ballooninit = true;
     return ret;
 }
 
@@ -1745,6 +1881,44 @@ int qemuMonitorGetBlockStatsParamsNumber(qemuMonitorPtr mon,
     return ret;
 }
 
+/*
+ * Fetch the statistics of all block devices with a single query.
+ * Returns a hash table of qemuMonitorBlockStats keyed by the guest
+ * side device alias, or NULL on error.
+ */
+virHashTablePtr
+qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon)
+{
+    int ret;
+    virHashTablePtr table;
+
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return NULL;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("collecting all block statistics requires a JSON monitor"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return NULL;
+
+    ret = qemuMonitorJSONGetAllBlockStatsInfo(mon, table);
+
+    if (ret < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
 int qemuMonitorGetBlockExtent(qemuMonitorPtr mon,
                               const char *dev_name,
                               unsigned long long *extent)
@@ -47,6 +47,10 @@ typedef int (*qemuMonitorPasswordHandler)(qemuMonitorPtr mon,
                                           void *opaque);
 
 struct _qemuMonitorMessage {
+    /* Command ID the reply is tagged with by the JSON
+     * monitor, NULL if replies are matched by order */
+    char *id;
+
     int txFD;
 
     char *txBuffer;
@@ -66,6 +70,10 @@ struct _qemuMonitorMessage {
 
     qemuMonitorPasswordHandler passwordHandler;
     void *passwordOpaque;
+
+    /* Link in the monitor's queue of in-flight messages,
+     * private to qemu_monitor.c */
+    qemuMonitorMessagePtr next;
 };
 
 
@@ -208,6 +216,8 @@ qemuMonitorPtr qemuMonitorOpenFD(virDomainObjPtr vm,
 
 void qemuMonitorClose(qemuMonitorPtr mon);
 
+void qemuMonitorSetStreamParser(bool enable);
+
 int qemuMonitorSetCapabilities(qemuMonitorPtr mon);
 
 int qemuMonitorSetLink(qemuMonitorPtr mon,
@@ -338,6 +348,21 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                          int *nparams);
 
+typedef struct _qemuMonitorBlockStats qemuMonitorBlockStats;
+typedef qemuMonitorBlockStats *qemuMonitorBlockStatsPtr;
+struct _qemuMonitorBlockStats {
+    long long rd_req;
+    long long rd_bytes;
+    long long rd_total_times;
+    long long wr_req;
+    long long wr_bytes;
+    long long wr_total_times;
+    long long flush_req;
+    long long flush_total_times;
+};
+
+virHashTablePtr qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon);
+
 int qemuMonitorGetBlockExtent(qemuMonitorPtr mon,
                               const char *dev_name,
                               unsigned long long *extent);
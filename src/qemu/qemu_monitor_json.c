@@ -42,6 +42,7 @@
 #include "virerror.h"
 #include "virjson.h"
 #include "virstring.h"
+#include "c-ctype.h"
 #include "cpu/cpu_x86.h"
 
 #ifdef WITH_DTRACE_PROBES
@@ -146,22 +147,44 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+/*
+ * Find the in-flight message a reply belongs to. Replies carry
+ * the "id" of the command they answer; if QEMU could not parse
+ * the command, there's no id and since QMP handles commands in
+ * order the reply belongs to the oldest pending message.
+ */
+static qemuMonitorMessagePtr
+qemuMonitorJSONFindReplyMessage(qemuMonitorMessagePtr msgs,
+                                virJSONValuePtr reply)
+{
+    const char *id = virJSONValueObjectGetString(reply, "id");
+    qemuMonitorMessagePtr msg;
+
+    for (msg = msgs; msg; msg = msg->next) {
+        if (msg->finished || msg->txOffset != msg->txLength)
+            continue;
+        if (!id || STREQ_NULLABLE(msg->id, id))
+            return msg;
+    }
+
+    return NULL;
+}
+
+/* @text is the JSON text @obj was parsed from */
 static int
-qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
-                             const char *line,
-                             qemuMonitorMessagePtr msg)
+qemuMonitorJSONIOProcessValue(qemuMonitorPtr mon,
+                              virJSONValuePtr obj,
+                              const char *text,
+                              qemuMonitorMessagePtr msgs)
 {
-    virJSONValuePtr obj = NULL;
+    qemuMonitorMessagePtr msg;
     int ret = -1;
 
-    VIR_DEBUG("Line [%s]", line);
-
-    if (!(obj = virJSONValueFromString(line)))
-        goto cleanup;
+    VIR_DEBUG("Line [%s]", text);
 
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Parsed JSON reply '%s' isn't an object"), line);
+                       _("Parsed JSON reply '%s' isn't an object"), text);
         goto cleanup;
     }
 
@@ -169,24 +192,24 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
         ret = 0;
     } else if (virJSONValueObjectHasKey(obj, "event") == 1) {
         PROBE(QEMU_MONITOR_RECV_EVENT,
-              "mon=%p event=%s", mon, line);
+              "mon=%p event=%s", mon, text);
         ret = qemuMonitorJSONIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
         PROBE(QEMU_MONITOR_RECV_REPLY,
-              "mon=%p reply=%s", mon, line);
-        if (msg) {
+              "mon=%p reply=%s", mon, text);
+        if ((msg = qemuMonitorJSONFindReplyMessage(msgs, obj))) {
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
             ret = 0;
         } else {
             virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Unexpected JSON reply '%s'"), line);
+                           _("Unexpected JSON reply '%s'"), text);
         }
     } else {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unknown JSON reply '%s'"), line);
+                       _("Unknown JSON reply '%s'"), text);
     }
 
 cleanup:
@@ -194,14 +217,87 @@ cleanup:
     return ret;
 }
 
+static int
+qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
+                             const char *line,
+                             qemuMonitorMessagePtr msgs)
+{
+    virJSONValuePtr obj;
+
+    if (!(obj = virJSONValueFromString(line)))
+        return -1;
+
+    return qemuMonitorJSONIOProcessValue(mon, obj, line, msgs);
+}
+
+/*
+ * Replies and events are parsed straight out of the monitor buffer
+ * by the incremental @parser, which keeps its state across reads, so
+ * a large reply split over many reads is only scanned once and no
+ * copy of each value is needed.
+ */
+static int
+qemuMonitorJSONIOProcessStream(qemuMonitorPtr mon,
+                               virJSONStreamParserPtr parser,
+                               char *data,
+                               size_t len,
+                               qemuMonitorMessagePtr msgs)
+{
+    size_t used = 0;
+    ssize_t got;
+    virJSONValuePtr obj;
+
+    while (used < len) {
+        char *text = data + used;
+        char *end;
+        char c;
+        int rc;
+
+        if ((got = virJSONStreamParserFeed(parser, data + used,
+                                           len - used, &obj)) < 0)
+            return -1;
+        used += got;
+
+        if (!obj)
+            break;
+
+        /* The value is followed by its line ending or by the NUL
+         * terminating the buffer, so it can be terminated in place
+         * for the probes and error messages */
+        while (c_isspace(*text))
+            text++;
+        end = data + used;
+        c = *end;
+        *end = '\0';
+        rc = qemuMonitorJSONIOProcessValue(mon, obj, text, msgs);
+        *end = c;
+
+        if (rc < 0)
+            return -1;
+    }
+
+    return used;
+}
+
+/*
+ * Without a @parser, replies and events are split at LINE_ENDING and
+ * each line is parsed once it has been received whole.
+ */
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             virJSONStreamParserPtr parser,
+                             char *data,
                              size_t len,
-                             qemuMonitorMessagePtr msg)
+                             qemuMonitorMessagePtr msgs)
 {
     int used = 0;
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
 
+    if (parser) {
+        used = qemuMonitorJSONIOProcessStream(mon, parser, data, len, msgs);
+        VIR_DEBUG("Total used %d bytes out of %zd available in buffer", used, len);
+        return used;
+    }
+
     while (used < len) {
         char *nl = strstr(data + used, LINE_ENDING);
 
@@ -212,7 +308,7 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
                 return -1;
             used += got + strlen(LINE_ENDING);
             line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
+            if (qemuMonitorJSONIOProcessLine(mon, line, msgs) < 0) {
                 VIR_FREE(line);
                 return -1;
             }
@@ -261,6 +357,8 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
     msg.txLength = strlen(msg.txBuffer);
     msg.txFD = scm_fd;
 
+    msg.id = id;
+
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
     ret = qemuMonitorSend(mon, &msg);
@@ -1606,37 +1704,60 @@ cleanup:
 }
 
 
-int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
-                                     const char *dev_name,
-                                     long long *rd_req,
-                                     long long *rd_bytes,
-                                     long long *rd_total_times,
-                                     long long *wr_req,
-                                     long long *wr_bytes,
-                                     long long *wr_total_times,
-                                     long long *flush_req,
-                                     long long *flush_total_times,
-                                     long long *errs)
+static int
+qemuMonitorJSONGetBlockStatsEntry(virJSONValuePtr dev,
+                                  qemuMonitorBlockStatsPtr bstats)
+{
+    virJSONValuePtr stats;
+
+    bstats->rd_req = bstats->rd_bytes = bstats->rd_total_times = -1;
+    bstats->wr_req = bstats->wr_bytes = bstats->wr_total_times = -1;
+    bstats->flush_req = bstats->flush_total_times = -1;
+
+    if ((stats = virJSONValueObjectGet(dev, "stats")) == NULL ||
+        stats->type != VIR_JSON_TYPE_OBJECT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats stats entry was not in expected format"));
+        return -1;
+    }
+
+#define QEMU_MONITOR_BLOCK_STAT(name, var, optional)                        \
+    if ((!optional || virJSONValueObjectHasKey(stats, name)) &&             \
+        virJSONValueObjectGetNumberLong(stats, name, &bstats->var) < 0) {   \
+        virReportError(VIR_ERR_INTERNAL_ERROR,                              \
+                       _("cannot read %s statistic"), name);                \
+        return -1;                                                          \
+    }
+
+    QEMU_MONITOR_BLOCK_STAT("rd_bytes", rd_bytes, false);
+    QEMU_MONITOR_BLOCK_STAT("rd_operations", rd_req, false);
+    QEMU_MONITOR_BLOCK_STAT("rd_total_time_ns", rd_total_times, true);
+    QEMU_MONITOR_BLOCK_STAT("wr_bytes", wr_bytes, false);
+    QEMU_MONITOR_BLOCK_STAT("wr_operations", wr_req, false);
+    QEMU_MONITOR_BLOCK_STAT("wr_total_time_ns", wr_total_times, true);
+    QEMU_MONITOR_BLOCK_STAT("flush_operations", flush_req, true);
+    QEMU_MONITOR_BLOCK_STAT("flush_total_time_ns", flush_total_times, true);
+
+#undef QEMU_MONITOR_BLOCK_STAT
+
+    return 0;
+}
+
+
+/*
+ * Fill @table with the statistics of every block device reported by a
+ * single query-blockstats, keyed by the guest side device name.
+ */
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
 {
     int ret;
     size_t i;
-    bool found = false;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-blockstats",
                                                      NULL);
     virJSONValuePtr reply = NULL;
     virJSONValuePtr devices;
-
-    *rd_req = *rd_bytes = -1;
-    *wr_req = *wr_bytes = *errs = -1;
-
-    if (rd_total_times)
-        *rd_total_times = -1;
-    if (wr_total_times)
-        *wr_total_times = -1;
-    if (flush_req)
-        *flush_req = -1;
-    if (flush_total_times)
-        *flush_total_times = -1;
+    qemuMonitorBlockStatsPtr bstats = NULL;
 
     if (!cmd)
         return -1;
@@ -1658,8 +1779,8 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
-        virJSONValuePtr stats;
         const char *thisdev;
+
         if (!dev || dev->type != VIR_JSON_TYPE_OBJECT) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not in expected format"));
@@ -1673,95 +1794,88 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
         }
 
         /* New QEMU has separate names for host & guest side of the disk
-         * and libvirt gives the host side a 'drive-' prefix. The passed
-         * in dev_name is the guest side though
+         * and libvirt gives the host side a 'drive-' prefix. The table
+         * is keyed by the guest side though
          */
         if (STRPREFIX(thisdev, QEMU_DRIVE_HOST_PREFIX))
             thisdev += strlen(QEMU_DRIVE_HOST_PREFIX);
 
-        if (STRNEQ(thisdev, dev_name))
-            continue;
-
-        found = true;
-        if ((stats = virJSONValueObjectGet(dev, "stats")) == NULL ||
-            stats->type != VIR_JSON_TYPE_OBJECT) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats stats entry was not in expected format"));
+        if (VIR_ALLOC(bstats) < 0)
             goto cleanup;
-        }
 
-        if (virJSONValueObjectGetNumberLong(stats, "rd_bytes", rd_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_bytes");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "rd_operations", rd_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                            "rd_operations");
-            goto cleanup;
-        }
-        if (rd_total_times &&
-            virJSONValueObjectHasKey(stats, "rd_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "rd_total_time_ns",
-                                             rd_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_total_time_ns");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_bytes", wr_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_bytes");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_operations", wr_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_operations");
+        if (qemuMonitorJSONGetBlockStatsEntry(dev, bstats) < 0)
             goto cleanup;
-        }
-        if (wr_total_times &&
-            virJSONValueObjectHasKey(stats, "wr_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "wr_total_time_ns",
-                                             wr_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_total_time_ns");
-            goto cleanup;
-        }
-        if (flush_req &&
-            virJSONValueObjectHasKey(stats, "flush_operations") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_operations",
-                                            flush_req) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_operations");
-            goto cleanup;
-        }
-        if (flush_total_times &&
-            virJSONValueObjectHasKey(stats, "flush_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_total_time_ns",
-                                            flush_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_total_time_ns");
+
+        if (virHashAddEntry(table, thisdev, bstats) < 0)
             goto cleanup;
-        }
+        bstats = NULL;
     }
+    ret = 0;
 
-    if (!found) {
+cleanup:
+    VIR_FREE(bstats);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
+                                     const char *dev_name,
+                                     long long *rd_req,
+                                     long long *rd_bytes,
+                                     long long *rd_total_times,
+                                     long long *wr_req,
+                                     long long *wr_bytes,
+                                     long long *wr_total_times,
+                                     long long *flush_req,
+                                     long long *flush_total_times,
+                                     long long *errs)
+{
+    int ret = -1;
+    virHashTablePtr table;
+    qemuMonitorBlockStatsPtr bstats;
+
+    *rd_req = *rd_bytes = -1;
+    *wr_req = *wr_bytes = *errs = -1;
+
+    if (rd_total_times)
+        *rd_total_times = -1;
+    if (wr_total_times)
+        *wr_total_times = -1;
+    if (flush_req)
+        *flush_req = -1;
+    if (flush_total_times)
+        *flush_total_times = -1;
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return -1;
+
+    if (qemuMonitorJSONGetAllBlockStatsInfo(mon, table) < 0)
+        goto cleanup;
+
+    if (!(bstats = virHashLookup(table, dev_name))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot find statistics for device '%s'"), dev_name);
         goto cleanup;
     }
+
+    *rd_req = bstats->rd_req;
+    *rd_bytes = bstats->rd_bytes;
+    *wr_req = bstats->wr_req;
+    *wr_bytes = bstats->wr_bytes;
+    if (rd_total_times)
+        *rd_total_times = bstats->rd_total_times;
+    if (wr_total_times)
+        *wr_total_times = bstats->wr_total_times;
+    if (flush_req)
+        *flush_req = bstats->flush_req;
+    if (flush_total_times)
+        *flush_total_times = bstats->flush_total_times;
     ret = 0;
 
 cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    virHashFree(table);
     return ret;
 }
 
@@ -30,11 +30,13 @@
 # include "qemu_monitor.h"
 # include "virbitmap.h"
 # include "cpu/cpu.h"
+# include "virjson.h"
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             virJSONStreamParserPtr parser,
+                             char *data,
                              size_t len,
-                             qemuMonitorMessagePtr msg);
+                             qemuMonitorMessagePtr msgs);
 
 int qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
                                       const char *cmd,
@@ -79,6 +81,8 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
                                      long long *flush_req,
                                      long long *flush_total_times,
                                      long long *errs);
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table);
 int qemuMonitorJSONGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                              int *nparams);
 int qemuMonitorJSONGetBlockExtent(qemuMonitorPtr mon,
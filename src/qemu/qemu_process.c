@@ -3027,12 +3027,73 @@ cleanup:
     return ret;
 }
 
+/* Statistics shared by all the reconnect jobs, reported
+ * once the last of them finishes */
+typedef struct _qemuProcessReconnectStats qemuProcessReconnectStats;
+typedef qemuProcessReconnectStats *qemuProcessReconnectStatsPtr;
+struct _qemuProcessReconnectStats {
+    unsigned long long start;
+
+    /* Atomic access only */
+    int pending;
+    int ndomains;
+    int monitorTime;
+    int cgroupTime;
+    int capsTime;
+};
+
 struct qemuProcessReconnectData {
     virConnectPtr conn;
     virQEMUDriverPtr driver;
     void *payload;
     struct qemuDomainJobObj oldjob;
+    qemuProcessReconnectStatsPtr stats;
 };
+
+
+static unsigned long long
+qemuProcessReconnectTimeStart(void)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return 0;
+    }
+    return now;
+}
+
+/* Add the time elapsed since @start to the @total of a phase */
+static void
+qemuProcessReconnectTimeEnd(int *total,
+                            unsigned long long start)
+{
+    unsigned long long now = qemuProcessReconnectTimeStart();
+
+    if (start && now > start)
+        virAtomicIntAdd(total, now - start);
+}
+
+
+static void
+qemuProcessReconnectStatsRelease(qemuProcessReconnectStatsPtr stats)
+{
+    unsigned long long now;
+
+    if (!virAtomicIntDecAndTest(&stats->pending))
+        return;
+
+    now = qemuProcessReconnectTimeStart();
+    VIR_INFO("Reconnected to %d domains in %llu ms "
+             "(monitor %d ms, cgroups %d ms, capabilities %d ms in total)",
+             virAtomicIntGet(&stats->ndomains),
+             now > stats->start ? now - stats->start : 0,
+             virAtomicIntGet(&stats->monitorTime),
+             virAtomicIntGet(&stats->cgroupTime),
+             virAtomicIntGet(&stats->capsTime));
+    VIR_FREE(stats);
+}
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
@@ -3042,14 +3103,17 @@ struct qemuProcessReconnectData {
  * so that we now have to close it.
  */
 static void
-qemuProcessReconnect(void *opaque)
+qemuProcessReconnect(void *jobdata,
+                     void *opaque ATTRIBUTE_UNUSED)
 {
-    struct qemuProcessReconnectData *data = opaque;
+    struct qemuProcessReconnectData *data = jobdata;
     virQEMUDriverPtr driver = data->driver;
     virDomainObjPtr obj = data->payload;
     qemuDomainObjPrivatePtr priv;
     virConnectPtr conn = data->conn;
+    qemuProcessReconnectStatsPtr stats = data->stats;
     struct qemuDomainJobObj oldjob;
+    unsigned long long start;
     int state;
     int reason;
     virQEMUDriverConfigPtr cfg;
@@ -3066,16 +3130,16 @@ qemuProcessReconnect(void *opaque)
 
     priv = obj->privateData;
 
-    /* Job was started by the caller for us */
+    /* Job was started by the caller for us, together with an extra
+     * reference because we can't allow 'vm' to be deleted if
+     * qemuConnectMonitor() failed */
     qemuDomainObjTransferJob(obj);
 
-    /* Hold an extra reference because we can't allow 'vm' to be
-     * deleted if qemuConnectMonitor() failed */
-    virObjectRef(obj);
-
     /* XXX check PID liveliness & EXE path */
+    start = qemuProcessReconnectTimeStart();
     if (qemuConnectMonitor(driver, obj, -1) < 0)
         goto error;
+    qemuProcessReconnectTimeEnd(&stats->monitorTime, start);
 
     /* Failure to connect to agent shouldn't be fatal */
     if (qemuConnectAgent(driver, obj) < 0) {
@@ -3095,8 +3159,10 @@ qemuProcessReconnect(void *opaque)
     if (qemuUpdateActiveScsiHostdevs(driver, obj->def) < 0)
         goto error;
 
+    start = qemuProcessReconnectTimeStart();
     if (qemuConnectCgroup(driver, obj) < 0)
         goto error;
+    qemuProcessReconnectTimeEnd(&stats->cgroupTime, start);
 
     /* XXX: Need to change as long as lock is introduced for
      * qemu_driver->sharedDevices.
@@ -3126,10 +3192,12 @@ qemuProcessReconnect(void *opaque)
     /* If upgrading from old libvirtd we won't have found any
      * caps in the domain status, so re-query them
      */
+    start = qemuProcessReconnectTimeStart();
     if (!priv->qemuCaps &&
         !(priv->qemuCaps = virQEMUCapsCacheLookupCopy(driver->qemuCapsCache,
                                                       obj->def->emulator)))
         goto error;
+    qemuProcessReconnectTimeEnd(&stats->capsTime, start);
 
     /* In case the domain shutdown while we were not running,
      * we need to finish the shutdown process. And we need to do it after
@@ -3199,6 +3267,8 @@ endjob:
 
     virConnectClose(conn);
     virObjectUnref(cfg);
+    virAtomicIntInc(&stats->ndomains);
+    qemuProcessReconnectStatsRelease(stats);
 
     return;
 
@@ -3234,13 +3304,13 @@ error:
     }
     virConnectClose(conn);
     virObjectUnref(cfg);
+    qemuProcessReconnectStatsRelease(stats);
 }
 
 static int
 qemuProcessReconnectHelper(virDomainObjPtr obj,
                            void *opaque)
 {
-    virThread thread;
     struct qemuProcessReconnectData *src = opaque;
     struct qemuProcessReconnectData *data;
 
@@ -3254,7 +3324,12 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     data->payload = obj;
 
     /*
-     * We create a separate thread to run qemuProcessReconnect in it.
+     * We queue a job running qemuProcessReconnect in a separate thread
+     * from the driver's reconnect pool, which bounds the number of
+     * domains being reconnected at once.
+     * The job is taken here rather than by the worker, so that the
+     * domain, active but without a monitor, is never left without a
+     * job while it waits in the queue.
      * However, qemuProcessReconnect needs to:
      * 1. just before monitor reconnect do lightweight MonitorEnter
      *    (increase VM refcount, unlock VM & driver)
@@ -3273,39 +3348,45 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     qemuDomainObjRestoreJob(obj, &data->oldjob);
 
     if (qemuDomainObjBeginJob(src->driver, obj, QEMU_JOB_MODIFY) < 0)
-        goto error;
+        goto killvm;
+
+    /* Released by qemuProcessReconnect */
+    virObjectRef(obj);
 
     /* Since we close the connection later on, we have to make sure
      * that the threads we start see a valid connection throughout their
      * lifetime. We simply increase the reference counter here.
      */
     virConnectRef(data->conn);
+    virAtomicIntInc(&data->stats->pending);
 
-    if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
+    if (virThreadPoolSendJob(src->driver->reconnectPool, 0, data) < 0) {
 
         virConnectClose(data->conn);
+        ignore_value(virAtomicIntDecAndTest(&data->stats->pending));
 
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Could not create thread. QEMU initialization "
                          "might be incomplete"));
-        if (!qemuDomainObjEndJob(src->driver, obj)) {
-            obj = NULL;
-        } else if (virObjectUnref(obj)) {
-           /* We can't spawn a thread and thus connect to monitor.
-            * Kill qemu */
-            qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED, 0);
-            if (!obj->persistent)
-                qemuDomainRemoveInactive(src->driver, obj);
-            else
-                virObjectUnlock(obj);
-        }
-        goto error;
+        if (!qemuDomainObjEndJob(src->driver, obj) ||
+            !virObjectUnref(obj))
+            goto error;
+        goto killvm;
     }
 
     virObjectUnlock(obj);
 
     return 0;
 
+killvm:
+    /* We can't connect to the monitor, and a running domain must not
+     * be left without one. Kill qemu */
+    qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED, 0);
+    if (!obj->persistent)
+        qemuDomainRemoveInactive(src->driver, obj);
+    else
+        virObjectUnlock(obj);
+
 error:
     VIR_FREE(data);
     return -1;
@@ -3315,13 +3396,36 @@ error:
  * qemuProcessReconnectAll
  *
  * Try to re-open the resources for live VMs that we care
- * about.
+ * about, using up to startup_workers threads. This only queues
+ * the reconnection, which completes asynchronously.
  */
-void
+int
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+    int ret = -1;
+
+    if (!(driver->reconnectPool = virThreadPoolNew(0, cfg->startupWorkers, 0,
+                                                   qemuProcessReconnect,
+                                                   NULL)))
+        goto cleanup;
+
+    /* The reference held here keeps the statistics from being
+     * reported until all the domains have been queued */
+    if (VIR_ALLOC(data.stats) < 0)
+        goto cleanup;
+    data.stats->start = qemuProcessReconnectTimeStart();
+    data.stats->pending = 1;
+
     virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+
+    qemuProcessReconnectStatsRelease(data.stats);
+    ret = 0;
+
+cleanup:
+    virObjectUnref(cfg);
+    return ret;
 }
 
 static int
@@ -3572,7 +3676,9 @@ int qemuProcessStart(virConnectPtr conn,
     if (virDomainObjSetDefTransient(caps, driver->xmlopt, vm, true) < 0)
         goto cleanup;
 
-    vm->def->id = qemuDriverAllocateID(driver);
+    if (virDomainObjListSetID(driver->domains, vm,
+                              qemuDriverAllocateID(driver)) < 0)
+        goto cleanup;
     qemuDomainSetFakeReboot(driver, vm, false);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_UNKNOWN);
 
@@ -4163,7 +4269,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
      * can lock the vm, and then call qemuProcessStop(). So we should
      * set vm->def->id to -1 here to avoid qemuProcessStop() to be called twice.
      */
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
@@ -4431,7 +4537,9 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     if (virDomainObjSetDefTransient(caps, driver->xmlopt, vm, true) < 0)
         goto error;
 
-    vm->def->id = qemuDriverAllocateID(driver);
+    if (virDomainObjListSetID(driver->domains, vm,
+                              qemuDriverAllocateID(driver)) < 0)
+        goto error;
 
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
         driver->inhibitCallback(true, driver->inhibitOpaque);
@@ -40,7 +40,7 @@ int qemuProcessStopCPUs(virQEMUDriverPtr driver,
                         enum qemuDomainAsyncJob asyncJob);
 
 void qemuProcessAutostartAll(virQEMUDriverPtr driver);
-void qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver);
+int qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver);
 
 int qemuProcessAssignPCIAddresses(virDomainDefPtr def);
 
@@ -5004,11 +5004,41 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
+{
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x", st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
@@ -5024,7 +5054,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -5034,6 +5065,30 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+    virNetClientStreamPtr privst = st->privateData;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    return virNetClientStreamRecvHole(privst, length, flags);
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -5206,7 +5261,10 @@ cleanup:
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamEventAddCallback = remoteStreamEventAddCallback,
@@ -5755,6 +5813,105 @@ done:
 }
 
 
+static int
+remoteConnectGetAllDomainStats(virConnectPtr conn,
+                               virDomainPtr *doms,
+                               unsigned int ndoms,
+                               unsigned int stats,
+                               virDomainStatsRecordPtr **retStats,
+                               unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i;
+    remote_connect_get_all_domain_stats_args args;
+    remote_connect_get_all_domain_stats_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+
+    if (ndoms) {
+        if (ndoms > REMOTE_DOMAIN_LIST_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("Too many domains '%u' for limit '%d'"),
+                           ndoms, REMOTE_DOMAIN_LIST_MAX);
+            goto done;
+        }
+
+        if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0)
+            goto done;
+
+        for (i = 0; i < ndoms; i++)
+            make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    }
+    args.doms.doms_len = ndoms;
+
+    args.stats = stats;
+    args.flags = flags;
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("Too many domain stats records '%d' for limit '%d'"),
+                       ret.retStats.retStats_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.retStats.retStats_len; i++) {
+        remote_domain_stats_record *rec = ret.retStats.retStats_val + i;
+
+        if (VIR_ALLOC(elem) < 0)
+            goto cleanup;
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        if (remoteDeserializeTypedParameters(rec->params.params_val,
+                                             rec->params.params_len,
+                                             REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                             &elem->params,
+                                             &elem->nparams) < 0)
+            goto cleanup;
+
+        tmpret[i] = elem;
+        elem = NULL;
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = ret.retStats.retStats_len;
+
+cleanup:
+    if (elem) {
+        if (elem->dom)
+            virDomainFree(elem->dom);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret);
+
+done:
+    xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_args,
+             (char *) &args);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
 static int
 remoteDomainOpenGraphics(virDomainPtr dom,
                          unsigned int idx,
@@ -7149,6 +7306,7 @@ static virDriver remote_driver = {
     .domainMigrateFinish3Params = remoteDomainMigrateFinish3Params, /* 1.1.0 */
     .domainMigrateConfirm3Params = remoteDomainMigrateConfirm3Params, /* 1.1.0 */
     .connectGetCPUModelNames = remoteConnectGetCPUModelNames, /* 1.1.3 */
+    .connectGetAllDomainStats = remoteConnectGetAllDomainStats, /* 1.2.1 */
 };
 
 static virNetworkDriver network_driver = {
@@ -258,6 +258,8 @@ while (<PROTOCOL>) {
             $calls{$name}->{streamflag} = "none";
         }
 
+        $calls{$name}->{sparseflag} = $opts{sparseflag};
+
         $calls{$name}->{acl} = $opts{acl};
         $calls{$name}->{aclfilter} = $opts{aclfilter};
 
@@ -908,7 +910,12 @@ elsif ($mode eq "server") {
             print "    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))\n";
             print "        goto cleanup;\n";
             print "\n";
-            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header)))\n";
+            if ($call->{sparseflag}) {
+                print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header,\n";
+                print "                                            args->flags & $call->{sparseflag})))\n";
+            } else {
+                print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header, false)))\n";
+            }
             print "        goto cleanup;\n";
             print "\n";
         }
@@ -1030,7 +1037,7 @@ elsif ($mode eq "server") {
 
     print "virNetServerProgramProc ${structprefix}Procs[] = {\n";
     for ($id = 0 ; $id <= $#calls ; $id++) {
-        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority);
+        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority, $procname);
 
         if (defined $calls[$id] && !$calls[$id]->{msg}) {
             $comment = "/* Method $calls[$id]->{ProcName} => $id */";
@@ -1041,6 +1048,7 @@ elsif ($mode eq "server") {
             $retlen = $rettype ne "void" ? "sizeof($rettype)" : "0";
             $argfilter = $argtype ne "void" ? "xdr_$argtype" : "xdr_void";
             $retfilter = $rettype ne "void" ? "xdr_$rettype" : "xdr_void";
+            $procname = "\"$calls[$id]->{ProcName}\"";
         } else {
             if ($calls[$id]->{msg}) {
                 $comment = "/* Async event $calls[$id]->{ProcName} => $id */";
@@ -1051,11 +1059,12 @@ elsif ($mode eq "server") {
             $arglen = $retlen = 0;
             $argfilter = "xdr_void";
             $retfilter = "xdr_void";
+            $procname = "NULL";
         }
 
     $priority = defined $calls[$id]->{priority} ? $calls[$id]->{priority} : 0;
 
-        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority\n},\n";
+        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority,\n   $procname\n},\n";
     }
     print "};\n";
     print "size_t ${structprefix}NProcs = ARRAY_CARDINALITY(${structprefix}Procs);\n";
@@ -31,6 +31,13 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+typedef struct _virNetClientStreamHole virNetClientStreamHole;
+typedef virNetClientStreamHole *virNetClientStreamHolePtr;
+struct _virNetClientStreamHole {
+    size_t pos;                 /* offset into the incoming data */
+    unsigned long long length;
+};
+
 struct _virNetClientStream {
     virObjectLockable parent;
 
@@ -52,6 +59,11 @@ struct _virNetClientStream {
     size_t incomingLength;
     bool incomingEOF;
 
+    /* Holes of a sparse stream, in the order they were received
+     * and placed relative to the data still in @incoming */
+    virNetClientStreamHolePtr holes;
+    size_t nholes;
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -86,7 +98,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingOffset || st->incomingEOF || st->nholes) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -108,7 +120,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingOffset || st->incomingEOF || st->nholes))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -160,6 +172,7 @@ void virNetClientStreamDispose(void *obj)
 
     virResetError(&st->err);
     VIR_FREE(st->incoming);
+    VIR_FREE(st->holes);
     virObjectUnref(st->prog);
 }
 
@@ -259,6 +272,39 @@ cleanup:
 }
 
 
+static int
+virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                            virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    virNetClientStreamHole hole;
+
+    memset(&data, 0, sizeof(data));
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    if (data.length < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("invalid hole length %lld in stream"),
+                       (long long) data.length);
+        return -1;
+    }
+
+    /* Adjacent holes are merged */
+    if (st->nholes &&
+        st->holes[st->nholes - 1].pos == st->incomingOffset) {
+        st->holes[st->nholes - 1].length += data.length;
+        return 0;
+    }
+
+    hole.pos = st->incomingOffset;
+    hole.length = data.length;
+    return VIR_APPEND_ELEMENT(st->holes, st->nholes, hole);
+}
+
+
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg)
 {
@@ -266,6 +312,17 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     size_t need;
 
     virObjectLock(st);
+    if (msg->header.type == VIR_NET_STREAM_HOLE) {
+        if (virNetClientStreamQueueHole(st, msg) < 0)
+            goto cleanup;
+
+        VIR_DEBUG("Stream incoming hole at %zu holes %zu",
+                  st->incomingOffset, st->nholes);
+        virNetClientStreamEventTimerUpdate(st);
+        ret = 0;
+        goto cleanup;
+    }
+
     need = msg->bufferLength - msg->bufferOffset;
     if (need) {
         size_t avail = st->incomingLength - st->incomingOffset;
@@ -353,17 +410,71 @@ error:
     return -1;
 }
 
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg;
+    virNetStreamHole data;
+
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    /* Like data packets, holes are async fire&forget */
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto error;
+
+    virNetMessageFree(msg);
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    size_t i;
+
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virObjectLock(st);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingOffset && !st->incomingEOF && !st->nholes) {
         virNetMessagePtr msg;
         int ret;
 
@@ -393,11 +504,30 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
+    VIR_DEBUG("After IO %zu holes %zu", st->incomingOffset, st->nholes);
+    if (st->nholes && st->holes[0].pos == 0) {
+        int want;
+
+        if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+            rv = -3;
+            goto cleanup;
+        }
+
+        /* The caller does not know about holes, hand it zeros */
+        want = MIN(nbytes, INT_MAX);
+        if (want > st->holes[0].length)
+            want = st->holes[0].length;
+        memset(data, 0, want);
+        st->holes[0].length -= want;
+        if (!st->holes[0].length)
+            VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+        rv = want;
+    } else if (st->incomingOffset) {
         int want = st->incomingOffset;
         if (want > nbytes)
             want = nbytes;
+        if (st->nholes && want > st->holes[0].pos)
+            want = st->holes[0].pos;
         memcpy(data, st->incoming, want);
         if (want < st->incomingOffset) {
             memmove(st->incoming, st->incoming + want, st->incomingOffset - want);
@@ -406,6 +536,8 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             VIR_FREE(st->incoming);
             st->incomingOffset = st->incomingLength = 0;
         }
+        for (i = 0; i < st->nholes; i++)
+            st->holes[i].pos -= want;
         rv = want;
     } else {
         rv = 0;
@@ -419,6 +551,34 @@ cleanup:
 }
 
 
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+
+    virCheckFlags(0, -1);
+
+    virObjectLock(st);
+
+    *length = 0;
+    if (st->nholes && st->holes[0].pos == 0) {
+        if (st->holes[0].length > LLONG_MAX) {
+            *length = LLONG_MAX;
+            st->holes[0].length -= LLONG_MAX;
+        } else {
+            *length = st->holes[0].length;
+            VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+        }
+    }
+
+    virNetClientStreamEventTimerUpdate(st);
+
+    virObjectUnlock(st);
+    return 0;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
@@ -53,11 +53,21 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  const char *data,
                                  size_t nbytes);
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags);
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock);
+                                 bool nonblock,
+                                 unsigned int flags);
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags);
 
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
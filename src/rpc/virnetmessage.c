@@ -30,9 +30,202 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Memory kept around by a pool in each buffer size class */
+#define VIR_NET_MESSAGE_POOL_CLASS_BYTES (4 * 1024 * 1024)
+/* Idle message structs kept around by a pool */
+#define VIR_NET_MESSAGE_POOL_MAX_MSGS 1024
+
+/*
+ * A pool recycles the messages of a server along with their buffers,
+ * so that dispatching small calls at a high rate does not hit malloc
+ * for each of them. Idle buffers are chained through their first
+ * bytes, which is why the smallest class can hold a pointer.
+ */
+struct _virNetMessagePool {
+    virObjectLockable parent;
+
+    virNetMessagePtr msgs;
+    size_t nmsgs;
+    char *buffers[VIR_NET_MESSAGE_POOL_CLASSES];
+
+    virNetMessagePoolStats stats;
+};
+
+static virClassPtr virNetMessagePoolClass;
+static void virNetMessagePoolDispose(void *obj);
+
+static int virNetMessagePoolOnceInit(void)
+{
+    if (!(virNetMessagePoolClass = virClassNew(virClassForObjectLockable(),
+                                               "virNetMessagePool",
+                                               sizeof(virNetMessagePool),
+                                               virNetMessagePoolDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
+
+static size_t virNetMessagePoolClassSize(size_t cls)
+{
+    if (cls == 0)
+        return 4096;
+    return ((size_t)VIR_NET_MESSAGE_INITIAL << (2 * (cls - 1))) +
+        VIR_NET_MESSAGE_LEN_MAX;
+}
+
+
+virNetMessagePoolPtr virNetMessagePoolNew(void)
+{
+    virNetMessagePoolPtr pool;
+    size_t i;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return NULL;
+
+    if (!(pool = virObjectLockableNew(virNetMessagePoolClass)))
+        return NULL;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++)
+        pool->stats.bufferSize[i] = virNetMessagePoolClassSize(i);
+
+    return pool;
+}
+
+
+static void virNetMessagePoolDispose(void *obj)
+{
+    virNetMessagePoolPtr pool = obj;
+    virNetMessagePtr msg;
+    char *buf;
+    size_t i;
+
+    VIR_DEBUG("pool=%p msgHits=%llu msgMisses=%llu",
+              pool, pool->stats.msgHits, pool->stats.msgMisses);
+
+    while ((msg = pool->msgs)) {
+        pool->msgs = msg->next;
+        VIR_FREE(msg);
+    }
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        VIR_DEBUG("pool=%p size=%zu hits=%llu misses=%llu",
+                  pool, pool->stats.bufferSize[i],
+                  pool->stats.bufferHits[i], pool->stats.bufferMisses[i]);
+        while ((buf = pool->buffers[i])) {
+            memcpy(&pool->buffers[i], buf, sizeof(buf));
+            VIR_FREE(buf);
+        }
+    }
+}
+
+
+/**
+ * virNetMessagePoolGet:
+ * @pool: the pool to take the message from, or NULL
+ * @tracked: whether the message counts against the client requests
+ *
+ * Like virNetMessageNew, but the message is recycled from @pool when
+ * possible and goes back to it once freed. The buffer of a pooled
+ * message must only be allocated with virNetMessageResizeBuffer.
+ *
+ * Returns the message or NULL on error.
+ */
+virNetMessagePtr virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                                      bool tracked)
+{
+    virNetMessagePtr msg;
+
+    if (!pool)
+        return virNetMessageNew(tracked);
+
+    virObjectLock(pool);
+    if ((msg = pool->msgs)) {
+        pool->msgs = msg->next;
+        pool->nmsgs--;
+        pool->stats.msgHits++;
+    } else {
+        pool->stats.msgMisses++;
+    }
+    virObjectUnlock(pool);
+
+    if (!msg && VIR_ALLOC(msg) < 0)
+        return NULL;
+
+    msg->next = NULL;
+    msg->tracked = tracked;
+    msg->pool = virObjectRef(pool);
+    VIR_DEBUG("msg=%p tracked=%d pool=%p", msg, tracked, pool);
+
+    return msg;
+}
+
+
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               virNetMessagePoolStatsPtr stats)
+{
+    virObjectLock(pool);
+    *stats = pool->stats;
+    virObjectUnlock(pool);
+}
+
+
+static char *virNetMessagePoolTakeBuffer(virNetMessagePoolPtr pool,
+                                         size_t cls)
+{
+    char *buf;
+
+    virObjectLock(pool);
+    if ((buf = pool->buffers[cls])) {
+        memcpy(&pool->buffers[cls], buf, sizeof(buf));
+        pool->stats.bufferCached[cls]--;
+        pool->stats.bufferHits[cls]++;
+    } else {
+        pool->stats.bufferMisses[cls]++;
+    }
+    virObjectUnlock(pool);
+
+    if (!buf)
+        ignore_value(VIR_ALLOC_N(buf, virNetMessagePoolClassSize(cls)));
+
+    return buf;
+}
+
+
+/* Call with the pool locked */
+static void virNetMessagePoolPutBuffer(virNetMessagePoolPtr pool,
+                                       char *buf,
+                                       size_t size)
+{
+    size_t cls;
+
+    if (!buf)
+        return;
+
+    for (cls = 0; cls < VIR_NET_MESSAGE_POOL_CLASSES; cls++) {
+        if (pool->stats.bufferSize[cls] != size)
+            continue;
+
+        if (pool->stats.bufferCached[cls] * size <
+            VIR_NET_MESSAGE_POOL_CLASS_BYTES) {
+            memcpy(buf, &pool->buffers[cls], sizeof(buf));
+            pool->buffers[cls] = buf;
+            pool->stats.bufferCached[cls]++;
+            return;
+        }
+        break;
+    }
+
+    VIR_FREE(buf);
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -47,9 +240,16 @@ virNetMessagePtr virNetMessageNew(bool tracked)
 }
 
 
+/*
+ * Pooled messages keep their buffer, only its length is reset,
+ * so the message can be refilled without allocating.
+ */
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
+    virNetMessagePoolPtr pool = msg->pool;
+    char *buffer = NULL;
+    size_t bufferAlloc = 0;
     size_t i;
 
     VIR_DEBUG("msg=%p nfds=%zu", msg, msg->nfds);
@@ -57,15 +257,25 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0; i < msg->nfds; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg->buffer);
+    if (pool) {
+        buffer = msg->buffer;
+        bufferAlloc = msg->bufferAlloc;
+    } else {
+        VIR_FREE(msg->buffer);
+    }
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
+    msg->pool = pool;
+    msg->buffer = buffer;
+    msg->bufferAlloc = bufferAlloc;
 }
 
 
 void virNetMessageFree(virNetMessagePtr msg)
 {
     size_t i;
+    virNetMessagePoolPtr pool;
+
     if (!msg)
         return;
 
@@ -76,9 +286,84 @@ void virNetMessageFree(virNetMessagePtr msg)
 
     for (i = 0; i < msg->nfds; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
-    VIR_FREE(msg->buffer);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg);
+
+    if (!(pool = msg->pool)) {
+        VIR_FREE(msg->buffer);
+        VIR_FREE(msg);
+        return;
+    }
+
+    virObjectLock(pool);
+    virNetMessagePoolPutBuffer(pool, msg->buffer, msg->bufferAlloc);
+    if (pool->nmsgs < VIR_NET_MESSAGE_POOL_MAX_MSGS) {
+        memset(msg, 0, sizeof(*msg));
+        msg->next = pool->msgs;
+        pool->msgs = msg;
+        pool->nmsgs++;
+    } else {
+        VIR_FREE(msg);
+    }
+    virObjectUnlock(pool);
+    virObjectUnref(pool);
+}
+
+
+/**
+ * virNetMessageResizeBuffer:
+ * @msg: the message
+ * @len: the new length of the message buffer
+ *
+ * Make the buffer of @msg hold @len bytes and set its length. The
+ * data already in the buffer is kept. Pooled messages get a buffer
+ * of the next size class from their pool and only need a new one
+ * when @len exceeds the one they already have.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int virNetMessageResizeBuffer(virNetMessagePtr msg,
+                              size_t len)
+{
+    size_t cls;
+    char *buf;
+
+    if (!msg->pool) {
+        if (VIR_REALLOC_N(msg->buffer, len) < 0)
+            return -1;
+        msg->bufferAlloc = len;
+        msg->bufferLength = len;
+        return 0;
+    }
+
+    if (len > msg->bufferAlloc) {
+        for (cls = 0; cls < VIR_NET_MESSAGE_POOL_CLASSES; cls++) {
+            if (virNetMessagePoolClassSize(cls) >= len)
+                break;
+        }
+
+        if (cls == VIR_NET_MESSAGE_POOL_CLASSES) {
+            /* Too large to be worth keeping around */
+            if (VIR_REALLOC_N(msg->buffer, len) < 0)
+                return -1;
+            msg->bufferAlloc = len;
+        } else {
+            if (!(buf = virNetMessagePoolTakeBuffer(msg->pool, cls)))
+                return -1;
+            if (msg->buffer)
+                memcpy(buf, msg->buffer, MIN(msg->bufferLength, len));
+
+            virObjectLock(msg->pool);
+            virNetMessagePoolPutBuffer(msg->pool, msg->buffer,
+                                       msg->bufferAlloc);
+            virObjectUnlock(msg->pool);
+
+            msg->buffer = buf;
+            msg->bufferAlloc = virNetMessagePoolClassSize(cls);
+        }
+    }
+
+    msg->bufferLength = len;
+    return 0;
 }
 
 void virNetMessageQueuePush(virNetMessagePtr *queue, virNetMessagePtr msg)
@@ -141,8 +426,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 
     /* Extend our declared buffer length and carry
        on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength + len) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -218,8 +502,11 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    /* The message is rewritten from scratch, so don't let a pooled
+     * buffer copy the old contents when it grows */
+    msg->bufferLength = 0;
+    if (virNetMessageResizeBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                  VIR_NET_MESSAGE_LEN_MAX) < 0)
         return ret;
     msg->bufferOffset = 0;
 
@@ -355,9 +642,7 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         xdr_destroy(&xdr);
 
-        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, newlen + VIR_NET_MESSAGE_LEN_MAX) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -439,9 +724,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
             return -1;
         }
 
-        msg->bufferLength = msg->bufferOffset + len;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, msg->bufferOffset + len) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
@@ -29,6 +29,9 @@ typedef struct virNetMessageError *virNetMessageErrorPtr;
 typedef struct _virNetMessage virNetMessage;
 typedef virNetMessage *virNetMessagePtr;
 
+typedef struct _virNetMessagePool virNetMessagePool;
+typedef virNetMessagePool *virNetMessagePoolPtr;
+
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
 struct _virNetMessage {
@@ -38,6 +41,10 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferAlloc; /* Allocated size of buffer, for pooled messages */
+
+    /* Pool the message and its buffer return to when freed */
+    virNetMessagePoolPtr pool;
 
     virNetMessageHeader header;
 
@@ -54,6 +61,33 @@ struct _virNetMessage {
 
 virNetMessagePtr virNetMessageNew(bool tracked);
 
+/* Size classes of the buffers kept by a message pool: 4 KiB for
+ * small calls, then VIR_NET_MESSAGE_INITIAL growing by a factor of 4
+ * like virNetMessageEncodePayload does, up to 4 MiB */
+# define VIR_NET_MESSAGE_POOL_CLASSES 5
+
+typedef struct _virNetMessagePoolStats virNetMessagePoolStats;
+typedef virNetMessagePoolStats *virNetMessagePoolStatsPtr;
+struct _virNetMessagePoolStats {
+    unsigned long long msgHits;
+    unsigned long long msgMisses;
+    size_t bufferSize[VIR_NET_MESSAGE_POOL_CLASSES];
+    unsigned long long bufferHits[VIR_NET_MESSAGE_POOL_CLASSES];
+    unsigned long long bufferMisses[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t bufferCached[VIR_NET_MESSAGE_POOL_CLASSES];
+};
+
+virNetMessagePoolPtr virNetMessagePoolNew(void);
+virNetMessagePtr virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                                      bool tracked);
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               virNetMessagePoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virNetMessageResizeBuffer(virNetMessagePtr msg,
+                              size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 void virNetMessageClear(virNetMessagePtr);
 
 void virNetMessageFree(virNetMessagePtr msg);
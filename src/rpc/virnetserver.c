@@ -38,6 +38,7 @@
 #include "virnetservermdns.h"
 #include "virdbus.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #ifndef SA_SIGINFO
 # define SA_SIGINFO 0
@@ -62,12 +63,15 @@ struct _virNetServerJob {
     virNetServerClientPtr client;
     virNetMessagePtr msg;
     virNetServerProgramPtr prog;
+    unsigned long long queued; /* in microseconds, for statistics */
 };
 
 struct _virNetServer {
     virObjectLockable parent;
 
     virThreadPoolPtr workers;
+    /* Recycles the messages received from clients */
+    virNetMessagePoolPtr msgPool;
 
     bool privileged;
 
@@ -135,7 +139,8 @@ VIR_ONCE_GLOBAL_INIT(virNetServer)
 static int virNetServerProcessMsg(virNetServerPtr srv,
                                   virNetServerClientPtr client,
                                   virNetServerProgramPtr prog,
-                                  virNetMessagePtr msg)
+                                  virNetMessagePtr msg,
+                                  unsigned long long queueTime)
 {
     int ret = -1;
     if (!prog) {
@@ -165,7 +170,8 @@ static int virNetServerProcessMsg(virNetServerPtr srv,
     if (virNetServerProgramDispatch(prog,
                                     srv,
                                     client,
-                                    msg) < 0)
+                                    msg,
+                                    queueTime) < 0)
         goto cleanup;
 
 done:
@@ -179,11 +185,17 @@ static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
     virNetServerJobPtr job = jobOpaque;
+    unsigned long long now;
+    unsigned long long queueTime = 0;
 
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
               srv, job->client, job->msg, job->prog);
 
-    if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
+    if (job->queued && virTimeMicrosMonotonicRaw(&now) == 0 && now > job->queued)
+        queueTime = now - job->queued;
+
+    if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg,
+                               queueTime) < 0)
         goto error;
 
     virObjectUnref(job->prog);
@@ -228,6 +240,7 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
 
         job->client = client;
         job->msg = msg;
+        ignore_value(virTimeMicrosMonotonicRaw(&job->queued));
 
         if (prog) {
             virObjectRef(prog);
@@ -235,14 +248,14 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        ret = virThreadPoolSendJobFull(srv->workers, priority, client, job);
 
         if (ret < 0) {
             VIR_FREE(job);
             virObjectUnref(prog);
         }
     } else {
-        ret = virNetServerProcessMsg(srv, client, prog, msg);
+        ret = virNetServerProcessMsg(srv, client, prog, msg, 0);
     }
 
 cleanup:
@@ -304,6 +317,7 @@ static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
                                          virNetServerServiceGetAuth(svc),
                                          virNetServerServiceIsReadonly(svc),
                                          virNetServerServiceGetMaxRequests(svc),
+                                         srv->msgPool,
 #if WITH_GNUTLS
                                          virNetServerServiceGetTLSContext(svc),
 #endif
@@ -373,11 +387,20 @@ virNetServerPtr virNetServerNew(size_t min_workers,
     if (!(srv = virObjectLockableNew(virNetServerClass)))
         return NULL;
 
+    /* Each worker gets its own queue, and the calls of a client
+     * are queued on the same worker. Idle workers steal calls from
+     * the other queues, so the calls of a client still run
+     * concurrently, up to max_client_requests. High priority calls
+     * bypass the queues, see virNetServerDispatchNewMessage */
     if (max_workers &&
-        !(srv->workers = virThreadPoolNew(min_workers, max_workers,
-                                          priority_workers,
-                                          virNetServerHandleJob,
-                                          srv)))
+        !(srv->workers = virThreadPoolNewFull(min_workers, max_workers,
+                                              priority_workers,
+                                              virNetServerHandleJob,
+                                              srv,
+                                              VIR_THREAD_POOL_MULTI_QUEUE)))
+        goto error;
+
+    if (!(srv->msgPool = virNetMessagePoolNew()))
         goto error;
 
     srv->nclients_max = max_clients;
@@ -562,6 +585,7 @@ virNetServerPtr virNetServerNewPostExecRestart(virJSONValuePtr object,
         }
 
         if (!(client = virNetServerClientNewPostExecRestart(child,
+                                                            srv->msgPool,
                                                             clientPrivNewPostExecRestart,
                                                             clientPrivPreExecRestart,
                                                             clientPrivFree,
@@ -686,6 +710,20 @@ error:
 }
 
 
+/**
+ * virNetServerGetMessageStats:
+ * @srv: the server
+ * @stats: filled with the hit rates of the message pool
+ *
+ * Report how well the messages received by the server are recycled.
+ */
+void virNetServerGetMessageStats(virNetServerPtr srv,
+                                 virNetMessagePoolStatsPtr stats)
+{
+    virNetMessagePoolGetStats(srv->msgPool, stats);
+}
+
+
 bool virNetServerIsPrivileged(virNetServerPtr srv)
 {
     bool priv;
@@ -1062,6 +1100,109 @@ void virNetServerUpdateServices(virNetServerPtr srv,
 }
 
 
+/**
+ * virNetServerFormatStats:
+ * @srv: the server
+ * @buf: buffer to append to
+ *
+ * Append the state of the worker pool, the per procedure statistics
+ * of every program and the call totals of every client to @buf, one
+ * line of key=value pairs per item.
+ */
+void virNetServerFormatStats(virNetServerPtr srv,
+                             virBufferPtr buf)
+{
+    virNetServerProgramPtr *programs = NULL;
+    virNetServerClientPtr *clients = NULL;
+    size_t nprograms = 0;
+    size_t nclients = 0;
+    virNetMessagePoolStats msgStats;
+    size_t i;
+
+    /* Take references so that the programs and clients, which have
+     * their own locks, are not formatted with the server locked */
+    virObjectLock(srv);
+    if (srv->workers)
+        virBufferAsprintf(buf,
+                          "workers=%zu min_workers=%zu max_workers=%zu"
+                          " priority_workers=%zu queue_depth=%zu\n",
+                          virThreadPoolGetCurrentWorkers(srv->workers),
+                          virThreadPoolGetMinWorkers(srv->workers),
+                          virThreadPoolGetMaxWorkers(srv->workers),
+                          virThreadPoolGetPriorityWorkers(srv->workers),
+                          virThreadPoolGetJobQueueDepth(srv->workers));
+    virBufferAsprintf(buf, "clients=%zu max_clients=%zu\n",
+                      srv->nclients, srv->nclients_max);
+
+    virNetServerGetMessageStats(srv, &msgStats);
+    virBufferAsprintf(buf, "message_pool_hits=%llu message_pool_misses=%llu\n",
+                      msgStats.msgHits, msgStats.msgMisses);
+
+    if (VIR_ALLOC_N(programs, srv->nprograms) == 0) {
+        for (i = 0; i < srv->nprograms; i++)
+            programs[i] = virObjectRef(srv->programs[i]);
+        nprograms = srv->nprograms;
+    }
+    if (VIR_ALLOC_N(clients, srv->nclients) == 0) {
+        for (i = 0; i < srv->nclients; i++)
+            clients[i] = virObjectRef(srv->clients[i]);
+        nclients = srv->nclients;
+    }
+    virObjectUnlock(srv);
+
+    for (i = 0; i < nprograms; i++) {
+        virNetServerProgramFormatStats(programs[i], buf);
+        virObjectUnref(programs[i]);
+    }
+    for (i = 0; i < nclients; i++) {
+        virNetServerClientFormatStats(clients[i], buf);
+        virObjectUnref(clients[i]);
+    }
+
+    VIR_FREE(programs);
+    VIR_FREE(clients);
+}
+
+
+/**
+ * virNetServerDumpStats:
+ * @srv: the server
+ * @path: file to write to
+ *
+ * Replace the contents of @path with the output of
+ * virNetServerFormatStats.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerDumpStats(virNetServerPtr srv,
+                          const char *path)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
+    int ret = -1;
+
+    virNetServerFormatStats(srv, &buf);
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return -1;
+    }
+    content = virBufferContentAndReset(&buf);
+
+    if (virFileWriteStr(path, content ? content : "", 0600) < 0) {
+        virReportSystemError(errno,
+                             _("cannot write RPC statistics to '%s'"), path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(content);
+    return ret;
+}
+
+
 void virNetServerRun(virNetServerPtr srv)
 {
     int timerid = -1;
@@ -1205,6 +1346,7 @@ void virNetServerDispose(void *obj)
 
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
+    virObjectUnref(srv->msgPool);
 }
 
 void virNetServerClose(virNetServerPtr srv)
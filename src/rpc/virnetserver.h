@@ -34,6 +34,7 @@
 # include "virnetserverservice.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virbuffer.h"
 
 virNetServerPtr virNetServerNew(size_t min_workers,
                                 size_t max_workers,
@@ -61,6 +62,9 @@ typedef int (*virNetServerAutoShutdownFunc)(virNetServerPtr srv, void *opaque);
 
 bool virNetServerIsPrivileged(virNetServerPtr srv);
 
+void virNetServerGetMessageStats(virNetServerPtr srv,
+                                 virNetMessagePoolStatsPtr stats);
+
 void virNetServerAutoShutdown(virNetServerPtr srv,
                               unsigned int timeout);
 
@@ -89,6 +93,11 @@ int virNetServerSetTLSContext(virNetServerPtr srv,
 void virNetServerUpdateServices(virNetServerPtr srv,
                                 bool enabled);
 
+void virNetServerFormatStats(virNetServerPtr srv,
+                             virBufferPtr buf);
+int virNetServerDumpStats(virNetServerPtr srv,
+                          const char *path);
+
 void virNetServerRun(virNetServerPtr srv);
 
 void virNetServerQuit(virNetServerPtr srv);
@@ -93,6 +93,8 @@ struct _virNetServerClient
     /* Zero or many messages waiting for transmit
      * back to client, including async events */
     virNetMessagePtr tx;
+    /* Pool the 'rx' messages are taken from, may be NULL */
+    virNetMessagePoolPtr msgPool;
 
     /* Filters to capture messages that would otherwise
      * end up on the 'dx' queue */
@@ -108,6 +110,12 @@ struct _virNetServerClient
     virNetServerClientCloseFunc privateDataCloseFunc;
 
     virKeepAlivePtr keepalive;
+
+    /* Totals over the RPC calls dispatched for this client */
+    unsigned long long ncalls;
+    unsigned long long nerrors;
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
 };
 
 
@@ -134,6 +142,28 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client);
 static int virNetServerClientSendMessageLocked(virNetServerClientPtr client,
                                                virNetMessagePtr msg);
 
+/*
+ * @client: a locked client object
+ *
+ * Returns a message ready to receive the length word of a packet
+ */
+static virNetMessagePtr
+virNetServerClientNewRx(virNetServerClientPtr client)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessagePoolGet(client->msgPool, true)))
+        return NULL;
+
+    if (virNetMessageResizeBuffer(msg, VIR_NET_MESSAGE_LEN_MAX) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
 /*
  * @client: a locked client object
  */
@@ -348,7 +378,8 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
                               virNetTLSContextPtr tls,
 #endif
                               bool readonly,
-                              size_t nrequests_max)
+                              size_t nrequests_max,
+                              virNetMessagePoolPtr pool)
 {
     virNetServerClientPtr client;
 
@@ -365,6 +396,7 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
     client->tlsCtxt = virObjectRef(tls);
 #endif
     client->nrequests_max = nrequests_max;
+    client->msgPool = virObjectRef(pool);
 
     client->sockTimer = virEventAddTimeout(-1, virNetServerClientSockTimerFunc,
                                            client, NULL);
@@ -372,10 +404,7 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
         goto error;
 
     /* Prepare one for packet receive */
-    if (!(client->rx = virNetMessageNew(true)))
-        goto error;
-    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (!(client->rx = virNetServerClientNewRx(client)))
         goto error;
     client->nrequests = 1;
 
@@ -395,6 +424,7 @@ virNetServerClientPtr virNetServerClientNew(virNetSocketPtr sock,
                                             int auth,
                                             bool readonly,
                                             size_t nrequests_max,
+                                            virNetMessagePoolPtr pool,
 #ifdef WITH_GNUTLS
                                             virNetTLSContextPtr tls,
 #endif
@@ -417,7 +447,8 @@ virNetServerClientPtr virNetServerClientNew(virNetSocketPtr sock,
 #ifdef WITH_GNUTLS
                                                  tls,
 #endif
-                                                 readonly, nrequests_max)))
+                                                 readonly, nrequests_max,
+                                                 pool)))
         return NULL;
 
     if (privNew) {
@@ -434,6 +465,7 @@ virNetServerClientPtr virNetServerClientNew(virNetSocketPtr sock,
 
 
 virNetServerClientPtr virNetServerClientNewPostExecRestart(virJSONValuePtr object,
+                                                           virNetMessagePoolPtr pool,
                                                            virNetServerClientPrivNewPostExecRestart privNew,
                                                            virNetServerClientPrivPreExecRestart privPreExecRestart,
                                                            virFreeCallback privFree,
@@ -480,7 +512,8 @@ virNetServerClientPtr virNetServerClientNewPostExecRestart(virJSONValuePtr objec
                                                  NULL,
 #endif
                                                  readonly,
-                                                 nrequests_max))) {
+                                                 nrequests_max,
+                                                 pool))) {
         virObjectUnref(sock);
         return NULL;
     }
@@ -897,6 +930,52 @@ const char *virNetServerClientRemoteAddrString(virNetServerClientPtr client)
 }
 
 
+void virNetServerClientRecordCall(virNetServerClientPtr client,
+                                  bool failed,
+                                  size_t bytesIn,
+                                  size_t bytesOut)
+{
+    virObjectLock(client);
+    client->ncalls++;
+    if (failed)
+        client->nerrors++;
+    client->bytesIn += bytesIn;
+    client->bytesOut += bytesOut;
+    virObjectUnlock(client);
+}
+
+
+/*
+ * Append one line with the call totals of @client to @buf
+ */
+void virNetServerClientFormatStats(virNetServerClientPtr client,
+                                   virBufferPtr buf)
+{
+    const char *addr;
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+    unsigned long long timestamp;
+
+    virObjectLock(client);
+    virBufferAsprintf(buf, "client=%p", client);
+    if ((addr = virNetServerClientRemoteAddrString(client)))
+        virBufferAsprintf(buf, " addr=%s", addr);
+    else if (client->sock &&
+             virNetSocketGetUNIXIdentity(client->sock, &uid, &gid, &pid,
+                                         &timestamp) == 0)
+        virBufferAsprintf(buf, " pid=%lld uid=%lld",
+                          (long long) pid, (long long) uid);
+    virBufferAsprintf(buf,
+                      " readonly=%d requests=%zu calls=%llu errors=%llu"
+                      " bytes_in=%llu bytes_out=%llu\n",
+                      client->readonly, client->nrequests,
+                      client->ncalls, client->nerrors,
+                      client->bytesIn, client->bytesOut);
+    virObjectUnlock(client);
+}
+
+
 void virNetServerClientDispose(void *obj)
 {
     virNetServerClientPtr client = obj;
@@ -920,6 +999,7 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tlsCtxt);
 #endif
     virObjectUnref(client->sock);
+    virObjectUnref(client->msgPool);
     virObjectUnlock(client);
 }
 
@@ -1246,17 +1326,10 @@ readmore:
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetServerClientNewRx(client)))
                 client->wantClose = true;
-            } else {
-                client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    client->wantClose = true;
-                } else {
-                    client->nrequests++;
-                }
-            }
+            else
+                client->nrequests++;
         }
         virNetServerClientUpdateEvent(client);
     }
@@ -1352,8 +1425,8 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     client->nrequests < client->nrequests_max) {
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
-                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    if (virNetMessageResizeBuffer(msg,
+                                                  VIR_NET_MESSAGE_LEN_MAX) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -29,6 +29,7 @@
 # include "virnetmessage.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virbuffer.h"
 
 typedef struct _virNetServerClient virNetServerClient;
 typedef virNetServerClient *virNetServerClientPtr;
@@ -53,6 +54,7 @@ virNetServerClientPtr virNetServerClientNew(virNetSocketPtr sock,
                                             int auth,
                                             bool readonly,
                                             size_t nrequests_max,
+                                            virNetMessagePoolPtr pool,
 # ifdef WITH_GNUTLS
                                             virNetTLSContextPtr tls,
 # endif
@@ -62,6 +64,7 @@ virNetServerClientPtr virNetServerClientNew(virNetSocketPtr sock,
                                             void *privOpaque);
 
 virNetServerClientPtr virNetServerClientNewPostExecRestart(virJSONValuePtr object,
+                                                           virNetMessagePoolPtr pool,
                                                            virNetServerClientPrivNewPostExecRestart privNew,
                                                            virNetServerClientPrivPreExecRestart privPreExecRestart,
                                                            virFreeCallback privFree,
@@ -114,6 +117,13 @@ typedef void (*virNetServerClientCloseFunc)(virNetServerClientPtr client);
 void virNetServerClientSetCloseHook(virNetServerClientPtr client,
                                     virNetServerClientCloseFunc cf);
 
+void virNetServerClientRecordCall(virNetServerClientPtr client,
+                                  bool failed,
+                                  size_t bytesIn,
+                                  size_t bytesOut);
+void virNetServerClientFormatStats(virNetServerClientPtr client,
+                                   virBufferPtr buf);
+
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
@@ -31,16 +31,47 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Upper bounds, in microseconds, of the execution time histogram
+ * buckets, included in them. The last bucket takes everything above. */
+static const unsigned long long virNetServerProgramHistBounds[] = {
+    100, 1000, 10 * 1000, 100 * 1000, 1000 * 1000, 10 * 1000 * 1000,
+};
+static const char *virNetServerProgramHistNames[] = {
+    "100us", "1ms", "10ms", "100ms", "1s", "10s", "inf",
+};
+verify(ARRAY_CARDINALITY(virNetServerProgramHistNames) ==
+       ARRAY_CARDINALITY(virNetServerProgramHistBounds) + 1);
+
+#define VIR_NET_SERVER_PROGRAM_HIST_BUCKETS \
+    ARRAY_CARDINALITY(virNetServerProgramHistNames)
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long queueTime;   /* total, in microseconds */
+    unsigned long long execTime;    /* total, in microseconds */
+    unsigned long long execMax;
+    unsigned long long hist[VIR_NET_SERVER_PROGRAM_HIST_BUCKETS];
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+};
+
 struct _virNetServerProgram {
-    virObject object;
+    virObjectLockable parent;
 
     unsigned program;
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* One entry per procedure, protected by the object lock */
+    virNetServerProgramProcStatsPtr stats;
 };
 
 
@@ -49,7 +80,7 @@ static void virNetServerProgramDispose(void *obj);
 
 static int virNetServerProgramOnceInit(void)
 {
-    if (!(virNetServerProgramClass = virClassNew(virClassForObject(),
+    if (!(virNetServerProgramClass = virClassNew(virClassForObjectLockable(),
                                                  "virNetServerProgram",
                                                  sizeof(virNetServerProgram),
                                                  virNetServerProgramDispose)))
@@ -71,8 +102,13 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (virNetServerProgramInitialize() < 0)
         return NULL;
 
-    if (!(prog = virObjectNew(virNetServerProgramClass)))
+    if (!(prog = virObjectLockableNew(virNetServerProgramClass)))
+        return NULL;
+
+    if (VIR_ALLOC_N(prog->stats, nprocs) < 0) {
+        virObjectUnref(prog);
         return NULL;
+    }
 
     prog->program = program;
     prog->version = version;
@@ -137,6 +173,119 @@ virNetServerProgramGetPriority(virNetServerProgramPtr prog,
     return proc->priority;
 }
 
+
+/* Microseconds passed since @start, or 0 if unknown */
+static unsigned long long
+virNetServerProgramTimeSince(unsigned long long start)
+{
+    unsigned long long now;
+
+    if (start && virTimeMicrosMonotonicRaw(&now) == 0 && now > start)
+        return now - start;
+
+    return 0;
+}
+
+
+/**
+ * virNetServerProgramRecordCall:
+ * @prog: the program the procedure belongs to
+ * @client: the client that made the call
+ * @procedure: the procedure number
+ * @queueTime: microseconds the call waited for a worker
+ * @execTime: microseconds the worker spent processing the call
+ * @failed: whether an error was sent back
+ * @bytesIn: size of the call message
+ * @bytesOut: size of the reply message
+ *
+ * Account for one call in the statistics of @procedure and @client.
+ * A call is counted in the first histogram bucket whose bound its
+ * execution time does not exceed.
+ */
+void
+virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                              virNetServerClientPtr client,
+                              int procedure,
+                              unsigned long long queueTime,
+                              unsigned long long execTime,
+                              bool failed,
+                              size_t bytesIn,
+                              size_t bytesOut)
+{
+    virNetServerProgramProcStatsPtr stats;
+    size_t i;
+
+    if (procedure < 0 || procedure >= prog->nprocs)
+        return;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virNetServerProgramHistBounds); i++) {
+        if (execTime <= virNetServerProgramHistBounds[i])
+            break;
+    }
+
+    virObjectLock(prog);
+    stats = &prog->stats[procedure];
+    stats->calls++;
+    if (failed)
+        stats->errors++;
+    stats->queueTime += queueTime;
+    stats->execTime += execTime;
+    if (execTime > stats->execMax)
+        stats->execMax = execTime;
+    stats->hist[i]++;
+    stats->bytesIn += bytesIn;
+    stats->bytesOut += bytesOut;
+    virObjectUnlock(prog);
+
+    virNetServerClientRecordCall(client, failed, bytesIn, bytesOut);
+}
+
+
+/**
+ * virNetServerProgramFormatStats:
+ * @prog: the program
+ * @buf: buffer to append to
+ *
+ * Append one line for each procedure of @prog that was called at
+ * least once, with its call counters, average queue and execution
+ * times, execution time histogram and traffic.
+ */
+void
+virNetServerProgramFormatStats(virNetServerProgramPtr prog,
+                               virBufferPtr buf)
+{
+    size_t i, j;
+
+    virObjectLock(prog);
+    for (i = 0; i < prog->nprocs; i++) {
+        virNetServerProgramProcStatsPtr stats = &prog->stats[i];
+
+        if (!stats->calls)
+            continue;
+
+        virBufferAsprintf(buf, "program=0x%x version=%u proc=%zu",
+                          prog->program, prog->version, i);
+        if (prog->procs[i].name)
+            virBufferAsprintf(buf, " name=%s", prog->procs[i].name);
+        virBufferAsprintf(buf,
+                          " calls=%llu errors=%llu"
+                          " queue_avg_us=%llu exec_avg_us=%llu exec_max_us=%llu"
+                          " bytes_in=%llu bytes_out=%llu",
+                          stats->calls, stats->errors,
+                          stats->queueTime / stats->calls,
+                          stats->execTime / stats->calls,
+                          stats->execMax,
+                          stats->bytesIn, stats->bytesOut);
+        for (j = 0; j < VIR_NET_SERVER_PROGRAM_HIST_BUCKETS; j++)
+            virBufferAsprintf(buf, " exec_le_%s=%llu",
+                              virNetServerProgramHistNames[j],
+                              stats->hist[j]);
+        virBufferAddLit(buf, "\n");
+    }
+    virObjectUnlock(prog);
+}
+
+
 static int
 virNetServerProgramSendError(unsigned program,
                              unsigned version,
@@ -253,12 +402,14 @@ static int
 virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
                                 virNetServerPtr server,
                                 virNetServerClientPtr client,
-                                virNetMessagePtr msg);
+                                virNetMessagePtr msg,
+                                unsigned long long queueTime);
 
 /*
  * @server: the unlocked server object
  * @client: the unlocked client object
  * @msg: the complete incoming message packet, with header already decoded
+ * @queueTime: microseconds the message waited for a worker, for statistics
  *
  * This function is intended to be called from worker threads
  * when an incoming message is ready to be dispatched for
@@ -273,7 +424,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
 int virNetServerProgramDispatch(virNetServerProgramPtr prog,
                                 virNetServerPtr server,
                                 virNetServerClientPtr client,
-                                virNetMessagePtr msg)
+                                virNetMessagePtr msg,
+                                unsigned long long queueTime)
 {
     int ret = -1;
     virNetMessageError rerr;
@@ -302,10 +454,12 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
     switch (msg->header.type) {
     case VIR_NET_CALL:
     case VIR_NET_CALL_WITH_FDS:
-        ret = virNetServerProgramDispatchCall(prog, server, client, msg);
+        ret = virNetServerProgramDispatchCall(prog, server, client, msg,
+                                              queueTime);
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -355,6 +509,7 @@ cleanup:
  * @server: the unlocked server object
  * @client: the unlocked client object
  * @msg: the complete incoming method call, with header already decoded
+ * @queueTime: microseconds the call waited for a worker, for statistics
  *
  * This method is used to dispatch a message representing an
  * incoming method call from a client. It decodes the payload
@@ -367,18 +522,24 @@ static int
 virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
                                 virNetServerPtr server,
                                 virNetServerClientPtr client,
-                                virNetMessagePtr msg)
+                                virNetMessagePtr msg,
+                                unsigned long long queueTime)
 {
     char *arg = NULL;
     char *ret = NULL;
     int rv = -1;
-    virNetServerProgramProcPtr dispatcher;
+    virNetServerProgramProcPtr dispatcher = NULL;
     virNetMessageError rerr;
     size_t i;
     virIdentityPtr identity = NULL;
+    int procedure = msg->header.proc;
+    size_t bytesIn = msg->bufferLength;
+    unsigned long long start = 0;
 
     memset(&rerr, 0, sizeof(rerr));
 
+    ignore_value(virTimeMicrosMonotonicRaw(&start));
+
     if (msg->header.status != VIR_NET_OK) {
         virReportError(VIR_ERR_RPC,
                        _("Unexpected message status %u"),
@@ -488,10 +649,20 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     VIR_FREE(ret);
 
     virObjectUnref(identity);
+
+    virNetServerProgramRecordCall(prog, client, procedure, queueTime,
+                                  virNetServerProgramTimeSince(start),
+                                  false, bytesIn, msg->bufferLength);
+
     /* Put reply on end of tx queue to send out  */
     return virNetServerClientSendMessage(client, msg);
 
 error:
+    if (dispatcher)
+        virNetServerProgramRecordCall(prog, client, procedure, queueTime,
+                                      virNetServerProgramTimeSince(start),
+                                      true, bytesIn, 0);
+
     /* Bad stuff (de-)serializing message, but we have an
      * RPC error message we can send back to the client */
     rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
@@ -546,6 +717,44 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length,
+                                      unsigned int flags)
+{
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
 {
+    virNetServerProgramPtr prog = obj;
+
+    VIR_FREE(prog->stats);
 }
@@ -27,6 +27,7 @@
 # include "virnetmessage.h"
 # include "virnetserverclient.h"
 # include "virobject.h"
+# include "virbuffer.h"
 
 typedef struct _virNetServer virNetServer;
 typedef virNetServer *virNetServerPtr;
@@ -55,6 +56,7 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    const char *name;
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -74,7 +76,20 @@ int virNetServerProgramMatches(virNetServerProgramPtr prog,
 int virNetServerProgramDispatch(virNetServerProgramPtr prog,
                                 virNetServerPtr server,
                                 virNetServerClientPtr client,
-                                virNetMessagePtr msg);
+                                virNetMessagePtr msg,
+                                unsigned long long queueTime);
+
+void virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                                   virNetServerClientPtr client,
+                                   int procedure,
+                                   unsigned long long queueTime,
+                                   unsigned long long execTime,
+                                   bool failed,
+                                   size_t bytesIn,
+                                   size_t bytesOut);
+
+void virNetServerProgramFormatStats(virNetServerProgramPtr prog,
+                                    virBufferPtr buf);
 
 int virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
@@ -101,4 +116,12 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length,
+                                      unsigned int flags);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
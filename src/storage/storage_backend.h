@@ -80,6 +80,9 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    /* Optional, refreshes a pool still holding the volumes of the
+     * previous refresh, updating only those which changed */
+    virStorageBackendRefreshPool updatePool;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
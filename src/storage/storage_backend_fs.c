@@ -32,6 +32,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -51,6 +54,10 @@
 #include "virfile.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "viratomic.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -818,108 +825,567 @@ error:
 }
 
 
-/**
- * Iterate over the pool's directory and enumerate all disk images
- * within it. This is non-recursive.
+/* Number of threads probing the files of a pool during a refresh */
+#define VIR_STORAGE_BACKEND_FS_PROBE_WORKERS 8
+
+/*
+ * State kept along with the volumes of a pool between refreshes, so
+ * that only the files which changed since the previous refresh are
+ * probed again. It is dropped together with the volumes.
+ */
+typedef struct _virStorageBackendFileSystemState virStorageBackendFileSystemState;
+typedef virStorageBackendFileSystemState *virStorageBackendFileSystemStatePtr;
+struct _virStorageBackendFileSystemState {
+    /* File name -> virStorageBackendFileSystemStamp */
+    virHashTablePtr stamps;
+
+    /* inotify descriptor watching the pool directory, or -1 */
+    int watch;
+    /* true once @watch has seen every change since the last
+     * refresh, so that a refresh only has to check the files
+     * named by its events */
+    bool synced;
+};
+
+typedef struct _virStorageBackendFileSystemStamp virStorageBackendFileSystemStamp;
+typedef virStorageBackendFileSystemStamp *virStorageBackendFileSystemStampPtr;
+struct _virStorageBackendFileSystemStamp {
+    struct stat sb;             /* stat() of the file when it was probed */
+    bool volume;                /* whether the probe found a volume */
+};
+
+typedef struct _virStorageBackendFileSystemVolProbe virStorageBackendFileSystemVolProbe;
+typedef virStorageBackendFileSystemVolProbe *virStorageBackendFileSystemVolProbePtr;
+struct _virStorageBackendFileSystemVolProbe {
+    char *name;
+    struct stat sb;
+
+    virStorageVolDefPtr vol;    /* NULL if the file is no volume */
+    int ret;
+    virErrorPtr err;
+};
+
+typedef struct _virStorageBackendFileSystemProbeData virStorageBackendFileSystemProbeData;
+typedef virStorageBackendFileSystemProbeData *virStorageBackendFileSystemProbeDataPtr;
+struct _virStorageBackendFileSystemProbeData {
+    const char *dir;
+    virStorageBackendFileSystemVolProbePtr probes;
+    size_t nprobes;
+    int next; /* Atomic access only */
+};
+
+
+static void
+virStorageBackendFileSystemStateFree(void *opaque)
+{
+    virStorageBackendFileSystemStatePtr state = opaque;
+
+    if (!state)
+        return;
+
+    virHashFree(state->stamps);
+    VIR_FORCE_CLOSE(state->watch);
+    VIR_FREE(state);
+}
+
+static void
+virStorageBackendFileSystemStampFree(void *payload,
+                                     const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+/*
+ * Start watching the directory of @pool. Changes on the remote side
+ * of a network filesystem are not reported, so those pools are only
+ * compared against the stamps.
+ */
+static void
+virStorageBackendFileSystemWatch(virStoragePoolObjPtr pool,
+                                 virStorageBackendFileSystemStatePtr state)
+{
+#if HAVE_SYS_INOTIFY_H
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+        IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+        IN_DELETE_SELF | IN_MOVE_SELF;
+    char ebuf[1024];
+
+    state->synced = false;
+    VIR_FORCE_CLOSE(state->watch);
+
+    if (pool->def->type == VIR_STORAGE_POOL_NETFS)
+        return;
+
+    if ((state->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        VIR_WARN("Unable to watch storage pool '%s': %s",
+                 pool->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
+        return;
+    }
+
+    if (inotify_add_watch(state->watch, pool->def->target.path, mask) < 0) {
+        VIR_WARN("Unable to watch storage pool '%s': %s",
+                 pool->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
+        VIR_FORCE_CLOSE(state->watch);
+    }
+#else
+    state->synced = false;
+#endif /* HAVE_SYS_INOTIFY_H */
+}
+
+/*
+ * Collect the names of the files which changed since the previous
+ * refresh into @changed.
+ *
+ * Returns 0 on success, 1 if the events do not tell the whole story
+ * and the directory has to be scanned, -1 on error.
  */
 static int
-virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
-                                   virStoragePoolObjPtr pool)
+virStorageBackendFileSystemReadEvents(virStorageBackendFileSystemStatePtr state,
+                                      virHashTablePtr changed)
+{
+#if HAVE_SYS_INOTIFY_H
+    char buf[4096];
+
+    if (!state->synced || state->watch < 0)
+        return 1;
+
+    for (;;) {
+        ssize_t got = read(state->watch, buf, sizeof(buf));
+        char *tmp = buf;
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return 1;
+        }
+
+        while (got >= sizeof(struct inotify_event)) {
+            struct inotify_event e;
+            char *name;
+
+            memcpy(&e, tmp, sizeof(e));
+            if (got < sizeof(e) + e.len)
+                return 1;
+            name = tmp + sizeof(e);
+
+            tmp += sizeof(e) + e.len;
+            got -= sizeof(e) + e.len;
+
+            /* Lost events, or the directory itself went away */
+            if (e.mask & (IN_Q_OVERFLOW | IN_IGNORED |
+                          IN_DELETE_SELF | IN_MOVE_SELF))
+                return 1;
+
+            if (e.len && name[0] &&
+                !virHashLookup(changed, name) &&
+                virHashAddEntry(changed, name, (void *) 1) < 0)
+                return -1;
+        }
+    }
+#else
+    (void) state;
+    (void) changed;
+    return 1;
+#endif /* HAVE_SYS_INOTIFY_H */
+}
+
+/*
+ * Returns 0 with @volret filled, or set to NULL if @name is not a
+ * volume, and -1 on error.
+ */
+static int
+virStorageBackendFileSystemProbeVol(const char *dir,
+                                    const char *name,
+                                    virStorageVolDefPtr *volret)
+{
+    virStorageVolDefPtr vol = NULL;
+    char *backingStore;
+    int backingStoreFormat;
+    int ret;
+
+    *volret = NULL;
+
+    if (VIR_ALLOC(vol) < 0)
+        goto error;
+
+    if (VIR_STRDUP(vol->name, name) < 0)
+        goto error;
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&vol->target.path, "%s/%s", dir, vol->name) == -1)
+        goto error;
+
+    if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        goto error;
+
+    if ((ret = virStorageBackendProbeTarget(&vol->target,
+                                            &backingStore,
+                                            &backingStoreFormat,
+                                            &vol->allocation,
+                                            &vol->capacity,
+                                            &vol->target.encryption)) < 0) {
+        if (ret == -2) {
+            /* Silently ignore non-regular files,
+             * eg '.' '..', 'lost+found', dangling symbolic link */
+            virStorageVolDefFree(vol);
+            return 0;
+        } else if (ret == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. */
+            backingStoreFormat = VIR_STORAGE_FILE_RAW;
+        } else
+            goto error;
+    }
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (backingStore != NULL) {
+        vol->backingStore.path = backingStore;
+        vol->backingStore.format = backingStoreFormat;
+
+        if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                    NULL, NULL,
+                                    VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
+            /* The backing file is currently unavailable, the capacity,
+             * allocation, owner, group and mode are unknown. Just log the
+             * error and continue.
+             * Unfortunately virStorageBackendProbeTarget() might already
+             * have logged a similar message for the same problem, but only
+             * if AUTO format detection was used. */
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot probe backing volume info: %s"),
+                           vol->backingStore.path);
+        }
+    }
+
+    *volret = vol;
+    return 0;
+
+error:
+    virStorageVolDefFree(vol);
+    return -1;
+}
+
+static void
+virStorageBackendFileSystemProbeWorker(void *opaque)
+{
+    virStorageBackendFileSystemProbeDataPtr data = opaque;
+    int i;
+
+    while ((i = virAtomicIntAdd(&data->next, 1)) < (int) data->nprobes) {
+        virStorageBackendFileSystemVolProbePtr probe = &data->probes[i];
+
+        probe->ret = virStorageBackendFileSystemProbeVol(data->dir,
+                                                         probe->name,
+                                                         &probe->vol);
+        if (probe->ret < 0)
+            probe->err = virSaveLastError();
+    }
+}
+
+/*
+ * Probe all the files of @probes, using up to
+ * VIR_STORAGE_BACKEND_FS_PROBE_WORKERS threads.
+ */
+static void
+virStorageBackendFileSystemProbeAll(virStoragePoolObjPtr pool,
+                                    virStorageBackendFileSystemVolProbePtr probes,
+                                    size_t nprobes)
+{
+    virStorageBackendFileSystemProbeData data = {
+        .dir = pool->def->target.path,
+        .probes = probes,
+        .nprobes = nprobes,
+    };
+    size_t nworkers = VIR_STORAGE_BACKEND_FS_PROBE_WORKERS;
+    virThreadPtr workers = NULL;
+    size_t nthreads = 0;
+    size_t i;
+
+    if (nworkers > nprobes)
+        nworkers = nprobes;
+
+    if (nworkers > 1 &&
+        VIR_ALLOC_N_QUIET(workers, nworkers - 1) == 0) {
+        for (i = 0; i < nworkers - 1; i++) {
+            if (virThreadCreate(&workers[i], true,
+                                virStorageBackendFileSystemProbeWorker,
+                                &data) < 0) {
+                VIR_WARN("Failed to create worker thread, "
+                         "probing volumes with %zu", nthreads + 1);
+                break;
+            }
+            nthreads++;
+        }
+    }
+
+    /* The calling thread is a worker too */
+    virStorageBackendFileSystemProbeWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&workers[i]);
+    VIR_FREE(workers);
+}
+
+static bool
+virStorageBackendFileSystemStampEqual(const struct stat *a,
+                                      const struct stat *b)
+{
+    struct timespec amtime = get_stat_mtime(a);
+    struct timespec bmtime = get_stat_mtime(b);
+    struct timespec actime = get_stat_ctime(a);
+    struct timespec bctime = get_stat_ctime(b);
+
+    return a->st_dev == b->st_dev &&
+        a->st_ino == b->st_ino &&
+        a->st_size == b->st_size &&
+        amtime.tv_sec == bmtime.tv_sec &&
+        amtime.tv_nsec == bmtime.tv_nsec &&
+        actime.tv_sec == bctime.tv_sec &&
+        actime.tv_nsec == bctime.tv_nsec;
+}
+
+static void
+virStorageBackendFileSystemDropVol(virStoragePoolObjPtr pool,
+                                   virStorageBackendFileSystemStatePtr state,
+                                   const char *name)
+{
+    virStorageVolDefPtr vol;
+
+    virHashRemoveEntry(state->stamps, name);
+
+    if ((vol = virStorageVolDefFindByName(pool, name))) {
+        virStoragePoolObjRemoveVol(pool, vol);
+        virStorageVolDefFree(vol);
+    }
+}
+
+/*
+ * Queue @name for probing unless its volume is known and its file
+ * did not change since it was probed.
+ */
+static int
+virStorageBackendFileSystemCheckFile(virStoragePoolObjPtr pool,
+                                     virStorageBackendFileSystemStatePtr state,
+                                     const char *name,
+                                     virStorageBackendFileSystemVolProbePtr *probes,
+                                     size_t *nprobes)
+{
+    virStorageBackendFileSystemVolProbe probe = { 0 };
+    virStorageBackendFileSystemStampPtr stamp;
+    char *path = NULL;
+    int rc;
+
+    if (virAsprintf(&path, "%s/%s", pool->def->target.path, name) < 0)
+        return -1;
+    rc = stat(path, &probe.sb);
+    VIR_FREE(path);
+
+    if (rc < 0) {
+        /* Gone, or a dangling symbolic link */
+        virStorageBackendFileSystemDropVol(pool, state, name);
+        return 0;
+    }
+
+    if ((stamp = virHashLookup(state->stamps, name)) &&
+        (!stamp->volume || virStorageVolDefFindByName(pool, name)) &&
+        virStorageBackendFileSystemStampEqual(&stamp->sb, &probe.sb))
+        return 0;
+
+    if (VIR_STRDUP(probe.name, name) < 0)
+        return -1;
+
+    if (VIR_APPEND_ELEMENT(*probes, *nprobes, probe) < 0) {
+        VIR_FREE(probe.name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Check every file of the pool directory, recording the names seen
+ * into @seen.
+ */
+static int
+virStorageBackendFileSystemScan(virStoragePoolObjPtr pool,
+                                virStorageBackendFileSystemStatePtr state,
+                                virHashTablePtr seen,
+                                virStorageBackendFileSystemVolProbePtr *probes,
+                                size_t *nprobes)
 {
     DIR *dir;
     struct dirent *ent;
-    struct statvfs sb;
-    virStorageVolDefPtr vol = NULL;
+    int ret = -1;
 
     if (!(dir = opendir(pool->def->target.path))) {
         virReportSystemError(errno,
                              _("cannot open path '%s'"),
                              pool->def->target.path);
-        goto cleanup;
+        return -1;
     }
 
     while ((ent = readdir(dir)) != NULL) {
-        int ret;
-        char *backingStore;
-        int backingStoreFormat;
+        if (virHashAddEntry(seen, ent->d_name, (void *) 1) < 0 ||
+            virStorageBackendFileSystemCheckFile(pool, state, ent->d_name,
+                                                 probes, nprobes) < 0)
+            goto cleanup;
+    }
 
-        if (VIR_ALLOC(vol) < 0)
+    ret = 0;
+
+cleanup:
+    closedir(dir);
+    return ret;
+}
+
+static int
+virStorageBackendFileSystemNotSeen(const void *payload ATTRIBUTE_UNUSED,
+                                   const void *name,
+                                   const void *opaque)
+{
+    return !virHashLookup((virHashTablePtr) opaque, name);
+}
+
+struct virStorageBackendFileSystemCheckData {
+    virStoragePoolObjPtr pool;
+    virStorageBackendFileSystemStatePtr state;
+    virStorageBackendFileSystemVolProbePtr *probes;
+    size_t *nprobes;
+    int ret;
+};
+
+static void
+virStorageBackendFileSystemCheckChanged(void *payload ATTRIBUTE_UNUSED,
+                                        const void *name,
+                                        void *opaque)
+{
+    struct virStorageBackendFileSystemCheckData *data = opaque;
+
+    if (data->ret == 0 &&
+        virStorageBackendFileSystemCheckFile(data->pool, data->state, name,
+                                             data->probes,
+                                             data->nprobes) < 0)
+        data->ret = -1;
+}
+
+/**
+ * Iterate over the pool's directory and enumerate all disk images
+ * within it. This is non-recursive.
+ *
+ * The volumes found by the previous refresh are kept if the stat()
+ * of their file is unchanged, and where inotify is available only
+ * the files it reports as changed are looked at.
+ */
+static int
+virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                   virStoragePoolObjPtr pool)
+{
+    virStorageBackendFileSystemStatePtr state = pool->volumes.privateData;
+    virStorageBackendFileSystemVolProbePtr probes = NULL;
+    size_t nprobes = 0;
+    virHashTablePtr names = NULL;
+    struct statvfs sb;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (!state) {
+        if (VIR_ALLOC(state) < 0)
             goto cleanup;
+        state->watch = -1;
+        pool->volumes.privateData = state;
+        pool->volumes.privateDataFreeFunc =
+            virStorageBackendFileSystemStateFree;
 
-        if (VIR_STRDUP(vol->name, ent->d_name) < 0)
+        if (!(state->stamps =
+              virHashCreate(64, virStorageBackendFileSystemStampFree)))
             goto cleanup;
+    }
+
+    if (!(names = virHashCreate(64, NULL)))
+        goto cleanup;
+
+    if ((rc = virStorageBackendFileSystemReadEvents(state, names)) < 0)
+        goto cleanup;
+
+    if (rc == 0) {
+        struct virStorageBackendFileSystemCheckData data = {
+            pool, state, &probes, &nprobes, 0
+        };
+
+        VIR_DEBUG("Checking %zd changed files of pool '%s'",
+                  virHashSize(names), pool->def->name);
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
+        virHashForEach(names, virStorageBackendFileSystemCheckChanged, &data);
+        if (data.ret < 0)
             goto cleanup;
+    } else {
+        /* The watch has to be in place before the scan starts, so
+         * that nothing happening during the scan gets lost */
+        virStorageBackendFileSystemWatch(pool, state);
+        virHashRemoveAll(names);
 
-        if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        if (virStorageBackendFileSystemScan(pool, state, names,
+                                            &probes, &nprobes) < 0)
             goto cleanup;
 
-        if ((ret = virStorageBackendProbeTarget(&vol->target,
-                                                &backingStore,
-                                                &backingStoreFormat,
-                                                &vol->allocation,
-                                                &vol->capacity,
-                                                &vol->target.encryption)) < 0) {
-            if (ret == -2) {
-                /* Silently ignore non-regular files,
-                 * eg '.' '..', 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (ret == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-                backingStoreFormat = VIR_STORAGE_FILE_RAW;
-            } else
-                goto cleanup;
+        /* Whatever was not seen is gone */
+        i = pool->volumes.count;
+        while (i-- > 0) {
+            virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+            if (!virHashLookup(names, vol->name))
+                virStorageBackendFileSystemDropVol(pool, state, vol->name);
         }
+        virHashRemoveSet(state->stamps,
+                         virStorageBackendFileSystemNotSeen, names);
+    }
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (backingStore != NULL) {
-            vol->backingStore.path = backingStore;
-            vol->backingStore.format = backingStoreFormat;
-
-            if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
-                                        NULL, NULL,
-                                        VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
-                /* The backing file is currently unavailable, the capacity,
-                 * allocation, owner, group and mode are unknown. Just log the
-                 * error and continue.
-                 * Unfortunately virStorageBackendProbeTarget() might already
-                 * have logged a similar message for the same problem, but only
-                 * if AUTO format detection was used. */
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("cannot probe backing volume info: %s"),
-                               vol->backingStore.path);
-            }
+    VIR_DEBUG("Probing %zu files of pool '%s'", nprobes, pool->def->name);
+    virStorageBackendFileSystemProbeAll(pool, probes, nprobes);
+
+    for (i = 0; i < nprobes; i++) {
+        virStorageBackendFileSystemVolProbePtr probe = &probes[i];
+        virStorageBackendFileSystemStampPtr stamp;
+
+        if (probe->ret < 0) {
+            if (probe->err)
+                virSetError(probe->err);
+            goto cleanup;
         }
 
+        virStorageBackendFileSystemDropVol(pool, state, probe->name);
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0)
+        if (VIR_ALLOC(stamp) < 0)
             goto cleanup;
-        pool->volumes.objs[pool->volumes.count++] = vol;
-        vol = NULL;
-    }
-    closedir(dir);
+        stamp->sb = probe->sb;
+        stamp->volume = !!probe->vol;
+        if (virHashAddEntry(state->stamps, probe->name, stamp) < 0) {
+            VIR_FREE(stamp);
+            goto cleanup;
+        }
 
+        if (probe->vol) {
+            if (virStoragePoolObjAddVol(pool, probe->vol) < 0)
+                goto cleanup;
+            probe->vol = NULL;
+        }
+    }
 
     if (statvfs(pool->def->target.path, &sb) < 0) {
         virReportSystemError(errno,
                              _("cannot statvfs path '%s'"),
                              pool->def->target.path);
-        return -1;
+        goto cleanup;
     }
     pool->def->capacity = ((unsigned long long)sb.f_frsize *
                            (unsigned long long)sb.f_blocks);
@@ -927,14 +1393,20 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
                             (unsigned long long)sb.f_frsize);
     pool->def->allocation = pool->def->capacity - pool->def->available;
 
-    return 0;
+    state->synced = state->watch >= 0;
+    ret = 0;
 
  cleanup:
-    if (dir)
-        closedir(dir);
-    virStorageVolDefFree(vol);
-    virStoragePoolObjClearVols(pool);
-    return -1;
+    for (i = 0; i < nprobes; i++) {
+        VIR_FREE(probes[i].name);
+        virStorageVolDefFree(probes[i].vol);
+        virFreeError(probes[i].err);
+    }
+    VIR_FREE(probes);
+    virHashFree(names);
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
+    return ret;
 }
 
 
@@ -1287,6 +1759,7 @@ virStorageBackend virStorageBackendDirectory = {
     .buildPool = virStorageBackendFileSystemBuild,
     .checkPool = virStorageBackendFileSystemCheck,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemRefresh,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
     .buildVolFrom = virStorageBackendFileSystemVolBuildFrom,
@@ -1304,6 +1777,7 @@ virStorageBackend virStorageBackendFileSystem = {
     .checkPool = virStorageBackendFileSystemCheck,
     .startPool = virStorageBackendFileSystemStart,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemRefresh,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
@@ -1321,6 +1795,7 @@ virStorageBackend virStorageBackendNetFileSystem = {
     .startPool = virStorageBackendFileSystemStart,
     .findPoolSources = virStorageBackendFileSystemNetFindPoolSources,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .updatePool = virStorageBackendFileSystemRefresh,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
@@ -345,9 +345,10 @@ virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
         if (okay < 0)
             goto cleanup;
-        if (vol && VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count,
-                                      vol) < 0)
+        if (vol && virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
             goto cleanup;
+        }
     }
     if (errno) {
         virReportSystemError(errno, _("failed to read directory '%s' in '%s'"),
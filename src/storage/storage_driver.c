@@ -65,6 +65,140 @@ static void storageDriverUnlock(virStorageDriverStatePtr driver)
     virMutexUnlock(&driver->lock);
 }
 
+/*
+ * The driver wide volume index only gives a hint of which pool holds
+ * a volume: lookups still check that pool for it and fall back to
+ * searching every pool, so entries going stale is harmless.
+ */
+static void
+storageDriverIndexDataFree(void *payload,
+                           const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+static void
+storageDriverIndexAdd(virHashTablePtr table,
+                      const char *id,
+                      const char *poolname)
+{
+    char *name;
+
+    if (!table || !id || VIR_STRDUP_QUIET(name, poolname) < 0)
+        return;
+
+    if (virHashUpdateEntry(table, id, name) < 0)
+        VIR_FREE(name);
+}
+
+static int
+storageDriverIndexMatchPool(const void *payload,
+                            const void *name ATTRIBUTE_UNUSED,
+                            const void *data)
+{
+    return STREQ(payload, data);
+}
+
+static void
+storageDriverIndexRemove(virHashTablePtr table,
+                         const char *id,
+                         const char *poolname)
+{
+    const char *name;
+
+    if (!table || !id || !(name = virHashLookup(table, id)))
+        return;
+
+    if (STREQ(name, poolname))
+        virHashRemoveEntry(table, id);
+}
+
+static void
+storageDriverIndexVol(virStorageDriverStatePtr driver,
+                      virStoragePoolObjPtr pool,
+                      virStorageVolDefPtr vol)
+{
+    virMutexLock(&driver->volIndexLock);
+    storageDriverIndexAdd(driver->volKeys, vol->key, pool->def->name);
+    storageDriverIndexAdd(driver->volPaths, vol->target.path,
+                          pool->def->name);
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+static void
+storageDriverUnindexVol(virStorageDriverStatePtr driver,
+                        virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virMutexLock(&driver->volIndexLock);
+    storageDriverIndexRemove(driver->volKeys, vol->key, pool->def->name);
+    storageDriverIndexRemove(driver->volPaths, vol->target.path,
+                             pool->def->name);
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+static void
+storageDriverIndexPool(virStorageDriverStatePtr driver,
+                       virStoragePoolObjPtr pool)
+{
+    size_t i;
+
+    virMutexLock(&driver->volIndexLock);
+    for (i = 0; i < pool->volumes.count; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+        storageDriverIndexAdd(driver->volKeys, vol->key, pool->def->name);
+        storageDriverIndexAdd(driver->volPaths, vol->target.path,
+                              pool->def->name);
+    }
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+static void
+storageDriverUnindexPool(virStorageDriverStatePtr driver,
+                         virStoragePoolObjPtr pool)
+{
+    virMutexLock(&driver->volIndexLock);
+    if (driver->volKeys)
+        virHashRemoveSet(driver->volKeys, storageDriverIndexMatchPool,
+                         pool->def->name);
+    if (driver->volPaths)
+        virHashRemoveSet(driver->volPaths, storageDriverIndexMatchPool,
+                         pool->def->name);
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+/*
+ * Returns the locked, active pool which @table points to for @id,
+ * provided it holds a volume found by @find, or NULL.
+ */
+static virStoragePoolObjPtr
+storageDriverIndexLookup(virStorageDriverStatePtr driver,
+                         virHashTablePtr table,
+                         const char *id,
+                         virStorageVolDefPtr (*find)(virStoragePoolObjPtr,
+                                                     const char *),
+                         virStorageVolDefPtr *vol)
+{
+    virStoragePoolObjPtr pool = NULL;
+    char *poolname = NULL;
+
+    virMutexLock(&driver->volIndexLock);
+    if (table)
+        ignore_value(VIR_STRDUP_QUIET(poolname, virHashLookup(table, id)));
+    virMutexUnlock(&driver->volIndexLock);
+
+    if (poolname &&
+        (pool = virStoragePoolObjFindByName(&driver->pools, poolname)) &&
+        (!virStoragePoolObjIsActive(pool) || !(*vol = find(pool, id)))) {
+        virStoragePoolObjUnlock(pool);
+        pool = NULL;
+    }
+
+    VIR_FREE(poolname);
+    return pool;
+}
+
 static void
 storageDriverAutostart(virStorageDriverStatePtr driver) {
     size_t i;
@@ -125,6 +259,7 @@ storageDriverAutostart(virStorageDriverStatePtr driver) {
                 virStoragePoolObjUnlock(pool);
                 continue;
             }
+            storageDriverIndexPool(driver, pool);
             pool->active = 1;
         }
         virStoragePoolObjUnlock(pool);
@@ -153,8 +288,17 @@ storageStateInitialize(bool privileged,
         VIR_FREE(driverState);
         return -1;
     }
+    if (virMutexInit(&driverState->volIndexLock) < 0) {
+        virMutexDestroy(&driverState->lock);
+        VIR_FREE(driverState);
+        return -1;
+    }
     storageDriverLock(driverState);
 
+    if (!(driverState->volKeys = virHashCreate(256, storageDriverIndexDataFree)) ||
+        !(driverState->volPaths = virHashCreate(256, storageDriverIndexDataFree)))
+        goto error;
+
     if (privileged) {
         if (VIR_STRDUP(base, SYSCONFDIR "/libvirt") < 0)
             goto error;
@@ -246,9 +390,13 @@ storageStateCleanup(void) {
     /* free inactive pools */
     virStoragePoolObjListFree(&driverState->pools);
 
+    virHashFree(driverState->volKeys);
+    virHashFree(driverState->volPaths);
+
     VIR_FREE(driverState->configDir);
     VIR_FREE(driverState->autostartDir);
     storageDriverUnlock(driverState);
+    virMutexDestroy(&driverState->volIndexLock);
     virMutexDestroy(&driverState->lock);
     VIR_FREE(driverState);
 
@@ -620,6 +768,7 @@ storagePoolCreateXML(virConnectPtr conn,
         pool = NULL;
         goto cleanup;
     }
+    storageDriverIndexPool(driver, pool);
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
     pool->active = 1;
 
@@ -781,6 +930,7 @@ storagePoolCreate(virStoragePoolPtr obj,
             backend->stopPool(obj->conn, pool);
         goto cleanup;
     }
+    storageDriverIndexPool(driver, pool);
 
     VIR_INFO("Starting up storage pool '%s'", pool->def->name);
     pool->active = 1;
@@ -874,6 +1024,7 @@ storagePoolDestroy(virStoragePoolPtr obj) {
         backend->stopPool(obj->conn, pool) < 0)
         goto cleanup;
 
+    storageDriverUnindexPool(driver, pool);
     virStoragePoolObjClearVols(pool);
 
     pool->active = 0;
@@ -958,6 +1109,7 @@ storagePoolRefresh(virStoragePoolPtr obj,
     virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
+    int rc;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -990,8 +1142,15 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(obj->conn, pool) < 0) {
+    storageDriverUnindexPool(driver, pool);
+    if (backend->updatePool) {
+        rc = backend->updatePool(obj->conn, pool);
+    } else {
+        virStoragePoolObjClearVols(pool);
+        rc = backend->refreshPool(obj->conn, pool);
+    }
+    if (rc < 0) {
+        virStoragePoolObjClearVols(pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
@@ -1003,6 +1162,7 @@ storagePoolRefresh(virStoragePoolPtr obj,
         }
         goto cleanup;
     }
+    storageDriverIndexPool(driver, pool);
     ret = 0;
 
 cleanup:
@@ -1398,37 +1558,41 @@ static virStorageVolPtr
 storageVolLookupByKey(virConnectPtr conn,
                       const char *key) {
     virStorageDriverStatePtr driver = conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
     size_t i;
     virStorageVolPtr ret = NULL;
 
     storageDriverLock(driver);
-    for (i = 0; i < driver->pools.count && !ret; i++) {
-        virStoragePoolObjLock(driver->pools.objs[i]);
-        if (virStoragePoolObjIsActive(driver->pools.objs[i])) {
-            virStorageVolDefPtr vol =
-                virStorageVolDefFindByKey(driver->pools.objs[i], key);
+    pool = storageDriverIndexLookup(driver, driver->volKeys, key,
+                                    virStorageVolDefFindByKey, &vol);
 
-            if (vol) {
-                if (virStorageVolLookupByKeyEnsureACL(conn, driver->pools.objs[i]->def, vol) < 0) {
-                    virStoragePoolObjUnlock(driver->pools.objs[i]);
-                    goto cleanup;
-                }
-
-                ret = virGetStorageVol(conn,
-                                       driver->pools.objs[i]->def->name,
-                                       vol->name,
-                                       vol->key,
-                                       NULL, NULL);
-            }
+    for (i = 0; i < driver->pools.count && !pool; i++) {
+        virStoragePoolObjLock(driver->pools.objs[i]);
+        if (virStoragePoolObjIsActive(driver->pools.objs[i]) &&
+            (vol = virStorageVolDefFindByKey(driver->pools.objs[i], key))) {
+            pool = driver->pools.objs[i];
+            storageDriverIndexVol(driver, pool, vol);
+        } else {
+            virStoragePoolObjUnlock(driver->pools.objs[i]);
         }
-        virStoragePoolObjUnlock(driver->pools.objs[i]);
     }
 
-    if (!ret)
+    if (!pool) {
         virReportError(VIR_ERR_NO_STORAGE_VOL,
                        _("no storage vol with matching key %s"), key);
+        goto cleanup;
+    }
+
+    if (virStorageVolLookupByKeyEnsureACL(conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    ret = virGetStorageVol(conn, pool->def->name, vol->name, vol->key,
+                           NULL, NULL);
 
 cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
     storageDriverUnlock(driver);
     return ret;
 }
@@ -1437,6 +1601,8 @@ static virStorageVolPtr
 storageVolLookupByPath(virConnectPtr conn,
                        const char *path) {
     virStorageDriverStatePtr driver = conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
     size_t i;
     virStorageVolPtr ret = NULL;
     char *cleanpath;
@@ -1446,10 +1612,15 @@ storageVolLookupByPath(virConnectPtr conn,
         return NULL;
 
     storageDriverLock(driver);
-    for (i = 0; i < driver->pools.count && !ret; i++) {
+
+    /* The index only knows the paths volumes were stored with, so
+     * anything else still has to be translated by each pool */
+    pool = storageDriverIndexLookup(driver, driver->volPaths, cleanpath,
+                                    virStorageVolDefFindByPath, &vol);
+
+    for (i = 0; i < driver->pools.count && !pool; i++) {
         virStoragePoolObjLock(driver->pools.objs[i]);
         if (virStoragePoolObjIsActive(driver->pools.objs[i])) {
-            virStorageVolDefPtr vol;
             char *stable_path;
 
             stable_path = virStorageBackendStablePath(driver->pools.objs[i],
@@ -1470,27 +1641,30 @@ storageVolLookupByPath(virConnectPtr conn,
             VIR_FREE(stable_path);
 
             if (vol) {
-                if (virStorageVolLookupByPathEnsureACL(conn, driver->pools.objs[i]->def, vol) < 0) {
-                    virStoragePoolObjUnlock(driver->pools.objs[i]);
-                    goto cleanup;
-                }
-
-                ret = virGetStorageVol(conn,
-                                       driver->pools.objs[i]->def->name,
-                                       vol->name,
-                                       vol->key,
-                                       NULL, NULL);
+                pool = driver->pools.objs[i];
+                storageDriverIndexVol(driver, pool, vol);
+                break;
             }
         }
         virStoragePoolObjUnlock(driver->pools.objs[i]);
     }
 
-    if (!ret)
+    if (!pool) {
         virReportError(VIR_ERR_NO_STORAGE_VOL,
                        _("no storage vol with matching path %s"), path);
+        goto cleanup;
+    }
+
+    if (virStorageVolLookupByPathEnsureACL(conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    ret = virGetStorageVol(conn, pool->def->name, vol->name, vol->key,
+                           NULL, NULL);
 
 cleanup:
     VIR_FREE(cleanpath);
+    if (pool)
+        virStoragePoolObjUnlock(pool);
     storageDriverUnlock(driver);
     return ret;
 }
@@ -1543,10 +1717,6 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     if (!backend->createVol) {
         virReportError(VIR_ERR_NO_SUPPORT,
                        "%s", _("storage pool does not support volume "
@@ -1561,13 +1731,16 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0)
+        goto cleanup;
+
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
         goto cleanup;
     }
+    storageDriverIndexVol(driver, pool, voldef);
 
     if (VIR_ALLOC(buildvoldef) < 0) {
         voldef = NULL;
@@ -1728,10 +1901,6 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     /* 'Define' the new volume so we get async progress reporting.
      * Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
@@ -1740,9 +1909,12 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0)
+        goto cleanup;
+
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
+    storageDriverIndexVol(driver, pool, newvol);
 
     /* Drop the pool lock during volume allocation */
     pool->asyncjobs++;
@@ -1814,7 +1986,7 @@ storageVolDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1852,11 +2024,19 @@ storageVolDownload(virStorageVolPtr obj,
         goto out;
     }
 
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_RDONLY) < 0)
-        goto out;
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_RDONLY) < 0)
+            goto out;
+    } else {
+        if (virFDStreamOpenFile(stream,
+                                vol->target.path,
+                                offset, length,
+                                O_RDONLY) < 0)
+            goto out;
+    }
 
     ret = 0;
 
@@ -1880,7 +2060,7 @@ storageVolUpload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1920,11 +2100,19 @@ storageVolUpload(virStorageVolPtr obj,
 
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_WRONLY) < 0)
-        goto out;
+    if (flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_WRONLY) < 0)
+            goto out;
+    } else {
+        if (virFDStreamOpenFile(stream,
+                                vol->target.path,
+                                offset, length,
+                                O_WRONLY) < 0)
+            goto out;
+    }
 
     ret = 0;
 
@@ -2325,7 +2513,6 @@ storageVolDelete(virStorageVolPtr obj,
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     virStorageVolDefPtr vol = NULL;
-    size_t i;
     int ret = -1;
 
     storageDriverLock(driver);
@@ -2381,25 +2568,11 @@ storageVolDelete(virStorageVolPtr obj,
     pool->def->allocation -= vol->allocation;
     pool->def->available += vol->allocation;
 
-    for (i = 0; i < pool->volumes.count; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-            vol = NULL;
-
-            if (i < (pool->volumes.count - 1))
-                memmove(pool->volumes.objs + i, pool->volumes.objs + i + 1,
-                        sizeof(*(pool->volumes.objs)) * (pool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            pool->volumes.count--;
-
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    storageDriverUnindexVol(driver, pool, vol);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
     ret = 0;
 
 cleanup:
@@ -621,10 +621,13 @@ cleanup:
 }
 
 static void
-testDomainShutdownState(virDomainPtr domain,
+testDomainShutdownState(testConnPtr privconn,
+                        virDomainPtr domain,
                         virDomainObjPtr privdom,
                         virDomainShutoffReason reason)
 {
+    virDomainObjListSetID(privconn->domains, privdom, -1);
+
     if (privdom->newDef) {
         virDomainDefFree(privdom->def);
         privdom->def = privdom->newDef;
@@ -649,7 +652,9 @@ testDomainStartState(testConnPtr privconn,
         goto cleanup;
 
     virDomainObjSetState(dom, VIR_DOMAIN_RUNNING, reason);
-    dom->def->id = privconn->nextDomID++;
+    if (virDomainObjListSetID(privconn->domains, dom,
+                              privconn->nextDomID++) < 0)
+        goto cleanup;
 
     if (virDomainObjSetDefTransient(privconn->caps,
                                     privconn->xmlopt,
@@ -661,7 +666,8 @@ testDomainStartState(testConnPtr privconn,
     ret = 0;
 cleanup:
     if (ret < 0)
-        testDomainShutdownState(NULL, dom, VIR_DOMAIN_SHUTOFF_FAILED);
+        testDomainShutdownState(privconn, NULL, dom,
+                                VIR_DOMAIN_SHUTOFF_FAILED);
     return ret;
 }
 
@@ -1078,7 +1084,7 @@ testParseDomains(testConnPtr privconn,
                 goto error;
             }
         } else {
-            testDomainShutdownState(NULL, obj, 0);
+            testDomainShutdownState(privconn, NULL, obj, 0);
         }
         virDomainObjSetState(obj, nsdata->runstate, 0);
 
@@ -1205,10 +1211,6 @@ testOpenVolumesForPool(const char *file,
         if (!def)
             goto error;
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0)
-            goto error;
-
         if (def->target.path == NULL) {
             if (virAsprintf(&def->target.path, "%s/%s",
                             pool->def->target.path,
@@ -1219,11 +1221,13 @@ testOpenVolumesForPool(const char *file,
         if (!def->key && VIR_STRDUP(def->key, def->target.path) < 0)
             goto error;
 
+        if (virStoragePoolObjAddVol(pool, def) < 0)
+            goto error;
+
         pool->def->allocation += def->allocation;
         pool->def->available = (pool->def->capacity -
                                 pool->def->allocation);
 
-        pool->volumes.objs[pool->volumes.count++] = def;
         def = NULL;
     }
 
@@ -1766,7 +1770,8 @@ static int testDomainDestroy(virDomainPtr domain)
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_DESTROYED);
+    testDomainShutdownState(privconn, domain, privdom,
+                            VIR_DOMAIN_SHUTOFF_DESTROYED);
     event = virDomainEventLifecycleNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_DESTROYED);
@@ -1896,7 +1901,8 @@ static int testDomainShutdownFlags(virDomainPtr domain,
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+    testDomainShutdownState(privconn, domain, privdom,
+                            VIR_DOMAIN_SHUTOFF_SHUTDOWN);
     event = virDomainEventLifecycleNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -1971,7 +1977,8 @@ static int testDomainReboot(virDomainPtr domain,
     }
 
     if (virDomainObjGetState(privdom, NULL) == VIR_DOMAIN_SHUTOFF) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+        testDomainShutdownState(privconn, domain, privdom,
+                                VIR_DOMAIN_SHUTOFF_SHUTDOWN);
         event = virDomainEventLifecycleNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -2135,7 +2142,8 @@ testDomainSaveFlags(virDomainPtr domain, const char *path,
     }
     fd = -1;
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SAVED);
+    testDomainShutdownState(privconn, domain, privdom,
+                            VIR_DOMAIN_SHUTOFF_SAVED);
     event = virDomainEventLifecycleNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SAVED);
@@ -2319,7 +2327,8 @@ static int testDomainCoreDump(virDomainPtr domain,
     }
 
     if (flags & VIR_DUMP_CRASH) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_CRASHED);
+        testDomainShutdownState(privconn, domain, privdom,
+                                VIR_DOMAIN_SHUTOFF_CRASHED);
         event = virDomainEventLifecycleNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_CRASHED);
@@ -5299,10 +5308,6 @@ testStorageVolCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0)
-        goto cleanup;
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1)
@@ -5311,12 +5316,13 @@ testStorageVolCreateXML(virStoragePoolPtr pool,
     if (VIR_STRDUP(privvol->key, privvol->target.path) < 0)
         goto cleanup;
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -5387,10 +5393,6 @@ testStorageVolCreateXMLFrom(virStoragePoolPtr pool,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0)
-        goto cleanup;
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1)
@@ -5399,12 +5401,13 @@ testStorageVolCreateXMLFrom(virStoragePoolPtr pool,
     if (VIR_STRDUP(privvol->key, privvol->target.path) < 0)
         goto cleanup;
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -5424,7 +5427,6 @@ testStorageVolDelete(virStorageVolPtr vol,
     testConnPtr privconn = vol->conn->privateData;
     virStoragePoolObjPtr privpool;
     virStorageVolDefPtr privvol;
-    size_t i;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -5460,25 +5462,8 @@ testStorageVolDelete(virStorageVolPtr vol,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    for (i = 0; i < privpool->volumes.count; i++) {
-        if (privpool->volumes.objs[i] == privvol) {
-            virStorageVolDefFree(privvol);
-
-            if (i < (privpool->volumes.count - 1))
-                memmove(privpool->volumes.objs + i,
-                        privpool->volumes.objs + i + 1,
-                        sizeof(*(privpool->volumes.objs)) *
-                                (privpool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(privpool->volumes.objs,
-                              privpool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            privpool->volumes.count--;
-
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(privpool, privvol);
+    virStorageVolDefFree(privvol);
     ret = 0;
 
 cleanup:
@@ -6239,7 +6224,7 @@ testDomainManagedSave(virDomainPtr dom, unsigned int flags)
         goto cleanup;
     }
 
-    testDomainShutdownState(dom, vm, VIR_DOMAIN_SHUTOFF_SAVED);
+    testDomainShutdownState(privconn, dom, vm, VIR_DOMAIN_SHUTOFF_SAVED);
     event = virDomainEventLifecycleNewFromObj(vm,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SAVED);
@@ -6777,7 +6762,7 @@ testDomainSnapshotCreateXML(virDomainPtr domain,
 
         if ((flags & VIR_DOMAIN_SNAPSHOT_CREATE_HALT) &&
             virDomainObjIsActive(vm)) {
-            testDomainShutdownState(domain, vm,
+            testDomainShutdownState(privconn, domain, vm,
                                     VIR_DOMAIN_SHUTOFF_FROM_SNAPSHOT);
             event = virDomainEventLifecycleNewFromObj(vm, VIR_DOMAIN_EVENT_STOPPED,
                                     VIR_DOMAIN_EVENT_STOPPED_FROM_SNAPSHOT);
@@ -7043,7 +7028,7 @@ testDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
                 }
 
                 virResetError(err);
-                testDomainShutdownState(snapshot->domain, vm,
+                testDomainShutdownState(privconn, snapshot->domain, vm,
                                         VIR_DOMAIN_SHUTOFF_FROM_SNAPSHOT);
                 event = virDomainEventLifecycleNewFromObj(vm,
                             VIR_DOMAIN_EVENT_STOPPED,
@@ -7116,7 +7101,7 @@ testDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
 
         if (virDomainObjIsActive(vm)) {
             /* Transitions 4, 7 */
-            testDomainShutdownState(snapshot->domain, vm,
+            testDomainShutdownState(privconn, snapshot->domain, vm,
                                     VIR_DOMAIN_SHUTOFF_FROM_SNAPSHOT);
             event = virDomainEventLifecycleNewFromObj(vm,
                                     VIR_DOMAIN_EVENT_STOPPED,
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "virutil.h"
 #include "virthread.h"
@@ -73,8 +74,171 @@ cleanup:
     return fd;
 }
 
+/* Copy @fd to stdout as a sequence of sparse records, skipping
+ * over holes instead of reading them back as zeros */
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+runIOSparseRead(const char *path, int fd, unsigned long long length,
+                char *buf, size_t buflen)
+{
+    unsigned long long total = 0;
+    virFileSparseRecord rec;
+
+    memset(&rec, 0, sizeof(rec));
+
+    while (!length || total < length) {
+        bool inData;
+        unsigned long long section;
+        ssize_t got;
+
+        if (virFileInData(fd, &inData, &section) < 0)
+            return -1;
+        if (length && section > length - total)
+            section = length - total;
+        if (section == 0)
+            break; /* End of file before end of requested data */
+
+        if (!inData) {
+            rec.type = VIR_FILE_SPARSE_RECORD_HOLE;
+            rec.length = section;
+            if (safewrite(STDOUT_FILENO, &rec, sizeof(rec)) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to write stdout"));
+                return -1;
+            }
+            if (lseek(fd, section, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, _("Unable to seek %s"), path);
+                return -1;
+            }
+            total += section;
+            continue;
+        }
+
+        if ((got = saferead(fd, buf, MIN(buflen, section))) < 0) {
+            virReportSystemError(errno, _("Unable to read %s"), path);
+            return -1;
+        }
+        if (got == 0)
+            break;
+
+        rec.type = VIR_FILE_SPARSE_RECORD_DATA;
+        rec.length = got;
+        if (safewrite(STDOUT_FILENO, &rec, sizeof(rec)) < 0 ||
+            safewrite(STDOUT_FILENO, buf, got) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            return -1;
+        }
+        total += got;
+    }
+
+    return 0;
+}
+
+
+/* Apply the sparse records read from stdin to @fd, deallocating
+ * the ranges covered by holes */
+static int
+runIOSparseWrite(const char *path, int fd, unsigned long long length,
+                 char *buf, size_t buflen)
+{
+    unsigned long long total = 0;
+    virFileSparseRecord rec;
+    struct stat sb;
+    off_t cur, end;
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("Unable to access %s"), path);
+        return -1;
+    }
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        (end = lseek(fd, 0, SEEK_END)) == (off_t) -1 ||
+        lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, _("Unable to seek %s"), path);
+        return -1;
+    }
+
+    while (1) {
+        ssize_t got;
+
+        if ((got = saferead(STDIN_FILENO, &rec, sizeof(rec))) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of stream */
+        if (got != sizeof(rec)) {
+            virReportSystemError(EIO, "%s", _("Truncated record on stdin"));
+            return -1;
+        }
+
+        if (length && rec.length > length - total) {
+            virReportSystemError(ENOSPC, _("Unable to write %s"), path);
+            return -1;
+        }
+
+        switch ((virFileSparseRecordType) rec.type) {
+        case VIR_FILE_SPARSE_RECORD_HOLE:
+            /* Past the old end of file seeking is enough, only the
+             * existing contents need to be deallocated */
+            if (cur < end &&
+                virFilePunchHole(fd, cur, MIN(rec.length, end - cur)) < 0) {
+                virReportSystemError(errno, _("Unable to punch hole in %s"),
+                                     path);
+                return -1;
+            }
+            if (lseek(fd, rec.length, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, _("Unable to seek %s"), path);
+                return -1;
+            }
+            break;
+
+        case VIR_FILE_SPARSE_RECORD_DATA: {
+            unsigned long long remain = rec.length;
+
+            while (remain) {
+                size_t want = MIN(buflen, remain);
+
+                if ((got = saferead(STDIN_FILENO, buf, want)) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("Unable to read stdin"));
+                    return -1;
+                }
+                if (got != want) {
+                    virReportSystemError(EIO, "%s",
+                                         _("Truncated record on stdin"));
+                    return -1;
+                }
+                if (safewrite(fd, buf, got) < 0) {
+                    virReportSystemError(errno, _("Unable to write %s"), path);
+                    return -1;
+                }
+                remain -= got;
+            }
+            break;
+        }
+
+        default:
+            virReportSystemError(EINVAL, _("Unknown record type %u on stdin"),
+                                 rec.type);
+            return -1;
+        }
+
+        cur += rec.length;
+        total += rec.length;
+    }
+
+    /* A trailing hole only moved the file offset, so make sure the
+     * file covers it */
+    if (S_ISREG(sb.st_mode) && cur > end && ftruncate(fd, cur) < 0) {
+        virReportSystemError(errno, _("Unable to truncate %s"), path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      bool sparse)
 {
     void *base = NULL; /* Location to be freed */
     char *buf = NULL; /* Aligned location within base */
@@ -137,6 +301,23 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+    if (sparse) {
+        if (direct) {
+            virReportSystemError(EINVAL, "%s",
+                                 _("O_DIRECT cannot be used in sparse mode"));
+            goto cleanup;
+        }
+
+        if (fdin == fd) {
+            if (runIOSparseRead(path, fd, length, buf, buflen) < 0)
+                goto cleanup;
+        } else {
+            if (runIOSparseWrite(path, fd, length, buf, buflen) < 0)
+                goto cleanup;
+        }
+        goto done;
+    }
+
     while (1) {
         ssize_t got;
 
@@ -178,6 +359,7 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         }
     }
 
+done:
     /* Ensure all data is written */
     if (fdatasync(fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
@@ -209,7 +391,7 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
+                 "   or: %s FILENAME LENGTH FD [SPARSE]\n"),
                program_name, program_name);
     }
     exit(status);
@@ -225,6 +407,7 @@ main(int argc, char **argv)
     int oflags = -1;
     int mode;
     unsigned int delete = 0;
+    unsigned int sparse = 0;
     int fd = -1;
     int lengthIndex = 0;
 
@@ -270,13 +453,18 @@ main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
         fd = prepare(path, oflags, mode, offset);
-    } else if (argc == 4) { /* FILENAME LENGTH FD */
+    } else if (argc == 4 || argc == 5) { /* FILENAME LENGTH FD [SPARSE] */
         lengthIndex = 2;
         if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
             exit(EXIT_FAILURE);
         }
+        if (argc == 5 && virStrToLong_ui(argv[4], NULL, 10, &sparse) < 0) {
+            fprintf(stderr, _("%s: malformed sparse flag %s"),
+                    program_name, argv[4]);
+            exit(EXIT_FAILURE);
+        }
 #ifdef F_GETFL
         oflags = fcntl(fd, F_GETFL);
 #else
@@ -301,7 +489,7 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0 || runIO(path, fd, oflags, length, sparse != 0) < 0)
         goto error;
 
     if (delete)
@@ -49,6 +49,7 @@
 #include "virfile.h"
 #include "virhash.h"
 #include "virhashcode.h"
+#include "virstatcache.h"
 #include "virstring.h"
 #include "virsystemd.h"
 
@@ -692,10 +693,11 @@ cleanup:
 
 
 static int
-virCgroupGetValueStr(virCgroupPtr group,
-                     int controller,
-                     const char *key,
-                     char **value)
+virCgroupGetValueStrFull(virCgroupPtr group,
+                         int controller,
+                         const char *key,
+                         bool cached,
+                         char **value)
 {
     char *keypath = NULL;
     int ret = -1, rc;
@@ -707,7 +709,11 @@ virCgroupGetValueStr(virCgroupPtr group,
 
     VIR_DEBUG("Get value %s", keypath);
 
-    if ((rc = virFileReadAll(keypath, 1024*1024, value)) < 0) {
+    if (cached)
+        rc = virStatCacheRead(keypath, 1024*1024, value);
+    else
+        rc = virFileReadAll(keypath, 1024*1024, value);
+    if (rc < 0) {
         virReportSystemError(errno,
                              _("Unable to read from '%s'"), keypath);
         goto cleanup;
@@ -725,6 +731,28 @@ cleanup:
 }
 
 
+static int
+virCgroupGetValueStr(virCgroupPtr group,
+                     int controller,
+                     const char *key,
+                     char **value)
+{
+    return virCgroupGetValueStrFull(group, controller, key, false, value);
+}
+
+
+/* Accounting files are polled continuously by stats collectors, so
+ * read them through the shared stats cache */
+static int
+virCgroupGetStatStr(virCgroupPtr group,
+                    int controller,
+                    const char *key,
+                    char **value)
+{
+    return virCgroupGetValueStrFull(group, controller, key, true, value);
+}
+
+
 static int
 virCgroupSetValueU64(virCgroupPtr group,
                      int controller,
@@ -2490,8 +2518,8 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 {
-    return virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                                "cpuacct.usage_percpu", usage);
+    return virCgroupGetStatStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                               "cpuacct.usage_percpu", usage);
 }
 
 
@@ -2894,9 +2922,25 @@ virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 int
 virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
-    return virCgroupGetValueU64(group,
-                                VIR_CGROUP_CONTROLLER_CPUACCT,
-                                "cpuacct.usage", usage);
+    char *str;
+    int ret = -1;
+
+    if (virCgroupGetStatStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.usage", &str) < 0)
+        return -1;
+
+    if (virStrToLong_ull(str, NULL, 10, usage) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s' as an integer"),
+                       str);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(str);
+    return ret;
 }
 
 
@@ -2909,8 +2953,8 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
     int ret = -1;
     static double scale = -1.0;
 
-    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                             "cpuacct.stat", &str) < 0)
+    if (virCgroupGetStatStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.stat", &str) < 0)
         return -1;
 
     if (!(p = STRSKIP(str, "user ")) ||
@@ -28,6 +28,10 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <dirent.h>
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+# include <spawn.h>
+#endif
 
 #if WITH_CAPNG
 # include <cap-ng.h>
@@ -389,6 +393,220 @@ virCommandHandshakeChild(virCommandPtr cmd)
     return 0;
 }
 
+static int
+virCommandCompareFD(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Close all the descriptors above stderr in the child, but @childin,
+ * @childout, @childerr and the ones passed with virCommandPassFD.
+ * With a high RLIMIT_NOFILE, calling close() on every possible
+ * descriptor is what takes most of the time spent spawning a
+ * command, so only the open descriptors are closed when the kernel
+ * tells us which they are.
+ */
+static int
+virCommandMassClose(virCommandPtr cmd,
+                    int childin,
+                    int childout,
+                    int childerr)
+{
+    int *keep = NULL;
+    size_t nkeep = 0;
+    int openmax;
+    int fd;
+    int tmpfd;
+    size_t i;
+    int ret = -1;
+# ifdef __linux__
+    DIR *dir;
+    struct dirent *ent;
+# endif
+
+    if (VIR_ALLOC_N(keep, cmd->npassfd + 3) < 0)
+        goto cleanup;
+
+    if (childin > STDERR_FILENO)
+        keep[nkeep++] = childin;
+    if (childout > STDERR_FILENO)
+        keep[nkeep++] = childout;
+    if (childerr > STDERR_FILENO)
+        keep[nkeep++] = childerr;
+
+    for (i = 0; i < cmd->npassfd; i++) {
+        fd = cmd->passfd[i].fd;
+        if (virSetInherit(fd, true) < 0) {
+            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
+            goto cleanup;
+        }
+        keep[nkeep++] = fd;
+    }
+
+    qsort(keep, nkeep, sizeof(*keep), virCommandCompareFD);
+
+# ifdef HAVE_CLOSE_RANGE
+    /* Close the gaps between the descriptors to keep */
+    fd = STDERR_FILENO + 1;
+    for (i = 0; i <= nkeep; i++) {
+        unsigned int last = i < nkeep ? keep[i] - 1 : ~0U;
+
+        if (i < nkeep && keep[i] < fd)
+            continue;
+        if (last >= fd && close_range(fd, last, 0) < 0)
+            break;
+        if (i < nkeep)
+            fd = keep[i] + 1;
+    }
+    if (i > nkeep) {
+        ret = 0;
+        goto cleanup;
+    }
+    VIR_DEBUG("close_range failed, falling back to listing open fds");
+# endif
+
+# ifdef __linux__
+    if ((dir = opendir("/proc/self/fd"))) {
+        while ((ent = readdir(dir))) {
+            if (virStrToLong_i(ent->d_name, NULL, 10, &fd) < 0 ||
+                fd <= STDERR_FILENO || fd == dirfd(dir) ||
+                bsearch(&fd, keep, nkeep, sizeof(*keep),
+                        virCommandCompareFD))
+                continue;
+            VIR_MASS_CLOSE(fd);
+        }
+        closedir(dir);
+        ret = 0;
+        goto cleanup;
+    }
+# endif
+
+    errno = 0;
+    openmax = sysconf(_SC_OPEN_MAX);
+    if (openmax < 0) {
+        /* Without a limit there is no last descriptor to close */
+        if (errno == 0)
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot close descriptors with an unlimited RLIMIT_NOFILE"));
+        else
+            virReportSystemError(errno,  "%s",
+                                 _("sysconf(_SC_OPEN_MAX) failed"));
+        goto cleanup;
+    }
+    for (fd = STDERR_FILENO + 1; fd < openmax; fd++) {
+        if (bsearch(&fd, keep, nkeep, sizeof(*keep), virCommandCompareFD))
+            continue;
+        tmpfd = fd;
+        VIR_MASS_CLOSE(tmpfd);
+    }
+    ret = 0;
+
+cleanup:
+    VIR_FREE(keep);
+    return ret;
+}
+
+# ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+/*
+ * A command which needs nothing else done between fork and exec
+ * than setting up its standard descriptors can be started with
+ * posix_spawn, which glibc implements with a vfork-like clone that
+ * neither copies the page tables of the daemon nor walks its
+ * descriptors one by one.
+ */
+static bool
+virCommandCanSpawn(virCommandPtr cmd,
+                   int childin,
+                   int childout,
+                   int childerr)
+{
+    if (cmd->hook || cmd->handshake || cmd->pwd || cmd->npassfd ||
+        (cmd->flags & (VIR_EXEC_DAEMON | VIR_EXEC_CLEAR_CAPS)) ||
+        cmd->uid != (uid_t)-1 || cmd->gid != (gid_t)-1 ||
+        cmd->capabilities ||
+        cmd->maxMemLock || cmd->maxProcesses || cmd->maxFiles)
+        return false;
+#  if defined(WITH_SECDRIVER_SELINUX)
+    if (cmd->seLinuxLabel)
+        return false;
+#  endif
+#  if defined(WITH_SECDRIVER_APPARMOR)
+    if (cmd->appArmorProfile)
+        return false;
+#  endif
+
+    /* Duplicating a descriptor onto itself would leave it
+     * close-on-exec, so leave that case to prepareStdFd */
+    return childin > STDERR_FILENO &&
+        childout > STDERR_FILENO &&
+        childerr > STDERR_FILENO;
+}
+
+/*
+ * Start @binary with posix_spawn.  The child gets the default signal
+ * handlers and an empty signal mask, just like after virFork.
+ * Returns 0 on success, -1 if the command must be started the usual
+ * way, which is also how a binary that cannot be executed keeps being
+ * reported through the exit status of the child.
+ */
+static int
+virCommandSpawn(virCommandPtr cmd,
+                const char *binary,
+                int childin,
+                int childout,
+                int childerr,
+                pid_t *pid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdefault;
+    sigset_t sigmask;
+    char ebuf[1024];
+    int rc;
+
+    if ((rc = posix_spawn_file_actions_init(&actions)) != 0)
+        goto error;
+    if ((rc = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        goto error;
+    }
+
+    sigfillset(&sigdefault);
+    sigemptyset(&sigmask);
+
+    if ((rc = posix_spawn_file_actions_adddup2(&actions, childin,
+                                               STDIN_FILENO)) != 0 ||
+        (rc = posix_spawn_file_actions_adddup2(&actions, childout,
+                                               STDOUT_FILENO)) != 0 ||
+        (rc = posix_spawn_file_actions_adddup2(&actions, childerr,
+                                               STDERR_FILENO)) != 0 ||
+        (rc = posix_spawn_file_actions_addclosefrom_np(&actions,
+                                                       STDERR_FILENO + 1)) != 0 ||
+        (rc = posix_spawnattr_setsigdefault(&attr, &sigdefault)) != 0 ||
+        (rc = posix_spawnattr_setsigmask(&attr, &sigmask)) != 0 ||
+        (rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                              POSIX_SPAWN_SETSIGMASK)) != 0)
+        goto cleanup;
+
+    rc = posix_spawn(pid, binary, &actions, &attr, cmd->args,
+                     cmd->env ? cmd->env : environ);
+
+cleanup:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc == 0) {
+        VIR_DEBUG("Spawned %s as pid %lld", binary, (long long) *pid);
+        return 0;
+    }
+error:
+    VIR_DEBUG("Cannot spawn %s: %s, forking instead",
+              binary, virStrerror(rc, ebuf, sizeof(ebuf)));
+    *pid = -1;
+    return -1;
+}
+# endif /* HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP */
+
 /*
  * virExec:
  * @cmd virCommandPtr containing all information about the program to
@@ -398,13 +616,12 @@ static int
 virExec(virCommandPtr cmd)
 {
     pid_t pid;
-    int null = -1, fd, openmax;
+    int null = -1;
     int pipeout[2] = {-1, -1};
     int pipeerr[2] = {-1, -1};
     int childin = cmd->infd;
     int childout = -1;
     int childerr = -1;
-    int tmpfd;
     char *binarystr = NULL;
     const char *binary = NULL;
     int forkRet, ret;
@@ -484,7 +701,13 @@ virExec(virCommandPtr cmd)
     if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
         goto cleanup;
 
-    forkRet = virFork(&pid);
+# ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+    if (virCommandCanSpawn(cmd, childin, childout, childerr) &&
+        virCommandSpawn(cmd, binary, childin, childout, childerr, &pid) == 0)
+        forkRet = 0;
+    else
+# endif
+        forkRet = virFork(&pid);
 
     if (pid < 0) {
         goto cleanup;
@@ -522,23 +745,8 @@ virExec(virCommandPtr cmd)
         goto fork_error;
     }
 
-    openmax = sysconf(_SC_OPEN_MAX);
-    if (openmax < 0) {
-        virReportSystemError(errno,  "%s",
-                             _("sysconf(_SC_OPEN_MAX) failed"));
+    if (virCommandMassClose(cmd, childin, childout, childerr) < 0)
         goto fork_error;
-    }
-    for (fd = 3; fd < openmax; fd++) {
-        if (fd == childin || fd == childout || fd == childerr)
-            continue;
-        if (!virCommandFDIsSet(cmd, fd)) {
-            tmpfd = fd;
-            VIR_MASS_CLOSE(tmpfd);
-        } else if (virSetInherit(fd, true) < 0) {
-            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
-            goto fork_error;
-        }
-    }
 
     if (prepareStdFd(childin, STDIN_FILENO) < 0) {
         virReportSystemError(errno,
@@ -1848,6 +2056,51 @@ virCommandToString(virCommandPtr cmd)
 }
 
 
+/**
+ * virCommandGetArgList:
+ * @cmd: the command to inspect
+ * @args: filled with a NULL terminated copy of the arguments
+ * @nargs: filled with the number of arguments
+ *
+ * Call after adding all arguments, to get a copy of the arguments
+ * cmd would be run with, not including the program name.  Caller is
+ * responsible for freeing @args with virStringFreeList.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCommandGetArgList(virCommandPtr cmd,
+                     char ***args,
+                     size_t *nargs)
+{
+    size_t i;
+
+    if (!cmd || cmd->has_error == ENOMEM) {
+        virReportOOMError();
+        return -1;
+    }
+    if (cmd->has_error) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("invalid use of command API"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(*args, cmd->nargs) < 0)
+        return -1;
+
+    for (i = 1; i < cmd->nargs; i++) {
+        if (VIR_STRDUP((*args)[i - 1], cmd->args[i]) < 0) {
+            virStringFreeList(*args);
+            *args = NULL;
+            return -1;
+        }
+    }
+    *nargs = cmd->nargs - 1;
+
+    return 0;
+}
+
+
 /*
  * Manage input and output to the child process.
  */
@@ -0,0 +1,727 @@
+/*
+ * vircompress.c: multi-threaded chunked compression of a file descriptor
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "vircompress.h"
+#include "viralloc.h"
+#include "virendian.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#if WITH_ZLIB
+
+/* Every chunk is written as a gzip member (RFC 1952) carrying an
+ * extra "LV" subfield with the length of its deflate data, so readers
+ * can find the next chunk without inflating the current one. Plain
+ * gzip tools ignore the subfield and decompress the whole stream. */
+# define VIR_COMPRESS_HEADER_LEN 20
+# define VIR_COMPRESS_TRAILER_LEN 8
+
+/* A raw deflate stream holding no data */
+# define VIR_COMPRESS_EMPTY_DATA "\x03\x00"
+
+# define VIR_COMPRESS_MAX_THREADS 64
+
+typedef struct _virCompressorWorker virCompressorWorker;
+typedef virCompressorWorker *virCompressorWorkerPtr;
+struct _virCompressorWorker {
+    virCompressorPtr comp;
+    virThread thread;
+    z_stream zs;
+    bool zsInit;
+    unsigned char *in;
+    unsigned char *out;
+};
+
+struct _virCompressor {
+    virCompressMode mode;
+    int infd;
+    int outfd;
+    char *name;
+    size_t chunkSize;
+
+    virCompressorWorkerPtr workers;
+    size_t nworkers;
+    size_t nthreads;
+    bool joined;
+
+    /* Held while a worker reads the next chunk, so chunks
+     * are numbered in the order they appear in the input */
+    virMutex readLock;
+    size_t nextRead;
+    bool eof;
+
+    /* Protects everything below. Chunks are written in the
+     * order they were read: a worker waits on @cond until
+     * @nextWrite reaches the number of its chunk. */
+    virMutex lock;
+    virCond cond;
+    size_t nextWrite;
+    virErrorPtr error;
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned long long start;
+    unsigned long long end;
+};
+
+
+bool
+virCompressorAvailable(void)
+{
+    return true;
+}
+
+
+static void
+virCompressorSetError(virCompressorPtr comp)
+{
+    virMutexLock(&comp->lock);
+    if (!comp->error)
+        comp->error = virSaveLastError();
+    virMutexUnlock(&comp->lock);
+}
+
+
+static bool
+virCompressorFailed(virCompressorPtr comp)
+{
+    bool ret;
+
+    virMutexLock(&comp->lock);
+    ret = comp->error != NULL;
+    virMutexUnlock(&comp->lock);
+    return ret;
+}
+
+
+static void
+virCompressorPutLE32(unsigned char *buf, uint32_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+    buf[2] = (val >> 16) & 0xff;
+    buf[3] = (val >> 24) & 0xff;
+}
+
+
+static void
+virCompressorPutHeader(unsigned char *buf, uint32_t dataLen)
+{
+    memset(buf, 0, VIR_COMPRESS_HEADER_LEN);
+    buf[0] = 0x1f;              /* ID1 */
+    buf[1] = 0x8b;              /* ID2 */
+    buf[2] = 8;                 /* CM: deflate */
+    buf[3] = 4;                 /* FLG: FEXTRA */
+    buf[9] = 0xff;              /* OS: unknown */
+    buf[10] = 8;                /* XLEN */
+    buf[12] = 'L';              /* SI1 */
+    buf[13] = 'V';              /* SI2 */
+    buf[14] = 4;                /* LEN */
+    virCompressorPutLE32(buf + 16, dataLen);
+}
+
+
+static void
+virCompressorPutTrailer(unsigned char *buf, uint32_t crc, uint32_t rawLen)
+{
+    virCompressorPutLE32(buf, crc);
+    virCompressorPutLE32(buf + 4, rawLen);
+}
+
+
+static size_t
+virCompressorDataMax(virCompressorPtr comp)
+{
+    /* Large enough for raw deflate output too */
+    return compressBound(comp->chunkSize);
+}
+
+
+/*
+ * Read the next chunk of input into @buf.
+ *
+ * When compressing, this is up to chunkSize bytes of raw data. When
+ * decompressing, this is the deflate data of a gzip member followed
+ * by its trailer, and @rawLen is set to the size it inflates to.
+ *
+ * Returns the number of bytes placed in @buf, 0 at the end of the
+ * input, or -1 on error.
+ */
+static ssize_t
+virCompressorReadChunk(virCompressorPtr comp,
+                       unsigned char *buf,
+                       size_t *rawLen)
+{
+    unsigned char header[VIR_COMPRESS_HEADER_LEN];
+    ssize_t got;
+    size_t dataLen;
+
+    if (comp->mode == VIR_COMPRESS_DEFLATE) {
+        if ((got = saferead(comp->infd, buf, comp->chunkSize)) < 0) {
+            virReportSystemError(errno, _("Unable to read %s"), comp->name);
+            return -1;
+        }
+        *rawLen = got;
+        return got;
+    }
+
+    if ((got = saferead(comp->infd, header, sizeof(header))) < 0) {
+        virReportSystemError(errno, _("Unable to read %s"), comp->name);
+        return -1;
+    }
+    if (got != sizeof(header))
+        goto truncated;
+
+    if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 ||
+        header[3] != 4 || header[10] != 8 || header[11] != 0 ||
+        header[12] != 'L' || header[13] != 'V' ||
+        header[14] != 4 || header[15] != 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Chunk %zu of %s is not in the expected format"),
+                       comp->nextRead, comp->name);
+        return -1;
+    }
+
+    dataLen = virReadBufInt32LE(header + 16);
+    if (dataLen == 0 || dataLen > virCompressorDataMax(comp)) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Invalid length %zu of chunk %zu in %s"),
+                       dataLen, comp->nextRead, comp->name);
+        return -1;
+    }
+    dataLen += VIR_COMPRESS_TRAILER_LEN;
+
+    if ((got = saferead(comp->infd, buf, dataLen)) < 0) {
+        virReportSystemError(errno, _("Unable to read %s"), comp->name);
+        return -1;
+    }
+    if (got != dataLen)
+        goto truncated;
+
+    /* An empty member marks the end of the stream */
+    *rawLen = virReadBufInt32LE(buf + dataLen - 4);
+    if (*rawLen == 0)
+        return 0;
+
+    if (*rawLen > comp->chunkSize) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Invalid length %zu of chunk %zu in %s"),
+                       *rawLen, comp->nextRead, comp->name);
+        return -1;
+    }
+
+    return got;
+
+truncated:
+    virReportError(VIR_ERR_OPERATION_FAILED,
+                   _("Unexpected end of compressed data in %s"),
+                   comp->name);
+    return -1;
+}
+
+
+/*
+ * Compress or decompress the chunk read in @worker->in.
+ * Returns the number of bytes to write out from @worker->out,
+ * or -1 on error.
+ */
+static ssize_t
+virCompressorProcessChunk(virCompressorWorkerPtr worker,
+                          size_t inLen,
+                          size_t rawLen,
+                          size_t seq)
+{
+    virCompressorPtr comp = worker->comp;
+    z_stream *zs = &worker->zs;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    int rc;
+
+    if (comp->mode == VIR_COMPRESS_DEFLATE) {
+        size_t dataMax = virCompressorDataMax(comp);
+
+        if ((rc = deflateReset(zs)) != Z_OK)
+            goto error;
+
+        zs->next_in = worker->in;
+        zs->avail_in = inLen;
+        zs->next_out = worker->out + VIR_COMPRESS_HEADER_LEN;
+        zs->avail_out = dataMax;
+        if ((rc = deflate(zs, Z_FINISH)) != Z_STREAM_END)
+            goto error;
+
+        crc = crc32(crc, worker->in, inLen);
+        virCompressorPutHeader(worker->out, zs->total_out);
+        virCompressorPutTrailer(worker->out + VIR_COMPRESS_HEADER_LEN +
+                                zs->total_out, crc, inLen);
+        return VIR_COMPRESS_HEADER_LEN + zs->total_out +
+            VIR_COMPRESS_TRAILER_LEN;
+    }
+
+    if ((rc = inflateReset(zs)) != Z_OK)
+        goto error;
+
+    zs->next_in = worker->in;
+    zs->avail_in = inLen - VIR_COMPRESS_TRAILER_LEN;
+    zs->next_out = worker->out;
+    zs->avail_out = comp->chunkSize;
+    if ((rc = inflate(zs, Z_FINISH)) != Z_STREAM_END)
+        goto error;
+
+    crc = crc32(crc, worker->out, zs->total_out);
+    if (zs->total_out != rawLen ||
+        crc != virReadBufInt32LE(worker->in + inLen - 8)) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Chunk %zu of %s is corrupt"),
+                       seq, comp->name);
+        return -1;
+    }
+    return zs->total_out;
+
+error:
+    if (comp->mode == VIR_COMPRESS_DEFLATE)
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Unable to compress chunk %zu of %s: %s"),
+                       seq, comp->name, zs->msg ? zs->msg : zError(rc));
+    else
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Unable to decompress chunk %zu of %s: %s"),
+                       seq, comp->name, zs->msg ? zs->msg : zError(rc));
+    return -1;
+}
+
+
+static void
+virCompressorWorkerRun(void *opaque)
+{
+    virCompressorWorkerPtr worker = opaque;
+    virCompressorPtr comp = worker->comp;
+
+    /* After a failure keep reading the input until its end, so
+     * that the process feeding it does not block on a full pipe */
+    for (;;) {
+        ssize_t inLen;
+        ssize_t outLen = -1;
+        size_t rawLen = 0;
+        size_t seq;
+        bool failed;
+
+        virMutexLock(&comp->readLock);
+        if (comp->eof) {
+            virMutexUnlock(&comp->readLock);
+            break;
+        }
+        if ((inLen = virCompressorReadChunk(comp, worker->in, &rawLen)) <= 0) {
+            comp->eof = true;
+            virMutexUnlock(&comp->readLock);
+            if (inLen < 0)
+                virCompressorSetError(comp);
+            break;
+        }
+        seq = comp->nextRead++;
+        virMutexUnlock(&comp->readLock);
+
+        if (!virCompressorFailed(comp) &&
+            (outLen = virCompressorProcessChunk(worker, inLen,
+                                                rawLen, seq)) < 0)
+            virCompressorSetError(comp);
+
+        virMutexLock(&comp->lock);
+        while (comp->nextWrite != seq)
+            ignore_value(virCondWait(&comp->cond, &comp->lock));
+        failed = comp->error != NULL;
+        virMutexUnlock(&comp->lock);
+
+        if (!failed && outLen >= 0) {
+            if (safewrite(comp->outfd, worker->out, outLen) != outLen) {
+                virReportSystemError(errno, _("Unable to write %s"),
+                                     comp->name);
+                virCompressorSetError(comp);
+                outLen = -1;
+            }
+        }
+
+        virMutexLock(&comp->lock);
+        if (!failed && outLen >= 0) {
+            comp->bytesIn += comp->mode == VIR_COMPRESS_DEFLATE ?
+                inLen : outLen;
+            comp->bytesOut += comp->mode == VIR_COMPRESS_DEFLATE ?
+                outLen : inLen + VIR_COMPRESS_HEADER_LEN;
+        }
+        comp->nextWrite++;
+        virCondBroadcast(&comp->cond);
+        virMutexUnlock(&comp->lock);
+    }
+}
+
+
+static int
+virCompressorWorkerInit(virCompressorWorkerPtr worker)
+{
+    virCompressorPtr comp = worker->comp;
+    size_t inMax = virCompressorDataMax(comp) + VIR_COMPRESS_TRAILER_LEN;
+    size_t outMax = comp->chunkSize;
+    int rc;
+
+    if (comp->mode == VIR_COMPRESS_DEFLATE) {
+        inMax = comp->chunkSize;
+        outMax = VIR_COMPRESS_HEADER_LEN + virCompressorDataMax(comp) +
+            VIR_COMPRESS_TRAILER_LEN;
+    }
+
+    if (VIR_ALLOC_N(worker->in, inMax) < 0 ||
+        VIR_ALLOC_N(worker->out, outMax) < 0)
+        return -1;
+
+    /* Negative window bits select raw deflate data, as the gzip
+     * header and trailer are written by hand */
+    if (comp->mode == VIR_COMPRESS_DEFLATE)
+        rc = deflateInit2(&worker->zs, Z_BEST_SPEED, Z_DEFLATED,
+                          -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    else
+        rc = inflateInit2(&worker->zs, -MAX_WBITS);
+
+    if (rc != Z_OK) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to initialize zlib: %s"), zError(rc));
+        return -1;
+    }
+    worker->zsInit = true;
+
+    return 0;
+}
+
+
+/**
+ * virCompressorNew:
+ * @mode: whether to compress or decompress
+ * @infd: file descriptor to read from
+ * @outfd: file descriptor to write to
+ * @name: name of the data being processed, for error messages
+ * @chunkSize: size of the uncompressed chunks
+ * @nthreads: number of worker threads, or 0 for one per online CPU
+ *
+ * Start worker threads copying all of @infd to @outfd, compressing
+ * or decompressing on the way. The caller keeps ownership of both
+ * file descriptors and must not close them before the compressor
+ * is finished. When decompressing, @chunkSize must be at least the
+ * size used for compression.
+ *
+ * Returns the new compressor, or NULL on error.
+ */
+virCompressorPtr
+virCompressorNew(virCompressMode mode,
+                 int infd,
+                 int outfd,
+                 const char *name,
+                 size_t chunkSize,
+                 size_t nthreads)
+{
+    virCompressorPtr comp;
+    size_t i;
+
+    if (chunkSize == 0 || chunkSize > VIR_COMPRESS_CHUNK_SIZE_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Invalid compression chunk size %zu"), chunkSize);
+        return NULL;
+    }
+
+    if (nthreads == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+    if (nthreads > VIR_COMPRESS_MAX_THREADS)
+        nthreads = VIR_COMPRESS_MAX_THREADS;
+
+    if (VIR_ALLOC(comp) < 0)
+        return NULL;
+
+    if (virMutexInit(&comp->readLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(comp);
+        return NULL;
+    }
+    if (virMutexInit(&comp->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        virMutexDestroy(&comp->readLock);
+        VIR_FREE(comp);
+        return NULL;
+    }
+    if (virCondInit(&comp->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&comp->lock);
+        virMutexDestroy(&comp->readLock);
+        VIR_FREE(comp);
+        return NULL;
+    }
+
+    comp->mode = mode;
+    comp->infd = infd;
+    comp->outfd = outfd;
+    comp->chunkSize = chunkSize;
+    comp->joined = true;
+
+    if (VIR_STRDUP(comp->name, name) < 0 ||
+        VIR_ALLOC_N(comp->workers, nthreads) < 0)
+        goto error;
+
+    comp->nworkers = nthreads;
+    for (i = 0; i < nthreads; i++) {
+        comp->workers[i].comp = comp;
+        if (virCompressorWorkerInit(&comp->workers[i]) < 0)
+            goto error;
+    }
+
+    if (virTimeMillisNow(&comp->start) < 0)
+        goto error;
+
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&comp->workers[i].thread, true,
+                            virCompressorWorkerRun, &comp->workers[i]) < 0) {
+            if (i == 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to create compression thread"));
+                goto error;
+            }
+            VIR_WARN("Only %zu of %zu compression threads started for %s",
+                     i, nthreads, name);
+            break;
+        }
+        comp->nthreads++;
+        comp->joined = false;
+    }
+
+    VIR_DEBUG("Started %zu threads %scompressing %s in %zu byte chunks",
+              comp->nthreads, mode == VIR_COMPRESS_DEFLATE ? "" : "de",
+              name, chunkSize);
+
+    return comp;
+
+error:
+    virCompressorFree(comp);
+    return NULL;
+}
+
+
+static void
+virCompressorJoin(virCompressorPtr comp)
+{
+    size_t i;
+
+    if (comp->joined)
+        return;
+
+    for (i = 0; i < comp->nthreads; i++)
+        virThreadJoin(&comp->workers[i].thread);
+    comp->joined = true;
+
+    virMutexLock(&comp->lock);
+    if (virTimeMillisNow(&comp->end) < 0)
+        comp->end = comp->start;
+    virMutexUnlock(&comp->lock);
+}
+
+
+/**
+ * virCompressorFinish:
+ * @comp: the compressor
+ *
+ * Wait until all the input has been read and processed. When
+ * compressing, the end of stream marker is written after the last
+ * chunk.
+ *
+ * Returns 0 on success, -1 with the first error raised by any of
+ * the workers.
+ */
+int
+virCompressorFinish(virCompressorPtr comp)
+{
+    unsigned char last[VIR_COMPRESS_HEADER_LEN +
+                       sizeof(VIR_COMPRESS_EMPTY_DATA) - 1 +
+                       VIR_COMPRESS_TRAILER_LEN];
+
+    if (!comp->joined) {
+        virCompressorJoin(comp);
+
+        if (!comp->error && comp->mode == VIR_COMPRESS_DEFLATE) {
+            size_t dataLen = sizeof(VIR_COMPRESS_EMPTY_DATA) - 1;
+
+            virCompressorPutHeader(last, dataLen);
+            memcpy(last + VIR_COMPRESS_HEADER_LEN,
+                   VIR_COMPRESS_EMPTY_DATA, dataLen);
+            virCompressorPutTrailer(last + VIR_COMPRESS_HEADER_LEN + dataLen,
+                                    0, 0);
+
+            if (safewrite(comp->outfd, last, sizeof(last)) != sizeof(last)) {
+                virReportSystemError(errno, _("Unable to write %s"),
+                                     comp->name);
+                comp->error = virSaveLastError();
+                return -1;
+            }
+            comp->bytesOut += sizeof(last);
+        }
+    }
+
+    if (comp->error) {
+        virSetError(comp->error);
+        return -1;
+    }
+
+    VIR_DEBUG("Processed %s: %llu bytes in, %llu bytes out, %llu ms",
+              comp->name, comp->bytesIn, comp->bytesOut,
+              comp->end - comp->start);
+
+    return 0;
+}
+
+
+/**
+ * virCompressorGetStats:
+ * @comp: the compressor
+ * @bytesIn: filled with the number of bytes read and processed
+ * @bytesOut: filled with the number of bytes written
+ * @elapsed: filled with the time spent so far, in milliseconds
+ *
+ * Safe to call from any thread while the workers are running.
+ */
+void
+virCompressorGetStats(virCompressorPtr comp,
+                      unsigned long long *bytesIn,
+                      unsigned long long *bytesOut,
+                      unsigned long long *elapsed)
+{
+    unsigned long long now;
+
+    virMutexLock(&comp->lock);
+    *bytesIn = comp->bytesIn;
+    *bytesOut = comp->bytesOut;
+    if (comp->end)
+        now = comp->end;
+    else if (virTimeMillisNow(&now) < 0)
+        now = comp->start;
+    *elapsed = now - comp->start;
+    virMutexUnlock(&comp->lock);
+}
+
+
+/**
+ * virCompressorFree:
+ * @comp: the compressor
+ *
+ * Wait for the workers to exit if virCompressorFinish was not
+ * called, then release all resources. The caller must have made
+ * sure the input ends, for example by closing the write end of
+ * the pipe feeding it.
+ */
+void
+virCompressorFree(virCompressorPtr comp)
+{
+    size_t i;
+
+    if (!comp)
+        return;
+
+    virCompressorJoin(comp);
+
+    virCondDestroy(&comp->cond);
+    virMutexDestroy(&comp->lock);
+    virMutexDestroy(&comp->readLock);
+    virFreeError(comp->error);
+    for (i = 0; i < comp->nworkers; i++) {
+        virCompressorWorkerPtr worker = &comp->workers[i];
+
+        if (worker->zsInit) {
+            if (comp->mode == VIR_COMPRESS_DEFLATE)
+                deflateEnd(&worker->zs);
+            else
+                inflateEnd(&worker->zs);
+        }
+        VIR_FREE(worker->in);
+        VIR_FREE(worker->out);
+    }
+    VIR_FREE(comp->workers);
+    VIR_FREE(comp->name);
+    VIR_FREE(comp);
+}
+
+#else /* !WITH_ZLIB */
+
+bool
+virCompressorAvailable(void)
+{
+    return false;
+}
+
+
+virCompressorPtr
+virCompressorNew(virCompressMode mode ATTRIBUTE_UNUSED,
+                 int infd ATTRIBUTE_UNUSED,
+                 int outfd ATTRIBUTE_UNUSED,
+                 const char *name ATTRIBUTE_UNUSED,
+                 size_t chunkSize ATTRIBUTE_UNUSED,
+                 size_t nthreads ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("built-in compression requires zlib support"));
+    return NULL;
+}
+
+
+int
+virCompressorFinish(virCompressorPtr comp ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("built-in compression requires zlib support"));
+    return -1;
+}
+
+
+void
+virCompressorGetStats(virCompressorPtr comp ATTRIBUTE_UNUSED,
+                      unsigned long long *bytesIn,
+                      unsigned long long *bytesOut,
+                      unsigned long long *elapsed)
+{
+    *bytesIn = *bytesOut = *elapsed = 0;
+}
+
+
+void
+virCompressorFree(virCompressorPtr comp ATTRIBUTE_UNUSED)
+{
+}
+
+#endif /* !WITH_ZLIB */
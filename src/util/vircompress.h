@@ -0,0 +1,67 @@
+/*
+ * vircompress.h: multi-threaded chunked compression of a file descriptor
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_COMPRESS_H__
+# define __VIR_COMPRESS_H__
+
+# include "internal.h"
+
+/*
+ * A compressor copies everything read from one file descriptor to
+ * another, compressing or decompressing it on the way in a number of
+ * worker threads.  The input is cut in chunks that are compressed
+ * independently with zlib, so decompression can be spread across
+ * threads just as well.  Each chunk becomes one gzip member whose
+ * header records the compressed length, and an empty member ends
+ * the stream, so the output can also be read with gzip -d.
+ */
+
+# define VIR_COMPRESS_CHUNK_SIZE_DEFAULT (4 * 1024 * 1024)
+# define VIR_COMPRESS_CHUNK_SIZE_MAX (64 * 1024 * 1024)
+
+typedef enum {
+    VIR_COMPRESS_DEFLATE = 0,
+    VIR_COMPRESS_INFLATE,
+} virCompressMode;
+
+typedef struct _virCompressor virCompressor;
+typedef virCompressor *virCompressorPtr;
+
+bool virCompressorAvailable(void);
+
+virCompressorPtr virCompressorNew(virCompressMode mode,
+                                  int infd,
+                                  int outfd,
+                                  const char *name,
+                                  size_t chunkSize,
+                                  size_t nthreads)
+    ATTRIBUTE_NONNULL(4);
+
+int virCompressorFinish(virCompressorPtr comp);
+
+void virCompressorGetStats(virCompressorPtr comp,
+                           unsigned long long *bytesIn,
+                           unsigned long long *bytesOut,
+                           unsigned long long *elapsed);
+
+void virCompressorFree(virCompressorPtr comp);
+
+#endif /* __VIR_COMPRESS_H__ */
@@ -24,9 +24,11 @@
 #include <config.h>
 
 #include "virevent.h"
+#include "vireventepoll.h"
 #include "vireventpoll.h"
 #include "virlog.h"
 #include "virerror.h"
+#include "virutil.h"
 
 #include <stdlib.h>
 
@@ -36,6 +38,7 @@ static virEventRemoveHandleFunc removeHandleImpl = NULL;
 static virEventAddTimeoutFunc addTimeoutImpl = NULL;
 static virEventUpdateTimeoutFunc updateTimeoutImpl = NULL;
 static virEventRemoveTimeoutFunc removeTimeoutImpl = NULL;
+static int (*runOnceImpl)(void) = virEventPollRunOnce;
 
 /**
  * virEventAddHandle:
@@ -220,6 +223,10 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * not have a need to integrate with an external event
  * loop impl.
  *
+ * On Linux, setting the LIBVIRT_EVENT_IMPL environment variable
+ * to "epoll" selects an implementation based on epoll() instead,
+ * which scales better with the number of file handles watched.
+ *
  * Once registered, the application has to invoke virEventRunDefaultImpl in
  * a loop to process events.  Failure to do so may result in connections being
  * closed unexpectedly as a result of keepalive timeout.
@@ -232,6 +239,31 @@ int virEventRegisterDefaultImpl(void)
 
     virResetLastError();
 
+#if HAVE_SYS_EPOLL_H
+    {
+        const char *impl = virGetEnvBlockSUID("LIBVIRT_EVENT_IMPL");
+
+        if (impl && STREQ(impl, "epoll")) {
+            VIR_DEBUG("using epoll event implementation");
+            if (virEventEpollInit() < 0) {
+                virDispatchError(NULL);
+                return -1;
+            }
+
+            virEventRegisterImpl(
+                virEventEpollAddHandle,
+                virEventEpollUpdateHandle,
+                virEventEpollRemoveHandle,
+                virEventEpollAddTimeout,
+                virEventEpollUpdateTimeout,
+                virEventEpollRemoveTimeout
+                );
+            runOnceImpl = virEventEpollRunOnce;
+            return 0;
+        }
+    }
+#endif
+
     if (virEventPollInit() < 0) {
         virDispatchError(NULL);
         return -1;
@@ -245,6 +277,7 @@ int virEventRegisterDefaultImpl(void)
         virEventPollUpdateTimeout,
         virEventPollRemoveTimeout
         );
+    runOnceImpl = virEventPollRunOnce;
 
     return 0;
 }
@@ -271,7 +304,7 @@ int virEventRunDefaultImpl(void)
     VIR_DEBUG("running default event implementation");
     virResetLastError();
 
-    if (virEventPollRunOnce() < 0) {
+    if (runOnceImpl() < 0) {
         virDispatchError(NULL);
         return -1;
     }
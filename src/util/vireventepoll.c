@@ -0,0 +1,1000 @@
+/*
+ * vireventepoll.c: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#include "virthread.h"
+#include "virlog.h"
+#include "vireventepoll.h"
+#include "viralloc.h"
+#include "virutil.h"
+#include "virfile.h"
+#include "virerror.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+#if HAVE_SYS_EPOLL_H
+
+# define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
+
+/* Maximum number of ready file handles fetched by one iteration
+ * of the loop, the others will be reported by the next one */
+# define EVENT_EPOLL_MAX_EVENTS 64
+
+static int virEventEpollInterruptLocked(void);
+
+/* State for a single file handle being monitored */
+typedef struct _virEventEpollHandle virEventEpollHandle;
+typedef virEventEpollHandle *virEventEpollHandlePtr;
+struct _virEventEpollHandle {
+    int watch;
+    int fd;
+    int events;
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    /* Link in the list of handles being purged */
+    virEventEpollHandlePtr next;
+};
+
+/* epoll only accepts each file descriptor once, so this
+ * tracks all the handles registered for a file descriptor */
+typedef struct _virEventEpollFd virEventEpollFd;
+typedef virEventEpollFd *virEventEpollFdPtr;
+struct _virEventEpollFd {
+    size_t nhandles;
+    virEventEpollHandlePtr *handles;
+
+    /* Events the file descriptor is registered for with epoll */
+    int events;
+    bool registered;
+
+    /* File descriptors epoll does not support, such as regular
+     * files, which poll() would always report as ready */
+    bool alwaysReady;
+};
+
+/* State for a single timer being generated */
+typedef struct _virEventEpollTimeout virEventEpollTimeout;
+typedef virEventEpollTimeout *virEventEpollTimeoutPtr;
+struct _virEventEpollTimeout {
+    int timer;
+    int frequency;
+    unsigned long long expiresAt;
+    virEventTimeoutCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    /* Position in the heap of pending timers, -1 if disabled */
+    ssize_t heapIndex;
+
+    /* Link in the list of timers being purged */
+    virEventEpollTimeoutPtr next;
+};
+
+/* State for the main event loop */
+struct virEventEpollLoop {
+    virMutex lock;
+    int running;
+    virThread leader;
+    int wakeupfd[2];
+    int epollfd;
+
+    /* Watch and timer IDs only grow, so appending keeps
+     * these arrays sorted and lookups use bsearch */
+    size_t handlesCount;
+    size_t handlesAlloc;
+    size_t handlesDeleted;
+    virEventEpollHandlePtr *handles;
+    size_t timeoutsCount;
+    size_t timeoutsAlloc;
+    size_t timeoutsDeleted;
+    virEventEpollTimeoutPtr *timeouts;
+
+    /* Indexed by file descriptor */
+    size_t fdsCount;
+    virEventEpollFdPtr fds;
+    size_t fdsAlwaysReady;
+
+    /* Min-heap of enabled timers, by expiry time. Both this and
+     * the list of expired timers used while dispatching have room
+     * for all the timers, so they never need to grow */
+    size_t heapCount;
+    size_t heapAlloc;
+    virEventEpollTimeoutPtr *heap;
+    size_t expiredCount;
+    size_t expiredAlloc;
+    virEventEpollTimeoutPtr *expired;
+};
+
+/* Only have one event loop */
+static struct virEventEpollLoop eventLoop;
+
+/* Unique ID for the next FD watch to be registered */
+static int nextWatch = 1;
+
+/* Unique ID for the next timer to be registered */
+static int nextTimer = 1;
+
+
+static int
+virEventEpollToNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        ret |= EPOLLIN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        ret |= EPOLLOUT;
+    if (events & VIR_EVENT_HANDLE_ERROR)
+        ret |= EPOLLERR;
+    if (events & VIR_EVENT_HANDLE_HANGUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+static int
+virEventEpollFromNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= VIR_EVENT_HANDLE_READABLE;
+    if (events & EPOLLOUT)
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+    if (events & EPOLLERR)
+        ret |= VIR_EVENT_HANDLE_ERROR;
+    if (events & EPOLLHUP)
+        ret |= VIR_EVENT_HANDLE_HANGUP;
+    return ret;
+}
+
+
+static int
+virEventEpollHandleCompare(const void *key, const void *elem)
+{
+    int watch = *(const int *)key;
+    const virEventEpollHandle *handle = *(virEventEpollHandlePtr const *)elem;
+
+    if (watch < handle->watch)
+        return -1;
+    return watch > handle->watch;
+}
+
+static virEventEpollHandlePtr
+virEventEpollFindHandle(int watch)
+{
+    virEventEpollHandlePtr *handle;
+
+    handle = bsearch(&watch, eventLoop.handles, eventLoop.handlesCount,
+                     sizeof(*eventLoop.handles), virEventEpollHandleCompare);
+    return handle ? *handle : NULL;
+}
+
+static int
+virEventEpollTimeoutCompare(const void *key, const void *elem)
+{
+    int timer = *(const int *)key;
+    const virEventEpollTimeout *timeout = *(virEventEpollTimeoutPtr const *)elem;
+
+    if (timer < timeout->timer)
+        return -1;
+    return timer > timeout->timer;
+}
+
+static virEventEpollTimeoutPtr
+virEventEpollFindTimeout(int timer)
+{
+    virEventEpollTimeoutPtr *timeout;
+
+    timeout = bsearch(&timer, eventLoop.timeouts, eventLoop.timeoutsCount,
+                      sizeof(*eventLoop.timeouts), virEventEpollTimeoutCompare);
+    return timeout ? *timeout : NULL;
+}
+
+
+/*
+ * Recompute the events a file descriptor is watched for from its
+ * handles and update its registration with epoll accordingly
+ */
+static int
+virEventEpollUpdateFd(int fd)
+{
+    virEventEpollFdPtr efd = &eventLoop.fds[fd];
+    struct epoll_event ev;
+    int events = 0;
+    size_t i;
+
+    for (i = 0; i < efd->nhandles; i++) {
+        if (!efd->handles[i]->deleted)
+            events |= efd->handles[i]->events;
+    }
+
+    if (efd->alwaysReady || (events == efd->events &&
+                             efd->registered == !!events)) {
+        efd->events = events;
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (!events) {
+        /* The kernel already dropped the file descriptor if it was
+         * closed before its handle got removed */
+        if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, &ev) < 0 &&
+            errno != ENOENT && errno != EBADF)
+            goto error;
+        efd->registered = false;
+    } else if (efd->registered &&
+               epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+        /* nothing more to do */
+    } else if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        efd->registered = true;
+    } else if (errno == EPERM) {
+        EVENT_DEBUG("fd %d not supported by epoll, always ready", fd);
+        efd->alwaysReady = true;
+        efd->registered = false;
+        eventLoop.fdsAlwaysReady++;
+    } else if (errno != EEXIST ||
+               epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        goto error;
+    } else {
+        efd->registered = true;
+    }
+
+    efd->events = events;
+    return 0;
+
+error:
+    virReportSystemError(errno,
+                         _("Unable to update events of file handle %d"), fd);
+    return -1;
+}
+
+
+/*
+ * Register a callback for monitoring file handle events.
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    virEventEpollHandlePtr handle = NULL;
+    virEventEpollFdPtr efd;
+    int watch = -1;
+
+    if (fd < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid file handle %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (fd >= eventLoop.fdsCount &&
+        VIR_EXPAND_N(eventLoop.fds, eventLoop.fdsCount,
+                     fd + 1 - eventLoop.fdsCount) < 0)
+        goto cleanup;
+    efd = &eventLoop.fds[fd];
+
+    if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
+                     eventLoop.handlesCount, 1) < 0 ||
+        VIR_ALLOC(handle) < 0)
+        goto cleanup;
+
+    handle->watch = nextWatch++;
+    handle->fd = fd;
+    handle->events = virEventEpollToNativeEvents(events);
+    handle->cb = cb;
+    handle->ff = ff;
+    handle->opaque = opaque;
+
+    if (VIR_APPEND_ELEMENT_COPY(efd->handles, efd->nhandles, handle) < 0) {
+        VIR_FREE(handle);
+        goto cleanup;
+    }
+    eventLoop.handles[eventLoop.handlesCount++] = handle;
+
+    if (virEventEpollUpdateFd(fd) < 0) {
+        /* Let the next cleanup purge it, without calling @ff */
+        handle->ff = NULL;
+        handle->deleted = true;
+        eventLoop.handlesDeleted++;
+        goto cleanup;
+    }
+
+    watch = handle->watch;
+    virEventEpollInterruptLocked();
+
+    PROBE(EVENT_POLL_ADD_HANDLE,
+          "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
+          watch, fd, events, cb, opaque, ff);
+
+cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    return watch;
+}
+
+void virEventEpollUpdateHandle(int watch, int events)
+{
+    virEventEpollHandlePtr handle;
+    PROBE(EVENT_POLL_UPDATE_HANDLE,
+          "watch=%d events=%d",
+          watch, events);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid update watch %d", watch);
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((handle = virEventEpollFindHandle(watch))) {
+        handle->events = virEventEpollToNativeEvents(events);
+        if (virEventEpollUpdateFd(handle->fd) < 0)
+            virResetLastError();
+        virEventEpollInterruptLocked();
+    }
+    virMutexUnlock(&eventLoop.lock);
+
+    if (!handle)
+        VIR_WARN("Got update for non-existent handle watch %d", watch);
+}
+
+/*
+ * Unregister a callback from a file handle
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the handle.
+ * Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveHandle(int watch)
+{
+    virEventEpollHandlePtr handle;
+    int ret = -1;
+    PROBE(EVENT_POLL_REMOVE_HANDLE,
+          "watch=%d",
+          watch);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid remove watch %d", watch);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((handle = virEventEpollFindHandle(watch)) && !handle->deleted) {
+        EVENT_DEBUG("mark delete %d %d", watch, handle->fd);
+        handle->deleted = true;
+        eventLoop.handlesDeleted++;
+        if (virEventEpollUpdateFd(handle->fd) < 0)
+            virResetLastError();
+        virEventEpollInterruptLocked();
+        ret = 0;
+    }
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+
+/*
+ * Helpers maintaining the min-heap of enabled timers
+ */
+static void
+virEventEpollHeapSet(size_t i,
+                     virEventEpollTimeoutPtr timeout)
+{
+    eventLoop.heap[i] = timeout;
+    timeout->heapIndex = i;
+}
+
+static void
+virEventEpollHeapSiftUp(size_t i)
+{
+    virEventEpollTimeoutPtr timeout = eventLoop.heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (eventLoop.heap[parent]->expiresAt <= timeout->expiresAt)
+            break;
+        virEventEpollHeapSet(i, eventLoop.heap[parent]);
+        i = parent;
+    }
+    virEventEpollHeapSet(i, timeout);
+}
+
+static void
+virEventEpollHeapSiftDown(size_t i)
+{
+    virEventEpollTimeoutPtr timeout = eventLoop.heap[i];
+
+    while (2 * i + 1 < eventLoop.heapCount) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < eventLoop.heapCount &&
+            eventLoop.heap[child + 1]->expiresAt < eventLoop.heap[child]->expiresAt)
+            child++;
+        if (timeout->expiresAt <= eventLoop.heap[child]->expiresAt)
+            break;
+        virEventEpollHeapSet(i, eventLoop.heap[child]);
+        i = child;
+    }
+    virEventEpollHeapSet(i, timeout);
+}
+
+static void
+virEventEpollHeapPush(virEventEpollTimeoutPtr timeout)
+{
+    virEventEpollHeapSet(eventLoop.heapCount++, timeout);
+    virEventEpollHeapSiftUp(timeout->heapIndex);
+}
+
+static void
+virEventEpollHeapRemove(virEventEpollTimeoutPtr timeout)
+{
+    size_t i = timeout->heapIndex;
+
+    if (timeout->heapIndex < 0)
+        return;
+
+    timeout->heapIndex = -1;
+    if (i != --eventLoop.heapCount) {
+        virEventEpollTimeoutPtr last = eventLoop.heap[eventLoop.heapCount];
+        virEventEpollHeapSet(i, last);
+        virEventEpollHeapSiftDown(i);
+        virEventEpollHeapSiftUp(last->heapIndex);
+    }
+}
+
+static void
+virEventEpollHeapSchedule(virEventEpollTimeoutPtr timeout,
+                          unsigned long long now)
+{
+    if (timeout->frequency < 0 || timeout->deleted) {
+        virEventEpollHeapRemove(timeout);
+        return;
+    }
+
+    timeout->expiresAt = now + timeout->frequency;
+    if (timeout->heapIndex < 0) {
+        virEventEpollHeapPush(timeout);
+    } else {
+        virEventEpollHeapSiftUp(timeout->heapIndex);
+        virEventEpollHeapSiftDown(timeout->heapIndex);
+    }
+}
+
+
+/*
+ * Register a callback for a timer event
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+{
+    virEventEpollTimeoutPtr timeout = NULL;
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0) {
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
+                     eventLoop.timeoutsCount, 1) < 0 ||
+        VIR_RESIZE_N(eventLoop.heap, eventLoop.heapAlloc,
+                     eventLoop.timeoutsCount, 1) < 0 ||
+        VIR_RESIZE_N(eventLoop.expired, eventLoop.expiredAlloc,
+                     eventLoop.timeoutsCount, 1) < 0 ||
+        VIR_ALLOC(timeout) < 0)
+        goto cleanup;
+
+    timeout->timer = nextTimer++;
+    timeout->frequency = frequency;
+    timeout->cb = cb;
+    timeout->ff = ff;
+    timeout->opaque = opaque;
+    timeout->heapIndex = -1;
+
+    eventLoop.timeouts[eventLoop.timeoutsCount++] = timeout;
+    virEventEpollHeapSchedule(timeout, now);
+
+    ret = timeout->timer;
+    virEventEpollInterruptLocked();
+
+    PROBE(EVENT_POLL_ADD_TIMEOUT,
+          "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
+          ret, frequency, cb, opaque, ff);
+
+cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+void virEventEpollUpdateTimeout(int timer, int frequency)
+{
+    virEventEpollTimeoutPtr timeout;
+    unsigned long long now;
+    PROBE(EVENT_POLL_UPDATE_TIMEOUT,
+          "timer=%d frequency=%d",
+          timer, frequency);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid update timer %d", timer);
+        return;
+    }
+
+    if (virTimeMillisNow(&now) < 0) {
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((timeout = virEventEpollFindTimeout(timer))) {
+        timeout->frequency = frequency;
+        virEventEpollHeapSchedule(timeout, now);
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  timeout->expiresAt);
+        virEventEpollInterruptLocked();
+    }
+    virMutexUnlock(&eventLoop.lock);
+
+    if (!timeout)
+        VIR_WARN("Got update for non-existent timer %d", timer);
+}
+
+/*
+ * Unregister a callback for a timer
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the timer.
+ * Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveTimeout(int timer)
+{
+    virEventEpollTimeoutPtr timeout;
+    int ret = -1;
+    PROBE(EVENT_POLL_REMOVE_TIMEOUT,
+          "timer=%d",
+          timer);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid remove timer %d", timer);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((timeout = virEventEpollFindTimeout(timer)) && !timeout->deleted) {
+        timeout->deleted = true;
+        eventLoop.timeoutsDeleted++;
+        virEventEpollHeapRemove(timeout);
+        virEventEpollInterruptLocked();
+        ret = 0;
+    }
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+
+/* Figure out how long to wait from the first timer to expire.
+ * @timeout: filled with expiry time of soonest timer, or -1 if
+ *           no timeout is pending
+ * returns: 0 on success, -1 on error
+ */
+static int virEventEpollCalculateTimeout(int *timeout)
+{
+    unsigned long long then;
+    unsigned long long now;
+
+    if (eventLoop.fdsAlwaysReady) {
+        EVENT_DEBUG("%zu file handles always ready", eventLoop.fdsAlwaysReady);
+        *timeout = 0;
+        return 0;
+    }
+
+    if (!eventLoop.heapCount) {
+        EVENT_DEBUG("%s", "No timeout is pending");
+        *timeout = -1;
+        return 0;
+    }
+
+    then = eventLoop.heap[0]->expiresAt;
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    EVENT_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
+    *timeout = then > now ? then - now : 0;
+    EVENT_DEBUG("Timeout at %llu due in %d ms", then, *timeout);
+
+    return 0;
+}
+
+
+/*
+ * Pop all the timers which expired from the heap, schedule
+ * their next expiry and invoke their callback. Does not try
+ * to 'catch up' on time if the actual expiry time was later
+ * than the requested time.
+ *
+ * This method must cope with timers being registered, updated
+ * or deleted by a callback.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchTimeouts(void)
+{
+    unsigned long long now;
+    size_t i;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    eventLoop.expiredCount = 0;
+    while (eventLoop.heapCount &&
+           eventLoop.heap[0]->expiresAt <= (now + 20)) {
+        virEventEpollTimeoutPtr timeout = eventLoop.heap[0];
+        virEventEpollHeapRemove(timeout);
+        eventLoop.expired[eventLoop.expiredCount++] = timeout;
+    }
+
+    /* Reschedule only once they are all popped, so that timers
+     * with a zero frequency fire once per iteration */
+    for (i = 0; i < eventLoop.expiredCount; i++)
+        virEventEpollHeapSchedule(eventLoop.expired[i], now);
+
+    VIR_DEBUG("Dispatch %zu", eventLoop.expiredCount);
+
+    for (i = 0; i < eventLoop.expiredCount; i++) {
+        virEventEpollTimeoutPtr timeout = eventLoop.expired[i];
+        virEventTimeoutCallback cb = timeout->cb;
+        int timer = timeout->timer;
+        void *opaque = timeout->opaque;
+
+        if (timeout->deleted || timeout->frequency < 0)
+            continue;
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+    return 0;
+}
+
+
+/*
+ * Invoke the callbacks of the handles of @fd interested in @revents
+ *
+ * This method must cope with handles being registered, updated
+ * or deleted by a callback.
+ */
+static void virEventEpollDispatchFd(int fd, int revents)
+{
+    size_t i;
+
+    /* NB, re-read everything from eventLoop on each iteration
+     * since the arrays may be reallocated by callbacks */
+    for (i = 0; fd < eventLoop.fdsCount && i < eventLoop.fds[fd].nhandles; i++) {
+        virEventEpollHandlePtr handle = eventLoop.fds[fd].handles[i];
+        virEventHandleCallback cb = handle->cb;
+        int watch = handle->watch;
+        void *opaque = handle->opaque;
+        int hEvents;
+
+        if (handle->deleted || !handle->events)
+            continue;
+
+        if (eventLoop.fds[fd].alwaysReady)
+            hEvents = handle->events & (EPOLLIN | EPOLLOUT);
+        else
+            hEvents = revents & (handle->events | EPOLLERR | EPOLLHUP);
+        if (!hEvents)
+            continue;
+
+        hEvents = virEventEpollFromNativeEvents(hEvents);
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+}
+
+
+/* Dispatch the file handles epoll reported events for, and
+ * those epoll can't handle, which are always ready.
+ */
+static void virEventEpollDispatchHandles(int nevents,
+                                         struct epoll_event *events)
+{
+    size_t i;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (i = 0; i < nevents; i++)
+        virEventEpollDispatchFd(events[i].data.fd, events[i].events);
+
+    if (eventLoop.fdsAlwaysReady) {
+        for (i = 0; i < eventLoop.fdsCount; i++) {
+            if (eventLoop.fds[i].alwaysReady)
+                virEventEpollDispatchFd(i, 0);
+        }
+    }
+}
+
+
+/* Used post dispatch to actually remove any timers that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupTimeouts(void)
+{
+    virEventEpollTimeoutPtr purge = NULL;
+    virEventEpollTimeoutPtr timeout;
+    size_t i;
+    size_t j;
+
+    if (!eventLoop.timeoutsDeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsDeleted);
+
+    for (i = 0, j = 0; i < eventLoop.timeoutsCount; i++) {
+        timeout = eventLoop.timeouts[i];
+        if (!timeout->deleted) {
+            eventLoop.timeouts[j++] = timeout;
+            continue;
+        }
+        timeout->next = purge;
+        purge = timeout;
+    }
+    eventLoop.timeoutsCount = j;
+    eventLoop.timeoutsDeleted = 0;
+
+    while ((timeout = purge)) {
+        purge = timeout->next;
+
+        PROBE(EVENT_POLL_PURGE_TIMEOUT,
+              "timer=%d",
+              timeout->timer);
+        if (timeout->ff) {
+            virFreeCallback ff = timeout->ff;
+            void *opaque = timeout->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(timeout);
+    }
+}
+
+/* Used post dispatch to actually remove any handles that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupHandles(void)
+{
+    virEventEpollHandlePtr purge = NULL;
+    virEventEpollHandlePtr handle;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (!eventLoop.handlesDeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", eventLoop.handlesDeleted);
+
+    for (i = 0, j = 0; i < eventLoop.handlesCount; i++) {
+        virEventEpollFdPtr efd;
+
+        handle = eventLoop.handles[i];
+        if (!handle->deleted) {
+            eventLoop.handles[j++] = handle;
+            continue;
+        }
+
+        efd = &eventLoop.fds[handle->fd];
+        for (k = 0; k < efd->nhandles; k++) {
+            if (efd->handles[k] == handle) {
+                VIR_DELETE_ELEMENT(efd->handles, k, efd->nhandles);
+                break;
+            }
+        }
+        if (!efd->nhandles && efd->alwaysReady) {
+            efd->alwaysReady = false;
+            efd->events = 0;
+            eventLoop.fdsAlwaysReady--;
+        }
+
+        handle->next = purge;
+        purge = handle;
+    }
+    eventLoop.handlesCount = j;
+    eventLoop.handlesDeleted = 0;
+
+    while ((handle = purge)) {
+        purge = handle->next;
+
+        PROBE(EVENT_POLL_PURGE_HANDLE,
+              "watch=%d",
+              handle->watch);
+        if (handle->ff) {
+            virFreeCallback ff = handle->ff;
+            void *opaque = handle->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(handle);
+    }
+}
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventEpollRunOnce(void)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout, nhandles;
+
+    virMutexLock(&eventLoop.lock);
+    eventLoop.running = 1;
+    virThreadSelf(&eventLoop.leader);
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    if (virEventEpollCalculateTimeout(&timeout) < 0)
+        goto error;
+    nhandles = eventLoop.handlesCount;
+
+    virMutexUnlock(&eventLoop.lock);
+
+ retry:
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%d timeout=%d",
+          nhandles, timeout);
+    ret = epoll_wait(eventLoop.epollfd, events,
+                     ARRAY_CARDINALITY(events), timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("Unable to wait on file handles"));
+        return -1;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&eventLoop.lock);
+    if (virEventEpollDispatchTimeouts() < 0)
+        goto error;
+
+    virEventEpollDispatchHandles(ret, events);
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+
+error:
+    virMutexUnlock(&eventLoop.lock);
+    return -1;
+}
+
+
+static void virEventEpollHandleWakeup(int watch ATTRIBUTE_UNUSED,
+                                      int fd,
+                                      int events ATTRIBUTE_UNUSED,
+                                      void *opaque ATTRIBUTE_UNUSED)
+{
+    char c;
+    virMutexLock(&eventLoop.lock);
+    ignore_value(saferead(fd, &c, sizeof(c)));
+    virMutexUnlock(&eventLoop.lock);
+}
+
+int virEventEpollInit(void)
+{
+    if (virMutexInit(&eventLoop.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if ((eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll file descriptor"));
+        return -1;
+    }
+
+    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        VIR_FORCE_CLOSE(eventLoop.epollfd);
+        return -1;
+    }
+
+    if (virEventEpollAddHandle(eventLoop.wakeupfd[0],
+                               VIR_EVENT_HANDLE_READABLE,
+                               virEventEpollHandleWakeup, NULL, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add handle %d to event loop"),
+                       eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+        VIR_FORCE_CLOSE(eventLoop.epollfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int virEventEpollInterruptLocked(void)
+{
+    char c = '\0';
+
+    if (!eventLoop.running ||
+        virThreadIsSelf(&eventLoop.leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
+                  virThreadID(&eventLoop.leader));
+        return 0;
+    }
+
+    VIR_DEBUG("Interrupting");
+    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return 0;
+}
+
+int virEventEpollInterrupt(void)
+{
+    int ret;
+    virMutexLock(&eventLoop.lock);
+    ret = virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -0,0 +1,75 @@
+/*
+ * vireventepoll.h: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_EVENT_EPOLL_H__
+# define __VIR_EVENT_EPOLL_H__
+
+# include "internal.h"
+
+/*
+ * Same interface as the poll() based event loop in vireventpoll.h,
+ * but only the ready file handles are visited after each wakeup
+ * and timers are kept in a min-heap ordered by expiry time.
+ */
+
+# if HAVE_SYS_EPOLL_H
+
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff);
+void virEventEpollUpdateHandle(int watch, int events);
+int virEventEpollRemoveHandle(int watch);
+
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff);
+void virEventEpollUpdateTimeout(int timer, int frequency);
+int virEventEpollRemoveTimeout(int timer);
+
+/**
+ * virEventEpollInit: Initialize the event loop
+ *
+ * returns -1 if initialization failed
+ */
+int virEventEpollInit(void);
+
+/**
+ * virEventEpollRunOnce: run a single iteration of the event loop.
+ *
+ * Blocks the caller until at least one file handle has an
+ * event or the first timer expires.
+ *
+ * returns -1 if the event monitoring failed
+ */
+int virEventEpollRunOnce(void);
+
+/**
+ * virEventEpollInterrupt: wakeup any thread waiting in epoll_wait()
+ *
+ * return -1 if wakup failed
+ */
+int virEventEpollInterrupt(void);
+
+# endif /* HAVE_SYS_EPOLL_H */
+
+#endif /* __VIR_EVENT_EPOLL_H__ */
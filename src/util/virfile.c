@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <dirname.h>
+#include <poll.h>
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 # include <mntent.h>
 #endif
@@ -57,6 +58,8 @@
 #include "virprocess.h"
 #include "virstring.h"
 #include "virstoragefile.h"
+#include "virthread.h"
+#include "virtime.h"
 #include "virutil.h"
 
 #include "c-ctype.h"
@@ -1104,6 +1107,162 @@ safezero(int fd, off_t offset, off_t len)
 #endif /* HAVE_POSIX_FALLOCATE */
 
 
+/**
+ * virFileInData:
+ * @fd: file to check
+ * @inData: set to true if the current position is within data
+ * @length: set to the number of bytes left in the current section
+ *
+ * Tell whether the current position of @fd lies within data or
+ * within a hole, and how far the section extends. Reaching the end
+ * of the file is reported as a hole of zero length. The position of
+ * @fd is left unchanged. Files and filesystems which cannot report
+ * holes are treated as containing data only.
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+virFileInData(int fd,
+              bool *inData,
+              unsigned long long *length)
+{
+    off_t cur, end;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data, hole;
+#endif
+    int ret = -1;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        goto cleanup;
+    }
+
+    if ((end = lseek(fd, 0, SEEK_END)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seek to end of file"));
+        goto restore;
+    }
+
+    if (cur >= end) {
+        *inData = false;
+        *length = 0;
+        ret = 0;
+        goto restore;
+    }
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if ((data = lseek(fd, cur, SEEK_DATA)) == (off_t) -1) {
+        if (errno == ENXIO) {
+            /* Nothing but a hole up to the end of the file */
+            *inData = false;
+            *length = end - cur;
+            ret = 0;
+        } else if (errno == EINVAL || errno == ENOTSUP) {
+            *inData = true;
+            *length = end - cur;
+            ret = 0;
+        } else {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to data"));
+        }
+        goto restore;
+    }
+
+    if (data > cur) {
+        *inData = false;
+        *length = data - cur;
+        ret = 0;
+        goto restore;
+    }
+
+    /* There's always an implicit hole at the end of the file */
+    if ((hole = lseek(fd, cur, SEEK_HOLE)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seek to hole"));
+        goto restore;
+    }
+
+    *inData = true;
+    *length = hole - cur;
+    ret = 0;
+#else
+    *inData = true;
+    *length = end - cur;
+    ret = 0;
+#endif
+
+restore:
+    if (lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to restore position in file"));
+        ret = -1;
+    }
+cleanup:
+    return ret;
+}
+
+
+/**
+ * virFilePunchHole:
+ * @fd: file to modify
+ * @offset: start of the range
+ * @length: size of the range
+ *
+ * Deallocate the given range of @fd so that it reads back as zeros,
+ * without changing the size of the file. Filesystems, kernels and
+ * block devices that cannot deallocate a range have the zeros written
+ * out instead.
+ *
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int
+virFilePunchHole(int fd,
+                 off_t offset,
+                 off_t length)
+{
+    char *buf = NULL;
+    size_t buflen = 1024 * 1024;
+    off_t cur;
+
+/* Avoid issues with older kernel's <linux/fs.h> namespace pollution. */
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, length) == 0)
+        return 0;
+    /* block devices report ENODEV */
+    if (errno != ENOSYS && errno != EOPNOTSUPP && errno != ENODEV)
+        return -1;
+#endif
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        lseek(fd, offset, SEEK_SET) == (off_t) -1)
+        return -1;
+
+    if (buflen > length)
+        buflen = length;
+    if (VIR_ALLOC_N_QUIET(buf, buflen) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (length) {
+        size_t bytes = MIN(buflen, length);
+
+        if (safewrite(fd, buf, bytes) < 0) {
+            VIR_FREE(buf);
+            return -1;
+        }
+        length -= bytes;
+    }
+    VIR_FREE(buf);
+
+    if (lseek(fd, cur, SEEK_SET) == (off_t) -1)
+        return -1;
+    return 0;
+}
+
+
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 /* search /proc/mounts for mount point of *type; return pointer to
  * malloc'ed string of the path if found, otherwise return NULL
@@ -1829,152 +1988,403 @@ virFileOpenForceOwnerMode(const char *path, int fd, mode_t mode,
     return ret;
 }
 
-/* virFileOpenForked() - an internal utility function called only by
- * virFileOpenAs(). It forks, then the child does setuid+setgid to
- * given uid:gid and attempts to open the file, while the parent just
- * calls recvfd to get the open fd back from the child. returns the
- * fd, or -errno if there is an error. */
+/*
+ * Opening a file as another user needs a process running as that
+ * user, which used to mean one fork per virFileOpenAs() call.  Looking
+ * up a backing chain on root-squashed NFS opens every layer that way,
+ * so instead a broker process is kept for each uid:gid pair.  It
+ * receives open requests over a socket and sends the descriptors back,
+ * and exits once it has been idle for VIR_FILE_BROKER_IDLE_TIMEOUT
+ * seconds or when the daemon goes away.
+ */
+# define VIR_FILE_BROKER_IDLE_TIMEOUT 30
+
+typedef struct _virFileBrokerRequest virFileBrokerRequest;
+struct _virFileBrokerRequest {
+    int openflags;
+    mode_t mode;
+    unsigned int flags;
+    size_t pathlen;
+};
+
+typedef struct _virFileBroker virFileBroker;
+typedef virFileBroker *virFileBrokerPtr;
+struct _virFileBroker {
+    virMutex lock;                  /* held for each request */
+    uid_t uid;
+    gid_t gid;
+    int fd;                         /* -1 if no broker is running */
+    unsigned long long lastUsed;
+};
+
+static virMutex virFileBrokersLock;
+static virFileBrokerPtr *virFileBrokers;
+static size_t virFileNBrokers;
+
 static int
-virFileOpenForked(const char *path, int openflags, mode_t mode,
-                  uid_t uid, gid_t gid, unsigned int flags)
+virFileBrokersOnceInit(void)
 {
-    pid_t pid;
-    int waitret, status, ret = 0;
+    if (virMutexInit(&virFileBrokersLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virFileBrokers)
+
+
+static virFileBrokerPtr
+virFileBrokerGet(uid_t uid, gid_t gid)
+{
+    virFileBrokerPtr broker = NULL;
+    size_t i;
+
+    if (virFileBrokersInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virFileBrokersLock);
+    for (i = 0; i < virFileNBrokers; i++) {
+        if (virFileBrokers[i]->uid == uid &&
+            virFileBrokers[i]->gid == gid) {
+            broker = virFileBrokers[i];
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC(broker) < 0)
+        goto cleanup;
+    if (virMutexInit(&broker->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        VIR_FREE(broker);
+        goto cleanup;
+    }
+    broker->uid = uid;
+    broker->gid = gid;
+    broker->fd = -1;
+
+    if (VIR_APPEND_ELEMENT_COPY(virFileBrokers, virFileNBrokers, broker) < 0) {
+        virMutexDestroy(&broker->lock);
+        VIR_FREE(broker);
+    }
+
+cleanup:
+    virMutexUnlock(&virFileBrokersLock);
+    return broker;
+}
+
+
+/* Close everything the broker inherited from the daemon but the
+ * standard descriptors and @sock */
+static void
+virFileBrokerCloseFDs(int sock)
+{
+    DIR *dir;
+    struct dirent *ent;
+    int openmax;
+    int fd;
+
+    if ((dir = opendir("/proc/self/fd"))) {
+        while ((ent = readdir(dir))) {
+            if (virStrToLong_i(ent->d_name, NULL, 10, &fd) < 0 ||
+                fd <= STDERR_FILENO || fd == sock || fd == dirfd(dir))
+                continue;
+            VIR_MASS_CLOSE(fd);
+        }
+        closedir(dir);
+        return;
+    }
+
+    if ((openmax = sysconf(_SC_OPEN_MAX)) < 0)
+        openmax = 1024;
+    for (fd = STDERR_FILENO + 1; fd < openmax; fd++) {
+        int tmpfd = fd;
+
+        if (fd != sock)
+            VIR_MASS_CLOSE(tmpfd);
+    }
+}
+
+
+/* Body of the broker process, which never returns.  The first thing
+ * written to @sock is whether switching to @uid:@gid worked, then
+ * each request gets back an errno value followed by the descriptor
+ * if that is 0. */
+static void ATTRIBUTE_NORETURN
+virFileBrokerRun(int sock, uid_t uid, gid_t gid,
+                 gid_t *groups, int ngroups)
+{
+    virFileBrokerRequest req;
+    char path[PATH_MAX];
+    struct pollfd pfd;
     int fd = -1;
+    int err = 0;
+    int rc;
+
+    virFileBrokerCloseFDs(sock);
+
+    /* Close logging again to ensure no FDs leak to the broker */
+    virLogReset();
+
+    if (virSetUIDGID(uid, gid, groups, ngroups) < 0)
+        err = errno ? errno : EPERM;
+    if (safewrite(sock, &err, sizeof(err)) != sizeof(err) || err)
+        _exit(EXIT_FAILURE);
+
+    for (;;) {
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, VIR_FILE_BROKER_IDLE_TIMEOUT * 1000);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+
+        if (saferead(sock, &req, sizeof(req)) != sizeof(req) ||
+            req.pathlen >= sizeof(path) ||
+            saferead(sock, path, req.pathlen) != req.pathlen)
+            break;
+        path[req.pathlen] = '\0';
+
+        err = 0;
+        if ((fd = open(path, req.openflags, req.mode)) < 0)
+            err = errno;
+        else if ((rc = virFileOpenForceOwnerMode(path, fd, req.mode,
+                                                 uid, gid, req.flags)) < 0)
+            err = -rc;
+
+        if (safewrite(sock, &err, sizeof(err)) != sizeof(err))
+            break;
+
+        if (err == 0) {
+            do {
+                rc = sendfd(sock, fd);
+            } while (rc < 0 && errno == EINTR);
+            if (rc < 0)
+                break;
+        }
+        VIR_FORCE_CLOSE(fd);
+    }
+
+    VIR_FORCE_CLOSE(fd);
+    _exit(EXIT_SUCCESS);
+}
+
+
+/* Start the broker process for @broker, which must be locked.
+ * Returns 0 on success, -errno on failure. */
+static int
+virFileBrokerStart(virFileBrokerPtr broker)
+{
     int pair[2] = { -1, -1 };
-    int forkRet;
-    gid_t *groups;
+    gid_t *groups = NULL;
     int ngroups;
+    pid_t pid;
+    int forkRet;
+    int status;
+    int err;
+    int ret = -EIO;
 
-    /* parent is running as root, but caller requested that the
-     * file be opened as some other user and/or group). The
-     * following dance avoids problems caused by root-squashing
-     * NFS servers. */
-
-    ngroups = virGetGroupList(uid, gid, &groups);
-    if (ngroups < 0)
-        return -errno;
+    if ((ngroups = virGetGroupList(broker->uid, broker->gid, &groups)) < 0)
+        return errno ? -errno : -EIO;
 
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
         ret = -errno;
-        virReportSystemError(errno,
-                             _("failed to create socket needed for '%s'"),
-                             path);
-        VIR_FREE(groups);
-        return ret;
+        virReportSystemError(errno, "%s",
+                             _("failed to create socket for file broker"));
+        goto cleanup;
     }
 
     forkRet = virFork(&pid);
-    if (pid < 0)
-        return -errno;
+    if (pid < 0) {
+        ret = -errno;
+        goto cleanup;
+    }
 
     if (pid == 0) {
+        VIR_FORCE_CLOSE(pair[0]);
+        if (forkRet < 0)
+            _exit(EXIT_FAILURE);
 
-        /* child */
+        /* Detach the broker from the daemon, so nobody has to reap it
+         * when it exits on its own */
+        if ((pid = fork()) < 0)
+            _exit(EXIT_FAILURE);
+        if (pid > 0)
+            _exit(EXIT_SUCCESS);
 
-        VIR_FORCE_CLOSE(pair[0]); /* preserves errno */
-        if (forkRet < 0) {
-            /* error encountered and logged in virFork() after the fork. */
-            ret = -errno;
-            goto childerror;
-        }
+        virFileBrokerRun(pair[1], broker->uid, broker->gid,
+                         groups, ngroups);
+    }
 
-        /* set desired uid/gid, then attempt to create the file */
+    VIR_FORCE_CLOSE(pair[1]);
 
-        if (virSetUIDGID(uid, gid, groups, ngroups) < 0) {
-            ret = -errno;
-            goto childerror;
-        }
+    if (virProcessWait(pid, &status) < 0 || status != 0)
+        goto cleanup;
 
-        if ((fd = open(path, openflags, mode)) < 0) {
-            ret = -errno;
-            virReportSystemError(errno,
-                                 _("child process failed to create file '%s'"),
-                                 path);
-            goto childerror;
-        }
+    if (saferead(pair[0], &err, sizeof(err)) != sizeof(err))
+        goto cleanup;
+    if (err) {
+        ret = -err;
+        goto cleanup;
+    }
 
-        /* File is successfully open. Set permissions if requested. */
-        ret = virFileOpenForceOwnerMode(path, fd, mode, uid, gid, flags);
-        if (ret < 0)
-            goto childerror;
+    VIR_DEBUG("Started file broker for %u:%u",
+              (unsigned int) broker->uid, (unsigned int) broker->gid);
+    broker->fd = pair[0];
+    pair[0] = -1;
+    ret = 0;
 
-        do {
-            ret = sendfd(pair[1], fd);
-        } while (ret < 0 && errno == EINTR);
+cleanup:
+    VIR_FORCE_CLOSE(pair[0]);
+    VIR_FORCE_CLOSE(pair[1]);
+    VIR_FREE(groups);
+    return ret;
+}
 
-        if (ret < 0) {
-            ret = -errno;
-            virReportSystemError(errno, "%s",
-                                 _("child process failed to send fd to parent"));
-            goto childerror;
-        }
 
-    childerror:
-        /* ret tracks -errno on failure, but exit value must be positive.
-         * If the child exits with EACCES, then the parent tries again.  */
-        /* XXX This makes assumptions about errno being < 255, which is
-         * not true on Hurd.  */
-        VIR_FORCE_CLOSE(pair[1]);
-        if (ret < 0) {
-            VIR_FORCE_CLOSE(fd);
-        }
-        ret = -ret;
-        if ((ret & 0xff) != ret) {
-            VIR_WARN("unable to pass desired return value %d", ret);
-            ret = 0xff;
-        }
-        _exit(ret);
+/* Like safewrite(), but a broker which went away must not
+ * kill the caller with SIGPIPE */
+static int
+virFileBrokerSend(int fd, const void *buf, size_t len)
+{
+    const char *data = buf;
+    ssize_t rc;
+
+    while (len > 0) {
+        rc = send(fd, data, len, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        data += rc;
+        len -= rc;
     }
+    return 0;
+}
 
-    /* parent */
 
-    VIR_FREE(groups);
-    VIR_FORCE_CLOSE(pair[1]);
+/* Send one request to the running broker of @broker.  Returns the
+ * descriptor, -errno if the broker failed to open the file, -EPIPE
+ * if the broker was gone before it got the request, or -ECONNRESET
+ * if it went away while handling it, in which case the file may
+ * have been opened (and created) already. */
+static int
+virFileBrokerRequestOpen(virFileBrokerPtr broker, const char *path,
+                         int openflags, mode_t mode, unsigned int flags)
+{
+    virFileBrokerRequest req;
+    size_t pathlen = strlen(path);
+    int err;
+    int fd;
+
+    memset(&req, 0, sizeof(req));
+    req.openflags = openflags;
+    req.mode = mode;
+    req.flags = flags;
+    req.pathlen = pathlen;
+
+    if (virFileBrokerSend(broker->fd, &req, sizeof(req)) < 0 ||
+        virFileBrokerSend(broker->fd, path, pathlen) < 0)
+        return -EPIPE;
+
+    if (saferead(broker->fd, &err, sizeof(err)) != sizeof(err))
+        return -ECONNRESET;
+
+    if (err)
+        return -err;
 
     do {
-        fd = recvfd(pair[0], 0);
+        fd = recvfd(broker->fd, 0);
     } while (fd < 0 && errno == EINTR);
-    VIR_FORCE_CLOSE(pair[0]); /* NB: this preserves errno */
+    if (fd < 0)
+        return -ECONNRESET;
 
-    if (fd < 0 && errno != EACCES) {
-        ret = -errno;
-        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
-        return ret;
+    return fd;
+}
+
+
+/* virFileOpenForked() - an internal utility function called only by
+ * virFileOpenAs(). It asks the broker process running as uid:gid,
+ * starting one if needed, to open the file and pass the fd back, so
+ * the open happens with the given uid:gid. Returns the fd, or -errno
+ * if there is an error. */
+static int
+virFileOpenForked(const char *path, int openflags, mode_t mode,
+                  uid_t uid, gid_t gid, unsigned int flags)
+{
+    virFileBrokerPtr broker;
+    unsigned long long now = 0;
+    bool excl = (openflags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL);
+    size_t attempt;
+    int ret = -EPIPE;
+    int fd = -1;
+
+    /* parent is running as root, but caller requested that the
+     * file be opened as some other user and/or group). The
+     * following dance avoids problems caused by root-squashing
+     * NFS servers. */
+
+    if (strlen(path) >= PATH_MAX)
+        return -ENAMETOOLONG;
+
+    if (!(broker = virFileBrokerGet(uid, gid)))
+        return -ENOMEM;
+
+    virMutexLock(&broker->lock);
+
+    /* A broker idle for that long is exiting, if not gone already */
+    ignore_value(virTimeMillisNow(&now));
+    if (broker->fd >= 0 &&
+        now - broker->lastUsed >= (VIR_FILE_BROKER_IDLE_TIMEOUT - 1) * 1000ull)
+        VIR_FORCE_CLOSE(broker->fd);
+
+    /* Try once more with a fresh broker if the last one went away.
+     * An exclusive create must not be repeated once the broker may
+     * have done it, the second attempt would fail with EEXIST. */
+    for (attempt = 0; attempt < 2; attempt++) {
+        if (broker->fd < 0 &&
+            (ret = virFileBrokerStart(broker)) < 0)
+            break;
+
+        ret = virFileBrokerRequestOpen(broker, path, openflags, mode, flags);
+        if (ret != -EPIPE && ret != -ECONNRESET)
+            break;
+
+        VIR_FORCE_CLOSE(broker->fd);
+        if (ret == -ECONNRESET && excl)
+            break;
     }
 
-    /* wait for child to complete, and retrieve its exit code */
-    while ((waitret = waitpid(pid, &status, 0) == -1)
-           && (errno == EINTR));
-    if (waitret == -1) {
-        ret = -errno;
-        virReportSystemError(errno,
-                             _("failed to wait for child creating '%s'"),
-                             path);
-        VIR_FORCE_CLOSE(fd);
+    ignore_value(virTimeMillisNow(&broker->lastUsed));
+    virMutexUnlock(&broker->lock);
+
+    if (ret >= 0)
+        return ret;
+
+    if (ret == -ECONNRESET && excl)
         return ret;
+
+    /* fall back to the simpler method, which works better in
+     * some cases */
+    if (flags & VIR_FILE_OPEN_NOFORK) {
+        /* If we had already tried opening w/o fork+setuid and
+         * failed, no sense trying again. Just set return the
+         * original errno that we got at that time (by
+         * definition, always either EACCES or EPERM - EACCES
+         * is close enough).
+         */
+        return -EACCES;
     }
-    if (!WIFEXITED(status) || (ret = -WEXITSTATUS(status)) == -EACCES ||
-        fd == -1) {
-        /* fall back to the simpler method, which works better in
-         * some cases */
+    if ((fd = open(path, openflags, mode)) < 0)
+        return -errno;
+    ret = virFileOpenForceOwnerMode(path, fd, mode, uid, gid, flags);
+    if (ret < 0) {
         VIR_FORCE_CLOSE(fd);
-        if (flags & VIR_FILE_OPEN_NOFORK) {
-            /* If we had already tried opening w/o fork+setuid and
-             * failed, no sense trying again. Just set return the
-             * original errno that we got at that time (by
-             * definition, always either EACCES or EPERM - EACCES
-             * is close enough).
-             */
-            return -EACCES;
-        }
-        if ((fd = open(path, openflags, mode)) < 0)
-            return -errno;
-        ret = virFileOpenForceOwnerMode(path, fd, mode, uid, gid, flags);
-        if (ret < 0) {
-            VIR_FORCE_CLOSE(fd);
-            return ret;
-        }
+        return ret;
     }
     return fd;
 }
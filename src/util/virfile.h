@@ -43,6 +43,30 @@ ssize_t safewrite(int fd, const void *buf, size_t count)
 int safezero(int fd, off_t offset, off_t len)
     ATTRIBUTE_RETURN_CHECK;
 
+int virFileInData(int fd,
+                  bool *inData,
+                  unsigned long long *length)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+int virFilePunchHole(int fd, off_t offset, off_t length)
+    ATTRIBUTE_RETURN_CHECK;
+
+/* In sparse mode, libvirt_iohelper and its fdstream peer exchange
+ * a sequence of records over the pipe rather than the plain file
+ * contents. Each record starts with this header, and data records
+ * are followed by @length bytes of file content. Both ends run on
+ * the same host, so the header uses the native byte order. */
+typedef enum {
+    VIR_FILE_SPARSE_RECORD_DATA = 0,
+    VIR_FILE_SPARSE_RECORD_HOLE = 1,
+} virFileSparseRecordType;
+
+typedef struct _virFileSparseRecord virFileSparseRecord;
+struct _virFileSparseRecord {
+    unsigned int type; /* virFileSparseRecordType */
+    unsigned int padding;
+    unsigned long long length;
+};
+
 /* Don't call these directly - use the macros below */
 int virFileClose(int *fdptr, virFileCloseFlags flags)
         ATTRIBUTE_RETURN_CHECK;
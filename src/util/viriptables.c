@@ -50,18 +50,95 @@
 #include "virstring.h"
 #include "virutil.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 bool iptables_supports_xlock = false;
+static bool iptables_supports_restore = false;
+static bool ip6tables_supports_restore = false;
+static bool iptables_restore_supports_wait = false;
+static bool ip6tables_restore_supports_wait = false;
+
+typedef struct _iptablesTransactionRule iptablesTransactionRule;
+typedef iptablesTransactionRule *iptablesTransactionRulePtr;
+struct _iptablesTransactionRule {
+    int family;
+    const char *table;
+    virCommandPtr cmd;
+};
+
+/* Rules queued by the current thread while a transaction is open */
+typedef struct _iptablesTransaction iptablesTransaction;
+typedef iptablesTransaction *iptablesTransactionPtr;
+struct _iptablesTransaction {
+    size_t nrules;
+    iptablesTransactionRulePtr rules;
+};
+
+static virThreadLocal iptablesTransactionCurrent;
+
+static void
+iptablesTransactionFree(void *opaque)
+{
+    iptablesTransactionPtr trans = opaque;
+    size_t i;
+
+    if (!trans)
+        return;
+
+    for (i = 0; i < trans->nrules; i++)
+        virCommandFree(trans->rules[i].cmd);
+    VIR_FREE(trans->rules);
+    VIR_FREE(trans);
+}
 
 #if HAVE_FIREWALLD
 static char *firewall_cmd_path = NULL;
 #endif
 
+/* Whether the iptables-restore at @path can be used for transactions,
+ * which it cannot if iptables takes the xtables lock but iptables-restore
+ * does not, as it would then race with the other users of the lock.
+ * Sets @wait to whether iptables-restore understands --wait. */
+static bool
+iptablesRestoreProbe(const char *path, bool *wait)
+{
+    virCommandPtr cmd;
+    int status;
+
+    *wait = false;
+
+    if (!virFileIsExecutable(path))
+        return false;
+
+    if (iptables_supports_xlock) {
+        cmd = virCommandNewArgList(path, "--noflush", "--test", "--wait", NULL);
+        virCommandSetInputBuffer(cmd, "");
+        if (virCommandRun(cmd, &status) == 0 && status == 0)
+            *wait = true;
+        virCommandFree(cmd);
+
+        if (!*wait) {
+            VIR_INFO("%s does not support --wait, not using it", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static int
 virIpTablesOnceInit(void)
 {
     virCommandPtr cmd;
     int status;
 
+    if (virThreadLocalInit(&iptablesTransactionCurrent,
+                           iptablesTransactionFree) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot initialize thread local for iptables transactions"));
+        return -1;
+    }
+
 #if HAVE_FIREWALLD
     firewall_cmd_path = virFindFileInPath("firewall-cmd");
     if (!firewall_cmd_path) {
@@ -95,13 +172,23 @@ virIpTablesOnceInit(void)
         iptables_supports_xlock = true;
     }
     virCommandFree(cmd);
+
+    /* firewalld has no equivalent of iptables-restore, so transactions
+     * are only batched when the iptables binaries are used directly */
+    iptables_supports_restore =
+        iptablesRestoreProbe(IPTABLES_RESTORE_PATH,
+                             &iptables_restore_supports_wait);
+    ip6tables_supports_restore =
+        iptablesRestoreProbe(IP6TABLES_RESTORE_PATH,
+                             &ip6tables_restore_supports_wait);
+    if (!iptables_supports_restore)
+        VIR_INFO("iptables-restore not usable, rules will be applied one by one");
+
     return 0;
 }
 
 VIR_ONCE_GLOBAL_INIT(virIpTables)
 
-#define VIR_FROM_THIS VIR_FROM_NONE
-
 enum {
     ADD = 0,
     REMOVE
@@ -134,15 +221,274 @@ iptablesCommandNew(const char *table, const char *chain, int family, int action)
     return cmd;
 }
 
+static bool
+iptablesCanRestore(int family)
+{
+    return (family == AF_INET6) ? ip6tables_supports_restore
+                                : iptables_supports_restore;
+}
+
+/* Run @cmd, which modifies @table, or queue it if the calling thread
+ * has an iptables transaction open */
 static int
-iptablesCommandRunAndFree(virCommandPtr cmd)
+iptablesCommandRunAndFree(virCommandPtr cmd, int family, const char *table)
 {
+    iptablesTransactionPtr trans;
     int ret;
+
+    trans = virThreadLocalGet(&iptablesTransactionCurrent);
+    if (trans && iptablesCanRestore(family)) {
+        iptablesTransactionRule rule = { family, table, cmd };
+
+        if (VIR_APPEND_ELEMENT(trans->rules, trans->nrules, rule) < 0) {
+            virCommandFree(cmd);
+            return -1;
+        }
+        return 0;
+    }
+
     ret = virCommandRun(cmd, NULL);
     virCommandFree(cmd);
     return ret;
 }
 
+/* Add the arguments of @cmd following its --table to @buf as one line
+ * of iptables-restore input */
+static int
+iptablesFormatRestoreRule(virBufferPtr buf, virCommandPtr cmd)
+{
+    char **args = NULL;
+    size_t nargs;
+    size_t i;
+    bool first = true;
+
+    if (virCommandGetArgList(cmd, &args, &nargs) < 0)
+        return -1;
+
+    for (i = 0; i < nargs; i++) {
+        if (STREQ(args[i], "--table")) {
+            i += 2;
+            break;
+        }
+    }
+
+    for (; i < nargs; i++) {
+        if (!first)
+            virBufferAddChar(buf, ' ');
+        first = false;
+
+        if (*args[i] &&
+            strspn(args[i], "abcdefghijklmnopqrstuvwxyz"
+                            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "0123456789-_.:/,!=+") == strlen(args[i])) {
+            virBufferAdd(buf, args[i], -1);
+        } else {
+            virBufferAddChar(buf, '"');
+            virBufferEscape(buf, '\\', "\\\"", "%s", args[i]);
+            virBufferAddChar(buf, '"');
+        }
+    }
+    virBufferAddChar(buf, '\n');
+
+    virStringFreeList(args);
+    return 0;
+}
+
+/* Apply all rules of @family queued in @trans with a single
+ * iptables-restore.  Each table is committed atomically by
+ * iptables-restore, but if a later table fails the earlier ones
+ * stay in place. */
+static int
+iptablesTransactionRestore(iptablesTransactionPtr trans,
+                           int family,
+                           bool ignoreErrors)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *errbuf = NULL;
+    int status;
+    int ret = -1;
+    size_t i, j;
+
+    for (i = 0; i < trans->nrules; i++) {
+        bool seen = false;
+
+        if (trans->rules[i].family != family)
+            continue;
+
+        for (j = 0; j < i && !seen; j++) {
+            seen = trans->rules[j].family == family &&
+                STREQ(trans->rules[j].table, trans->rules[i].table);
+        }
+        if (seen)
+            continue;
+
+        virBufferAsprintf(&buf, "*%s\n", trans->rules[i].table);
+        for (j = i; j < trans->nrules; j++) {
+            if (trans->rules[j].family != family ||
+                STRNEQ(trans->rules[j].table, trans->rules[i].table))
+                continue;
+            if (iptablesFormatRestoreRule(&buf, trans->rules[j].cmd) < 0)
+                goto fallback;
+        }
+        virBufferAddLit(&buf, "COMMIT\n");
+    }
+
+    if (virBufferError(&buf)) {
+        virReportOOMError();
+        goto fallback;
+    }
+
+    if (!virBufferUse(&buf))
+        return 0;
+
+    input = virBufferContentAndReset(&buf);
+    cmd = virCommandNewArgList((family == AF_INET6)
+                               ? IP6TABLES_RESTORE_PATH
+                               : IPTABLES_RESTORE_PATH,
+                               "--noflush", NULL);
+    if ((family == AF_INET6) ? ip6tables_restore_supports_wait
+                             : iptables_restore_supports_wait)
+        virCommandAddArg(cmd, "--wait");
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto fallback;
+
+    if (status != 0) {
+        if (!ignoreErrors) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to apply %s rules: %s"),
+                           (family == AF_INET6) ? "ip6tables" : "iptables",
+                           NULLSTR(errbuf));
+        }
+        goto fallback;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    virCommandFree(cmd);
+    VIR_FREE(input);
+    VIR_FREE(errbuf);
+    return ret;
+
+fallback:
+    /* When removing rules, a single one that no longer exists makes
+     * iptables-restore reject the whole batch, so fall back to removing
+     * them one by one as was done before transactions existed. */
+    if (ignoreErrors) {
+        for (i = 0; i < trans->nrules; i++) {
+            if (trans->rules[i].family == family)
+                ignore_value(virCommandRun(trans->rules[i].cmd, &status));
+        }
+        ret = 0;
+    }
+    goto cleanup;
+}
+
+/**
+ * iptablesTransactionBegin:
+ *
+ * Start queueing the rules added or removed by the calling thread
+ * rather than running one iptables process per rule.  The queued rules
+ * are applied by iptablesTransactionCommit, or dropped by
+ * iptablesTransactionAbort.  While a transaction is open, the add and
+ * remove functions only fail on internal errors; errors from iptables
+ * itself are reported by iptablesTransactionCommit.  When
+ * iptables-restore is not available, cannot take the xtables lock that
+ * iptables uses, or firewalld is in use, rules are still applied
+ * immediately.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+iptablesTransactionBegin(void)
+{
+    iptablesTransactionPtr trans;
+
+    if (virIpTablesInitialize() < 0)
+        return -1;
+
+    if (virThreadLocalGet(&iptablesTransactionCurrent)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("an iptables transaction is already in progress"));
+        return -1;
+    }
+
+    if (VIR_ALLOC(trans) < 0)
+        return -1;
+
+    if (virThreadLocalSet(&iptablesTransactionCurrent, trans) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to start iptables transaction"));
+        VIR_FREE(trans);
+        return -1;
+    }
+
+    return 0;
+}
+
+static iptablesTransactionPtr
+iptablesTransactionEnd(void)
+{
+    iptablesTransactionPtr trans;
+
+    if (!(trans = virThreadLocalGet(&iptablesTransactionCurrent))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("no iptables transaction in progress"));
+        return NULL;
+    }
+
+    ignore_value(virThreadLocalSet(&iptablesTransactionCurrent, NULL));
+    return trans;
+}
+
+/**
+ * iptablesTransactionCommit:
+ * @ignoreErrors: whether failing rules should be skipped
+ *
+ * Apply the rules queued since iptablesTransactionBegin with one
+ * iptables-restore --noflush per address family, and close the
+ * transaction.  If @ignoreErrors is true, which is how rules are
+ * removed, a failed batch is retried one rule at a time and errors
+ * are ignored, just as when calling the remove functions outside a
+ * transaction.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+iptablesTransactionCommit(bool ignoreErrors)
+{
+    iptablesTransactionPtr trans;
+    int ret = 0;
+
+    if (!(trans = iptablesTransactionEnd()))
+        return -1;
+
+    if (iptablesTransactionRestore(trans, AF_INET, ignoreErrors) < 0 ||
+        iptablesTransactionRestore(trans, AF_INET6, ignoreErrors) < 0)
+        ret = -1;
+
+    iptablesTransactionFree(trans);
+    return ret;
+}
+
+/**
+ * iptablesTransactionAbort:
+ *
+ * Close the transaction opened by iptablesTransactionBegin, dropping
+ * the rules queued so far.
+ */
+void
+iptablesTransactionAbort(void)
+{
+    iptablesTransactionFree(iptablesTransactionEnd());
+}
+
 static int ATTRIBUTE_SENTINEL
 iptablesAddRemoveRule(const char *table, const char *chain, int family, int action,
                       const char *arg, ...)
@@ -159,7 +505,7 @@ iptablesAddRemoveRule(const char *table, const char *chain, int family, int acti
         virCommandAddArg(cmd, s);
     va_end(args);
 
-    return iptablesCommandRunAndFree(cmd);
+    return iptablesCommandRunAndFree(cmd, family, table);
 }
 
 static int
@@ -324,7 +670,8 @@ iptablesForwardAllowOut(virSocketAddr *netaddr,
 
     virCommandAddArgList(cmd, "--jump", "ACCEPT", NULL);
 
-    ret = iptablesCommandRunAndFree(cmd);
+    ret = iptablesCommandRunAndFree(cmd, VIR_SOCKET_ADDR_FAMILY(netaddr),
+                                    "filter");
     VIR_FREE(networkstr);
     return ret;
 }
@@ -792,7 +1139,8 @@ iptablesForwardMasquerade(virSocketAddr *netaddr,
              virCommandAddArgList(cmd, "--to-ports", &portRangeStr[1], NULL);
      }
 
-    ret = virCommandRun(cmd, NULL);
+    ret = iptablesCommandRunAndFree(cmd, AF_INET, "nat");
+    cmd = NULL;
 cleanup:
     virCommandFree(cmd);
     VIR_FREE(networkstr);
@@ -886,7 +1234,8 @@ iptablesForwardDontMasquerade(virSocketAddr *netaddr,
 
     virCommandAddArgList(cmd, "--source", networkstr,
                          "--destination", destaddr, "--jump", "RETURN", NULL);
-    ret = virCommandRun(cmd, NULL);
+    ret = iptablesCommandRunAndFree(cmd, AF_INET, "nat");
+    cmd = NULL;
 cleanup:
     virCommandFree(cmd);
     VIR_FREE(networkstr);
@@ -948,18 +1297,26 @@ iptablesOutputFixUdpChecksum(const char *iface,
                              int action)
 {
     char portstr[32];
+    virCommandPtr cmd;
+    int ret;
 
     snprintf(portstr, sizeof(portstr), "%d", port);
     portstr[sizeof(portstr) - 1] = '\0';
 
-    return iptablesAddRemoveRule("mangle", "POSTROUTING",
-                                 AF_INET,
-                                 action,
-                                 "--out-interface", iface,
-                                 "--protocol", "udp",
-                                 "--destination-port", portstr,
-                                 "--jump", "CHECKSUM", "--checksum-fill",
-                                 NULL);
+    cmd = iptablesCommandNew("mangle", "POSTROUTING", AF_INET, action);
+    virCommandAddArgList(cmd,
+                         "--out-interface", iface,
+                         "--protocol", "udp",
+                         "--destination-port", portstr,
+                         "--jump", "CHECKSUM", "--checksum-fill",
+                         NULL);
+
+    /* Not every iptables supports CHECKSUM, so rather than queueing
+     * this rule in a transaction, where it would make the whole batch
+     * fail, run it right away and let the caller ignore the error. */
+    ret = virCommandRun(cmd, NULL);
+    virCommandFree(cmd);
+    return ret;
 }
 
 /**
@@ -26,6 +26,10 @@
 
 # include "virsocketaddr.h"
 
+int              iptablesTransactionBegin        (void);
+int              iptablesTransactionCommit       (bool ignoreErrors);
+void             iptablesTransactionAbort        (void);
+
 int              iptablesAddTcpInput             (int family,
                                                   const char *iface,
                                                   int port);
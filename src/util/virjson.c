@@ -29,6 +29,7 @@
 #include "virlog.h"
 #include "virstring.h"
 #include "virutil.h"
+#include "c-ctype.h"
 
 #if WITH_YAJL
 # include <yajl/yajl_gen.h>
@@ -59,9 +60,119 @@ struct _virJSONParser {
     virJSONValuePtr head;
     virJSONParserStatePtr state;
     unsigned int nstate;
+    size_t nstateAlloc;
+
+    /* Arena the values are allocated from, NULL for heap values */
+    virJSONArenaPtr arena;
+    /* Stop the parser once a complete top level value was read */
+    bool stopAtValue;
+    bool complete;
+};
+
+
+/*
+ * Parsed trees are made of lots of tiny allocations: one for each
+ * value, key, string and number. Replies to monitor commands are
+ * parsed and freed at a high rate, so with VIR_JSON_PARSE_ARENA all
+ * of those come from a few large chunks instead, which are released
+ * at once together with the root of the tree. Only the arrays of
+ * object pairs and array values, which grow while parsing, are kept
+ * on the heap.
+ */
+#define VIR_JSON_ARENA_CHUNK 4096
+#define VIR_JSON_ARENA_ALIGN 8
+
+typedef struct _virJSONArenaChunk virJSONArenaChunk;
+typedef virJSONArenaChunk *virJSONArenaChunkPtr;
+struct _virJSONArenaChunk {
+    virJSONArenaChunkPtr next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct _virJSONArena {
+    virJSONValuePtr root;
+    virJSONArenaChunkPtr chunks;
 };
 
 
+static virJSONArenaPtr
+virJSONArenaNew(void)
+{
+    virJSONArenaPtr arena;
+
+    if (VIR_ALLOC(arena) < 0)
+        return NULL;
+
+    return arena;
+}
+
+
+static void
+virJSONArenaFree(virJSONArenaPtr arena)
+{
+    virJSONArenaChunkPtr chunk;
+
+    if (!arena)
+        return;
+
+    while ((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        VIR_FREE(chunk);
+    }
+
+    VIR_FREE(arena);
+}
+
+
+/* Returns zeroed memory which lives as long as @arena */
+static void *
+virJSONArenaAlloc(virJSONArenaPtr arena, size_t size)
+{
+    virJSONArenaChunkPtr chunk = arena->chunks;
+    void *ret;
+
+    size = VIR_ROUND_UP(size, VIR_JSON_ARENA_ALIGN);
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunksize = MAX(size, VIR_JSON_ARENA_CHUNK);
+
+        if (VIR_ALLOC_VAR(chunk, char, chunksize) < 0)
+            return NULL;
+        chunk->size = chunksize;
+
+        if (size > VIR_JSON_ARENA_CHUNK / 2 && arena->chunks) {
+            /* Don't waste the space left in the current chunk on a
+             * large allocation */
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+
+    ret = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ret;
+}
+
+
+static char *
+virJSONArenaStrndup(virJSONArenaPtr arena, const char *str, size_t len)
+{
+    char *ret;
+
+    if (!(ret = virJSONArenaAlloc(arena, len + 1)))
+        return NULL;
+
+    memcpy(ret, str, len);
+    return ret;
+}
+
+
 void virJSONValueFree(virJSONValuePtr value)
 {
     size_t i;
@@ -71,7 +182,8 @@ void virJSONValueFree(virJSONValuePtr value)
     switch ((virJSONType) value->type) {
     case VIR_JSON_TYPE_OBJECT:
         for (i = 0; i < value->data.object.npairs; i++) {
-            VIR_FREE(value->data.object.pairs[i].key);
+            if (!value->arena)
+                VIR_FREE(value->data.object.pairs[i].key);
             virJSONValueFree(value->data.object.pairs[i].value);
         }
         VIR_FREE(value->data.object.pairs);
@@ -82,16 +194,24 @@ void virJSONValueFree(virJSONValuePtr value)
         VIR_FREE(value->data.array.values);
         break;
     case VIR_JSON_TYPE_STRING:
-        VIR_FREE(value->data.string);
+        if (!value->arena)
+            VIR_FREE(value->data.string);
         break;
     case VIR_JSON_TYPE_NUMBER:
-        VIR_FREE(value->data.number);
+        if (!value->arena)
+            VIR_FREE(value->data.number);
         break;
     case VIR_JSON_TYPE_BOOLEAN:
     case VIR_JSON_TYPE_NULL:
         break;
     }
 
+    if (value->arena) {
+        if (value->arena->root == value)
+            virJSONArenaFree(value->arena);
+        return;
+    }
+
     VIR_FREE(value);
 }
 
@@ -269,13 +389,16 @@ int virJSONValueObjectAppend(virJSONValuePtr object, const char *key, virJSONVal
     if (virJSONValueObjectHasKey(object, key))
         return -1;
 
-    if (VIR_STRDUP(newkey, key) < 0)
+    if (VIR_RESIZE_N(object->data.object.pairs, object->data.object.nalloc,
+                     object->data.object.npairs, 1) < 0)
         return -1;
 
-    if (VIR_REALLOC_N(object->data.object.pairs,
-                      object->data.object.npairs + 1) < 0) {
-        VIR_FREE(newkey);
-        return -1;
+    if (object->arena) {
+        if (!(newkey = virJSONArenaStrndup(object->arena, key, strlen(key))))
+            return -1;
+    } else {
+        if (VIR_STRDUP(newkey, key) < 0)
+            return -1;
     }
 
     object->data.object.pairs[object->data.object.npairs].key = newkey;
@@ -389,8 +512,8 @@ int virJSONValueArrayAppend(virJSONValuePtr array, virJSONValuePtr value)
     if (array->type != VIR_JSON_TYPE_ARRAY)
         return -1;
 
-    if (VIR_REALLOC_N(array->data.array.values,
-                      array->data.array.nvalues + 1) < 0)
+    if (VIR_RESIZE_N(array->data.array.values, array->data.array.nalloc,
+                     array->data.array.nvalues, 1) < 0)
         return -1;
 
     array->data.array.values[array->data.array.nvalues] = value;
@@ -448,8 +571,64 @@ const char *virJSONValueObjectGetKey(virJSONValuePtr object, unsigned int n)
     return object->data.object.pairs[n].key;
 }
 
+/* Deep copy @value into heap allocated values */
+static virJSONValuePtr
+virJSONValueCopy(virJSONValuePtr value)
+{
+    virJSONValuePtr ret = NULL;
+    virJSONValuePtr elem;
+    size_t i;
+
+    switch ((virJSONType) value->type) {
+    case VIR_JSON_TYPE_OBJECT:
+        if (!(ret = virJSONValueNewObject()))
+            return NULL;
+        for (i = 0; i < value->data.object.npairs; i++) {
+            if (!(elem = virJSONValueCopy(value->data.object.pairs[i].value)))
+                goto error;
+            if (virJSONValueObjectAppend(ret, value->data.object.pairs[i].key,
+                                         elem) < 0) {
+                virJSONValueFree(elem);
+                goto error;
+            }
+        }
+        break;
+    case VIR_JSON_TYPE_ARRAY:
+        if (!(ret = virJSONValueNewArray()))
+            return NULL;
+        for (i = 0; i < value->data.array.nvalues; i++) {
+            if (!(elem = virJSONValueCopy(value->data.array.values[i])))
+                goto error;
+            if (virJSONValueArrayAppend(ret, elem) < 0) {
+                virJSONValueFree(elem);
+                goto error;
+            }
+        }
+        break;
+    case VIR_JSON_TYPE_STRING:
+        ret = virJSONValueNewString(value->data.string);
+        break;
+    case VIR_JSON_TYPE_NUMBER:
+        ret = virJSONValueNewNumber(value->data.number);
+        break;
+    case VIR_JSON_TYPE_BOOLEAN:
+        ret = virJSONValueNewBoolean(value->data.boolean);
+        break;
+    case VIR_JSON_TYPE_NULL:
+        ret = virJSONValueNewNull();
+        break;
+    }
+
+    return ret;
+
+error:
+    virJSONValueFree(ret);
+    return NULL;
+}
+
 /* Remove the key-value pair tied to @key out of @object.  If @value is
  * not NULL, the dropped value object is returned instead of freed.
+ * Values parsed into an arena are copied so they can outlive it.
  * Returns 1 on success, 0 if no key was found, and -1 on error.  */
 int
 virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
@@ -466,13 +645,19 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
     for (i = 0; i < object->data.object.npairs; i++) {
         if (STREQ(object->data.object.pairs[i].key, key)) {
             if (value) {
-                *value = object->data.object.pairs[i].value;
-                object->data.object.pairs[i].value = NULL;
+                if (object->data.object.pairs[i].value->arena) {
+                    if (!(*value = virJSONValueCopy(object->data.object.pairs[i].value)))
+                        return -1;
+                } else {
+                    *value = object->data.object.pairs[i].value;
+                    object->data.object.pairs[i].value = NULL;
+                }
             }
-            VIR_FREE(object->data.object.pairs[i].key);
+            if (!object->arena)
+                VIR_FREE(object->data.object.pairs[i].key);
             virJSONValueFree(object->data.object.pairs[i].value);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
+            VIR_DELETE_ELEMENT_INPLACE(object->data.object.pairs, i,
+                                       object->data.object.npairs);
             return 1;
         }
     }
@@ -693,13 +878,89 @@ int virJSONValueObjectIsNull(virJSONValuePtr object, const char *key)
 
 
 #if WITH_YAJL
+static virJSONValuePtr virJSONParserNewValue(virJSONParserPtr parser,
+                                             int type)
+{
+    virJSONValuePtr value;
+
+    if (parser->arena) {
+        if (!(value = virJSONArenaAlloc(parser->arena, sizeof(*value))))
+            return NULL;
+        value->arena = parser->arena;
+    } else {
+        if (VIR_ALLOC(value) < 0)
+            return NULL;
+    }
+
+    value->type = type;
+
+    return value;
+}
+
+static char *virJSONParserStrndup(virJSONParserPtr parser,
+                                  const char *str,
+                                  size_t len)
+{
+    char *ret;
+
+    if (parser->arena)
+        return virJSONArenaStrndup(parser->arena, str, len);
+
+    if (VIR_STRNDUP(ret, str, len) < 0)
+        return NULL;
+    return ret;
+}
+
+static void virJSONParserStateClearKey(virJSONParserPtr parser,
+                                       virJSONParserStatePtr state)
+{
+    if (parser->arena)
+        state->key = NULL;
+    else
+        VIR_FREE(state->key);
+}
+
+/* Free the partially parsed tree, if any, and make @parser ready
+ * for parsing a new value */
+static void virJSONParserClear(virJSONParserPtr parser)
+{
+    size_t i;
+
+    for (i = 0; i < parser->nstate; i++)
+        virJSONParserStateClearKey(parser, &parser->state[i]);
+    parser->nstate = 0;
+
+    if (parser->head)
+        virJSONValueFree(parser->head);
+    else
+        virJSONArenaFree(parser->arena);
+    parser->head = NULL;
+    parser->arena = NULL;
+    parser->complete = false;
+}
+
+/* Tell yajl whether to carry on after a value was inserted */
+static int virJSONParserValueDone(virJSONParserPtr parser)
+{
+    if (parser->nstate == 0 && parser->stopAtValue) {
+        /* Cancel the parse, the caller will pick the value */
+        parser->complete = true;
+        return 0;
+    }
+
+    return 1;
+}
+
 static int virJSONParserInsertValue(virJSONParserPtr parser,
                                     virJSONValuePtr value)
 {
     if (!parser->head) {
         parser->head = value;
+        if (parser->arena)
+            parser->arena->root = value;
     } else {
         virJSONParserStatePtr state;
+        virJSONValuePtr object;
         if (!parser->nstate) {
             VIR_DEBUG("got a value to insert without a container");
             return -1;
@@ -714,12 +975,20 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
                 return -1;
             }
 
-            if (virJSONValueObjectAppend(state->value,
-                                         state->key,
-                                         value) < 0)
+            object = state->value;
+            if (virJSONValueObjectHasKey(object, state->key))
+                return -1;
+
+            /* The key was already duplicated by the map key handler */
+            if (VIR_RESIZE_N(object->data.object.pairs,
+                             object->data.object.nalloc,
+                             object->data.object.npairs, 1) < 0)
                 return -1;
 
-            VIR_FREE(state->key);
+            object->data.object.pairs[object->data.object.npairs].key = state->key;
+            object->data.object.pairs[object->data.object.npairs].value = value;
+            object->data.object.npairs++;
+            state->key = NULL;
         }   break;
 
         case VIR_JSON_TYPE_ARRAY: {
@@ -745,7 +1014,7 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
 static int virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewNull();
+    virJSONValuePtr value = virJSONParserNewValue(parser, VIR_JSON_TYPE_NULL);
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -757,25 +1026,28 @@ static int virJSONParserHandleNull(void *ctx)
         return 0;
     }
 
-    return 1;
+    return virJSONParserValueDone(parser);
 }
 
 static int virJSONParserHandleBoolean(void *ctx, int boolean_)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
+    virJSONValuePtr value = virJSONParserNewValue(parser,
+                                                  VIR_JSON_TYPE_BOOLEAN);
 
     VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
 
     if (!value)
         return 0;
 
+    value->data.boolean = boolean_;
+
     if (virJSONParserInsertValue(parser, value) < 0) {
         virJSONValueFree(value);
         return 0;
     }
 
-    return 1;
+    return virJSONParserValueDone(parser);
 }
 
 static int virJSONParserHandleNumber(void *ctx,
@@ -783,25 +1055,21 @@ static int virJSONParserHandleNumber(void *ctx,
                                      yajl_size_t l)
 {
     virJSONParserPtr parser = ctx;
-    char *str;
-    virJSONValuePtr value;
-
-    if (VIR_STRNDUP(str, s, l) < 0)
-        return -1;
-    value = virJSONValueNewNumber(str);
-    VIR_FREE(str);
+    virJSONValuePtr value = virJSONParserNewValue(parser,
+                                                  VIR_JSON_TYPE_NUMBER);
 
-    VIR_DEBUG("parser=%p str=%s", parser, str);
+    VIR_DEBUG("parser=%p str=%.*s", parser, (int)l, s);
 
     if (!value)
         return 0;
 
-    if (virJSONParserInsertValue(parser, value) < 0) {
+    if (!(value->data.number = virJSONParserStrndup(parser, s, l)) ||
+        virJSONParserInsertValue(parser, value) < 0) {
         virJSONValueFree(value);
         return 0;
     }
 
-    return 1;
+    return virJSONParserValueDone(parser);
 }
 
 static int virJSONParserHandleString(void *ctx,
@@ -809,20 +1077,23 @@ static int virJSONParserHandleString(void *ctx,
                                      yajl_size_t stringLen)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
-                                                     stringLen);
+    virJSONValuePtr value = virJSONParserNewValue(parser,
+                                                  VIR_JSON_TYPE_STRING);
 
     VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
 
     if (!value)
         return 0;
 
-    if (virJSONParserInsertValue(parser, value) < 0) {
+    if (!(value->data.string = virJSONParserStrndup(parser,
+                                                    (const char *)stringVal,
+                                                    stringLen)) ||
+        virJSONParserInsertValue(parser, value) < 0) {
         virJSONValueFree(value);
         return 0;
     }
 
-    return 1;
+    return virJSONParserValueDone(parser);
 }
 
 static int virJSONParserHandleMapKey(void *ctx,
@@ -840,15 +1111,15 @@ static int virJSONParserHandleMapKey(void *ctx,
     state = &parser->state[parser->nstate-1];
     if (state->key)
         return 0;
-    if (VIR_STRNDUP(state->key, (const char *)stringVal, stringLen) < 0)
+    if (!(state->key = virJSONParserStrndup(parser, (const char *)stringVal,
+                                            stringLen)))
         return 0;
     return 1;
 }
 
-static int virJSONParserHandleStartMap(void *ctx)
+static int virJSONParserPushContainer(virJSONParserPtr parser, int type)
 {
-    virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewObject();
+    virJSONValuePtr value = virJSONParserNewValue(parser, type);
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -860,10 +1131,10 @@ static int virJSONParserHandleStartMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0) {
+    /* The state stack is kept around between values */
+    if (VIR_RESIZE_N(parser->state, parser->nstateAlloc,
+                     parser->nstate, 1) < 0)
         return 0;
-    }
 
     parser->state[parser->nstate].value = value;
     parser->state[parser->nstate].key = NULL;
@@ -872,10 +1143,8 @@ static int virJSONParserHandleStartMap(void *ctx)
     return 1;
 }
 
-
-static int virJSONParserHandleEndMap(void *ctx)
+static int virJSONParserPopContainer(virJSONParserPtr parser)
 {
-    virJSONParserPtr parser = ctx;
     virJSONParserStatePtr state;
 
     VIR_DEBUG("parser=%p", parser);
@@ -885,66 +1154,33 @@ static int virJSONParserHandleEndMap(void *ctx)
 
     state = &(parser->state[parser->nstate-1]);
     if (state->key) {
-        VIR_FREE(state->key);
+        virJSONParserStateClearKey(parser, state);
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
-        return 0;
     parser->nstate--;
 
-    return 1;
+    return virJSONParserValueDone(parser);
 }
 
-static int virJSONParserHandleStartArray(void *ctx)
+static int virJSONParserHandleStartMap(void *ctx)
 {
-    virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewArray();
-
-    VIR_DEBUG("parser=%p", parser);
-
-    if (!value)
-        return 0;
-
-    if (virJSONParserInsertValue(parser, value) < 0) {
-        virJSONValueFree(value);
-        return 0;
-    }
-
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0)
-        return 0;
+    return virJSONParserPushContainer(ctx, VIR_JSON_TYPE_OBJECT);
+}
 
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
+static int virJSONParserHandleEndMap(void *ctx)
+{
+    return virJSONParserPopContainer(ctx);
+}
 
-    return 1;
+static int virJSONParserHandleStartArray(void *ctx)
+{
+    return virJSONParserPushContainer(ctx, VIR_JSON_TYPE_ARRAY);
 }
 
 static int virJSONParserHandleEndArray(void *ctx)
 {
-    virJSONParserPtr parser = ctx;
-    virJSONParserStatePtr state;
-
-    VIR_DEBUG("parser=%p", parser);
-
-    if (!parser->nstate)
-        return 0;
-
-    state = &(parser->state[parser->nstate-1]);
-    if (state->key) {
-        VIR_FREE(state->key);
-        return 0;
-    }
-
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
-        return 0;
-    parser->nstate--;
-
-    return 1;
+    return virJSONParserPopContainer(ctx);
 }
 
 static const yajl_callbacks parserCallbacks = {
@@ -962,32 +1198,42 @@ static const yajl_callbacks parserCallbacks = {
 };
 
 
-/* XXX add an incremental streaming parser - yajl trivially supports it */
-virJSONValuePtr virJSONValueFromString(const char *jsonstring)
+static yajl_handle virJSONParserNewHandle(virJSONParserPtr parser)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0 };
-    virJSONValuePtr ret = NULL;
 # ifndef WITH_YAJL2
     yajl_parser_config cfg = { 1, 1 };
 # endif
 
-    VIR_DEBUG("string=%s", jsonstring);
-
 # ifdef WITH_YAJL2
-    hand = yajl_alloc(&parserCallbacks, NULL, &parser);
+    hand = yajl_alloc(&parserCallbacks, NULL, parser);
     if (hand) {
         yajl_config(hand, yajl_allow_comments, 1);
         yajl_config(hand, yajl_dont_validate_strings, 0);
     }
 # else
-    hand = yajl_alloc(&parserCallbacks, &cfg, NULL, &parser);
+    hand = yajl_alloc(&parserCallbacks, &cfg, NULL, parser);
 # endif
-    if (!hand) {
+    if (!hand)
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Unable to create JSON parser"));
+
+    return hand;
+}
+
+
+virJSONValuePtr virJSONValueFromString(const char *jsonstring)
+{
+    yajl_handle hand;
+    virJSONParser parser;
+    virJSONValuePtr ret = NULL;
+
+    VIR_DEBUG("string=%s", jsonstring);
+
+    memset(&parser, 0, sizeof(parser));
+
+    if (!(hand = virJSONParserNewHandle(&parser)))
         goto cleanup;
-    }
 
     if (yajl_parse(hand,
                    (const unsigned char *)jsonstring,
@@ -1000,7 +1246,6 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring)
                        _("cannot parse json %s: %s"),
                        jsonstring, (const char*) errstr);
         VIR_FREE(errstr);
-        virJSONValueFree(parser.head);
         goto cleanup;
     }
 
@@ -1008,27 +1253,163 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring)
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot parse json %s: unterminated string/map/array"),
                        jsonstring);
-        virJSONValueFree(parser.head);
     } else {
         ret = parser.head;
+        parser.head = NULL;
     }
 
 cleanup:
-    yajl_free(hand);
+    if (hand)
+        yajl_free(hand);
 
-    if (parser.nstate) {
-        size_t i;
-        for (i = 0; i < parser.nstate; i++)
-            VIR_FREE(parser.state[i].key);
-        VIR_FREE(parser.state);
-    }
+    virJSONParserClear(&parser);
+    VIR_FREE(parser.state);
 
-    VIR_DEBUG("result=%p", parser.head);
+    VIR_DEBUG("result=%p", ret);
 
     return ret;
 }
 
 
+struct _virJSONStreamParser {
+    unsigned int flags;
+    yajl_handle handle;
+    virJSONParser parser;
+    /* Number of bytes of the current value which were already fed
+     * to @handle and will be passed again by the caller */
+    size_t pending;
+};
+
+
+/**
+ * virJSONStreamParserNew:
+ * @flags: bitwise-OR of virJSONParseFlags
+ *
+ * Create a parser for a stream of concatenated JSON values, such as
+ * the replies and events sent on a QEMU monitor.
+ *
+ * Returns the new parser or NULL on error.
+ */
+virJSONStreamParserPtr virJSONStreamParserNew(unsigned int flags)
+{
+    virJSONStreamParserPtr stream;
+
+    virCheckFlags(VIR_JSON_PARSE_ARENA, NULL);
+
+    if (VIR_ALLOC(stream) < 0)
+        return NULL;
+
+    stream->flags = flags;
+    stream->parser.stopAtValue = true;
+
+    return stream;
+}
+
+
+static void virJSONStreamParserReset(virJSONStreamParserPtr stream)
+{
+    if (stream->handle)
+        yajl_free(stream->handle);
+    stream->handle = NULL;
+    virJSONParserClear(&stream->parser);
+    stream->pending = 0;
+}
+
+
+void virJSONStreamParserFree(virJSONStreamParserPtr stream)
+{
+    if (!stream)
+        return;
+
+    virJSONStreamParserReset(stream);
+    VIR_FREE(stream->parser.state);
+    VIR_FREE(stream);
+}
+
+
+/**
+ * virJSONStreamParserFeed:
+ * @stream: the parser
+ * @data: buffered data received from the stream
+ * @len: length of @data
+ * @value: filled with the first complete value in @data
+ *
+ * Parse data from the stream. The parser remembers how much of an
+ * incomplete value it has already seen, so the caller must keep the
+ * unconsumed bytes at the start of its buffer and pass them again
+ * along with newly received data. Only the data following what was
+ * already seen is parsed again.
+ *
+ * Returns the number of bytes consumed from @data, in which case
+ * @value is set if a whole value was parsed, or -1 on error.
+ */
+ssize_t virJSONStreamParserFeed(virJSONStreamParserPtr stream,
+                                const char *data,
+                                size_t len,
+                                virJSONValuePtr *value)
+{
+    size_t start = 0;
+    size_t from;
+    yajl_status rc;
+
+    *value = NULL;
+
+    if (!stream->pending) {
+        /* Skip whitespace and newlines between values */
+        while (start < len && c_isspace(data[start]))
+            start++;
+        if (start == len)
+            return len;
+    }
+
+    if (!stream->handle) {
+        if ((stream->flags & VIR_JSON_PARSE_ARENA) &&
+            !(stream->parser.arena = virJSONArenaNew()))
+            goto error;
+        if (!(stream->handle = virJSONParserNewHandle(&stream->parser)))
+            goto error;
+    }
+
+    from = start + stream->pending;
+    rc = yajl_parse(stream->handle,
+                    (const unsigned char *)data + from, len - from);
+
+    if (rc == yajl_status_client_canceled && stream->parser.complete) {
+        from += yajl_get_bytes_consumed(stream->handle);
+        *value = stream->parser.head;
+        stream->parser.head = NULL;
+        stream->parser.arena = NULL;
+        virJSONStreamParserReset(stream);
+        return from;
+    }
+
+# ifndef WITH_YAJL2
+    if (rc == yajl_status_insufficient_data)
+        rc = yajl_status_ok;
+# endif
+
+    if (rc != yajl_status_ok) {
+        unsigned char *errstr = yajl_get_error(stream->handle, 1,
+                                               (const unsigned char *)data + from,
+                                               len - from);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json %.*s: %s"),
+                       (int)(len - start), data + start, (const char *)errstr);
+        VIR_FREE(errstr);
+        goto error;
+    }
+
+    /* The value is not complete yet */
+    stream->pending = len - start;
+    return start;
+
+error:
+    virJSONStreamParserReset(stream);
+    return -1;
+}
+
+
 static int virJSONValueToStringOne(virJSONValuePtr object,
                                    yajl_gen g)
 {
@@ -1149,6 +1530,27 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
                    _("No JSON parser implementation is available"));
     return NULL;
 }
+virJSONStreamParserPtr virJSONStreamParserNew(unsigned int flags)
+{
+    virCheckFlags(VIR_JSON_PARSE_ARENA, NULL);
+
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return NULL;
+}
+void virJSONStreamParserFree(virJSONStreamParserPtr parser ATTRIBUTE_UNUSED)
+{
+}
+ssize_t virJSONStreamParserFeed(virJSONStreamParserPtr parser ATTRIBUTE_UNUSED,
+                                const char *data ATTRIBUTE_UNUSED,
+                                size_t len ATTRIBUTE_UNUSED,
+                                virJSONValuePtr *value)
+{
+    *value = NULL;
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return -1;
+}
 char *virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                            bool pretty ATTRIBUTE_UNUSED)
 {
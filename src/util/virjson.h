@@ -48,6 +48,9 @@ typedef virJSONObjectPair *virJSONObjectPairPtr;
 typedef struct _virJSONArray virJSONArray;
 typedef virJSONArray *virJSONArrayPtr;
 
+typedef struct _virJSONArena virJSONArena;
+typedef virJSONArena *virJSONArenaPtr;
+
 
 struct _virJSONObjectPair {
     char *key;
@@ -56,11 +59,13 @@ struct _virJSONObjectPair {
 
 struct _virJSONObject {
     size_t npairs;
+    size_t nalloc;
     virJSONObjectPairPtr pairs;
 };
 
 struct _virJSONArray {
     size_t nvalues;
+    size_t nalloc;
     virJSONValuePtr *values;
 };
 
@@ -68,6 +73,11 @@ struct _virJSONValue {
     int type; /* enum virJSONType */
     bool protect; /* prevents deletion when embedded in another object */
 
+    /* Set if the value, its key and string data were allocated from
+     * the arena of the tree it was parsed in, which is released with
+     * the root of the tree */
+    virJSONArenaPtr arena;
+
     union {
         virJSONObject object;
         virJSONArray array;
@@ -139,4 +149,23 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
+typedef enum {
+    /* Allocate each parsed tree from its own arena, which is cheaper
+     * than allocating each value separately. Values removed from such
+     * a tree with virJSONValueObjectRemoveKey are copied out of the
+     * arena so they can outlive it */
+    VIR_JSON_PARSE_ARENA = (1 << 0),
+} virJSONParseFlags;
+
+typedef struct _virJSONStreamParser virJSONStreamParser;
+typedef virJSONStreamParser *virJSONStreamParserPtr;
+
+virJSONStreamParserPtr virJSONStreamParserNew(unsigned int flags);
+void virJSONStreamParserFree(virJSONStreamParserPtr parser);
+ssize_t virJSONStreamParserFeed(virJSONStreamParserPtr parser,
+                                const char *data,
+                                size_t len,
+                                virJSONValuePtr *value)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+
 #endif /* __VIR_JSON_H_ */
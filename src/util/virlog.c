@@ -47,6 +47,7 @@
 #include "virutil.h"
 #include "virbuffer.h"
 #include "virthread.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virtime.h"
 #include "intprops.h"
@@ -69,16 +70,44 @@ VIR_ENUM_IMPL(virLogSource, VIR_LOG_FROM_LAST,
               "library");
 
 /*
- * A logging buffer to keep some history over logs
+ * Logging buffers to keep some history over logs. Each thread
+ * stores its logs in its own ring buffer so that no locking is
+ * needed, the rings are merged by timestamp when dumped. Rings
+ * are never freed: when a thread exits, its ring and the history
+ * it contains are kept and handed over to the next new thread.
  */
+typedef struct _virLogRing virLogRing;
+typedef virLogRing *virLogRingPtr;
+struct _virLogRing {
+    char *buffer;
+    int size;
+    int len;
+    int start;
+    int end;
+
+    /* Whether a thread currently owns the ring */
+    bool used;
+
+    /* Position of the next record to output while dumping */
+    int dumpStart;
+    int dumpLen;
+
+    virLogRingPtr next;
+};
 
 static int virLogSize = 64 * 1024;
-static char *virLogBuffer = NULL;
-static int virLogLen = 0;
-static int virLogStart = 0;
-static int virLogEnd = 0;
+static virLogRingPtr virLogRings = NULL;
+static virThreadLocal virLogRingLocal;
 static regex_t *virLogRegex = NULL;
 
+/*
+ * Bumped each time the filtering rules change, so that call sites
+ * know their cached decision is outdated, see virLogCallsite
+ */
+int virLogFiltersSerial = 1;
+
+#define VIR_LOG_CALLSITE_SERIAL_MAX (INT_MAX >> 12)
+
 
 #define VIR_LOG_DATE_REGEX "[0-9]{4}-[0-9]{2}-[0-9]{2}"
 #define VIR_LOG_TIME_REGEX "[0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{3}\\+[0-9]{4}"
@@ -130,6 +159,17 @@ static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
 static int virLogResetFilters(void);
 static int virLogResetOutputs(void);
+static void virLogVMessageFiltered(virLogSource source,
+                                   virLogPriority priority,
+                                   const char *filename,
+                                   int linenr,
+                                   const char *funcname,
+                                   virLogMetadataPtr metadata,
+                                   bool emit,
+                                   unsigned int filterflags,
+                                   const char *fmt,
+                                   va_list vargs)
+    ATTRIBUTE_FMT_PRINTF(9, 0);
 static void virLogOutputToFd(virLogSource src,
                              virLogPriority priority,
                              const char *filename,
@@ -195,32 +235,18 @@ virLogPriorityString(virLogPriority lvl)
 }
 
 
+static void virLogRingRelease(void *opaque);
+
 static int
 virLogOnceInit(void)
 {
-    const char *pbm = NULL;
-
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virThreadLocalInit(&virLogRingLocal, virLogRingRelease) < 0)
+        return -1;
+
     virLogLock();
-    if (VIR_ALLOC_N_QUIET(virLogBuffer, virLogSize + 1) < 0) {
-        /*
-         * The debug buffer is not a critical component, allow startup
-         * even in case of failure to allocate it in case of a
-         * configuration mistake.
-         */
-        virLogSize = 64 * 1024;
-        if (VIR_ALLOC_N_QUIET(virLogBuffer, virLogSize + 1) < 0) {
-            pbm = "Failed to allocate debug buffer: deactivating debug log\n";
-            virLogSize = 0;
-        } else {
-            pbm = "Failed to allocate debug buffer: reduced to 64 kB\n";
-        }
-    }
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
     virLogDefaultPriority = VIR_LOG_DEFAULT;
 
     if (VIR_ALLOC_QUIET(virLogRegex) >= 0) {
@@ -229,21 +255,127 @@ virLogOnceInit(void)
     }
 
     virLogUnlock();
-    if (pbm)
-        VIR_WARN("%s", pbm);
     return 0;
 }
 
 VIR_ONCE_GLOBAL_INIT(virLog)
 
 
+/*
+ * Must be called with the log lock held, each time the filters,
+ * the default priority or the debug buffer size change.
+ */
+static void
+virLogFiltersChanged(void)
+{
+    int serial = virLogFiltersSerial + 1;
+
+    if (serial > VIR_LOG_CALLSITE_SERIAL_MAX)
+        serial = 1;
+    virAtomicIntSet(&virLogFiltersSerial, serial);
+}
+
+
+/*
+ * Called on thread exit, the content of the ring is kept
+ * until another thread picks it up.
+ */
+static void
+virLogRingRelease(void *opaque)
+{
+    virLogRingPtr ring = opaque;
+
+    virLogLock();
+    ring->used = false;
+    virLogUnlock();
+}
+
+
+/*
+ * Mark the content of all rings as dropped. Like the emergency
+ * dump, this is done without synchronizing with the threads
+ * owning the rings, so at worst some records logged at the same
+ * time are garbled.
+ */
+static void
+virLogRingsClear(void)
+{
+    virLogRingPtr ring;
+
+    for (ring = virLogRings; ring; ring = ring->next) {
+        ring->end = 0;
+        ring->len = 0;
+        ring->start = 0;
+    }
+}
+
+
+/*
+ * Get the ring buffer of the calling thread, allocating it or
+ * resizing it to the current buffer size if needed.
+ *
+ * Returns NULL if the debug buffer is deactivated or could not
+ * be allocated.
+ */
+static virLogRingPtr
+virLogRingGet(void)
+{
+    virLogRingPtr ring = virThreadLocalGet(&virLogRingLocal);
+    int size = virLogSize;
+    char *buffer = NULL;
+
+    if (!ring) {
+        if (size <= 0)
+            return NULL;
+
+        virLogLock();
+        for (ring = virLogRings; ring; ring = ring->next) {
+            if (!ring->used)
+                break;
+        }
+        if (!ring && VIR_ALLOC_QUIET(ring) == 0) {
+            ring->next = virLogRings;
+            virLogRings = ring;
+        }
+        if (ring)
+            ring->used = true;
+        virLogUnlock();
+
+        if (!ring)
+            return NULL;
+
+        if (virThreadLocalSet(&virLogRingLocal, ring) < 0) {
+            virLogRingRelease(ring);
+            return NULL;
+        }
+    }
+
+    if (ring->size != size) {
+        if (size > 0 && VIR_ALLOC_N_QUIET(buffer, size) < 0)
+            return NULL;
+        ring->size = 0;
+        ring->end = 0;
+        ring->len = 0;
+        ring->start = 0;
+        VIR_FREE(ring->buffer);
+        ring->buffer = buffer;
+        ring->size = size;
+    }
+
+    if (!ring->buffer)
+        return NULL;
+    return ring;
+}
+
+
 /**
  * virLogSetBufferSize:
  * @size: size of the buffer in kilobytes or <= 0 to deactivate
  *
- * Dynamically set the size or deactivate the logging buffer used to keep
- * a trace of all recent debug output. Note that the content of the buffer
- * is lost if it gets reallocated.
+ * Dynamically set the size or deactivate the logging buffers used to keep
+ * a trace of all recent debug output, each thread having its own buffer
+ * of @size. Note that the content of a buffer is lost if it gets
+ * reallocated.
  *
  * Return -1 in case of failure or 0 in case of success
  */
@@ -251,8 +383,7 @@ int
 virLogSetBufferSize(int size)
 {
     int ret = 0;
-    int oldsize;
-    char *oldLogBuffer;
+    virLogRingPtr ring;
     const char *pbm = NULL;
 
     if (size < 0)
@@ -266,27 +397,25 @@ virLogSetBufferSize(int size)
 
     virLogLock();
 
-    oldsize = virLogSize;
-    oldLogBuffer = virLogBuffer;
-
     if (INT_MAX / 1024 <= size) {
         pbm = "Requested log size of %d kB too large\n";
         ret = -1;
         goto error;
     }
 
+    /* Rings owned by a thread are resized by their owner the next
+     * time it logs, the others can be dropped right away */
     virLogSize = size * 1024;
-    if (VIR_ALLOC_N_QUIET(virLogBuffer, virLogSize + 1) < 0) {
-        pbm = "Failed to allocate debug buffer of %d kB\n";
-        virLogBuffer = oldLogBuffer;
-        virLogSize = oldsize;
-        ret = -1;
-        goto error;
+    for (ring = virLogRings; ring; ring = ring->next) {
+        if (ring->used)
+            continue;
+        ring->size = 0;
+        ring->end = 0;
+        ring->len = 0;
+        ring->start = 0;
+        VIR_FREE(ring->buffer);
     }
-    VIR_FREE(oldLogBuffer);
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
+    virLogFiltersChanged();
 
 error:
     virLogUnlock();
@@ -312,53 +441,74 @@ virLogReset(void)
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
+    virLogRingsClear();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogFiltersChanged();
     virLogUnlock();
     return 0;
 }
 
 
 /*
- * Store a string in the ring buffer
+ * Copy data at the end of a ring buffer
  */
 static void
-virLogStr(const char *str)
+virLogRingWrite(virLogRingPtr ring,
+                const char *data,
+                int len)
 {
     int tmp;
-    int len;
-
-    if ((str == NULL) || (virLogBuffer == NULL) || (virLogSize <= 0))
-        return;
-    len = strlen(str);
-    if (len >= virLogSize)
-        return;
 
     /*
      * copy the data and reset the end, we cycle over the end of the buffer
      */
-    if (virLogEnd + len >= virLogSize) {
-        tmp = virLogSize - virLogEnd;
-        memcpy(&virLogBuffer[virLogEnd], str, tmp);
-        memcpy(&virLogBuffer[0], &str[tmp], len - tmp);
-        virLogEnd = len - tmp;
+    if (ring->end + len >= ring->size) {
+        tmp = ring->size - ring->end;
+        memcpy(&ring->buffer[ring->end], data, tmp);
+        memcpy(&ring->buffer[0], &data[tmp], len - tmp);
+        ring->end = len - tmp;
     } else {
-        memcpy(&virLogBuffer[virLogEnd], str, len);
-        virLogEnd += len;
+        memcpy(&ring->buffer[ring->end], data, len);
+        ring->end += len;
     }
-    virLogBuffer[virLogEnd] = 0;
+}
+
+
+/*
+ * Store a record made of a timestamp and a message in the ring
+ * buffer of the calling thread. Records are NUL terminated, so
+ * that rings can be merged when dumped.
+ */
+static void
+virLogStr(const char *timestamp,
+          const char *str)
+{
+    virLogRingPtr ring;
+    int tmp;
+    int tslen;
+    int len;
+
+    if (str == NULL || !(ring = virLogRingGet()))
+        return;
+    tslen = strlen(timestamp);
+    len = strlen(str);
+    if (tslen + 2 + len + 1 >= ring->size)
+        return;
+
+    virLogRingWrite(ring, timestamp, tslen);
+    virLogRingWrite(ring, ": ", 2);
+    virLogRingWrite(ring, str, len + 1);
+
     /*
      * Update the log length, and if full move the start index
      */
-    virLogLen += len;
-    if (virLogLen > virLogSize) {
-        tmp = virLogLen - virLogSize;
-        virLogLen = virLogSize;
-        virLogStart += tmp;
-        if (virLogStart >= virLogSize)
-            virLogStart -= virLogSize;
+    ring->len += tslen + 2 + len + 1;
+    if (ring->len > ring->size) {
+        tmp = ring->len - ring->size;
+        ring->len = ring->size;
+        ring->start += tmp;
+        if (ring->start >= ring->size)
+            ring->start -= ring->size;
     }
 }
 
@@ -396,11 +546,83 @@ virLogDumpAllFD(const char *msg, int len)
  * output which are safe to use from a signal handler.
  * In case none is found it is emitted to standard error.
  */
+static char
+virLogRingDumpChar(virLogRingPtr ring,
+                   int offset)
+{
+    if (offset >= ring->dumpLen)
+        return '\0';
+    return ring->buffer[(ring->dumpStart + offset) % ring->size];
+}
+
+
+/*
+ * Pick the ring whose next record to dump is the oldest one,
+ * records being prefixed with their timestamp.
+ */
+static virLogRingPtr
+virLogRingsDumpNext(void)
+{
+    virLogRingPtr ring;
+    virLogRingPtr oldest = NULL;
+    size_t i;
+
+    for (ring = virLogRings; ring; ring = ring->next) {
+        if (ring->dumpLen <= 0)
+            continue;
+        if (!oldest) {
+            oldest = ring;
+            continue;
+        }
+        for (i = 0; i < VIR_TIME_STRING_BUFLEN; i++) {
+            char c1 = virLogRingDumpChar(ring, i);
+            char c2 = virLogRingDumpChar(oldest, i);
+
+            if (c1 != c2) {
+                if (c1 < c2)
+                    oldest = ring;
+                break;
+            }
+            if (c1 == '\0')
+                break;
+        }
+    }
+
+    return oldest;
+}
+
+
+/*
+ * Output the next record of a ring and skip over it
+ */
+static void
+virLogRingDumpRecord(virLogRingPtr ring)
+{
+    int len = 0;
+    int tmp;
+
+    while (virLogRingDumpChar(ring, len) != '\0')
+        len++;
+
+    if (ring->dumpStart + len > ring->size) {
+        tmp = ring->size - ring->dumpStart;
+        virLogDumpAllFD(&ring->buffer[ring->dumpStart], tmp);
+        virLogDumpAllFD(&ring->buffer[0], len - tmp);
+    } else if (len > 0) {
+        virLogDumpAllFD(&ring->buffer[ring->dumpStart], len);
+    }
+
+    /* Also skip the terminating NUL */
+    len = MIN(len + 1, ring->dumpLen);
+    ring->dumpStart = (ring->dumpStart + len) % ring->size;
+    ring->dumpLen -= len;
+}
+
+
 void
 virLogEmergencyDumpAll(int signum)
 {
-    int len;
-    int oldLogStart, oldLogLen;
+    virLogRingPtr ring;
 
     switch (signum) {
 #ifdef SIGFPE
@@ -437,7 +659,7 @@ virLogEmergencyDumpAll(int signum)
             virLogDumpAllFD("Caught unexpected signal", -1);
             break;
     }
-    if ((virLogBuffer == NULL) || (virLogSize <= 0)) {
+    if (virLogSize <= 0) {
         virLogDumpAllFD(" internal log buffer deactivated\n", -1);
         return;
     }
@@ -446,34 +668,38 @@ virLogEmergencyDumpAll(int signum)
     virLogDumpAllFD("\n\n    ====== start of log =====\n\n", -1);
 
     /*
-     * Since we can't lock the buffer safely from a signal handler
-     * we mark it as empty in case of concurrent access, and proceed
+     * Since we can't lock the buffers safely from a signal handler
+     * we mark them as empty in case of concurrent access, and proceed
      * with the data, at worse we will output something a bit weird
-     * if another thread start logging messages at the same time.
-     * Note that virLogStr() uses virLogEnd for the computations and
-     * writes to the buffer and only then updates virLogLen and virLogStart
-     * so it's best to reset it first.
+     * if other threads start logging messages at the same time.
+     * Note that virLogStr() uses the end index for the computations and
+     * writes to the buffer and only then updates the length and start
+     * index so it's best to reset it first.
      */
-    oldLogStart = virLogStart;
-    oldLogLen = virLogLen;
-    virLogEnd = 0;
-    virLogLen = 0;
-    virLogStart = 0;
-
-    while (oldLogLen > 0) {
-        if (oldLogStart + oldLogLen < virLogSize) {
-            virLogBuffer[oldLogStart + oldLogLen] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], oldLogLen);
-            oldLogStart += oldLogLen;
-            oldLogLen = 0;
-        } else {
-            len = virLogSize - oldLogStart;
-            virLogBuffer[virLogSize] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], len);
-            oldLogLen -= len;
-            oldLogStart = 0;
+    for (ring = virLogRings; ring; ring = ring->next) {
+        ring->dumpStart = ring->start;
+        ring->dumpLen = ring->buffer ? ring->len : 0;
+        ring->end = 0;
+        ring->len = 0;
+        ring->start = 0;
+
+        /* If the ring wrapped, its oldest record is truncated */
+        if (ring->dumpLen == ring->size) {
+            while (ring->dumpLen > 0 &&
+                   ring->buffer[ring->dumpStart] != '\0') {
+                ring->dumpStart = (ring->dumpStart + 1) % ring->size;
+                ring->dumpLen--;
+            }
+            if (ring->dumpLen > 0) {
+                ring->dumpStart = (ring->dumpStart + 1) % ring->size;
+                ring->dumpLen--;
+            }
         }
     }
+
+    while ((ring = virLogRingsDumpNext()))
+        virLogRingDumpRecord(ring);
+
     virLogDumpAllFD("\n\n     ====== end of log =====\n\n", -1);
 }
 
@@ -498,7 +724,10 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogLock();
     virLogDefaultPriority = priority;
+    virLogFiltersChanged();
+    virLogUnlock();
     return 0;
 }
 
@@ -519,6 +748,7 @@ virLogResetFilters(void)
         VIR_FREE(virLogFilters[i].match);
     VIR_FREE(virLogFilters);
     virLogNbFilters = 0;
+    virLogFiltersChanged();
     return i;
 }
 
@@ -558,6 +788,7 @@ virLogDefineFilter(const char *match,
     for (i = 0; i < virLogNbFilters; i++) {
         if (STREQ(virLogFilters[i].match, match)) {
             virLogFilters[i].priority = priority;
+            virLogFiltersChanged();
             ret = i;
             goto cleanup;
         }
@@ -574,6 +805,7 @@ virLogDefineFilter(const char *match,
     virLogFilters[i].priority = priority;
     virLogFilters[i].flags = flags;
     virLogNbFilters++;
+    virLogFiltersChanged();
 cleanup:
     virLogUnlock();
     if (ret < 0)
@@ -583,35 +815,79 @@ cleanup:
 
 
 /**
- * virLogFiltersCheck:
+ * virLogFiltersCheckLocked:
  * @input: the input string
  *
  * Check the input of the message against the existing filters. Currently
  * the match is just a substring check of the category used as the input
- * string, a more subtle approach could be used instead
+ * string, a more subtle approach could be used instead.
+ * Must be called with the log lock held.
  *
  * Returns 0 if not matched or the new priority if found.
  */
 static int
-virLogFiltersCheck(const char *input,
-                   unsigned int *flags)
+virLogFiltersCheckLocked(const char *input,
+                         unsigned int *flags)
 {
-    int ret = 0;
     size_t i;
 
-    virLogLock();
     for (i = 0; i < virLogNbFilters; i++) {
         if (strstr(input, virLogFilters[i].match)) {
-            ret = virLogFilters[i].priority;
             *flags = virLogFilters[i].flags;
-            break;
+            return virLogFilters[i].priority;
         }
     }
+    return 0;
+}
+
+
+static int
+virLogFiltersCheck(const char *input,
+                   unsigned int *flags)
+{
+    int ret;
+
+    virLogLock();
+    ret = virLogFiltersCheckLocked(input, flags);
     virLogUnlock();
     return ret;
 }
 
 
+/**
+ * virLogCallsiteUpdate:
+ * @site: the call site
+ * @filename: file the call site is in
+ *
+ * Compute the filtering decision of a call site against the current
+ * filters, default priority and debug buffer size, and cache it in @site.
+ * No logging is allowed in here.
+ */
+void
+virLogCallsiteUpdate(virLogCallsitePtr site,
+                     const char *filename)
+{
+    unsigned int flags = 0;
+    int fprio;
+    int priority;
+
+    if (virLogInitialize() < 0)
+        return;
+
+    virLogLock();
+    if ((fprio = virLogFiltersCheckLocked(filename, &flags)) == 0)
+        fprio = virLogDefaultPriority;
+
+    /* Everything goes to the debug buffer if it's active */
+    priority = virLogSize > 0 ? VIR_LOG_DEBUG : fprio;
+
+    virAtomicIntSet(&site->state,
+                    (virLogFiltersSerial << 12) | (flags << 8) |
+                    (fprio << 4) | priority);
+    virLogUnlock();
+}
+
+
 /**
  * virLogResetOutputs:
  *
@@ -782,6 +1058,44 @@ virLogMessage(virLogSource source,
 }
 
 
+/**
+ * virLogCallsiteMessage:
+ * @site: the call site the message is emitted from
+ * @source: where is that message coming from
+ * @priority: the priority level
+ * @filename: file where the message was emitted
+ * @linenr: line where the message was emitted
+ * @funcname: the function emitting the (debug) message
+ * @metadata: NULL or metadata array, terminated by an item with NULL key
+ * @fmt: the string format
+ * @...: the arguments
+ *
+ * Same as virLogMessage(), using the filtering decision cached
+ * in @site rather than checking the filters again.
+ */
+void
+virLogCallsiteMessage(virLogCallsitePtr site,
+                      virLogSource source,
+                      virLogPriority priority,
+                      const char *filename,
+                      int linenr,
+                      const char *funcname,
+                      virLogMetadataPtr metadata,
+                      const char *fmt, ...)
+{
+    int state = site->state;
+    va_list ap;
+
+    va_start(ap, fmt);
+    virLogVMessageFiltered(source, priority,
+                           filename, linenr, funcname, metadata,
+                           priority >= VIR_LOG_CALLSITE_EMIT_PRIORITY(state),
+                           VIR_LOG_CALLSITE_FLAGS(state),
+                           fmt, ap);
+    va_end(ap);
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -806,12 +1120,7 @@ virLogVMessage(virLogSource source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logVersionStderr = true;
-    char *str = NULL;
-    char *msg = NULL;
-    char timestamp[VIR_TIME_STRING_BUFLEN];
-    int fprio, ret;
-    size_t i;
+    int fprio;
     int saved_errno = errno;
     bool emit = true;
     unsigned int filterflags = 0;
@@ -819,9 +1128,6 @@ virLogVMessage(virLogSource source,
     if (virLogInitialize() < 0)
         return;
 
-    if (fmt == NULL)
-        goto cleanup;
-
     /*
      * check against list of specific logging patterns
      */
@@ -833,7 +1139,40 @@ virLogVMessage(virLogSource source,
         emit = false;
     }
 
-    if (!emit && ((virLogBuffer == NULL) || (virLogSize <= 0)))
+    errno = saved_errno;
+    virLogVMessageFiltered(source, priority,
+                           filename, linenr, funcname, metadata,
+                           emit, filterflags, fmt, vargs);
+}
+
+
+static void
+virLogVMessageFiltered(virLogSource source,
+                       virLogPriority priority,
+                       const char *filename,
+                       int linenr,
+                       const char *funcname,
+                       virLogMetadataPtr metadata,
+                       bool emit,
+                       unsigned int filterflags,
+                       const char *fmt,
+                       va_list vargs)
+{
+    static bool logVersionStderr = true;
+    char *str = NULL;
+    char *msg = NULL;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    int ret;
+    size_t i;
+    int saved_errno = errno;
+
+    if (virLogInitialize() < 0)
+        return;
+
+    if (fmt == NULL)
+        goto cleanup;
+
+    if (!emit && virLogSize <= 0)
         goto cleanup;
 
     /*
@@ -851,18 +1190,14 @@ virLogVMessage(virLogSource source,
         timestamp[0] = '\0';
 
     /*
-     * Log based on defaults, first store in the history buffer,
-     * then if emit push the message on the outputs defined, if none
-     * use stderr.
+     * Log based on defaults, first store in the history buffer of
+     * the thread, which needs no locking, then if emit push the
+     * message on the outputs defined, if none use stderr.
      * NOTE: the locking is a single point of contention for multiple
      *       threads, but avoid intermixing. Maybe set up locks per output
      *       to improve paralellism.
      */
-    virLogLock();
-    virLogStr(timestamp);
-    virLogStr(": ");
-    virLogStr(msg);
-    virLogUnlock();
+    virLogStr(timestamp, msg);
     if (!emit)
         goto cleanup;
 
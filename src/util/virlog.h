@@ -54,6 +54,43 @@ typedef enum {
     VIR_LOG_FROM_LAST,
 } virLogSource;
 
+/*
+ * Each debug call site caches its filtering decision, packed in a
+ * single word so that it can be read and updated without locking:
+ * the lowest priority the site has to format messages at (either
+ * to emit them or to keep them in the debug buffer), the priority
+ * they are emitted at, the filter flags and the value of
+ * virLogFiltersSerial all of these were computed for. Whenever the
+ * filters, the default priority or the debug buffer change, the
+ * serial is bumped and the call sites recompute their decision the
+ * next time they are hit.
+ */
+typedef struct _virLogCallsite virLogCallsite;
+typedef virLogCallsite *virLogCallsitePtr;
+struct _virLogCallsite {
+    int state;
+};
+
+# define VIR_LOG_CALLSITE_PRIORITY(state) ((state) & 0xf)
+# define VIR_LOG_CALLSITE_EMIT_PRIORITY(state) (((state) >> 4) & 0xf)
+# define VIR_LOG_CALLSITE_FLAGS(state) (((state) >> 8) & 0xf)
+# define VIR_LOG_CALLSITE_SERIAL(state) ((state) >> 12)
+
+extern int virLogFiltersSerial;
+
+extern void virLogCallsiteUpdate(virLogCallsitePtr site,
+                                 const char *filename);
+
+static inline bool
+virLogCallsiteEnabled(virLogCallsitePtr site,
+                      virLogPriority priority,
+                      const char *filename)
+{
+    if (VIR_LOG_CALLSITE_SERIAL(site->state) != virLogFiltersSerial)
+        virLogCallsiteUpdate(site, filename);
+    return priority >= VIR_LOG_CALLSITE_PRIORITY(site->state);
+}
+
 /*
  * If configured with --enable-debug=yes then library calls
  * are printed to stderr for debugging or to an appropriate channel
@@ -61,7 +98,14 @@ typedef enum {
  */
 # ifdef ENABLE_DEBUG
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...)           \
-    virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+    do {                                                                \
+        static virLogCallsite virLogCallsiteSelf;                       \
+        if (virLogCallsiteEnabled(&virLogCallsiteSelf, VIR_LOG_DEBUG,   \
+                                  filename))                            \
+            virLogCallsiteMessage(&virLogCallsiteSelf, src,             \
+                                  VIR_LOG_DEBUG, filename, linenr,      \
+                                  funcname, NULL, __VA_ARGS__);         \
+    } while (0)
 # else
 /**
  * virLogEatParams:
@@ -187,6 +231,14 @@ extern void virLogVMessage(virLogSource src,
                            virLogMetadataPtr metadata,
                            const char *fmt,
                            va_list vargs) ATTRIBUTE_FMT_PRINTF(7, 0);
+extern void virLogCallsiteMessage(virLogCallsitePtr site,
+                                  virLogSource src,
+                                  virLogPriority priority,
+                                  const char *filename,
+                                  int linenr,
+                                  const char *funcname,
+                                  virLogMetadataPtr metadata,
+                                  const char *fmt, ...) ATTRIBUTE_FMT_PRINTF(8, 9);
 extern int virLogSetBufferSize(int size);
 extern void virLogEmergencyDumpAll(int signum);
 
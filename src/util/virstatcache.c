@@ -0,0 +1,403 @@
+/*
+ * virstatcache.c: shared snapshots of frequently polled stats files
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "virstatcache.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/*
+ * Files like /proc/net/dev, /proc/PID/stat or cpuacct.usage_percpu are
+ * read over and over again by anything that monitors guests.  Rather
+ * than opening and reading them on every request, we keep the file
+ * descriptor open, re-read it with pread() and hand out copies of the
+ * last snapshot for as long as it is younger than the configured
+ * maximum age.  With the default maximum age of zero every request
+ * still sees fresh data and only the open/close is saved.
+ */
+
+/* Upper bound on the number of file descriptors kept open */
+#define VIR_STAT_CACHE_MAX_FILES 256
+
+/* Entries not asked for during this long are closed */
+#define VIR_STAT_CACHE_IDLE_MS (60 * 1000)
+
+typedef struct _virStatCacheEntry virStatCacheEntry;
+typedef virStatCacheEntry *virStatCacheEntryPtr;
+struct _virStatCacheEntry {
+    /* Protected by virStatCacheLock */
+    size_t refs;                /* the table holds one, each reader one */
+    unsigned long long used;    /* last time anybody asked */
+
+    /* Protected by @lock, which is held while the file is read so that
+     * reading one file does not hold up readers of the others */
+    virMutex lock;
+    int fd;
+    char *data;                 /* NULL until the file was read */
+    size_t len;
+    size_t alloc;
+    unsigned long long stamp;   /* when reading @data started */
+};
+
+static virMutex virStatCacheLock;
+static virHashTablePtr virStatCacheFiles;
+static unsigned int virStatCacheMaxAge;
+
+static virStatCacheEntryPtr
+virStatCacheEntryNew(void)
+{
+    virStatCacheEntryPtr entry;
+
+    if (VIR_ALLOC_QUIET(entry) < 0)
+        return NULL;
+
+    if (virMutexInit(&entry->lock) < 0) {
+        VIR_FREE(entry);
+        return NULL;
+    }
+
+    entry->refs = 1;
+    entry->fd = -1;
+
+    return entry;
+}
+
+/* Close the file of @entry and forget its contents */
+static void
+virStatCacheEntryClear(virStatCacheEntryPtr entry)
+{
+    VIR_FORCE_CLOSE(entry->fd);
+    VIR_FREE(entry->data);
+    entry->len = 0;
+    entry->alloc = 0;
+}
+
+/* The caller must hold virStatCacheLock */
+static void
+virStatCacheEntryUnref(virStatCacheEntryPtr entry)
+{
+    if (!entry || --entry->refs > 0)
+        return;
+
+    virStatCacheEntryClear(entry);
+    virMutexDestroy(&entry->lock);
+    VIR_FREE(entry);
+}
+
+static void
+virStatCacheEntryHashFree(void *payload,
+                          const void *name ATTRIBUTE_UNUSED)
+{
+    virStatCacheEntryUnref(payload);
+}
+
+static int
+virStatCacheOnceInit(void)
+{
+    if (virMutexInit(&virStatCacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(virStatCacheFiles = virHashCreate(64, virStatCacheEntryHashFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStatCache)
+
+
+/**
+ * virStatCacheSetMaxAge:
+ * @maxAge: maximum age of a snapshot in milliseconds
+ *
+ * Set for how long the contents read from a file may be handed out
+ * before the file is read again.  Zero means every read goes to the
+ * file.
+ */
+void
+virStatCacheSetMaxAge(unsigned int maxAge)
+{
+    if (virStatCacheInitialize() < 0)
+        return;
+
+    virMutexLock(&virStatCacheLock);
+    virStatCacheMaxAge = maxAge;
+    virMutexUnlock(&virStatCacheLock);
+}
+
+
+unsigned int
+virStatCacheGetMaxAge(void)
+{
+    unsigned int ret;
+
+    if (virStatCacheInitialize() < 0)
+        return 0;
+
+    virMutexLock(&virStatCacheLock);
+    ret = virStatCacheMaxAge;
+    virMutexUnlock(&virStatCacheLock);
+    return ret;
+}
+
+
+static int
+virStatCacheIsIdle(const void *payload,
+                   const void *name ATTRIBUTE_UNUSED,
+                   const void *opaque)
+{
+    const virStatCacheEntry *entry = payload;
+    unsigned long long now = *(const unsigned long long *)opaque;
+
+    return now - entry->used > VIR_STAT_CACHE_IDLE_MS;
+}
+
+
+/* Read the whole of @entry->fd from the start into @entry->data.
+ * Returns 0 on success, -1 with errno set on failure. */
+static int
+virStatCacheEntryRefresh(virStatCacheEntryPtr entry, int maxlen)
+{
+    entry->len = 0;
+
+    for (;;) {
+        ssize_t got;
+
+        if (entry->alloc - entry->len < 2 &&
+            VIR_RESIZE_N_QUIET(entry->data, entry->alloc, entry->len,
+                               entry->alloc ? entry->alloc : 4096) < 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        got = pread(entry->fd, entry->data + entry->len,
+                    entry->alloc - entry->len - 1, entry->len);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (got == 0)
+            break;
+
+        entry->len += got;
+        if (entry->len > maxlen) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+    }
+
+    entry->data[entry->len] = '\0';
+    return 0;
+}
+
+
+/* Read @path into @entry, through the descriptor kept from an earlier
+ * read if there is one.  Returns 0 on success, -1 with errno set and
+ * @entry cleared on failure. */
+static int
+virStatCacheEntryLoad(virStatCacheEntryPtr entry,
+                      const char *path,
+                      int maxlen)
+{
+    bool opened = false;
+    int saved_errno;
+
+    if (entry->fd < 0) {
+        if ((entry->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+            goto error;
+        opened = true;
+    }
+
+    while (virStatCacheEntryRefresh(entry, maxlen) < 0) {
+        /* A descriptor kept from an earlier read may refer to a process
+         * or cgroup that has since gone away while @path now names a
+         * new one, so give a newly opened file a chance */
+        if (opened || errno == EOVERFLOW)
+            goto error;
+
+        VIR_FORCE_CLOSE(entry->fd);
+        if ((entry->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+            goto error;
+        opened = true;
+    }
+
+    return 0;
+
+error:
+    saved_errno = errno;
+    virStatCacheEntryClear(entry);
+    errno = saved_errno;
+    return -1;
+}
+
+
+/**
+ * virStatCacheRead:
+ * @path: file to read
+ * @maxlen: maximum number of bytes to accept
+ * @buf: filled with a newly allocated, NUL terminated copy of the contents
+ *
+ * Like virFileReadAll(), but serve the contents from a snapshot shared
+ * by all callers when it is recent enough and keep the file open
+ * between reads.  Intended for pseudo files in /proc, /sys and cgroup
+ * mounts whose contents are regenerated on every read.
+ *
+ * Returns the number of bytes read, or -1 with errno set on failure.
+ * No libvirt error is reported so that callers can decide whether a
+ * missing file is a problem.
+ */
+int
+virStatCacheRead(const char *path, int maxlen, char **buf)
+{
+    virStatCacheEntryPtr entry;
+    unsigned long long now;
+    unsigned int maxAge;
+    bool failed = false;
+    int ret = -1;
+    int saved_errno = 0;
+
+    *buf = NULL;
+
+    if (maxlen <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (virStatCacheInitialize() < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&virStatCacheLock);
+    maxAge = virStatCacheMaxAge;
+
+    if (!(entry = virHashLookup(virStatCacheFiles, path))) {
+        if (virHashSize(virStatCacheFiles) >= VIR_STAT_CACHE_MAX_FILES)
+            virHashRemoveSet(virStatCacheFiles, virStatCacheIsIdle, &now);
+
+        if (virHashSize(virStatCacheFiles) < VIR_STAT_CACHE_MAX_FILES) {
+            if (!(entry = virStatCacheEntryNew())) {
+                virMutexUnlock(&virStatCacheLock);
+                errno = ENOMEM;
+                return -1;
+            }
+
+            if (virHashAddEntry(virStatCacheFiles, path, entry) < 0) {
+                virStatCacheEntryUnref(entry);
+                virMutexUnlock(&virStatCacheLock);
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    }
+
+    if (entry) {
+        entry->refs++;
+        entry->used = now;
+    }
+    virMutexUnlock(&virStatCacheLock);
+
+    if (!entry) {
+        /* Too many files being watched, just read this one
+         * without keeping it around */
+        virStatCacheEntry tmp = { .fd = -1 };
+
+        if (virStatCacheEntryLoad(&tmp, path, maxlen) < 0)
+            return -1;
+
+        VIR_FORCE_CLOSE(tmp.fd);
+        *buf = tmp.data;
+        return tmp.len;
+    }
+
+    virMutexLock(&entry->lock);
+
+    /* A snapshot whose reading started after the request is as fresh as
+     * it gets, even if another caller asked for it */
+    if (!entry->data ||
+        entry->len > maxlen ||
+        (entry->stamp <= now && now - entry->stamp >= maxAge)) {
+        if (virTimeMillisNowRaw(&entry->stamp) < 0)
+            entry->stamp = now;
+
+        if (virStatCacheEntryLoad(entry, path, maxlen) < 0) {
+            saved_errno = errno;
+            failed = true;
+            goto unlock;
+        }
+    }
+
+    if (VIR_ALLOC_N_QUIET(*buf, entry->len + 1) < 0) {
+        saved_errno = ENOMEM;
+    } else {
+        memcpy(*buf, entry->data, entry->len + 1);
+        ret = entry->len;
+    }
+
+unlock:
+    virMutexUnlock(&entry->lock);
+
+    virMutexLock(&virStatCacheLock);
+    /* Do not keep a file around that cannot be read */
+    if (failed && virHashLookup(virStatCacheFiles, path) == entry)
+        virHashRemoveEntry(virStatCacheFiles, path);
+    virStatCacheEntryUnref(entry);
+    virMutexUnlock(&virStatCacheLock);
+
+    if (ret < 0)
+        errno = saved_errno;
+    return ret;
+}
+
+
+/**
+ * virStatCacheFlush:
+ *
+ * Close all files and forget all snapshots.
+ */
+void
+virStatCacheFlush(void)
+{
+    if (virStatCacheInitialize() < 0)
+        return;
+
+    virMutexLock(&virStatCacheLock);
+    virHashRemoveAll(virStatCacheFiles);
+    virMutexUnlock(&virStatCacheLock);
+}
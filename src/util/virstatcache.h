@@ -0,0 +1,35 @@
+/*
+ * virstatcache.h: shared snapshots of frequently polled stats files
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_STAT_CACHE_H__
+# define __VIR_STAT_CACHE_H__
+
+# include "internal.h"
+
+void virStatCacheSetMaxAge(unsigned int maxAge);
+unsigned int virStatCacheGetMaxAge(void);
+
+int virStatCacheRead(const char *path, int maxlen, char **buf)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+
+void virStatCacheFlush(void);
+
+#endif /* __VIR_STAT_CACHE_H__ */
@@ -37,6 +37,7 @@
 # include "virstatslinux.h"
 # include "viralloc.h"
 # include "virfile.h"
+# include "virstatcache.h"
 
 # define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
@@ -52,19 +53,22 @@ linuxDomainInterfaceStats(const char *path,
                           struct _virDomainInterfaceStats *stats)
 {
     int path_len;
-    FILE *fp;
-    char line[256], *colon;
-
-    fp = fopen("/proc/net/dev", "r");
-    if (!fp) {
+    char *content = NULL;
+    char *line, *next, *colon;
+    int ret = -1;
+
+    /* The file is shared by all interfaces of all guests, so read it
+     * through the stats cache instead of parsing a fresh copy for each
+     * of them */
+    if (virStatCacheRead("/proc/net/dev", 1024 * 1024, &content) < 0) {
         virReportSystemError(errno, "%s",
-                             _("Could not open /proc/net/dev"));
+                             _("Could not read /proc/net/dev"));
         return -1;
     }
 
     path_len = strlen(path);
 
-    while (fgets(line, sizeof(line), fp)) {
+    for (line = content; line && *line; line = next) {
         long long dummy;
         long long rx_bytes;
         long long rx_packets;
@@ -75,6 +79,9 @@ linuxDomainInterfaceStats(const char *path,
         long long tx_errs;
         long long tx_drop;
 
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
         /* The line looks like:
          *   "   eth0:..."
          * Split it at the colon.
@@ -106,16 +113,17 @@ linuxDomainInterfaceStats(const char *path,
             stats->tx_packets = tx_packets;
             stats->tx_errs = tx_errs;
             stats->tx_drop = tx_drop;
-            VIR_FORCE_FCLOSE(fp);
-
-            return 0;
+            ret = 0;
+            goto cleanup;
         }
     }
-    VIR_FORCE_FCLOSE(fp);
 
     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                    _("/proc/net/dev: Interface not found"));
-    return -1;
+
+cleanup:
+    VIR_FREE(content);
+    return ret;
 }
 
 #endif /* __linux__ */
@@ -122,6 +122,98 @@ void virSysinfoDefFree(virSysinfoDefPtr def)
     VIR_FREE(def);
 }
 
+/**
+ * virSysinfoDefCopy:
+ * @src: the definition to copy
+ *
+ * Returns a deep copy of @src, or NULL with an error reported
+ */
+virSysinfoDefPtr
+virSysinfoDefCopy(virSysinfoDefPtr src)
+{
+    virSysinfoDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+
+    if (VIR_STRDUP(def->bios_vendor, src->bios_vendor) < 0 ||
+        VIR_STRDUP(def->bios_version, src->bios_version) < 0 ||
+        VIR_STRDUP(def->bios_date, src->bios_date) < 0 ||
+        VIR_STRDUP(def->bios_release, src->bios_release) < 0 ||
+        VIR_STRDUP(def->system_manufacturer, src->system_manufacturer) < 0 ||
+        VIR_STRDUP(def->system_product, src->system_product) < 0 ||
+        VIR_STRDUP(def->system_version, src->system_version) < 0 ||
+        VIR_STRDUP(def->system_serial, src->system_serial) < 0 ||
+        VIR_STRDUP(def->system_uuid, src->system_uuid) < 0 ||
+        VIR_STRDUP(def->system_sku, src->system_sku) < 0 ||
+        VIR_STRDUP(def->system_family, src->system_family) < 0)
+        goto error;
+
+    if (src->nprocessor &&
+        VIR_ALLOC_N(def->processor, src->nprocessor) < 0)
+        goto error;
+
+    for (i = 0; i < src->nprocessor; i++) {
+        virSysinfoProcessorDefPtr dst = &def->processor[i];
+        virSysinfoProcessorDefPtr proc = &src->processor[i];
+
+        def->nprocessor++;
+        if (VIR_STRDUP(dst->processor_socket_destination,
+                       proc->processor_socket_destination) < 0 ||
+            VIR_STRDUP(dst->processor_type, proc->processor_type) < 0 ||
+            VIR_STRDUP(dst->processor_family, proc->processor_family) < 0 ||
+            VIR_STRDUP(dst->processor_manufacturer,
+                       proc->processor_manufacturer) < 0 ||
+            VIR_STRDUP(dst->processor_signature,
+                       proc->processor_signature) < 0 ||
+            VIR_STRDUP(dst->processor_version, proc->processor_version) < 0 ||
+            VIR_STRDUP(dst->processor_external_clock,
+                       proc->processor_external_clock) < 0 ||
+            VIR_STRDUP(dst->processor_max_speed,
+                       proc->processor_max_speed) < 0 ||
+            VIR_STRDUP(dst->processor_status, proc->processor_status) < 0 ||
+            VIR_STRDUP(dst->processor_serial_number,
+                       proc->processor_serial_number) < 0 ||
+            VIR_STRDUP(dst->processor_part_number,
+                       proc->processor_part_number) < 0)
+            goto error;
+    }
+
+    if (src->nmemory &&
+        VIR_ALLOC_N(def->memory, src->nmemory) < 0)
+        goto error;
+
+    for (i = 0; i < src->nmemory; i++) {
+        virSysinfoMemoryDefPtr dst = &def->memory[i];
+        virSysinfoMemoryDefPtr mem = &src->memory[i];
+
+        def->nmemory++;
+        if (VIR_STRDUP(dst->memory_size, mem->memory_size) < 0 ||
+            VIR_STRDUP(dst->memory_form_factor, mem->memory_form_factor) < 0 ||
+            VIR_STRDUP(dst->memory_locator, mem->memory_locator) < 0 ||
+            VIR_STRDUP(dst->memory_bank_locator,
+                       mem->memory_bank_locator) < 0 ||
+            VIR_STRDUP(dst->memory_type, mem->memory_type) < 0 ||
+            VIR_STRDUP(dst->memory_type_detail, mem->memory_type_detail) < 0 ||
+            VIR_STRDUP(dst->memory_speed, mem->memory_speed) < 0 ||
+            VIR_STRDUP(dst->memory_manufacturer,
+                       mem->memory_manufacturer) < 0 ||
+            VIR_STRDUP(dst->memory_serial_number,
+                       mem->memory_serial_number) < 0 ||
+            VIR_STRDUP(dst->memory_part_number, mem->memory_part_number) < 0)
+            goto error;
+    }
+
+    return def;
+
+error:
+    virSysinfoDefFree(def);
+    return NULL;
+}
+
 /**
  * virSysinfoRead:
  *
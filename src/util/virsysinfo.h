@@ -94,6 +94,8 @@ virSysinfoDefPtr virSysinfoRead(void);
 
 void virSysinfoDefFree(virSysinfoDefPtr def);
 
+virSysinfoDefPtr virSysinfoDefCopy(virSysinfoDefPtr src);
+
 int virSysinfoFormat(virBufferPtr buf, virSysinfoDefPtr def)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
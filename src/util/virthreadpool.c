@@ -28,6 +28,8 @@
 #include "virthreadpool.h"
 #include "viralloc.h"
 #include "virthread.h"
+#include "viratomic.h"
+#include "virhashcode.h"
 #include "virerror.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -52,15 +54,41 @@ struct _virThreadPoolJobList {
     virThreadPoolJobPtr firstPrio;
 };
 
+/*
+ * In multi-queue mode there is one job queue per possible worker,
+ * each with its own lock. Jobs with the same key always go to the
+ * same queue. Workers take jobs from their queue first and steal
+ * from the other queues when theirs is empty, so the jobs of a key
+ * are started in order but may run concurrently.
+ */
+typedef struct _virThreadPoolJobQueue virThreadPoolJobQueue;
+typedef virThreadPoolJobQueue *virThreadPoolJobQueuePtr;
+
+struct _virThreadPoolJobQueue {
+    virMutex lock;
+    virThreadPoolJobList jobList;
+    int waiting; /* atomic, number of jobs in jobList */
+};
+
 
 struct _virThreadPool {
-    bool quit;
+    int quit; /* atomic in multi-queue mode, see virThreadPoolSendQueueJob */
 
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
     virThreadPoolJobList jobList;
     size_t jobQueueDepth;
 
+    /* Multi-queue mode only, jobList then only holds
+     * priority jobs. All counters are atomic */
+    virThreadPoolJobQueuePtr queues;
+    int nQueueWorkers;
+    int idleQueueWorkers;
+    int queuedJobs;
+    int sharedJobs;
+    int nextQueue;
+    int jobSeq; /* bumped each time a job is queued */
+
     virMutex mutex;
     virCond cond;
     virCond quit_cond;
@@ -80,8 +108,170 @@ struct virThreadPoolWorkerData {
     virThreadPoolPtr pool;
     virCondPtr cond;
     bool priority;
+    size_t queue;
 };
 
+
+static void
+virThreadPoolJobListAppend(virThreadPoolJobListPtr jobList,
+                           virThreadPoolJobPtr job)
+{
+    job->prev = jobList->tail;
+    if (jobList->tail)
+        jobList->tail->next = job;
+    jobList->tail = job;
+
+    if (!jobList->head)
+        jobList->head = job;
+
+    if (job->priority && !jobList->firstPrio)
+        jobList->firstPrio = job;
+}
+
+
+static void
+virThreadPoolJobListRemove(virThreadPoolJobListPtr jobList,
+                           virThreadPoolJobPtr job)
+{
+    if (job == jobList->firstPrio) {
+        virThreadPoolJobPtr tmp = job->next;
+        while (tmp) {
+            if (tmp->priority) {
+                break;
+            }
+            tmp = tmp->next;
+        }
+        jobList->firstPrio = tmp;
+    }
+
+    if (job->prev)
+        job->prev->next = job->next;
+    else
+        jobList->head = job->next;
+    if (job->next)
+        job->next->prev = job->prev;
+    else
+        jobList->tail = job->prev;
+}
+
+
+static void
+virThreadPoolJobListClear(virThreadPoolJobListPtr jobList)
+{
+    virThreadPoolJobPtr job;
+
+    while ((job = jobList->head)) {
+        jobList->head = jobList->head->next;
+        VIR_FREE(job);
+    }
+    jobList->tail = jobList->firstPrio = NULL;
+}
+
+
+/* Take the oldest job of @queue */
+static virThreadPoolJobPtr
+virThreadPoolJobQueueTake(virThreadPoolPtr pool,
+                          virThreadPoolJobQueuePtr queue)
+{
+    virThreadPoolJobPtr job;
+
+    if (virAtomicIntGet(&queue->waiting) == 0)
+        return NULL;
+
+    virMutexLock(&queue->lock);
+    if ((job = queue->jobList.head)) {
+        virThreadPoolJobListRemove(&queue->jobList, job);
+        virAtomicIntAdd(&queue->waiting, -1);
+        virAtomicIntAdd(&pool->queuedJobs, -1);
+    }
+    virMutexUnlock(&queue->lock);
+
+    return job;
+}
+
+
+/*
+ * Look for a job to run by a multi-queue worker: from its own
+ * queue, then priority jobs, then by stealing a job from another
+ * queue.
+ */
+static virThreadPoolJobPtr
+virThreadPoolQueueWorkerNextJob(virThreadPoolPtr pool,
+                                size_t self)
+{
+    virThreadPoolJobPtr job = NULL;
+    size_t nqueues = pool->maxWorkers;
+    size_t i;
+
+    if ((job = virThreadPoolJobQueueTake(pool, &pool->queues[self])))
+        return job;
+
+    if (virAtomicIntGet(&pool->sharedJobs) > 0) {
+        virMutexLock(&pool->mutex);
+        if ((job = pool->jobList.head)) {
+            virThreadPoolJobListRemove(&pool->jobList, job);
+            pool->jobQueueDepth--;
+            virAtomicIntAdd(&pool->sharedJobs, -1);
+        }
+        virMutexUnlock(&pool->mutex);
+        if (job)
+            return job;
+    }
+
+    for (i = 1; i < nqueues && virAtomicIntGet(&pool->queuedJobs) > 0; i++) {
+        size_t idx = (self + i) % nqueues;
+
+        if ((job = virThreadPoolJobQueueTake(pool, &pool->queues[idx])))
+            return job;
+    }
+
+    return NULL;
+}
+
+
+static void virThreadPoolQueueWorker(struct virThreadPoolWorkerData *data)
+{
+    virThreadPoolPtr pool = data->pool;
+    size_t self = data->queue;
+    virThreadPoolJobPtr job = NULL;
+    int seq;
+
+    VIR_FREE(data);
+
+    while (1) {
+        seq = virAtomicIntGet(&pool->jobSeq);
+
+        if ((job = virThreadPoolQueueWorkerNextJob(pool, self))) {
+            (pool->jobFunc)(job->data, pool->jobOpaque);
+            VIR_FREE(job);
+            continue;
+        }
+
+        virMutexLock(&pool->mutex);
+        if (pool->quit)
+            break;
+
+        /* Senders bump jobSeq after queueing a job and then look for
+         * idle workers, so either we see a new value here and look
+         * again, or the sender sees us idle and signals the condition
+         * once we wait on it. */
+        virAtomicIntInc(&pool->idleQueueWorkers);
+        if (virAtomicIntGet(&pool->jobSeq) == seq &&
+            virCondWait(&pool->cond, &pool->mutex) < 0) {
+            virAtomicIntAdd(&pool->idleQueueWorkers, -1);
+            break;
+        }
+        virAtomicIntAdd(&pool->idleQueueWorkers, -1);
+        virMutexUnlock(&pool->mutex);
+    }
+
+    pool->nWorkers--;
+    if (pool->nWorkers == 0 && pool->nPrioWorkers == 0)
+        virCondSignal(&pool->quit_cond);
+    virMutexUnlock(&pool->mutex);
+}
+
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
@@ -90,6 +280,11 @@ static void virThreadPoolWorker(void *opaque)
     bool priority = data->priority;
     virThreadPoolJobPtr job = NULL;
 
+    if (pool->queues && !priority) {
+        virThreadPoolQueueWorker(data);
+        return;
+    }
+
     VIR_FREE(data);
 
     virMutexLock(&pool->mutex);
@@ -118,27 +313,10 @@ static void virThreadPoolWorker(void *opaque)
             job = pool->jobList.head;
         }
 
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority) {
-                    break;
-                }
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
-
+        virThreadPoolJobListRemove(&pool->jobList, job);
         pool->jobQueueDepth--;
+        if (pool->queues)
+            virAtomicIntAdd(&pool->sharedJobs, -1);
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
@@ -156,16 +334,82 @@ out:
     virMutexUnlock(&pool->mutex);
 }
 
+/* Call with the pool mutex held */
+static int
+virThreadPoolAddWorker(virThreadPoolPtr pool)
+{
+    struct virThreadPoolWorkerData *data = NULL;
+
+    if (VIR_EXPAND_N(pool->workers, pool->nWorkers, 1) < 0)
+        return -1;
+
+    if (VIR_ALLOC(data) < 0)
+        goto error;
+
+    data->pool = pool;
+    data->cond = &pool->cond;
+    data->queue = pool->nWorkers - 1;
+
+    if (virThreadCreate(&pool->workers[pool->nWorkers - 1],
+                        true,
+                        virThreadPoolWorker,
+                        data) < 0) {
+        VIR_FREE(data);
+        goto error;
+    }
+
+    if (pool->queues)
+        virAtomicIntSet(&pool->nQueueWorkers, pool->nWorkers);
+    return 0;
+
+error:
+    pool->nWorkers--;
+    return -1;
+}
+
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
                                   virThreadPoolJobFunc func,
                                   void *opaque)
+{
+    return virThreadPoolNewFull(minWorkers, maxWorkers, prioWorkers,
+                                func, opaque, 0);
+}
+
+
+/**
+ * virThreadPoolNewFull:
+ * @minWorkers: number of workers started right away
+ * @maxWorkers: maximum number of workers
+ * @prioWorkers: number of workers only handling priority jobs
+ * @func: function run for each job
+ * @opaque: data passed to @func
+ * @flags: bitwise-OR of virThreadPoolFlags
+ *
+ * With VIR_THREAD_POOL_MULTI_QUEUE, each worker gets its own job
+ * queue instead of sharing a single one, removing contention on the
+ * pool lock. Jobs sent with the same key always go to the same
+ * queue and are started in the order they were sent. Idle workers
+ * steal jobs from the other queues, so jobs with the same key can
+ * still run concurrently.
+ *
+ * Returns the new pool or NULL on error
+ */
+virThreadPoolPtr virThreadPoolNewFull(size_t minWorkers,
+                                      size_t maxWorkers,
+                                      size_t prioWorkers,
+                                      virThreadPoolJobFunc func,
+                                      void *opaque,
+                                      unsigned int flags)
 {
     virThreadPoolPtr pool;
     size_t i;
     struct virThreadPoolWorkerData *data = NULL;
 
+    virCheckFlags(VIR_THREAD_POOL_MULTI_QUEUE, NULL);
+
     if (minWorkers > maxWorkers)
         minWorkers = maxWorkers;
 
@@ -184,26 +428,30 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
 
-    if (VIR_ALLOC_N(pool->workers, minWorkers) < 0)
-        goto error;
-
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
 
-    for (i = 0; i < minWorkers; i++) {
-        if (VIR_ALLOC(data) < 0)
+    if ((flags & VIR_THREAD_POOL_MULTI_QUEUE) && maxWorkers) {
+        if (VIR_ALLOC_N(pool->queues, maxWorkers) < 0)
             goto error;
-        data->pool = pool;
-        data->cond = &pool->cond;
+        for (i = 0; i < maxWorkers; i++) {
+            if (virMutexInit(&pool->queues[i].lock) < 0) {
+                while (i-- > 0)
+                    virMutexDestroy(&pool->queues[i].lock);
+                VIR_FREE(pool->queues);
+                goto error;
+            }
+        }
+    }
 
-        if (virThreadCreate(&pool->workers[i],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
+    virMutexLock(&pool->mutex);
+    for (i = 0; i < minWorkers; i++) {
+        if (virThreadPoolAddWorker(pool) < 0) {
+            virMutexUnlock(&pool->mutex);
             goto error;
         }
-        pool->nWorkers++;
     }
+    virMutexUnlock(&pool->mutex);
 
     if (prioWorkers) {
         if (virCondInit(&pool->prioCond) < 0)
@@ -239,14 +487,14 @@ error:
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
-    virThreadPoolJobPtr job;
     bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
 
     virMutexLock(&pool->mutex);
-    pool->quit = true;
+    virAtomicIntSet(&pool->quit, 1);
     if (pool->nWorkers > 0)
         virCondBroadcast(&pool->cond);
     if (pool->nPrioWorkers > 0) {
@@ -257,9 +505,14 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
+    virThreadPoolJobListClear(&pool->jobList);
+
+    if (pool->queues) {
+        for (i = 0; i < pool->maxWorkers; i++) {
+            virThreadPoolJobListClear(&pool->queues[i].jobList);
+            virMutexDestroy(&pool->queues[i].lock);
+        }
+        VIR_FREE(pool->queues);
     }
 
     VIR_FREE(pool->workers);
@@ -290,6 +543,102 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
     return pool->nPrioWorkers;
 }
 
+size_t virThreadPoolGetCurrentWorkers(virThreadPoolPtr pool)
+{
+    size_t ret;
+
+    virMutexLock(&pool->mutex);
+    ret = pool->nWorkers;
+    virMutexUnlock(&pool->mutex);
+
+    return ret;
+}
+
+/*
+ * Return the number of jobs waiting for a worker, whether
+ * in the shared job list or in the per-worker queues
+ */
+size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
+{
+    size_t ret;
+    int queued;
+
+    virMutexLock(&pool->mutex);
+    ret = pool->jobQueueDepth;
+    virMutexUnlock(&pool->mutex);
+
+    /* The counter is only updated after a job is queued, so it can
+     * briefly go negative when a worker is quick to take the job */
+    if ((queued = virAtomicIntGet(&pool->queuedJobs)) > 0)
+        ret += queued;
+
+    return ret;
+}
+
+/*
+ * Queue a non-priority job of a multi-queue pool. Only the
+ * queue lock is taken, unless a worker has to be started or
+ * woken up.
+ */
+static int
+virThreadPoolSendQueueJob(virThreadPoolPtr pool,
+                          const void *key,
+                          void *jobData)
+{
+    virThreadPoolJobPtr job;
+    virThreadPoolJobQueuePtr queue;
+    unsigned int nqueues;
+    unsigned int idx;
+
+    if (virAtomicIntGet(&pool->quit))
+        return -1;
+
+    if (virAtomicIntGet(&pool->idleQueueWorkers) == 0 &&
+        virAtomicIntGet(&pool->nQueueWorkers) < pool->maxWorkers) {
+        virMutexLock(&pool->mutex);
+        if (!pool->quit &&
+            pool->nWorkers < pool->maxWorkers &&
+            virThreadPoolAddWorker(pool) < 0) {
+            virMutexUnlock(&pool->mutex);
+            return -1;
+        }
+        virMutexUnlock(&pool->mutex);
+    }
+
+    /* A key is mapped over all the queues rather than those with a
+     * worker, so that it stays on the same queue as workers are
+     * added */
+    if (key) {
+        idx = virHashCodeGen(&key, sizeof(key), 0) % pool->maxWorkers;
+    } else {
+        if ((nqueues = virAtomicIntGet(&pool->nQueueWorkers)) == 0)
+            nqueues = 1;
+        idx = (unsigned int) virAtomicIntInc(&pool->nextQueue) % nqueues;
+    }
+    queue = &pool->queues[idx];
+
+    if (VIR_ALLOC(job) < 0)
+        return -1;
+
+    job->data = jobData;
+
+    virMutexLock(&queue->lock);
+    virThreadPoolJobListAppend(&queue->jobList, job);
+    virAtomicIntInc(&queue->waiting);
+    virMutexUnlock(&queue->lock);
+    virAtomicIntInc(&pool->queuedJobs);
+    virAtomicIntInc(&pool->jobSeq);
+
+    if (virAtomicIntGet(&pool->idleQueueWorkers) > 0) {
+        virMutexLock(&pool->mutex);
+        virCondSignal(&pool->cond);
+        virMutexUnlock(&pool->mutex);
+    }
+
+    return 0;
+}
+
+
 /*
  * @priority - job priority
  * Return: 0 on success, -1 otherwise
@@ -297,36 +646,38 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
 int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
+{
+    return virThreadPoolSendJobFull(pool, priority, NULL, jobData);
+}
+
+
+/*
+ * @priority - job priority
+ * @key - in multi-queue mode, jobs with the same non-NULL key
+ *        are sent to the same worker queue, and started in
+ *        order
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *key,
+                             void *jobData)
 {
     virThreadPoolJobPtr job;
-    struct virThreadPoolWorkerData *data = NULL;
+
+    if (pool->queues && !priority)
+        return virThreadPoolSendQueueJob(pool, key, jobData);
 
     virMutexLock(&pool->mutex);
     if (pool->quit)
         goto error;
 
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
-        pool->nWorkers < pool->maxWorkers) {
-        if (VIR_EXPAND_N(pool->workers, pool->nWorkers, 1) < 0)
-            goto error;
-
-        if (VIR_ALLOC(data) < 0) {
-            pool->nWorkers--;
-            goto error;
-        }
-
-        data->pool = pool;
-        data->cond = &pool->cond;
-
-        if (virThreadCreate(&pool->workers[pool->nWorkers - 1],
-                            true,
-                            virThreadPoolWorker,
-                            data) < 0) {
-            VIR_FREE(data);
-            pool->nWorkers--;
-            goto error;
-        }
-    }
+    if ((pool->queues ?
+         virAtomicIntGet(&pool->idleQueueWorkers) == 0 :
+         pool->freeWorkers - pool->jobQueueDepth <= 0) &&
+        pool->nWorkers < pool->maxWorkers &&
+        virThreadPoolAddWorker(pool) < 0)
+        goto error;
 
     if (VIR_ALLOC(job) < 0)
         goto error;
@@ -334,18 +685,12 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
     job->data = jobData;
     job->priority = priority;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
-
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
-
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
-
+    virThreadPoolJobListAppend(&pool->jobList, job);
     pool->jobQueueDepth++;
+    if (pool->queues) {
+        virAtomicIntInc(&pool->sharedJobs);
+        virAtomicIntInc(&pool->jobSeq);
+    }
 
     virCondSignal(&pool->cond);
     if (priority)
@@ -33,15 +33,28 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+typedef enum {
+    VIR_THREAD_POOL_MULTI_QUEUE = (1 << 0), /* one job queue per worker */
+} virThreadPoolFlags;
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
                                   virThreadPoolJobFunc func,
                                   void *opaque) ATTRIBUTE_NONNULL(4);
 
+virThreadPoolPtr virThreadPoolNewFull(size_t minWorkers,
+                                      size_t maxWorkers,
+                                      size_t prioWorkers,
+                                      virThreadPoolJobFunc func,
+                                      void *opaque,
+                                      unsigned int flags) ATTRIBUTE_NONNULL(4);
+
 size_t virThreadPoolGetMinWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetMaxWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool);
+size_t virThreadPoolGetCurrentWorkers(virThreadPoolPtr pool);
+size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool);
 
 void virThreadPoolFree(virThreadPoolPtr pool);
 
@@ -50,4 +63,10 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendJobFull(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             const void *key,
+                             void *jobdata) ATTRIBUTE_NONNULL(1)
+                                            ATTRIBUTE_RETURN_CHECK;
+
 #endif
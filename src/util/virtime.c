@@ -78,6 +78,39 @@ int virTimeMillisNowRaw(unsigned long long *now)
 }
 
 
+/**
+ * virTimeMicrosMonotonicRaw:
+ * @now: filled with current time in microseconds
+ *
+ * Retrieves the current time of a clock which is not affected by
+ * changes to the system time, in microseconds since an unspecified
+ * point in the past. It is only meant for measuring intervals.
+ * Where no such clock exists, the system time is used.
+ *
+ * Returns 0 on success, -1 on error with errno set
+ */
+int virTimeMicrosMonotonicRaw(unsigned long long *now)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return -1;
+
+    *now = (ts.tv_sec * 1000ull * 1000ull) + (ts.tv_nsec / 1000ull);
+#else
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0)
+        return -1;
+
+    *now = (tv.tv_sec * 1000ull * 1000ull) + tv.tv_usec;
+#endif
+
+    return 0;
+}
+
+
 /**
  * virTimeFieldsNowRaw:
  * @fields: filled with current time fields
@@ -137,6 +137,7 @@ vmwareLoadDomains(struct vmware_driver *driver)
     vmwareDomainPtr pDomain;
     char *directoryName = NULL;
     char *fileName = NULL;
+    int pid;
     int ret = -1;
     virVMXContext ctx;
     char *outbuf = NULL;
@@ -179,7 +180,8 @@ vmwareLoadDomains(struct vmware_driver *driver)
 
         vmwareDomainConfigDisplay(pDomain, vmdef);
 
-        if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0)
+        if ((pid = vmwareExtractPid(vmxPath)) < 0 ||
+            virDomainObjListSetID(driver->domains, vm, pid) < 0)
             goto cleanup;
         /* vmrun list only reports running vms */
         virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 
 #include "testutils.h"
@@ -38,6 +39,7 @@
 #include "virerror.h"
 #include "virthread.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -898,6 +900,167 @@ cleanup:
     return ret;
 }
 
+/*
+ * Raise the descriptor limit from @orig as far as allowed, and leave
+ * a descriptor open just below it. Returns that descriptor.
+ */
+static int
+testRaiseFDLimit(const struct rlimit *orig)
+{
+    struct rlimit rlim;
+
+    rlim = *orig;
+    rlim.rlim_cur = MIN(rlim.rlim_max, 1024 * 1024);
+    if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        rlim = *orig;
+
+    /* An unlimited soft limit gives no descriptor number to use */
+    if (rlim.rlim_cur == RLIM_INFINITY || rlim.rlim_cur > 1024 * 1024)
+        rlim.rlim_cur = 1024 * 1024;
+
+    return dup2(STDERR_FILENO, rlim.rlim_cur - 1);
+}
+
+static int testHook(void *data ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+/*
+ * How long running true @count times takes, in milliseconds. A pre
+ * exec hook makes the command fork and close the descriptors with
+ * virCommandMassClose, instead of being started with posix_spawn.
+ */
+static int
+testRunTime(size_t count, bool hook, unsigned long long *ms)
+{
+    virCommandPtr cmd;
+    unsigned long long start;
+    unsigned long long end;
+    size_t i;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        cmd = virCommandNewArgList("true", NULL);
+        if (hook)
+            virCommandSetPreExecHook(cmd, testHook, NULL);
+        if (virCommandRun(cmd, NULL) < 0) {
+            virCommandFree(cmd);
+            return -1;
+        }
+        virCommandFree(cmd);
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+
+    *ms = end - start;
+    return 0;
+}
+
+/*
+ * Run program, no args, inherit all ENV, keep CWD, with the
+ * descriptor limit raised as far as allowed and a descriptor left
+ * open just below it.
+ * Only stdin/out/err open
+ */
+static int test22(const void *unused ATTRIBUTE_UNUSED)
+{
+    virCommandPtr cmd = NULL;
+    struct rlimit orig;
+    unsigned long long spawnTime;
+    unsigned long long forkTime;
+    int highfd = -1;
+    int ret = -1;
+
+    if (getrlimit(RLIMIT_NOFILE, &orig) < 0)
+        return -1;
+
+    if ((highfd = testRaiseFDLimit(&orig)) < 0)
+        goto cleanup;
+
+    cmd = virCommandNew(abs_builddir "/commandhelper");
+    if (virCommandRun(cmd, NULL) < 0) {
+        virErrorPtr err = virGetLastError();
+        printf("Cannot run child %s\n", err->message);
+        goto cleanup;
+    }
+
+    if (checkoutput("test22") < 0)
+        goto cleanup;
+
+    /* Compare the cost of both ways of starting a command with that
+     * many possible descriptors */
+    if (virTestGetDebug()) {
+        if (testRunTime(100, false, &spawnTime) < 0 ||
+            testRunTime(100, true, &forkTime) < 0)
+            goto cleanup;
+
+        fprintf(stderr,
+                "\n100 commands run with a limit of %d fds: "
+                "%llu ms spawned, %llu ms forked\n",
+                highfd + 1, spawnTime, forkTime);
+    }
+
+    ret = 0;
+
+cleanup:
+    virCommandFree(cmd);
+    VIR_FORCE_CLOSE(highfd);
+    ignore_value(setrlimit(RLIMIT_NOFILE, &orig));
+    return ret;
+}
+
+/*
+ * Run program, no args, inherit all ENV, keep CWD, with the
+ * descriptor limit raised as far as allowed and a descriptor left
+ * open just below it. A pre exec hook and a passed FD make the
+ * command fork instead of being spawned.
+ * stdin/out/err + one passed FD open
+ */
+static int test23(const void *unused ATTRIBUTE_UNUSED)
+{
+    virCommandPtr cmd = NULL;
+    struct rlimit orig;
+    int highfd = -1;
+    int passfd = -1;
+    int ret = -1;
+
+    if (getrlimit(RLIMIT_NOFILE, &orig) < 0)
+        return -1;
+
+    if ((highfd = testRaiseFDLimit(&orig)) < 0)
+        goto cleanup;
+
+    /* Kept open between the descriptors to close */
+    if ((passfd = dup2(STDERR_FILENO, 100)) < 0)
+        goto cleanup;
+
+    cmd = virCommandNew(abs_builddir "/commandhelper");
+    virCommandSetPreExecHook(cmd, testHook, NULL);
+    virCommandPassFD(cmd, passfd, 0);
+
+    if (virCommandRun(cmd, NULL) < 0) {
+        virErrorPtr err = virGetLastError();
+        printf("Cannot run child %s\n", err->message);
+        goto cleanup;
+    }
+
+    if (checkoutput("test23") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virCommandFree(cmd);
+    VIR_FORCE_CLOSE(passfd);
+    VIR_FORCE_CLOSE(highfd);
+    ignore_value(setrlimit(RLIMIT_NOFILE, &orig));
+    return ret;
+}
+
 static void virCommandThreadWorker(void *opaque)
 {
     virCommandTestDataPtr test = opaque;
@@ -1045,6 +1208,8 @@ mymain(void)
     DO_TEST(test19);
     DO_TEST(test20);
     DO_TEST(test21);
+    DO_TEST(test22);
+    DO_TEST(test23);
 
     virMutexLock(&test->lock);
     if (test->running) {
@@ -34,6 +34,23 @@
 #include "virutil.h"
 #include "vireventpoll.h"
 
+/* When built as eventepolltest, exercise the epoll based
+ * implementation with exactly the same tests */
+#ifdef EVENT_TEST_EPOLL
+# if HAVE_SYS_EPOLL_H
+#  include "vireventepoll.h"
+#  define virEventPollInit virEventEpollInit
+#  define virEventPollRunOnce virEventEpollRunOnce
+#  define virEventPollAddHandle virEventEpollAddHandle
+#  define virEventPollRemoveHandle virEventEpollRemoveHandle
+#  define virEventPollAddTimeout virEventEpollAddTimeout
+#  define virEventPollUpdateTimeout virEventEpollUpdateTimeout
+#  define virEventPollRemoveTimeout virEventEpollRemoveTimeout
+# else
+#  define EVENT_TEST_SKIP
+# endif
+#endif
+
 #define NUM_FDS 31
 #define NUM_TIME 31
 
@@ -265,6 +282,10 @@ mymain(void)
     pthread_t eventThread;
     char one = '1';
 
+#ifdef EVENT_TEST_SKIP
+    return EXIT_AM_SKIP;
+#endif
+
     for (i = 0; i < NUM_FDS; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
             fprintf(stderr, "Cannot create pipe: %d", errno);
@@ -312,6 +312,171 @@ static int testFDStreamWriteNonblock(const void *data)
     return testFDStreamWriteCommon(data, false);
 }
 
+/*
+ * Copy a file with two data extents and a trailing hole from one
+ * sparse stream to another, forwarding holes as they are reported,
+ * and check that the copy has the same content and size.
+ */
+#define SPARSE_LEN (2 * 1024 * 1024)
+
+static int testFDStreamSparseCommon(const char *scratchdir, bool blocking)
+{
+    int fd = -1;
+    char *infile = NULL;
+    char *outfile = NULL;
+    int ret = -1;
+    char *pattern = NULL;
+    char *buf = NULL;
+    char *expect = NULL;
+    virStreamPtr in = NULL;
+    virStreamPtr out = NULL;
+    size_t i;
+    virConnectPtr conn = NULL;
+    int flags = 0;
+
+    if (!blocking)
+        flags |= VIR_STREAM_NONBLOCK;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(pattern, PATTERN_LEN) < 0 ||
+        VIR_ALLOC_N(buf, SPARSE_LEN) < 0 ||
+        VIR_ALLOC_N(expect, SPARSE_LEN) < 0)
+        goto cleanup;
+
+    for (i = 0; i < PATTERN_LEN; i++)
+        pattern[i] = i;
+
+    memcpy(expect, pattern, PATTERN_LEN);
+    memcpy(expect + SPARSE_LEN / 2, pattern, PATTERN_LEN);
+
+    if (virAsprintf(&infile, "%s/input.sparse", scratchdir) < 0 ||
+        virAsprintf(&outfile, "%s/output.sparse", scratchdir) < 0)
+        goto cleanup;
+
+    if ((fd = open(infile, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0)
+        goto cleanup;
+
+    if (safewrite(fd, pattern, PATTERN_LEN) != PATTERN_LEN ||
+        lseek(fd, SPARSE_LEN / 2, SEEK_SET) < 0 ||
+        safewrite(fd, pattern, PATTERN_LEN) != PATTERN_LEN ||
+        ftruncate(fd, SPARSE_LEN) < 0)
+        goto cleanup;
+
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if ((fd = open(outfile, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (!(in = virStreamNew(conn, flags)) ||
+        !(out = virStreamNew(conn, flags)))
+        goto cleanup;
+
+    if (virFDStreamOpenFileSparse(in, infile, 0, 0, O_RDONLY) < 0 ||
+        virFDStreamOpenFileSparse(out, outfile, 0, 0, O_WRONLY) < 0)
+        goto cleanup;
+
+    for (;;) {
+        long long hole;
+        size_t offset = 0;
+        int got;
+
+        got = in->driver->streamRecvFlags(in, buf, SPARSE_LEN,
+                                          VIR_STREAM_RECV_STOP_AT_HOLE);
+        if (got == -2 && !blocking) {
+            usleep(20 * 1000);
+            continue;
+        }
+        if (got == -3) {
+            if (in->driver->streamRecvHole(in, &hole, 0) < 0 ||
+                out->driver->streamSendHole(out, hole, 0) < 0) {
+                virFilePrintf(stderr, "Failed to transfer hole: %s\n",
+                              virGetLastErrorMessage());
+                goto cleanup;
+            }
+            continue;
+        }
+        if (got < 0) {
+            virFilePrintf(stderr, "Failed to read stream: %s\n",
+                          virGetLastErrorMessage());
+            goto cleanup;
+        }
+        if (got == 0)
+            break;
+
+        while (offset < (size_t) got) {
+            int sent = out->driver->streamSend(out, buf + offset, got - offset);
+            if (sent == -2 && !blocking) {
+                usleep(20 * 1000);
+                continue;
+            }
+            if (sent < 0) {
+                virFilePrintf(stderr, "Failed to write stream: %s\n",
+                              virGetLastErrorMessage());
+                goto cleanup;
+            }
+            offset += sent;
+        }
+    }
+
+    if (in->driver->streamFinish(in) != 0 ||
+        out->driver->streamFinish(out) != 0) {
+        virFilePrintf(stderr, "Failed to finish stream: %s\n",
+                      virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if ((fd = open(outfile, O_RDONLY)) < 0)
+        goto cleanup;
+
+    if (saferead(fd, buf, SPARSE_LEN) != SPARSE_LEN ||
+        saferead(fd, pattern, 1) != 0) {
+        virFilePrintf(stderr, "Copy has wrong size\n");
+        goto cleanup;
+    }
+
+    if (memcmp(buf, expect, SPARSE_LEN) != 0) {
+        virFilePrintf(stderr, "Mismatched sparse copy\n");
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    if (in)
+        virStreamFree(in);
+    if (out)
+        virStreamFree(out);
+    VIR_FORCE_CLOSE(fd);
+    if (infile != NULL)
+        unlink(infile);
+    if (outfile != NULL)
+        unlink(outfile);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(infile);
+    VIR_FREE(outfile);
+    VIR_FREE(pattern);
+    VIR_FREE(buf);
+    VIR_FREE(expect);
+    return ret;
+}
+
+
+static int testFDStreamSparseBlock(const void *data)
+{
+    return testFDStreamSparseCommon(data, true);
+}
+static int testFDStreamSparseNonblock(const void *data)
+{
+    return testFDStreamSparseCommon(data, false);
+}
+
 #define SCRATCHDIRTEMPLATE abs_builddir "/fakesysfsdir-XXXXXX"
 
 static int
@@ -336,6 +501,10 @@ mymain(void)
         ret = -1;
     if (virtTestRun("Stream write non-blocking ", testFDStreamWriteNonblock, scratchdir) < 0)
         ret = -1;
+    if (virtTestRun("Stream sparse blocking ", testFDStreamSparseBlock, scratchdir) < 0)
+        ret = -1;
+    if (virtTestRun("Stream sparse non-blocking ", testFDStreamSparseNonblock, scratchdir) < 0)
+        ret = -1;
 
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(scratchdir);
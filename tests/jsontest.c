@@ -7,6 +7,7 @@
 
 #include "internal.h"
 #include "virjson.h"
+#include "virbuffer.h"
 #include "testutils.h"
 
 struct testInfo {
@@ -130,6 +131,89 @@ cleanup:
 }
 
 
+struct testStreamInfo {
+    const char *doc;
+    const char *expect;
+    bool pass;
+    /* bytes that arrive with each read, 0 for all at once */
+    size_t chunk;
+};
+
+
+/* Feed the concatenated values of info->doc to a stream parser
+ * info->chunk bytes at a time, the way the QEMU monitor receives
+ * them */
+static int
+testJSONStream(const void *data)
+{
+    const struct testStreamInfo *info = data;
+    virJSONStreamParserPtr parser;
+    virJSONValuePtr json = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *result = NULL;
+    size_t doclen = strlen(info->doc);
+    size_t offset = 0;
+    size_t avail = 0;
+    ssize_t used;
+    int ret = -1;
+
+    if (!(parser = virJSONStreamParserNew(VIR_JSON_PARSE_ARENA)))
+        return -1;
+
+    while (offset < doclen) {
+        if (info->chunk)
+            avail = MIN(avail + info->chunk, doclen - offset);
+        else
+            avail = doclen - offset;
+
+        if ((used = virJSONStreamParserFeed(parser, info->doc + offset,
+                                            avail, &json)) < 0) {
+            if (!info->pass)
+                ret = 0;
+            else if (virTestGetVerbose())
+                fprintf(stderr, "Fail to parse %s\n", info->doc);
+            goto cleanup;
+        }
+
+        offset += used;
+        avail -= used;
+
+        if (json) {
+            if (!(result = virJSONValueToString(json, false)))
+                goto cleanup;
+            virBufferAsprintf(&buf, "%s\n", result);
+            VIR_FREE(result);
+            virJSONValueFree(json);
+            json = NULL;
+        }
+    }
+
+    if (!info->pass) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "Should not have parsed %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (virBufferError(&buf))
+        goto cleanup;
+    result = virBufferContentAndReset(&buf);
+
+    if (STRNEQ(info->expect, result)) {
+        if (virTestGetVerbose())
+            virtTestDifference(stderr, info->expect, result);
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    virJSONStreamParserFree(parser);
+    virJSONValueFree(json);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(result);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -214,6 +298,54 @@ mymain(void)
                        "[ {[\"key1\", \"key2\"]: \"value\"} ]");
     DO_TEST_PARSE_FAIL("object with unterminated key", "{ \"key:7 }");
 
+#define DO_TEST_STREAM(name, doc, expect, pass, chunk)              \
+    do {                                                            \
+        struct testStreamInfo info = { doc, expect, pass, chunk };  \
+        if (virtTestRun(name, testJSONStream, &info) < 0)           \
+            ret = -1;                                               \
+    } while (0)
+
+#define STREAM_GREETING                                             \
+    "{\"QMP\": {\"version\": {\"qemu\": {\"major\": 1}}}}\r\n"      \
+    "{\"return\": {}, \"id\": \"libvirt-1\"}\r\n"                   \
+    "{\"timestamp\": {\"seconds\": 1}, \"event\": \"STOP\"}\r\n"
+#define STREAM_GREETING_EXPECT                                      \
+    "{\"QMP\":{\"version\":{\"qemu\":{\"major\":1}}}}\n"            \
+    "{\"return\":{},\"id\":\"libvirt-1\"}\n"                        \
+    "{\"timestamp\":{\"seconds\":1},\"event\":\"STOP\"}\n"
+
+    DO_TEST_STREAM("stream", STREAM_GREETING, STREAM_GREETING_EXPECT,
+                   true, 7);
+    DO_TEST_STREAM("stream byte by byte", STREAM_GREETING,
+                   STREAM_GREETING_EXPECT, true, 1);
+    DO_TEST_STREAM("stream in one read", STREAM_GREETING,
+                   STREAM_GREETING_EXPECT, true, 0);
+    DO_TEST_STREAM("stream of replies and events",
+                   "{\"return\": 1, \"id\": \"libvirt-2\"}\r\n"
+                   "{\"event\": \"RESUME\", \"data\": {\"x\": [1, 2]}}\r\n"
+                   "{\"event\": \"STOP\"}\r\n"
+                   "{\"error\": {\"class\": \"GenericError\"}, "
+                   "\"id\": \"libvirt-3\"}\r\n"
+                   "{\"event\": \"RESET\"}\r\n",
+                   "{\"return\":1,\"id\":\"libvirt-2\"}\n"
+                   "{\"event\":\"RESUME\",\"data\":{\"x\":[1,2]}}\n"
+                   "{\"event\":\"STOP\"}\n"
+                   "{\"error\":{\"class\":\"GenericError\"},"
+                   "\"id\":\"libvirt-3\"}\n"
+                   "{\"event\":\"RESET\"}\n",
+                   true, 13);
+    DO_TEST_STREAM("stream with a reply split across reads",
+                   "{\"return\": [{\"name\": \"quit\"}, {\"name\": \"eject\"}, "
+                   "{\"name\": \"change\"}, {\"name\": \"a \\\"quoted\\\" }\"}], "
+                   "\"id\": \"libvirt-4\"}\r\n",
+                   "{\"return\":[{\"name\":\"quit\"},{\"name\":\"eject\"},"
+                   "{\"name\":\"change\"},{\"name\":\"a \\\"quoted\\\" }\"}],"
+                   "\"id\":\"libvirt-4\"}\n",
+                   true, 32);
+    DO_TEST_STREAM("stream with garbage",
+                   "{\"return\": {}}\r\n{\"return\": 2345b45}\r\n",
+                   NULL, false, 7);
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virstring.h"
+#include "nwfilter/nwfilter_ebiptables_driverpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Rules as the driver instantiates them in the temporary chains */
+#define EXEC "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n"
+#define EBT_RULE(chain, match) \
+    "cmd='$EBT -t nat -%c " chain " %s " match "'\n" EXEC
+#define IPT_RULE(chain, match) \
+    "cmd='$IPT -%c " chain " %s " match "'\n" EXEC
+
+#define E1 { RT_EBTABLES, EBT_RULE("libvirt-J-vnet0", "-p IPv4 -j ACCEPT") }
+#define E2 { RT_EBTABLES, EBT_RULE("libvirt-J-vnet0", "-p ARP -j ACCEPT") }
+#define E3 { RT_EBTABLES, EBT_RULE("libvirt-J-vnet0", "-j DROP") }
+#define E4 { RT_EBTABLES, EBT_RULE("libvirt-P-vnet0", "-p IPv4 -j ACCEPT") }
+#define E5 { RT_EBTABLES, EBT_RULE("libvirt-J-vnet0", "-p RARP -j ACCEPT") }
+#define I1 { RT_IPTABLES, IPT_RULE("FJ-vnet0", "-p tcp --dport 22 -j RETURN") }
+#define I2 { RT_IPTABLES, IPT_RULE("FJ-vnet0", "-p tcp --dport 80 -j RETURN") }
+#define I3 { RT_IPTABLES, IPT_RULE("FJ-vnet0", "-j DROP") }
+#define Q1 { RT_IP6TABLES, IPT_RULE("FJ-vnet0", "-p tcp --dport 22 -j RETURN") }
+#define END { RT_EBTABLES, NULL }
+
+struct testRule {
+    enum RuleType ruleType;
+    const char *templ;
+};
+
+struct testDiffData {
+    const struct testRule *from;
+    const struct testRule *to;
+    bool batch;             /* iptables-restore is available */
+    const char *expect;     /* the commands of the diff, NULL to rebuild */
+};
+
+
+static ebiptablesRuleSetPtr
+testRuleSetNew(const struct testRule *rules)
+{
+    ebiptablesRuleSetPtr set = NULL;
+    ebiptablesRuleInstPtr inst = NULL;
+    ebiptablesRuleInstPtr *ptrs = NULL;
+    size_t n, i;
+
+    for (n = 0; rules[n].templ; n++)
+        ;
+
+    if (VIR_ALLOC_N(inst, n) < 0 ||
+        VIR_ALLOC_N(ptrs, n) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        inst[i].commandTemplate = (char *) rules[i].templ;
+        inst[i].ruleType = rules[i].ruleType;
+        ptrs[i] = &inst[i];
+    }
+
+    set = ebiptablesRuleSetNew(ptrs, n, NULL, 0, true, true);
+
+cleanup:
+    VIR_FREE(ptrs);
+    VIR_FREE(inst);
+    return set;
+}
+
+
+/* Add the commands of @script to @buf, one per line */
+static void
+testScriptCommands(virBufferPtr buf, const char *script)
+{
+    const char *line = script;
+    const char *next;
+
+    while (line && *line) {
+        next = strchr(line, '\n');
+        if (STRPREFIX(line, "cmd='"))
+            virBufferAdd(buf, line, next ? next - line + 1 : -1);
+        line = next ? next + 1 : NULL;
+    }
+}
+
+
+static int
+testRuleSetDiff(const void *opaque)
+{
+    const struct testDiffData *data = opaque;
+    static const enum RuleType ruleTypes[] = {
+        RT_EBTABLES, RT_IPTABLES, RT_IP6TABLES,
+    };
+    ebiptablesRuleSetPtr from = NULL;
+    ebiptablesRuleSetPtr to = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer cmds = VIR_BUFFER_INITIALIZER;
+    char *script = NULL;
+    const char *actual;
+    int applied;
+    size_t i;
+    int ret = -1;
+
+    if (ebiptablesDriverSetTools("/sbin/ebtables",
+                                 "/sbin/iptables",
+                                 data->batch ? "/sbin/iptables-restore" : NULL,
+                                 "/sbin/ip6tables",
+                                 data->batch ? "/sbin/ip6tables-restore" : NULL) < 0)
+        goto cleanup;
+
+    if (!(from = testRuleSetNew(data->from)) ||
+        !(to = testRuleSetNew(data->to)))
+        goto cleanup;
+
+    /* The rules are left to be rebuilt before anything is executed, and
+     * a diff without changes executes nothing either */
+    if (!data->expect || !*data->expect) {
+        applied = ebiptablesApplyRuleSetDiff("vnet0", from, to);
+        if (applied != (data->expect ? 1 : 0)) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "applying the diff returned %d\n", applied);
+            goto cleanup;
+        }
+        if (!data->expect) {
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(ruleTypes); i++) {
+        if (ebiptablesRuleSetDiff(&buf, from, to, ruleTypes[i]) < 0) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "no diff for rules of type %d\n",
+                        ruleTypes[i]);
+            goto cleanup;
+        }
+    }
+
+    if (virBufferError(&buf))
+        goto cleanup;
+    script = virBufferContentAndReset(&buf);
+
+    testScriptCommands(&cmds, script);
+    if (!(actual = virBufferCurrentContent(&cmds)))
+        goto cleanup;
+
+    if (STRNEQ(data->expect, actual)) {
+        virtTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(&cmds);
+    VIR_FREE(script);
+    ebiptablesRuleSetFree(from);
+    ebiptablesRuleSetFree(to);
+    return ret;
+}
+
+
+static const struct testRule rulesAll[] = {
+    E1, E2, E3, E4, I1, I2, I3, Q1, END
+};
+static const struct testRule rulesFewer[] = {
+    E1, E3, E4, I1, I3, Q1, END
+};
+static const struct testRule rulesReplaced[] = {
+    E1, E5, E3, E4, I1, I2, I3, Q1, END
+};
+static const struct testRule rulesReordered[] = {
+    E2, E1, E3, E4, I1, I2, I3, Q1, END
+};
+static const struct testRule rulesDuplicate[] = {
+    E1, E1, E3, E4, I1, I2, I3, Q1, END
+};
+static const struct testRule rulesNoIp6tables[] = {
+    E1, E2, E3, E4, I1, I2, I3, END
+};
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, from, to, batch, expect)                          \
+    do {                                                                \
+        static struct testDiffData data = { from, to, batch, expect };  \
+        if (virtTestRun("ruleset diff " name, testRuleSetDiff,          \
+                        &data) < 0)                                     \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("unchanged", rulesAll, rulesAll, true, "");
+
+    DO_TEST("add", rulesFewer, rulesAll, true,
+            "cmd='$EBT -t nat --atomic-save'\n"
+            "cmd='$EBT -t nat -I libvirt-I-vnet0 2 -p ARP -j ACCEPT'\n"
+            "cmd='$EBT -t nat --atomic-commit'\n"
+            "cmd='/sbin/iptables-restore --noflush'\n"
+            "cmd='$IPT -I FI-vnet0 2 -p tcp --dport 80 -j RETURN'\n");
+
+    DO_TEST("remove", rulesAll, rulesFewer, true,
+            "cmd='$EBT -t nat --atomic-save'\n"
+            "cmd='$EBT -t nat -D libvirt-I-vnet0  -p ARP -j ACCEPT'\n"
+            "cmd='$EBT -t nat --atomic-commit'\n"
+            "cmd='/sbin/iptables-restore --noflush'\n"
+            "cmd='$IPT -D FI-vnet0  -p tcp --dport 80 -j RETURN'\n");
+
+    DO_TEST("replace", rulesAll, rulesReplaced, true,
+            "cmd='$EBT -t nat --atomic-save'\n"
+            "cmd='$EBT -t nat -D libvirt-I-vnet0  -p ARP -j ACCEPT'\n"
+            "cmd='$EBT -t nat -I libvirt-I-vnet0 2 -p RARP -j ACCEPT'\n"
+            "cmd='$EBT -t nat --atomic-commit'\n");
+
+    /* Everything else makes the chains be rebuilt */
+    DO_TEST("reorder", rulesAll, rulesReordered, true, NULL);
+    DO_TEST("duplicate", rulesAll, rulesDuplicate, true, NULL);
+    DO_TEST("new chains", rulesAll, rulesNoIp6tables, true, NULL);
+    DO_TEST("no batch", rulesFewer, rulesAll, false, NULL);
+
+    ebiptablesDriverSetTools(NULL, NULL, NULL, NULL, NULL);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -19,9 +19,15 @@
 
 #include <config.h>
 
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 #include "testutils.h"
 #include "testutilsqemu.h"
 #include "qemumonitortestutils.h"
+#include "virfile.h"
+#include "virstring.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -207,6 +213,163 @@ cleanup:
     return ret;
 }
 
+/* A QEMU that fails to start with QMP and prints the -help of 0.12.1,
+ * recording in a file next to it how often it was probed */
+static const char testQemuCacheBinary[] =
+    "#!/bin/sh\n"
+    "case \" $* \" in\n"
+    "*\" -help \"*) echo probe >> \"$0.probes\"\n"
+    "             exec cat '" abs_srcdir "/qemuhelpdata/qemu-0.12.1' ;;\n"
+    "*\" -daemonize \"*) exit 1 ;;\n"
+    "esac\n"
+    "exit 0\n";
+
+typedef struct _testQemuCacheData testQemuCacheData;
+typedef testQemuCacheData *testQemuCacheDataPtr;
+struct _testQemuCacheData {
+    char *dir;
+    char *binary;
+    virQEMUCapsPtr first;
+};
+
+static int
+testQemuCacheProbes(testQemuCacheDataPtr data)
+{
+    char *path = NULL;
+    char *probes = NULL;
+    char *tmp;
+    int ret = 0;
+
+    if (virAsprintf(&path, "%s.probes", data->binary) < 0)
+        return -1;
+
+    if (virFileExists(path)) {
+        if (virFileReadAll(path, 1024, &probes) < 0) {
+            ret = -1;
+        } else {
+            for (tmp = probes; (tmp = strchr(tmp, '\n')); tmp++)
+                ret++;
+        }
+    }
+
+    VIR_FREE(path);
+    VIR_FREE(probes);
+    return ret;
+}
+
+/*
+ * Get the capabilities of the fake QEMU running as @runUid:@runGid
+ * and check that it was probed @probes times in total since the test
+ * started, so that the cache was used or not
+ */
+static int
+testQemuCacheCheck(testQemuCacheDataPtr data,
+                   uid_t runUid, gid_t runGid,
+                   int probes)
+{
+    virQEMUCapsPtr qemuCaps;
+    int ret = -1;
+    int n;
+
+    qemuCaps = virQEMUCapsNewForBinary(data->binary, data->dir, data->dir,
+                                       runUid, runGid);
+
+    if (!qemuCaps) {
+        /* probing as another user is only possible for root */
+        if (probes > 1 && runUid != (uid_t)-1 && geteuid() != 0)
+            return EXIT_AM_SKIP;
+        return -1;
+    }
+
+    if ((n = testQemuCacheProbes(data)) != probes) {
+        fprintf(stderr, "QEMU was probed %d times, expected %d\n", n, probes);
+        goto cleanup;
+    }
+
+    if (!data->first) {
+        data->first = qemuCaps;
+        qemuCaps = NULL;
+    } else if (testQemuCapsCompare(data->first, qemuCaps) < 0 ||
+               virQEMUCapsGetVersion(data->first) !=
+               virQEMUCapsGetVersion(qemuCaps)) {
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virObjectUnref(qemuCaps);
+    return ret;
+}
+
+static int
+testQemuCacheProbe(const void *opaque)
+{
+    testQemuCacheDataPtr data = (testQemuCacheDataPtr) opaque;
+
+    if (virFileWriteStr(data->binary, testQemuCacheBinary, 0700) < 0) {
+        fprintf(stderr, "cannot write %s\n", data->binary);
+        return -1;
+    }
+
+    return testQemuCacheCheck(data, -1, -1, 1);
+}
+
+static int
+testQemuCacheReload(const void *opaque)
+{
+    return testQemuCacheCheck((testQemuCacheDataPtr) opaque, -1, -1, 1);
+}
+
+static int
+testQemuCacheOtherUser(const void *opaque)
+{
+    /* an explicit uid:gid differs from keeping the daemon's */
+    return testQemuCacheCheck((testQemuCacheDataPtr) opaque,
+                              geteuid(), getegid(), 2);
+}
+
+static int
+testQemuCacheChangedBinary(const void *opaque)
+{
+    testQemuCacheDataPtr data = (testQemuCacheDataPtr) opaque;
+    struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+
+    if (utimes(data->binary, times) < 0) {
+        fprintf(stderr, "cannot change the times of %s\n", data->binary);
+        return -1;
+    }
+
+    return testQemuCacheCheck(data, geteuid(), getegid(), 3);
+}
+
+static int
+testQemuCache(void)
+{
+    testQemuCacheData data = { NULL, NULL, NULL };
+    int ret = 0;
+
+    if (VIR_STRDUP(data.dir, abs_builddir "/qemucapabilitiestest-XXXXXX") < 0 ||
+        !mkdtemp(data.dir) ||
+        virAsprintf(&data.binary, "%s/qemu-system-x86_64", data.dir) < 0) {
+        VIR_FREE(data.dir);
+        return -1;
+    }
+
+    /* the later checks depend on the cache written by the earlier ones */
+    if (virtTestRun("cache probe", testQemuCacheProbe, &data) < 0 ||
+        virtTestRun("cache reload", testQemuCacheReload, &data) < 0 ||
+        virtTestRun("cache other user", testQemuCacheOtherUser, &data) < 0 ||
+        virtTestRun("cache changed binary",
+                    testQemuCacheChangedBinary, &data) < 0)
+        ret = -1;
+
+    virObjectUnref(data.first);
+    ignore_value(virFileDeleteTree(data.dir));
+    VIR_FREE(data.binary);
+    VIR_FREE(data.dir);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -239,6 +402,9 @@ mymain(void)
     DO_TEST("caps_1.6.0-1");
     DO_TEST("caps_1.6.50-1");
 
+    if (testQemuCache() < 0)
+        ret = -1;
+
     virObjectUnref(xmlopt);
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
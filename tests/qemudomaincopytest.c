@@ -0,0 +1,229 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "qemu/qemu_conf.h"
+# include "qemu/qemu_domain.h"
+# include "testutilsqemu.h"
+# include "virfile.h"
+# include "virstring.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+/*
+ * virDomainDefCopy no longer goes through XML for non-migratable
+ * copies, so check the native copy formats exactly like a copy
+ * obtained by formatting and parsing the definition back.
+ */
+static int
+testCompareCopyToRoundTrip(const char *inxml, bool live)
+{
+    char *inXmlData = NULL;
+    char *xml = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+    int ret = -1;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr roundtrip = NULL;
+    virDomainDefPtr copy = NULL;
+    unsigned int flags = live ? 0 : VIR_DOMAIN_XML_INACTIVE;
+
+    if (virtTestLoadFile(inxml, &inXmlData) < 0)
+        goto fail;
+
+    if (!(def = virDomainDefParseString(inXmlData, driver.caps, driver.xmlopt,
+                                        QEMU_EXPECTED_VIRT_TYPES, flags)))
+        goto fail;
+
+    if (!(xml = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE)))
+        goto fail;
+
+    if (!(roundtrip = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                              -1, VIR_DOMAIN_XML_INACTIVE)))
+        goto fail;
+
+    if (!(copy = virDomainDefCopy(def, driver.caps, driver.xmlopt, false)))
+        goto fail;
+
+    if (!(expected = virDomainDefFormat(roundtrip, VIR_DOMAIN_XML_SECURE)) ||
+        !(actual = virDomainDefFormat(copy, VIR_DOMAIN_XML_SECURE)))
+        goto fail;
+
+    if (STRNEQ(expected, actual)) {
+        virtTestDifference(stderr, expected, actual);
+        goto fail;
+    }
+
+    ret = 0;
+ fail:
+    VIR_FREE(inXmlData);
+    VIR_FREE(xml);
+    VIR_FREE(expected);
+    VIR_FREE(actual);
+    virDomainDefFree(def);
+    virDomainDefFree(roundtrip);
+    virDomainDefFree(copy);
+    return ret;
+}
+
+struct testInfo {
+    const char *name;
+    bool live;
+};
+
+/* Inputs qemuxml2argvtest expects to be rejected by the parser */
+static const char *testSkipped[] = {
+    "boot-dev+order",
+    "pci-bridge-duplicate-index",
+    "pci-bridge-negative-index-invalid",
+    "pci-root-address",
+    "pci-root-nonzero-index",
+    "smbios-date",
+    "smbios-uuid-match",
+    "tpm-no-backend-invalid",
+    "usb-ich9-no-companion",
+    "usb-none-hub",
+    "usb-none-other",
+    "usb-none-usbtablet",
+    "virtio-rng-egd-crash",
+};
+
+/* Inputs with dynamic security labels that have not been generated
+ * yet, which only an inactive definition may lack */
+static const char *testSkippedLive[] = {
+    "controller-order",
+    "seclabel-dynamic",
+    "seclabel-dynamic-baselabel",
+    "seclabel-dynamic-labelskip",
+    "seclabel-dynamic-override",
+    "seclabel-dynamic-relabel",
+};
+
+static bool
+testIsSkipped(const char *name, bool live)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(testSkipped); i++) {
+        if (STREQ(testSkipped[i], name))
+            return true;
+    }
+    for (i = 0; live && i < ARRAY_CARDINALITY(testSkippedLive); i++) {
+        if (STREQ(testSkippedLive[i], name))
+            return true;
+    }
+    return false;
+}
+
+static int
+testCompareCopyHelper(const void *data)
+{
+    const struct testInfo *info = data;
+    char *xml = NULL;
+    int ret = -1;
+
+    if (testIsSkipped(info->name, info->live))
+        return EXIT_AM_SKIP;
+
+    if (virAsprintf(&xml, "%s/qemuxml2argvdata/qemuxml2argv-%s.xml",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    ret = testCompareCopyToRoundTrip(xml, info->live);
+
+cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+static int
+testCompareCopyName(const char *name, bool live)
+{
+    const struct testInfo info = { name, live };
+    char *title = NULL;
+    int ret;
+
+    if (virAsprintf(&title, "QEMU domain copy %s%s",
+                    name, live ? " (live)" : "") < 0)
+        return -1;
+
+    ret = virtTestRun(title, testCompareCopyHelper, &info);
+
+    VIR_FREE(title);
+    return ret;
+}
+
+
+/*
+ * Check the copy of every domain of qemuxml2argvtest, so that a new
+ * element of the definition that virDomainDefCopy does not handle gets
+ * noticed along with its first test.
+ */
+static int
+mymain(void)
+{
+    int ret = 0;
+    DIR *dir;
+    struct dirent *ent;
+
+    if ((driver.caps = testQemuCapsInit()) == NULL)
+        return EXIT_FAILURE;
+
+    if (!(driver.xmlopt = virQEMUDriverCreateXMLConf(&driver)))
+        return EXIT_FAILURE;
+
+    if (!(dir = opendir(abs_srcdir "/qemuxml2argvdata"))) {
+        fprintf(stderr, "cannot open %s/qemuxml2argvdata: %s\n",
+                abs_srcdir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    while ((ent = readdir(dir))) {
+        const char *name;
+        char *test = NULL;
+
+        if (!(name = STRSKIP(ent->d_name, "qemuxml2argv-")) ||
+            !virFileHasSuffix(name, ".xml"))
+            continue;
+
+        if (VIR_STRNDUP(test, name, strlen(name) - strlen(".xml")) < 0 ||
+            testCompareCopyName(test, false) < 0 ||
+            testCompareCopyName(test, true) < 0)
+            ret = -1;
+
+        VIR_FREE(test);
+    }
+    closedir(dir);
+
+    virObjectUnref(driver.caps);
+    virObjectUnref(driver.xmlopt);
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -19,6 +19,8 @@
 
 #include <config.h>
 
+#include <unistd.h>
+
 #include "testutils.h"
 #include "testutilsqemu.h"
 #include "qemumonitortestutils.h"
@@ -1420,6 +1422,8 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     long long flush_req, flush_total_times, errs;
     int nparams;
     unsigned long long extent;
+    virHashTablePtr stats = NULL;
+    qemuMonitorBlockStatsPtr bstats;
 
     const char *reply =
         "{"
@@ -1512,13 +1516,14 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     if (!test)
         return -1;
 
-    /* fill in seven times - we are gonna ask seven times later on */
+    /* fill in eight times - we are gonna ask eight times later on */
     if (qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
         qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0)
         goto cleanup;
 
@@ -1566,6 +1571,43 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
 
     CHECK(16, 49250, 1004952, 0, 0, 0, 0, 0, -1)
 
+    /* a single query must return the stats of all devices */
+    if (!(stats = virHashCreate(32, (virHashDataFree) free)) ||
+        qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorTestGetMonitor(test),
+                                            stats) < 0)
+        goto cleanup;
+
+    if (virHashSize(stats) != 3) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Invalid number of devices: %zd, expected 3",
+                       virHashSize(stats));
+        goto cleanup;
+    }
+
+#define CHECK_ALL(DEV, RD_REQ, RD_BYTES, RD_TOTAL_TIMES, WR_REQ, WR_BYTES, \
+                  WR_TOTAL_TIMES, FLUSH_REQ, FLUSH_TOTAL_TIMES) \
+    if (!(bstats = virHashLookup(stats, DEV))) { \
+        virReportError(VIR_ERR_INTERNAL_ERROR, \
+                       "Missing stats for device %s", DEV); \
+        goto cleanup; \
+    } \
+    rd_req = bstats->rd_req; \
+    rd_bytes = bstats->rd_bytes; \
+    rd_total_times = bstats->rd_total_times; \
+    wr_req = bstats->wr_req; \
+    wr_bytes = bstats->wr_bytes; \
+    wr_total_times = bstats->wr_total_times; \
+    flush_req = bstats->flush_req; \
+    flush_total_times = bstats->flush_total_times; \
+    errs = -1; \
+    CHECK(RD_REQ, RD_BYTES, RD_TOTAL_TIMES, WR_REQ, WR_BYTES, WR_TOTAL_TIMES, \
+          FLUSH_REQ, FLUSH_TOTAL_TIMES, -1)
+
+    CHECK_ALL("virtio-disk0", 1279, 28505088, 640616474, 174, 2845696,
+              530699221, 0, 0)
+    CHECK_ALL("virtio-disk1", 85, 348160, 8232156, 0, 0, 0, 0, 0)
+    CHECK_ALL("ide0-1-0", 16, 49250, 1004952, 0, 0, 0, 0, 0)
+
     if (qemuMonitorJSONGetBlockStatsParamsNumber(qemuMonitorTestGetMonitor(test),
                                                  &nparams) < 0)
         goto cleanup;
@@ -1612,10 +1654,12 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
 
     ret = 0;
 
+#undef CHECK_ALL
 #undef CHECK
 #undef CHECK0
 
 cleanup:
+    virHashFree(stats);
     qemuMonitorTestFree(test);
     return ret;
 }
@@ -2082,6 +2126,446 @@ cleanup:
     return ret;
 }
 
+struct testQemuMonitorJSONPipelineData {
+    char *heldID;
+};
+
+/* Swallows the command, its reply is sent along with the next one */
+static int
+testQemuMonitorJSONPipelineHold(qemuMonitorTestPtr test ATTRIBUTE_UNUSED,
+                                qemuMonitorTestItemPtr item,
+                                const char *cmdstr)
+{
+    struct testQemuMonitorJSONPipelineData *data;
+    virJSONValuePtr cmd;
+    int ret;
+
+    data = qemuMonitorTestItemGetPrivateData(item);
+
+    if (!(cmd = virJSONValueFromString(cmdstr)))
+        return -1;
+
+    ret = VIR_STRDUP(data->heldID, virJSONValueObjectGetString(cmd, "id"));
+    virJSONValueFree(cmd);
+    return ret < 0 ? -1 : 0;
+}
+
+/* Replies to this command first, then to the held one */
+static int
+testQemuMonitorJSONPipelineRelease(qemuMonitorTestPtr test,
+                                   qemuMonitorTestItemPtr item,
+                                   const char *cmdstr)
+{
+    struct testQemuMonitorJSONPipelineData *data;
+    virJSONValuePtr cmd;
+    char *reply = NULL;
+    int ret = -1;
+
+    data = qemuMonitorTestItemGetPrivateData(item);
+
+    if (!(cmd = virJSONValueFromString(cmdstr)))
+        return -1;
+
+    if (virAsprintf(&reply, "{\"return\": \"second\", \"id\": \"%s\"}",
+                    NULLSTR(virJSONValueObjectGetString(cmd, "id"))) < 0 ||
+        qemuMonitorTestAddReponse(test, reply) < 0)
+        goto cleanup;
+
+    VIR_FREE(reply);
+    if (virAsprintf(&reply, "{\"return\": \"first\", \"id\": \"%s\"}",
+                    NULLSTR(data->heldID)) < 0 ||
+        qemuMonitorTestAddReponse(test, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    VIR_FREE(reply);
+    virJSONValueFree(cmd);
+    return ret;
+}
+
+/* Runs @name on the monitor and checks the reply is @expect */
+static int
+testQemuMonitorJSONPipelineCommand(qemuMonitorPtr mon,
+                                   const char *name,
+                                   const char *expect)
+{
+    char *cmdstr = NULL;
+    char *replystr = NULL;
+    virJSONValuePtr reply = NULL;
+    const char *got;
+    int ret = -1;
+
+    if (virAsprintf(&cmdstr, "{\"execute\": \"%s\"}", name) < 0 ||
+        qemuMonitorJSONArbitraryCommand(mon, cmdstr, &replystr, false) < 0 ||
+        !(reply = virJSONValueFromString(replystr)))
+        goto cleanup;
+
+    if (!(got = virJSONValueObjectGetString(reply, "return")) ||
+        STRNEQ(got, expect)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected reply '%s', got '%s'", expect, NULLSTR(got));
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(cmdstr);
+    VIR_FREE(replystr);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+struct testQemuMonitorJSONPipelineThreadData {
+    qemuMonitorPtr mon;
+    int failed;
+};
+
+static void
+testQemuMonitorJSONPipelineThread(void *opaque)
+{
+    struct testQemuMonitorJSONPipelineThreadData *data = opaque;
+
+    virObjectLock(data->mon);
+    if (testQemuMonitorJSONPipelineCommand(data->mon,
+                                           "query-second", "second") < 0)
+        data->failed = 1;
+    virObjectUnlock(data->mon);
+}
+
+/*
+ * Two threads have a command in flight at once. The first command
+ * is written before the other thread can take the monitor lock, and
+ * QEMU answers the second before the first: each reply has to reach
+ * the thread which sent the command.
+ */
+static int
+testQemuMonitorJSONPipeline(const void *opaque)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr) opaque;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    struct testQemuMonitorJSONPipelineData data = { NULL };
+    struct testQemuMonitorJSONPipelineThreadData thdata = { NULL, 0 };
+    virThread thread;
+    bool joined = true;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    thdata.mon = qemuMonitorTestGetMonitor(test);
+
+    if (qemuMonitorTestAddHandler(test, testQemuMonitorJSONPipelineHold,
+                                  &data, NULL) < 0 ||
+        qemuMonitorTestAddHandler(test, testQemuMonitorJSONPipelineRelease,
+                                  &data, NULL) < 0)
+        goto cleanup;
+
+    if (virThreadCreate(&thread, true,
+                        testQemuMonitorJSONPipelineThread, &thdata) < 0)
+        goto cleanup;
+    joined = false;
+
+    if (testQemuMonitorJSONPipelineCommand(thdata.mon,
+                                           "query-first", "first") < 0)
+        goto cleanup;
+
+    virObjectUnlock(thdata.mon);
+    virThreadJoin(&thread);
+    virObjectLock(thdata.mon);
+    joined = true;
+
+    if (thdata.failed)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    if (!joined) {
+        virObjectUnlock(thdata.mon);
+        virThreadJoin(&thread);
+        virObjectLock(thdata.mon);
+    }
+    VIR_FREE(data.heldID);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+struct testQemuMonitorJSONIOData {
+    virDomainXMLOptionPtr xmlopt;
+    bool stream;
+    /* bytes that arrive with each read, 0 for all at once */
+    size_t chunk;
+};
+
+/* Three replies, one without an ID, interleaved with events */
+static const char *testQemuMonitorJSONIOStream =
+    "{\"return\": {\"name\": \"a long reply which is split into several "
+    "reads \\\"\\r\\n\\\" }\"}, \"id\": \"libvirt-1\"}\r\n"
+    "{\"timestamp\": {\"seconds\": 1, \"microseconds\": 2}, "
+    "\"event\": \"STOP\"}\r\n"
+    "{\"return\": [1, 2, {\"three\": 3}], \"id\": \"libvirt-2\"}\r\n"
+    "{\"event\": \"RESUME\", \"data\": {\"x\": null}}\r\n"
+    "{\"event\": \"NO-SUCH-EVENT\"}\r\n"
+    "{\"error\": {\"class\": \"GenericError\", \"desc\": \"no\"}}\r\n";
+
+static const char *testQemuMonitorJSONIOReplies[] = {
+    "{\"return\":{\"name\":\"a long reply which is split into several "
+    "reads \\\"\\r\\n\\\" }\"},\"id\":\"libvirt-1\"}",
+    "{\"return\":[1,2,{\"three\":3}],\"id\":\"libvirt-2\"}",
+    "{\"error\":{\"class\":\"GenericError\",\"desc\":\"no\"}}",
+};
+
+/*
+ * Pass the replies and events QEMU sent to qemuMonitorJSONIOProcess
+ * the way qemuMonitorIOProcess does, a few bytes at a time, keeping
+ * what wasn't consumed at the start of the buffer. Each reply must
+ * reach its own message whichever framing is used.
+ */
+static int
+testQemuMonitorJSONIOProcess(const void *opaque)
+{
+    const struct testQemuMonitorJSONIOData *data = opaque;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, data->xmlopt);
+    virJSONStreamParserPtr parser = NULL;
+    qemuMonitorMessage msgs[ARRAY_CARDINALITY(testQemuMonitorJSONIOReplies)];
+    const char *ids[] = { "libvirt-1", "libvirt-2", "libvirt-3" };
+    size_t doclen = strlen(testQemuMonitorJSONIOStream);
+    size_t offset = 0;
+    size_t avail = 0;
+    char *buf = NULL;
+    char *str = NULL;
+    size_t i;
+    int used;
+    int ret = -1;
+
+    memset(msgs, 0, sizeof(msgs));
+
+    if (!test)
+        return -1;
+
+    if (data->stream &&
+        !(parser = virJSONStreamParserNew(VIR_JSON_PARSE_ARENA)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(msgs); i++) {
+        msgs[i].id = (char *) ids[i];
+        if (i + 1 < ARRAY_CARDINALITY(msgs))
+            msgs[i].next = &msgs[i + 1];
+    }
+
+    if (VIR_ALLOC_N(buf, doclen + 1) < 0)
+        goto cleanup;
+
+    while (offset < doclen) {
+        /* like qemuMonitorIORead, keep the buffer NUL terminated */
+        if (data->chunk)
+            avail = MIN(avail + data->chunk, doclen - offset);
+        else
+            avail = doclen - offset;
+        memcpy(buf, testQemuMonitorJSONIOStream + offset, avail);
+        buf[avail] = '\0';
+
+        if ((used = qemuMonitorJSONIOProcess(qemuMonitorTestGetMonitor(test),
+                                             parser, buf, avail,
+                                             msgs)) < 0)
+            goto cleanup;
+
+        offset += used;
+        avail -= used;
+
+        if (!data->chunk && avail) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%zu bytes left unprocessed", avail);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(msgs); i++) {
+        if (!msgs[i].finished || !msgs[i].rxObject) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "No reply for message %zu", i);
+            goto cleanup;
+        }
+
+        if (!(str = virJSONValueToString(msgs[i].rxObject, false)))
+            goto cleanup;
+
+        if (STRNEQ(str, testQemuMonitorJSONIOReplies[i])) {
+            virtTestDifference(stderr, testQemuMonitorJSONIOReplies[i], str);
+            goto cleanup;
+        }
+        VIR_FREE(str);
+    }
+
+    ret = 0;
+cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(msgs); i++)
+        virJSONValueFree(msgs[i].rxObject);
+    VIR_FREE(str);
+    VIR_FREE(buf);
+    virJSONStreamParserFree(parser);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+struct testQemuMonitorJSONConcurrentData {
+    qemuMonitorPtr mon;
+    int balloonLookups;
+    int failed;
+};
+
+/*
+ * Answers the commands of the balloon path lookup and of
+ * qemuMonitorGetMemoryStats in whatever order they arrive
+ */
+static int
+testQemuMonitorJSONConcurrentReply(qemuMonitorTestPtr test,
+                                   qemuMonitorTestItemPtr item,
+                                   const char *cmdstr)
+{
+    struct testQemuMonitorJSONConcurrentData *data;
+    virJSONValuePtr cmd;
+    virJSONValuePtr args;
+    const char *name;
+    const char *path = NULL;
+    const char *ret;
+    char *reply = NULL;
+    int rc = -1;
+
+    data = qemuMonitorTestItemGetPrivateData(item);
+
+    if (!(cmd = virJSONValueFromString(cmdstr)))
+        return -1;
+
+    name = virJSONValueObjectGetString(cmd, "execute");
+    if ((args = virJSONValueObjectGet(cmd, "arguments")))
+        path = virJSONValueObjectGetString(args, "path");
+
+    if (STREQ_NULLABLE(name, "qom-list") && STREQ_NULLABLE(path, "/")) {
+        /* Give the other thread time to ask for the path too */
+        data->balloonLookups++;
+        usleep(100 * 1000);
+        ret = "[{\"name\": \"balloon\", \"type\": \"link<virtio-balloon-pci>\"}]";
+    } else if (STREQ_NULLABLE(name, "qom-list")) {
+        ret = "[{\"name\": \"guest-stats-polling-interval\", \"type\": \"int\"}]";
+    } else if (STREQ_NULLABLE(name, "query-balloon")) {
+        ret = "{\"actual\": 4294967296}";
+    } else if (STREQ_NULLABLE(name, "qom-get")) {
+        ret = "{\"stats\": {\"stat-free-memory\": 1048576}}";
+    } else {
+        rc = qemuMonitorTestAddUnexpectedErrorResponse(test);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&reply, "{\"return\": %s, \"id\": \"%s\"}", ret,
+                    NULLSTR(virJSONValueObjectGetString(cmd, "id"))) < 0)
+        goto cleanup;
+
+    rc = qemuMonitorTestAddReponse(test, reply);
+
+cleanup:
+    VIR_FREE(reply);
+    virJSONValueFree(cmd);
+    return rc;
+}
+
+static int
+testQemuMonitorJSONConcurrentStats(qemuMonitorPtr mon)
+{
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    int nstats;
+
+    nstats = qemuMonitorGetMemoryStats(mon, stats, ARRAY_CARDINALITY(stats));
+
+    /* actual balloon size and unused memory */
+    if (nstats != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected 2 memory stats, got %d", nstats);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+testQemuMonitorJSONConcurrentThread(void *opaque)
+{
+    struct testQemuMonitorJSONConcurrentData *data = opaque;
+
+    virObjectLock(data->mon);
+    if (testQemuMonitorJSONConcurrentStats(data->mon) < 0)
+        data->failed = 1;
+    virObjectUnlock(data->mon);
+}
+
+/*
+ * Query jobs share the monitor. Two threads ask for the memory
+ * stats at once, the balloon object path must be looked up once
+ * and both must get the guest stats.
+ */
+static int
+testQemuMonitorJSONConcurrentQuery(const void *opaque)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr) opaque;
+    struct testQemuMonitorJSONConcurrentData data = { NULL, 0, 0 };
+    qemuMonitorTestPtr test = NULL;
+    virDomainObjPtr vm = NULL;
+    virThread thread;
+    bool joined = true;
+    size_t i;
+    int ret = -1;
+
+    if (!(vm = virDomainObjNew(xmlopt)) ||
+        VIR_ALLOC(vm->def) < 0 ||
+        VIR_ALLOC(vm->def->memballoon) < 0)
+        goto cleanup;
+    vm->def->memballoon->model = VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO;
+
+    if (!(test = qemuMonitorTestNew(true, xmlopt, vm, NULL, NULL)))
+        goto cleanup;
+    data.mon = qemuMonitorTestGetMonitor(test);
+
+    /* one lookup of two commands, then two commands per thread */
+    for (i = 0; i < 6; i++) {
+        if (qemuMonitorTestAddHandler(test, testQemuMonitorJSONConcurrentReply,
+                                      &data, NULL) < 0)
+            goto cleanup;
+    }
+
+    if (virThreadCreate(&thread, true,
+                        testQemuMonitorJSONConcurrentThread, &data) < 0)
+        goto cleanup;
+    joined = false;
+
+    if (testQemuMonitorJSONConcurrentStats(data.mon) < 0)
+        goto cleanup;
+
+    virObjectUnlock(data.mon);
+    virThreadJoin(&thread);
+    virObjectLock(data.mon);
+    joined = true;
+
+    if (data.failed)
+        goto cleanup;
+
+    if (data.balloonLookups != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Balloon path looked up %d times", data.balloonLookups);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    if (!joined) {
+        virObjectUnlock(data.mon);
+        virThreadJoin(&thread);
+        virObjectLock(data.mon);
+    }
+    qemuMonitorTestFree(test);
+    virObjectUnref(vm);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -2115,6 +2599,13 @@ mymain(void)
     if (virtTestRun(# name, testQemuMonitorJSON ## name, &simpleFunc) < 0) \
         ret = -1
 
+#define DO_TEST_IO_PROCESS(name, stream, chunk)                           \
+    do {                                                                  \
+        struct testQemuMonitorJSONIOData data = { xmlopt, stream, chunk }; \
+        if (virtTestRun(name, testQemuMonitorJSONIOProcess, &data) < 0)   \
+            ret = -1;                                                     \
+    } while (0)
+
 #define DO_TEST_CPU_DATA(name) \
     do {                                                                  \
         struct testCPUData data = { name, xmlopt };                       \
@@ -2138,6 +2629,14 @@ mymain(void)
     DO_TEST(GetDeviceAliases);
     DO_TEST(CPU);
     DO_TEST(GetNonExistingCPUData);
+    DO_TEST(Pipeline);
+    DO_TEST(ConcurrentQuery);
+    DO_TEST_IO_PROCESS("IOProcess(lines, one read)", false, 0);
+    DO_TEST_IO_PROCESS("IOProcess(lines, byte by byte)", false, 1);
+    DO_TEST_IO_PROCESS("IOProcess(lines, split)", false, 23);
+    DO_TEST_IO_PROCESS("IOProcess(stream, one read)", true, 0);
+    DO_TEST_IO_PROCESS("IOProcess(stream, byte by byte)", true, 1);
+    DO_TEST_IO_PROCESS("IOProcess(stream, split)", true, 23);
     DO_TEST_SIMPLE("qmp_capabilities", qemuMonitorJSONSetCapabilities);
     DO_TEST_SIMPLE("system_powerdown", qemuMonitorJSONSystemPowerdown);
     DO_TEST_SIMPLE("system_reset", qemuMonitorJSONSystemReset);
@@ -115,6 +115,44 @@ qemuMonitorTestAddReponse(qemuMonitorTestPtr test,
 }
 
 
+/*
+ * Appends @response as the reply to @cmd, tagged with the command's
+ * "id" the way QEMU does so the monitor can match it up. Canned
+ * responses carry whatever ID they were captured with, which is
+ * replaced.
+ */
+static int
+qemuMonitorTestAddReplyToCommand(qemuMonitorTestPtr test,
+                                 virJSONValuePtr cmd,
+                                 const char *response)
+{
+    virJSONValuePtr reply = NULL;
+    const char *id;
+    char *replystr = NULL;
+    int ret = -1;
+
+    if (!cmd || !(id = virJSONValueObjectGetString(cmd, "id")) ||
+        !(reply = virJSONValueFromString(response)) ||
+        reply->type != VIR_JSON_TYPE_OBJECT) {
+        virResetLastError();
+        ret = qemuMonitorTestAddReponse(test, response);
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectRemoveKey(reply, "id", NULL) < 0 ||
+        virJSONValueObjectAppendString(reply, "id", id) < 0 ||
+        !(replystr = virJSONValueToString(reply, false)))
+        goto cleanup;
+
+    ret = qemuMonitorTestAddReponse(test, replystr);
+
+cleanup:
+    VIR_FREE(replystr);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 int
 qemuMonitorTestAddUnexpectedErrorResponse(qemuMonitorTestPtr test)
 {
@@ -489,7 +527,7 @@ qemuMonitorTestProcessCommandDefault(qemuMonitorTestPtr test,
     if (data->command_name && STRNEQ(data->command_name, cmdname))
         ret = qemuMonitorTestAddUnexpectedErrorResponse(test);
     else
-        ret = qemuMonitorTestAddReponse(test, data->response);
+        ret = qemuMonitorTestAddReplyToCommand(test, val, data->response);
 
 cleanup:
     VIR_FREE(cmdcopy);
@@ -649,7 +687,7 @@ qemuMonitorTestProcessCommandWithArgs(qemuMonitorTestPtr test,
     }
 
     /* arguments checked out, return the response */
-    ret = qemuMonitorTestAddReponse(test, data->response);
+    ret = qemuMonitorTestAddReplyToCommand(test, val, data->response);
 
 cleanup:
     VIR_FREE(argstr);
@@ -0,0 +1,184 @@
+/*
+ * vircompresstest.c: Test the chunked compression code
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "vircompress.h"
+#include "viralloc.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#if WITH_ZLIB
+
+struct testInfo {
+    size_t len;
+    size_t chunkSize;
+    size_t nthreads;
+    bool truncate;
+};
+
+static int
+testTempFile(void)
+{
+    char path[] = abs_builddir "/vircompressdata-XXXXXX";
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0)
+        return -1;
+    unlink(path);
+    return fd;
+}
+
+static int
+testRun(virCompressMode mode, int infd, int outfd,
+        size_t chunkSize, size_t nthreads)
+{
+    virCompressorPtr comp;
+    int ret;
+
+    if (lseek(infd, 0, SEEK_SET) < 0)
+        return -1;
+
+    if (!(comp = virCompressorNew(mode, infd, outfd, "test data",
+                                  chunkSize, nthreads)))
+        return -1;
+
+    ret = virCompressorFinish(comp);
+    virCompressorFree(comp);
+    return ret;
+}
+
+static int
+testCompressRoundTrip(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    int rawfd = -1;
+    int zfd = -1;
+    int outfd = -1;
+    char *data = NULL;
+    char *result = NULL;
+    off_t zlen;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(data, info->len + 1) < 0 ||
+        VIR_ALLOC_N(result, info->len + 1) < 0)
+        goto cleanup;
+
+    /* Mostly compressible, but not entirely trivial */
+    for (i = 0; i < info->len; i++)
+        data[i] = (i % 4096) < 1024 ? (i * 7919) >> 3 : 'x';
+
+    if ((rawfd = testTempFile()) < 0 ||
+        (zfd = testTempFile()) < 0 ||
+        (outfd = testTempFile()) < 0)
+        goto cleanup;
+
+    if (safewrite(rawfd, data, info->len) != info->len)
+        goto cleanup;
+
+    if (testRun(VIR_COMPRESS_DEFLATE, rawfd, zfd,
+                info->chunkSize, info->nthreads) < 0)
+        goto cleanup;
+
+    if (info->truncate) {
+        if ((zlen = lseek(zfd, 0, SEEK_END)) < 0 ||
+            ftruncate(zfd, zlen - 1) < 0)
+            goto cleanup;
+
+        if (testRun(VIR_COMPRESS_INFLATE, zfd, outfd,
+                    info->chunkSize, info->nthreads) == 0) {
+            virFilePrintf(stderr, "Truncated data was accepted\n");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (testRun(VIR_COMPRESS_INFLATE, zfd, outfd,
+                info->chunkSize, info->nthreads) < 0)
+        goto cleanup;
+
+    if (lseek(outfd, 0, SEEK_SET) < 0 ||
+        saferead(outfd, result, info->len + 1) != info->len) {
+        virFilePrintf(stderr, "Decompressed data has the wrong length\n");
+        goto cleanup;
+    }
+
+    if (memcmp(data, result, info->len) != 0) {
+        virFilePrintf(stderr, "Decompressed data does not match\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(rawfd);
+    VIR_FORCE_CLOSE(zfd);
+    VIR_FORCE_CLOSE(outfd);
+    VIR_FREE(data);
+    VIR_FREE(result);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FULL(name, len, chunkSize, nthreads, truncate)         \
+    do {                                                                \
+        struct testInfo info = { len, chunkSize, nthreads, truncate };  \
+        if (virtTestRun(name, testCompressRoundTrip, &info) < 0)        \
+            ret = -1;                                                   \
+    } while (0)
+
+# define DO_TEST(name, len, chunkSize, nthreads)                        \
+    DO_TEST_FULL(name, len, chunkSize, nthreads, false)
+
+    DO_TEST("empty", 0, 4096, 2);
+    DO_TEST("one byte", 1, 4096, 1);
+    DO_TEST("one chunk", 4096, 4096, 4);
+    DO_TEST("partial last chunk", 1024 * 1024 + 17, 4096, 4);
+    DO_TEST("more threads than chunks", 64 * 1024, 64 * 1024, 8);
+    DO_TEST("many chunks", 4 * 1024 * 1024, 16 * 1024, 8);
+    DO_TEST_FULL("truncated", 1024 * 1024, 4096, 4, true);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_ZLIB */
@@ -43,6 +43,48 @@ testLogMatch(const void *opaque)
 }
 
 
+static int
+testLogCallsite(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virLogCallsite site = { 0 };
+    const char *filename = "util/virlogtestdummy.c";
+    int ret = -1;
+
+    /* Without the debug buffer only the filters matter */
+    if (virLogSetBufferSize(0) < 0 ||
+        virLogSetDefaultPriority(VIR_LOG_WARN) < 0)
+        goto cleanup;
+
+    if (virLogCallsiteEnabled(&site, VIR_LOG_DEBUG, filename) ||
+        !virLogCallsiteEnabled(&site, VIR_LOG_ERROR, filename)) {
+        fprintf(stderr, "Unexpected decision with default priority\n");
+        goto cleanup;
+    }
+
+    /* The cached decision must be dropped when filters change */
+    if (virLogDefineFilter("virlogtestdummy", VIR_LOG_DEBUG, 0) < 0)
+        goto cleanup;
+
+    if (!virLogCallsiteEnabled(&site, VIR_LOG_DEBUG, filename)) {
+        fprintf(stderr, "Call site ignored new filter\n");
+        goto cleanup;
+    }
+
+    if (virLogReset() < 0)
+        goto cleanup;
+
+    if (virLogCallsiteEnabled(&site, VIR_LOG_DEBUG, filename)) {
+        fprintf(stderr, "Call site ignored filters reset\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virLogReset();
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -61,6 +103,9 @@ mymain(void)
 
     TEST_LOG_MATCH("libvirt:  error : cannot execute binary /usr/libexec/libvirt_lxc: No such file or directory", false);
 
+    if (virtTestRun("testLogCallsite", testLogCallsite, NULL) < 0)
+        ret = -1;
+
     return ret;
 }
 
@@ -28,6 +28,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virobject.h"
 #include "rpc/virnetmessage.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -519,6 +520,70 @@ cleanup:
     return ret;
 }
 
+static int testMessagePool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePoolPtr pool = virNetMessagePoolNew();
+    virNetMessagePoolStats stats;
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr first;
+    static const char input_buf[] = {
+        0x00, 0x00, 0x00, 0x1c,  /* Length */
+    };
+    int ret = -1;
+
+    if (!pool)
+        return -1;
+
+    if (!(first = msg = virNetMessagePoolGet(pool, true)))
+        goto cleanup;
+
+    if (virNetMessageResizeBuffer(msg, VIR_NET_MESSAGE_LEN_MAX) < 0)
+        goto cleanup;
+    memcpy(msg->buffer, input_buf, msg->bufferLength);
+
+    if (virNetMessageDecodeLength(msg) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength != 0x1c ||
+        memcmp(msg->buffer, input_buf, sizeof(input_buf)) != 0) {
+        VIR_DEBUG("Unexpected buffer after decoding length");
+        goto cleanup;
+    }
+
+    /* The reply needs a buffer of the next size class */
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    virNetMessageFree(msg);
+
+    /* Both the message and its small buffer are reused */
+    if (!(msg = virNetMessagePoolGet(pool, true)) ||
+        virNetMessageResizeBuffer(msg, VIR_NET_MESSAGE_LEN_MAX) < 0)
+        goto cleanup;
+
+    virNetMessagePoolGetStats(pool, &stats);
+
+    if (msg != first || stats.msgHits != 1 || stats.msgMisses != 1) {
+        VIR_DEBUG("Expected the message to be reused, hits=%llu misses=%llu",
+                  stats.msgHits, stats.msgMisses);
+        goto cleanup;
+    }
+
+    if (stats.bufferHits[0] != 1 || stats.bufferMisses[0] != 1 ||
+        stats.bufferMisses[1] != 1 || stats.bufferCached[1] != 1) {
+        VIR_DEBUG("Unexpected buffer stats hits=%llu misses=%llu/%llu cached=%zu",
+                  stats.bufferHits[0], stats.bufferMisses[0],
+                  stats.bufferMisses[1], stats.bufferCached[1]);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    virObjectUnref(pool);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -542,6 +607,9 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Pool", testMessagePool, NULL) < 0)
+        ret = -1;
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
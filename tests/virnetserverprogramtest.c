@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "rpc/virnetserverprogram.h"
+#include "rpc/virnetserverclient.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#ifdef HAVE_SOCKETPAIR
+static virNetServerProgramProc testProcs[] = {
+    { .name = NULL },
+    { .name = "TEST_PROC_ONE" },
+    { .name = "TEST_PROC_TWO" },
+};
+
+struct testCall {
+    int procedure;
+    unsigned long long queueTime;
+    unsigned long long execTime;
+    bool failed;
+    size_t bytesIn;
+    size_t bytesOut;
+};
+
+/* Every execution time right at and just above a histogram bound */
+static const struct testCall testCalls[] = {
+    { 1, 10, 0, false, 40, 60 },
+    { 1, 10, 100, false, 40, 60 },
+    { 1, 10, 101, false, 40, 60 },
+    { 1, 10, 1000, false, 40, 60 },
+    { 1, 10, 1001, false, 40, 60 },
+    { 1, 10, 10 * 1000, false, 40, 60 },
+    { 1, 10, 10 * 1000 + 1, false, 40, 60 },
+    { 1, 10, 100 * 1000, false, 40, 60 },
+    { 1, 10, 100 * 1000 + 1, false, 40, 60 },
+    { 1, 10, 1000 * 1000, true, 40, 0 },
+    { 1, 10, 1000 * 1000 + 1, false, 40, 60 },
+    { 1, 10, 10 * 1000 * 1000, false, 40, 60 },
+    { 1, 10, 10 * 1000 * 1000 + 1, false, 40, 60 },
+    { 2, 1000, 50, true, 100, 0 },
+    { 2, 3000, 150, false, 100, 200 },
+    /* Calls to unknown procedures are not accounted for */
+    { 3, 10, 10, false, 10, 10 },
+    { -1, 10, 10, false, 10, 10 },
+};
+
+static const char testStats[] =
+    "program=0x1234 version=1 proc=1 name=TEST_PROC_ONE"
+    " calls=13 errors=1 queue_avg_us=10 exec_avg_us=1709400"
+    " exec_max_us=10000001 bytes_in=520 bytes_out=720"
+    " exec_le_100us=2 exec_le_1ms=2 exec_le_10ms=2 exec_le_100ms=2"
+    " exec_le_1s=2 exec_le_10s=2 exec_le_inf=1\n"
+    "program=0x1234 version=1 proc=2 name=TEST_PROC_TWO"
+    " calls=2 errors=1 queue_avg_us=2000 exec_avg_us=100"
+    " exec_max_us=150 bytes_in=200 bytes_out=200"
+    " exec_le_100us=1 exec_le_1ms=1 exec_le_10ms=0 exec_le_100ms=0"
+    " exec_le_1s=0 exec_le_10s=0 exec_le_inf=0\n";
+
+
+static int testRecordCall(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int sv[2];
+    int ret = -1;
+    virNetSocketPtr sock = NULL;
+    virNetServerClientPtr client = NULL;
+    virNetServerProgramPtr prog = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    size_t i;
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        virReportSystemError(errno, "%s",
+                             "Cannot create socket pair");
+        return -1;
+    }
+
+    if (virNetSocketNewConnectSockFD(sv[0], &sock) < 0) {
+        virDispatchError(NULL);
+        goto cleanup;
+    }
+    sv[0] = -1;
+
+    if (!(client = virNetServerClientNew(sock, 0, false, 1, NULL,
+# ifdef WITH_GNUTLS
+                                         NULL,
+# endif
+                                         NULL, NULL, NULL, NULL))) {
+        virDispatchError(NULL);
+        goto cleanup;
+    }
+
+    if (!(prog = virNetServerProgramNew(0x1234, 1, testProcs,
+                                        ARRAY_CARDINALITY(testProcs))))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(testCalls); i++)
+        virNetServerProgramRecordCall(prog, client,
+                                      testCalls[i].procedure,
+                                      testCalls[i].queueTime,
+                                      testCalls[i].execTime,
+                                      testCalls[i].failed,
+                                      testCalls[i].bytesIn,
+                                      testCalls[i].bytesOut);
+
+    virNetServerProgramFormatStats(prog, &buf);
+    if (virBufferError(&buf))
+        goto cleanup;
+    actual = virBufferContentAndReset(&buf);
+
+    if (STRNEQ_NULLABLE(testStats, actual)) {
+        virtTestDifference(stderr, testStats, NULLSTR(actual));
+        goto cleanup;
+    }
+    VIR_FREE(actual);
+
+    /* The client totals include the calls to every procedure */
+    virNetServerClientFormatStats(client, &buf);
+    if (virBufferError(&buf))
+        goto cleanup;
+    actual = virBufferContentAndReset(&buf);
+
+    if (!actual ||
+        !strstr(actual, " calls=15 errors=2 bytes_in=720 bytes_out=920\n")) {
+        fprintf(stderr, "Unexpected client statistics '%s'\n",
+                NULLSTR(actual));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    virObjectUnref(prog);
+    virObjectUnref(client);
+    virObjectUnref(sock);
+    VIR_FORCE_CLOSE(sv[0]);
+    VIR_FORCE_CLOSE(sv[1]);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    virEventRegisterDefaultImpl();
+
+    if (virtTestRun("Record call",
+                    testRecordCall, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+VIRT_TEST_MAIN(mymain)
+#else
+static int
+mymain(void)
+{
+    return EXIT_AM_SKIP;
+}
+VIRT_TEST_MAIN(mymain);
+#endif
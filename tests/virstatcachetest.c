@@ -0,0 +1,249 @@
+/*
+ * virstatcachetest.c: Test the stats file cache
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "virstatcache.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static char *statFile;
+
+static int
+testCheckRead(const char *expect)
+{
+    char *buf = NULL;
+    int len;
+    int ret = -1;
+
+    if ((len = virStatCacheRead(statFile, 1024, &buf)) < 0) {
+        virFilePrintf(stderr, "Unable to read '%s': %d\n", statFile, errno);
+        return -1;
+    }
+
+    if (len != strlen(expect) || STRNEQ(buf, expect)) {
+        virFilePrintf(stderr, "Expected '%s', got '%s'\n", expect, buf);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+static int
+testFresh(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStatCacheSetMaxAge(0);
+
+    if (virFileWriteStr(statFile, "first\n", 0600) < 0 ||
+        testCheckRead("first\n") < 0)
+        return -1;
+
+    /* The file is kept open, but must be read again each time */
+    if (virFileWriteStr(statFile, "second, longer\n", 0) < 0 ||
+        testCheckRead("second, longer\n") < 0)
+        return -1;
+
+    if (virFileWriteStr(statFile, "3rd\n", 0) < 0 ||
+        testCheckRead("3rd\n") < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testMaxAge(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStatCacheFlush();
+    virStatCacheSetMaxAge(60 * 60 * 1000);
+
+    if (virFileWriteStr(statFile, "old\n", 0600) < 0 ||
+        testCheckRead("old\n") < 0)
+        return -1;
+
+    /* Within the maximum age the snapshot is served */
+    if (virFileWriteStr(statFile, "new\n", 0) < 0 ||
+        testCheckRead("old\n") < 0)
+        return -1;
+
+    virStatCacheFlush();
+    if (testCheckRead("new\n") < 0)
+        return -1;
+
+    virStatCacheSetMaxAge(0);
+    return 0;
+}
+
+static int
+testErrors(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *buf = NULL;
+    char big[2048];
+
+    virStatCacheSetMaxAge(0);
+
+    if (virStatCacheRead(abs_builddir "/no-such-stat-file", 1024, &buf) >= 0 ||
+        errno != ENOENT || buf) {
+        virFilePrintf(stderr, "Missing file was read\n");
+        VIR_FREE(buf);
+        return -1;
+    }
+
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    if (virFileWriteStr(statFile, big, 0600) < 0)
+        return -1;
+
+    if (virStatCacheRead(statFile, 1024, &buf) >= 0 ||
+        errno != EOVERFLOW || buf) {
+        virFilePrintf(stderr, "Oversized file was accepted\n");
+        VIR_FREE(buf);
+        return -1;
+    }
+
+    /* A larger limit reads it fine */
+    if (virStatCacheRead(statFile, sizeof(big), &buf) != sizeof(big) - 1) {
+        virFilePrintf(stderr, "Unable to read large file\n");
+        VIR_FREE(buf);
+        return -1;
+    }
+    VIR_FREE(buf);
+
+    return 0;
+}
+
+#define THREAD_FILES 4
+
+struct testThreadData {
+    char *path;
+    char *expect;
+    bool failed;
+};
+
+static void
+testThreadRead(void *opaque)
+{
+    struct testThreadData *data = opaque;
+    size_t i;
+
+    for (i = 0; i < 200; i++) {
+        char *buf = NULL;
+
+        if (virStatCacheRead(data->path, 1024, &buf) < 0 ||
+            STRNEQ(buf, data->expect))
+            data->failed = true;
+        VIR_FREE(buf);
+    }
+}
+
+/* Two threads per file reading several files at once */
+static int
+testThreads(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testThreadData data[THREAD_FILES * 2];
+    virThread threads[THREAD_FILES * 2];
+    size_t nthreads = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(data, 0, sizeof(data));
+    virStatCacheSetMaxAge(0);
+
+    for (i = 0; i < THREAD_FILES; i++) {
+        if (virAsprintf(&data[i].path, "%s.%zu", statFile, i) < 0 ||
+            virAsprintf(&data[i].expect, "contents of file %zu\n", i) < 0 ||
+            virFileWriteStr(data[i].path, data[i].expect, 0600) < 0)
+            goto cleanup;
+        data[i + THREAD_FILES].path = data[i].path;
+        data[i + THREAD_FILES].expect = data[i].expect;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(threads); i++) {
+        if (virThreadCreate(&threads[i], true, testThreadRead, &data[i]) < 0)
+            break;
+        nthreads++;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    if (nthreads < ARRAY_CARDINALITY(threads))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(data); i++) {
+        if (data[i].failed) {
+            virFilePrintf(stderr, "Wrong contents read from '%s'\n",
+                          data[i].path);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virStatCacheFlush();
+    for (i = 0; i < THREAD_FILES; i++) {
+        if (data[i].path)
+            unlink(data[i].path);
+        VIR_FREE(data[i].path);
+        VIR_FREE(data[i].expect);
+    }
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (VIR_STRDUP(statFile, abs_builddir "/virstatcachedata") < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("fresh", testFresh, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("max age", testMaxAge, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("errors", testErrors, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("threads", testThreads, NULL) < 0)
+        ret = -1;
+
+    virStatCacheFlush();
+    unlink(statFile);
+    VIR_FREE(statFile);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "viratomic.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define KEYS 16
+#define JOBS_PER_KEY 40
+
+struct testPoolState {
+    int ran[KEYS];
+    int started;
+    int overlapped;
+    int done;
+    virMutex lock;
+    virCond cond;
+};
+
+struct testJob {
+    size_t key;
+    size_t seq;
+};
+
+static struct testPoolState state;
+static struct testJob jobs[KEYS * JOBS_PER_KEY];
+
+
+static void
+testManyKeysJob(void *jobdata, void *opaque)
+{
+    struct testJob *job = jobdata;
+    struct testPoolState *st = opaque;
+
+    virAtomicIntInc(&st->ran[job->key]);
+
+    /* keep the workers busy so that new ones get started */
+    if (job->seq % 4 == 0)
+        usleep(500);
+
+    if (virAtomicIntInc(&st->done) == ARRAY_CARDINALITY(jobs)) {
+        virMutexLock(&st->lock);
+        virCondSignal(&st->cond);
+        virMutexUnlock(&st->lock);
+    }
+}
+
+
+/*
+ * Send the jobs of several keys, interleaved, to a multi-queue pool
+ * which starts with a single worker. Every job must run once, and
+ * workers must be added as the queues fill up.
+ */
+static int
+testManyKeys(const void *data ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    memset(&state.ran, 0, sizeof(state.ran));
+    state.done = 0;
+
+    if (!(pool = virThreadPoolNewFull(1, 8, 0, testManyKeysJob, &state,
+                                      VIR_THREAD_POOL_MULTI_QUEUE)))
+        return -1;
+
+    virMutexLock(&state.lock);
+
+    for (i = 0; i < JOBS_PER_KEY; i++) {
+        for (j = 0; j < KEYS; j++) {
+            struct testJob *job = &jobs[i * KEYS + j];
+
+            job->key = j;
+            job->seq = i;
+            if (virThreadPoolSendJobFull(pool, 0, &state.ran[j], job) < 0) {
+                virMutexUnlock(&state.lock);
+                goto cleanup;
+            }
+        }
+    }
+
+    while (virAtomicIntGet(&state.done) < ARRAY_CARDINALITY(jobs)) {
+        if (virCondWait(&state.cond, &state.lock) < 0) {
+            virMutexUnlock(&state.lock);
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&state.lock);
+
+    for (i = 0; i < KEYS; i++) {
+        if (virAtomicIntGet(&state.ran[i]) != JOBS_PER_KEY) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "key %zu ran %d jobs, expected %d\n",
+                        i, state.ran[i], JOBS_PER_KEY);
+            goto cleanup;
+        }
+    }
+
+    if (virThreadPoolGetCurrentWorkers(pool) < 2) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "no worker was added to the pool\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+
+/* Wait for a while for the other job to start as well */
+static void
+testSameKeyJob(void *jobdata ATTRIBUTE_UNUSED, void *opaque)
+{
+    struct testPoolState *st = opaque;
+    unsigned long long deadline = 0;
+
+    ignore_value(virTimeMillisNow(&deadline));
+    deadline += 5000;
+
+    virMutexLock(&st->lock);
+    st->started++;
+    virCondBroadcast(&st->cond);
+    while (st->started < 2) {
+        if (virCondWaitUntil(&st->cond, &st->lock, deadline) < 0)
+            break;
+    }
+    if (st->started == 2)
+        st->overlapped++;
+    st->done++;
+    virCondBroadcast(&st->cond);
+    virMutexUnlock(&st->lock);
+}
+
+
+/*
+ * Two jobs with the same key, like two calls of a single RPC client,
+ * must not wait for each other: each one only returns once it saw
+ * the other one running.
+ */
+static int
+testSameKey(const void *data ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool = NULL;
+    int key;
+    size_t i;
+    int ret = -1;
+
+    state.started = 0;
+    state.overlapped = 0;
+    state.done = 0;
+
+    if (!(pool = virThreadPoolNewFull(2, 2, 0, testSameKeyJob, &state,
+                                      VIR_THREAD_POOL_MULTI_QUEUE)))
+        return -1;
+
+    for (i = 0; i < 2; i++) {
+        if (virThreadPoolSendJobFull(pool, 0, &key, NULL) < 0)
+            goto cleanup;
+    }
+
+    virMutexLock(&state.lock);
+    while (state.done < 2) {
+        if (virCondWait(&state.cond, &state.lock) < 0) {
+            virMutexUnlock(&state.lock);
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&state.lock);
+
+    if (state.overlapped != 2) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "jobs with the same key did not run concurrently\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0 ||
+        virMutexInit(&state.lock) < 0 ||
+        virCondInit(&state.cond) < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("many keys", testManyKeys, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("same key", testSameKey, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
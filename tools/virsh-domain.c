@@ -61,56 +61,63 @@
 #endif
 
 virDomainPtr
-vshCommandOptDomainBy(vshControl *ctl, const vshCmd *cmd,
-                      const char **name, unsigned int flags)
+vshLookupDomainBy(vshControl *ctl,
+                  const char *name,
+                  unsigned int flags)
 {
     virDomainPtr dom = NULL;
-    const char *n = NULL;
     int id;
-    const char *optname = "domain";
     virCheckFlags(VSH_BYID | VSH_BYUUID | VSH_BYNAME, NULL);
 
-    if (!vshCmdHasOption(ctl, cmd, optname))
-        return NULL;
-
-    if (vshCommandOptStringReq(ctl, cmd, optname, &n) < 0)
-        return NULL;
-
-    vshDebug(ctl, VSH_ERR_INFO, "%s: found option <%s>: %s\n",
-             cmd->def->name, optname, n);
-
-    if (name)
-        *name = n;
-
     /* try it by ID */
     if (flags & VSH_BYID) {
-        if (virStrToLong_i(n, NULL, 10, &id) == 0 && id >= 0) {
+        if (virStrToLong_i(name, NULL, 10, &id) == 0 && id >= 0) {
             vshDebug(ctl, VSH_ERR_DEBUG,
-                     "%s: <%s> seems like domain ID\n",
-                     cmd->def->name, optname);
+                     "<domain> seems like domain ID\n");
             dom = virDomainLookupByID(ctl->conn, id);
         }
     }
     /* try it by UUID */
     if (!dom && (flags & VSH_BYUUID) &&
-        strlen(n) == VIR_UUID_STRING_BUFLEN-1) {
-        vshDebug(ctl, VSH_ERR_DEBUG, "%s: <%s> trying as domain UUID\n",
-                 cmd->def->name, optname);
-        dom = virDomainLookupByUUIDString(ctl->conn, n);
+        strlen(name) == VIR_UUID_STRING_BUFLEN-1) {
+        vshDebug(ctl, VSH_ERR_DEBUG, "<domain> trying as domain UUID\n");
+        dom = virDomainLookupByUUIDString(ctl->conn, name);
     }
     /* try it by NAME */
     if (!dom && (flags & VSH_BYNAME)) {
-        vshDebug(ctl, VSH_ERR_DEBUG, "%s: <%s> trying as domain NAME\n",
-                 cmd->def->name, optname);
-        dom = virDomainLookupByName(ctl->conn, n);
+        vshDebug(ctl, VSH_ERR_DEBUG, "<domain> trying as domain NAME\n");
+        dom = virDomainLookupByName(ctl->conn, name);
     }
 
     if (!dom)
-        vshError(ctl, _("failed to get domain '%s'"), n);
+        vshError(ctl, _("failed to get domain '%s'"), name);
 
     return dom;
 }
 
+
+virDomainPtr
+vshCommandOptDomainBy(vshControl *ctl, const vshCmd *cmd,
+                      const char **name, unsigned int flags)
+{
+    const char *n = NULL;
+    const char *optname = "domain";
+
+    if (!vshCmdHasOption(ctl, cmd, optname))
+        return NULL;
+
+    if (vshCommandOptStringReq(ctl, cmd, optname, &n) < 0)
+        return NULL;
+
+    vshDebug(ctl, VSH_ERR_INFO, "%s: found option <%s>: %s\n",
+             cmd->def->name, optname, n);
+
+    if (name)
+        *name = n;
+
+    return vshLookupDomainBy(ctl, n, flags);
+}
+
 static const char *
 vshDomainVcpuStateToString(int state)
 {
@@ -5123,6 +5130,31 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
         vshPrint(ctl, "%-17s %-13llu\n", _("Compression overflows:"), value);
     }
 
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_IMAGE_COMPRESSION_INPUT,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        val = vshPrettyCapacity(value, &unit);
+        vshPrint(ctl, "%-17s %-.3lf %s\n", _("Image data in:"), val, unit);
+    }
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_IMAGE_COMPRESSION_OUTPUT,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        val = vshPrettyCapacity(value, &unit);
+        vshPrint(ctl, "%-17s %-.3lf %s\n", _("Image data out:"), val, unit);
+    }
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_IMAGE_COMPRESSION_RATE,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        val = vshPrettyCapacity(value, &unit);
+        vshPrint(ctl, "%-17s %-.3lf %s/s\n", _("Compression rate:"), val, unit);
+    }
+
     ret = true;
 
 cleanup:
@@ -27,6 +27,7 @@
 #include "virsh-volume.h"
 
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -621,6 +622,10 @@ static const vshCmdOptDef opts_vol_upload[] = {
      .type = VSH_OT_INT,
      .help = N_("amount of data to upload")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .help = N_("preserve sparseness of volume")
+    },
     {.name = NULL}
 };
 
@@ -633,6 +638,65 @@ cmdVolUploadSource(virStreamPtr st ATTRIBUTE_UNUSED,
     return saferead(*fd, bytes, nbytes);
 }
 
+/* Like virStreamSendAll, but holes in @fd are sent as such */
+static int
+cmdVolUploadSparse(virStreamPtr st, int fd)
+{
+    char *bytes = NULL;
+    size_t want = 64 * 1024;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(bytes, want) < 0)
+        goto cleanup;
+
+    while (1) {
+        bool inData;
+        unsigned long long section;
+
+        if (virFileInData(fd, &inData, &section) < 0)
+            goto cleanup;
+        if (section == 0)
+            break;
+
+        if (!inData) {
+            if (lseek(fd, section, SEEK_CUR) == (off_t) -1)
+                goto cleanup;
+            while (section) {
+                long long skip = MIN(section, LLONG_MAX);
+
+                if (virStreamSendHole(st, skip, 0) < 0)
+                    goto cleanup;
+                section -= skip;
+            }
+            continue;
+        }
+
+        while (section) {
+            int got, offset = 0;
+
+            if ((got = saferead(fd, bytes, MIN(want, section))) < 0)
+                goto cleanup;
+            if (got == 0)
+                break;
+            while (offset < got) {
+                int done = virStreamSend(st, bytes + offset, got - offset);
+                if (done < 0)
+                    goto cleanup;
+                offset += done;
+            }
+            section -= got;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        virStreamAbort(st);
+    VIR_FREE(bytes);
+    return ret;
+}
+
 static bool
 cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -643,6 +707,8 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
     virStreamPtr st = NULL;
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
+    unsigned int flags = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -654,6 +720,9 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
         return false;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
+
     if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name))) {
         return false;
     }
@@ -671,14 +740,21 @@ cmdVolUpload(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
-    if (virStorageVolUpload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolUpload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot upload to volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
-        vshError(ctl, _("cannot send data to volume %s"), name);
-        goto cleanup;
+    if (sparse) {
+        if (cmdVolUploadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot send data to volume %s"), name);
+            goto cleanup;
+        }
+    } else {
+        if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
+            vshError(ctl, _("cannot send data to volume %s"), name);
+            goto cleanup;
+        }
     }
 
     if (VIR_CLOSE(fd) < 0) {
@@ -739,9 +815,91 @@ static const vshCmdOptDef opts_vol_download[] = {
      .type = VSH_OT_INT,
      .help = N_("amount of data to download")
     },
+    {.name = "sparse",
+     .type = VSH_OT_BOOL,
+     .help = N_("preserve sparseness of volume")
+    },
     {.name = NULL}
 };
 
+/* Write @length zeros to @fd from @zeros, which holds @zeroslen of them */
+static int
+cmdVolDownloadZeros(int fd, long long length,
+                    const char *zeros, size_t zeroslen)
+{
+    while (length > 0) {
+        size_t bytes = MIN(zeroslen, length);
+
+        if (safewrite(fd, zeros, bytes) < 0)
+            return -1;
+        length -= bytes;
+    }
+    return 0;
+}
+
+/* Like virStreamRecvAll, but holes are skipped over in @fd if it is a
+ * regular file, and written out as zeros otherwise */
+static int
+cmdVolDownloadSparse(virStreamPtr st, int fd)
+{
+    char *bytes = NULL;
+    char *zeros = NULL;
+    size_t want = 64 * 1024;
+    struct stat sb;
+    bool seekable;
+    off_t end;
+    int ret = -1;
+
+    if (fstat(fd, &sb) < 0)
+        goto cleanup;
+    /* pipes cannot seek, and devices cannot be truncated */
+    seekable = S_ISREG(sb.st_mode);
+
+    if (VIR_ALLOC_N(bytes, want) < 0 ||
+        (!seekable && VIR_ALLOC_N(zeros, want) < 0))
+        goto cleanup;
+
+    while (1) {
+        int got;
+        long long length;
+
+        got = virStreamRecvFlags(st, bytes, want,
+                                 VIR_STREAM_RECV_STOP_AT_HOLE);
+        if (got == -3) {
+            if (virStreamRecvHole(st, &length, 0) < 0)
+                goto cleanup;
+            if (seekable) {
+                if (lseek(fd, length, SEEK_CUR) == (off_t) -1)
+                    goto cleanup;
+            } else if (cmdVolDownloadZeros(fd, length, zeros, want) < 0) {
+                goto cleanup;
+            }
+            continue;
+        }
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+        if (safewrite(fd, bytes, got) < 0)
+            goto cleanup;
+    }
+
+    /* A trailing hole only moved the file offset */
+    if (seekable &&
+        ((end = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+         ftruncate(fd, end) < 0))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        virStreamAbort(st);
+    VIR_FREE(bytes);
+    VIR_FREE(zeros);
+    return ret;
+}
+
 static bool
 cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
 {
@@ -753,6 +911,8 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     bool created = false;
+    unsigned int flags = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
 
     if (vshCommandOptULongLong(cmd, "offset", &offset) < 0) {
         vshError(ctl, _("Unable to parse integer"));
@@ -764,6 +924,9 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
         return false;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
+
     if (!(vol = vshCommandOptVol(ctl, cmd, "vol", "pool", &name)))
         return false;
 
@@ -785,14 +948,21 @@ cmdVolDownload(vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
-    if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolDownload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
-        vshError(ctl, _("cannot receive data from volume %s"), name);
-        goto cleanup;
+    if (sparse) {
+        if (cmdVolDownloadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot receive data from volume %s"), name);
+            goto cleanup;
+        }
+    } else {
+        if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
+            vshError(ctl, _("cannot receive data from volume %s"), name);
+            goto cleanup;
+        }
     }
 
     if (VIR_CLOSE(fd) < 0) {